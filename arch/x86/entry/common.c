@@ -18,10 +18,10 @@
 /*
  * Low-level thread flags we need to check before return to user-mode.
  * Each flag represents a pending job. Flags may be re-set during the
- * handling of the jobs:
+ * handling of the jobs. The syscall fast path in entry_64.S checks
+ * the same flags:
  */
-#define EXIT_TO_USERMODE_LOOP_FLAGS \
-	(_TIF_SIGPENDING | _TIF_NEED_RESCHED | _TIF_NEED_CHECKPOINT)
+#define EXIT_TO_USERMODE_LOOP_FLAGS	_TIF_ALLWORK_MASK
 
 static void exit_to_usermode_loop(struct pt_regs *regs, u32 cached_flags)
 {
@@ -114,13 +114,15 @@ __visible void do_syscall_64(struct pt_regs *regs)
 	 * table.  The only functional difference is the x32 bit in
 	 * regs->orig_ax, which changes the behavior of some syscalls.
 	 */
-	strace_syscall_enter(regs);
+	if (unlikely(test_thread_flag(TIF_SYSCALL_TRACE)))
+		strace_syscall_enter(regs);
 	if (likely(nr < NR_syscalls)) {
 		regs->ax = sys_call_table[nr](
 			regs->di, regs->si, regs->dx,
 			regs->r10, regs->r8, regs->r9);
 	}
-	strace_syscall_exit(regs);
+	if (unlikely(test_thread_flag(TIF_SYSCALL_TRACE)))
+		strace_syscall_exit(regs);
 
 	syscall_return_slowpath(regs);
 }
@@ -16,6 +16,7 @@
 
 #define __SYSCALL_64_QUAL_(sym)		sym
 #define __SYSCALL_64_QUAL_ptregs(sym)	ptregs_##sym
+#define __SYSCALL_64_QUAL_fast(sym)	sym
 
 #define __SYSCALL_64(nr, sym, qual)	asmlinkage long __SYSCALL_64_QUAL_##qual(sym)(unsigned long, unsigned long, unsigned long, unsigned long, unsigned long, unsigned long);
 #include <asm/syscalls_64.h>
@@ -33,3 +34,19 @@ asmlinkage const sys_call_ptr_t sys_call_table[__NR_syscall_max+1] = {
 	[0 ... __NR_syscall_max] = &sys_ni_syscall,
 #include <asm/syscalls_64.h>
 };
+
+/*
+ * Syscalls marked as fast in syscall_64.tbl, which are cheap and only
+ * need the arguments. They are called directly from entry_SYSCALL_64,
+ * without saving extra regs, if there is no work to do at entry or exit.
+ */
+#undef __SYSCALL_64
+#define __SYSCALL_64_FAST_(nr)
+#define __SYSCALL_64_FAST_ptregs(nr)
+#define __SYSCALL_64_FAST_fast(nr)	[nr] = 1,
+
+#define __SYSCALL_64(nr, sym, qual) __SYSCALL_64_FAST_##qual(nr)
+
+asmlinkage const unsigned char sys_call_fastpath[__NR_syscall_max+1] = {
+#include <asm/syscalls_64.h>
+};
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * User context implementation of clock_gettime, gettimeofday and time.
+ *
+ * This file is linked into the vDSO image, it runs in user space.
+ * Only the vvar page can be touched, never call into kernel code.
+ * If TSC can not be used, fall back to the real syscall.
+ */
+
+#include <lego/time.h>
+#include <asm/vgtod.h>
+#include <generated/unistd_64.h>
+
+extern struct vsyscall_gtod_data vvar_gtod_data
+	__attribute__((visibility("hidden")));
+
+#define gtod	(&vvar_gtod_data)
+
+static long vdso_fallback_gettime(long clock, struct timespec *ts)
+{
+	long ret;
+
+	asm volatile ("syscall"
+		: "=a" (ret)
+		: "0" (__NR_clock_gettime), "D" (clock), "S" (ts)
+		: "rcx", "r11", "memory");
+	return ret;
+}
+
+static long vdso_fallback_gtod(struct timeval *tv, struct timezone *tz)
+{
+	long ret;
+
+	asm volatile ("syscall"
+		: "=a" (ret)
+		: "0" (__NR_gettimeofday), "D" (tv), "S" (tz)
+		: "rcx", "r11", "memory");
+	return ret;
+}
+
+static __always_inline u64 vread_tsc(void)
+{
+	u32 low, high;
+	u64 ret, last;
+
+	/*
+	 * rdtsc_ordered() relies on alternatives, which are not
+	 * applied to the vDSO image. LFENCE keeps RDTSC in order.
+	 */
+	asm volatile ("lfence; rdtsc" : "=a" (low), "=d" (high) : : "memory");
+	ret = ((u64)high << 32) | low;
+
+	/*
+	 * TSC of this CPU may be slightly behind the one that
+	 * updated cycle_last. Never go backwards.
+	 */
+	last = gtod->cycle_last;
+	if (likely(ret >= last))
+		return ret;
+	return last;
+}
+
+static __always_inline u64 vgetsns(int *mode)
+{
+	u64 cycles;
+
+	if (gtod->vclock_mode == VCLOCK_TSC)
+		cycles = vread_tsc();
+	else {
+		*mode = VCLOCK_NONE;
+		return 0;
+	}
+	return ((cycles - gtod->cycle_last) & gtod->mask) * gtod->mult;
+}
+
+static __always_inline void timespec_add_ns_loop(struct timespec *ts, u64 ns)
+{
+	/* Usually less than one iteration, cheaper than a division */
+	while (ns >= NSEC_PER_SEC) {
+		ns -= NSEC_PER_SEC;
+		ts->tv_sec++;
+	}
+	ts->tv_nsec = ns;
+}
+
+static int do_realtime(struct timespec *ts)
+{
+	unsigned int seq;
+	u64 ns;
+	int mode;
+
+	do {
+		seq = gtod_read_begin(gtod);
+		mode = gtod->vclock_mode;
+		ts->tv_sec = gtod->wall_time_sec;
+		ns = gtod->wall_time_snsec;
+		ns += vgetsns(&mode);
+		ns >>= gtod->shift;
+	} while (unlikely(gtod_read_retry(gtod, seq)));
+
+	timespec_add_ns_loop(ts, ns);
+	return mode;
+}
+
+static int do_monotonic(struct timespec *ts)
+{
+	unsigned int seq;
+	u64 ns;
+	int mode;
+
+	do {
+		seq = gtod_read_begin(gtod);
+		mode = gtod->vclock_mode;
+		ts->tv_sec = gtod->monotonic_time_sec;
+		ns = gtod->monotonic_time_snsec;
+		ns += vgetsns(&mode);
+		ns >>= gtod->shift;
+	} while (unlikely(gtod_read_retry(gtod, seq)));
+
+	timespec_add_ns_loop(ts, ns);
+	return mode;
+}
+
+static void do_realtime_coarse(struct timespec *ts)
+{
+	unsigned int seq;
+
+	do {
+		seq = gtod_read_begin(gtod);
+		ts->tv_sec = gtod->wall_time_coarse_sec;
+		ts->tv_nsec = gtod->wall_time_coarse_nsec;
+	} while (unlikely(gtod_read_retry(gtod, seq)));
+}
+
+static void do_monotonic_coarse(struct timespec *ts)
+{
+	unsigned int seq;
+
+	do {
+		seq = gtod_read_begin(gtod);
+		ts->tv_sec = gtod->monotonic_time_coarse_sec;
+		ts->tv_nsec = gtod->monotonic_time_coarse_nsec;
+	} while (unlikely(gtod_read_retry(gtod, seq)));
+}
+
+int __vdso_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	switch (clock) {
+	case CLOCK_REALTIME:
+		if (do_realtime(ts) == VCLOCK_NONE)
+			goto fallback;
+		break;
+	case CLOCK_MONOTONIC:
+		if (do_monotonic(ts) == VCLOCK_NONE)
+			goto fallback;
+		break;
+	case CLOCK_REALTIME_COARSE:
+		do_realtime_coarse(ts);
+		break;
+	case CLOCK_MONOTONIC_COARSE:
+		do_monotonic_coarse(ts);
+		break;
+	default:
+		goto fallback;
+	}
+	return 0;
+
+fallback:
+	return vdso_fallback_gettime(clock, ts);
+}
+int clock_gettime(clockid_t, struct timespec *)
+	__attribute__((weak, alias("__vdso_clock_gettime")));
+
+int __vdso_gettimeofday(struct timeval *tv, struct timezone *tz)
+{
+	if (likely(tv != NULL)) {
+		/* timeval and timespec have the same layout */
+		if (unlikely(do_realtime((struct timespec *)tv) == VCLOCK_NONE))
+			return vdso_fallback_gtod(tv, tz);
+		tv->tv_usec /= 1000;
+	}
+	if (unlikely(tz != NULL)) {
+		tz->tz_minuteswest = gtod->tz_minuteswest;
+		tz->tz_dsttime = gtod->tz_dsttime;
+	}
+	return 0;
+}
+int gettimeofday(struct timeval *, struct timezone *)
+	__attribute__((weak, alias("__vdso_gettimeofday")));
+
+/* Seconds are updated every tick, no need to read TSC */
+time_t __vdso_time(time_t *t)
+{
+	time_t result = READ_ONCE(gtod->wall_time_sec);
+
+	if (t)
+		*t = result;
+	return result;
+}
+time_t time(time_t *t)
+	__attribute__((weak, alias("__vdso_time")));
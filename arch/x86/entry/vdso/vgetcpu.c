@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * User context implementation of getcpu.
+ * Kernel stores (node << 12) | cpu into TSC_AUX of each CPU,
+ * RDTSCP hands it back without entering kernel.
+ */
+
+#include <lego/types.h>
+#include <asm/vgtod.h>
+#include <generated/unistd_64.h>
+
+extern struct vsyscall_gtod_data vvar_gtod_data
+	__attribute__((visibility("hidden")));
+
+static long vdso_fallback_getcpu(unsigned *cpu, unsigned *node, void *unused)
+{
+	long ret;
+
+	asm volatile ("syscall"
+		: "=a" (ret)
+		: "0" (__NR_getcpu), "D" (cpu), "S" (node), "d" (unused)
+		: "rcx", "r11", "memory");
+	return ret;
+}
+
+long __vdso_getcpu(unsigned *cpu, unsigned *node, void *unused)
+{
+	unsigned int p;
+
+	if (vvar_gtod_data.getcpu_mode != VGETCPU_RDTSCP)
+		return vdso_fallback_getcpu(cpu, node, unused);
+
+	asm volatile ("rdtscp" : "=c" (p) : : "eax", "edx");
+
+	if (cpu)
+		*cpu = p & VGETCPU_CPU_MASK;
+	if (node)
+		*node = p >> 12;
+	return 0;
+}
+long getcpu(unsigned *cpu, unsigned *node, void *unused)
+	__attribute__((weak, alias("__vdso_getcpu")));
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * vDSO and vvar page
+ *
+ * Both are mapped into permanent fixmap with user permission. All user
+ * page tables share the kernel half, so there is nothing to do per mm,
+ * and nothing needs to be known by memory component. execve() only has
+ * to tell user where the image is, via AT_SYSINFO_EHDR.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/time.h>
+#include <lego/kernel.h>
+#include <lego/auxvec.h>
+#include <lego/uaccess.h>
+#include <lego/clocksource.h>
+#include <lego/timekeeping.h>
+#include <asm/msr.h>
+#include <asm/numa.h>
+#include <asm/vdso.h>
+#include <asm/vgtod.h>
+#include <asm/fixmap.h>
+
+extern char vdso_image_start[], vdso_image_end[];
+
+union vvar_page {
+	struct vsyscall_gtod_data	gtod;
+	char				page[PAGE_SIZE];
+};
+
+static union vvar_page vvar_page __page_aligned_data;
+
+#define vdso_base()	__fix_to_virt(FIX_VDSO_FIRST)
+
+void __init map_vdso(void)
+{
+	unsigned long size = vdso_image_end - vdso_image_start;
+	unsigned long phys = __pa_symbol(vdso_image_start);
+	int i, nr_pages;
+
+	nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+	if (nr_pages > VDSO_NR_PAGES)
+		panic("vDSO image has %d pages, only %d reserved",
+			nr_pages, VDSO_NR_PAGES);
+
+	for (i = 0; i < nr_pages; i++)
+		__set_fixmap(FIX_VDSO_FIRST - i, phys + i * PAGE_SIZE,
+			     PAGE_KERNEL_VSYSCALL);
+	__set_fixmap(FIX_VVAR_PAGE, __pa_symbol(&vvar_page), PAGE_KERNEL_VVAR);
+
+	if (cpu_has(X86_FEATURE_RDTSCP))
+		vvar_page.gtod.getcpu_mode = VGETCPU_RDTSCP;
+
+	pr_info("vDSO: %lu bytes at %#lx, vvar at %#lx\n",
+		size, vdso_base(), __fix_to_virt(FIX_VVAR_PAGE));
+}
+
+/* Called by each CPU, used by getcpu() in vDSO */
+void vdso_cpu_init(int cpu)
+{
+	if (cpu_has(X86_FEATURE_RDTSCP))
+		wrmsr(MSR_TSC_AUX, (cpu_to_node(cpu) << 12) | cpu, 0);
+}
+
+/*
+ * Memory component builds the initial user stack, and ARCH_DLINFO
+ * always puts AT_SYSINFO_EHDR there with 0. Fill in the real address.
+ * @sp points to argc.
+ */
+int vdso_setup_auxv(unsigned long sp)
+{
+	unsigned long __user *p = (unsigned long __user *)sp;
+	unsigned long argc, type;
+	int i;
+
+	if (get_user(argc, p))
+		return -EFAULT;
+
+	/* Skip argc, argv[] and its NULL */
+	p += argc + 2;
+
+	/* Skip envp[] and its NULL */
+	do {
+		if (get_user(type, p++))
+			return -EFAULT;
+	} while (type);
+
+	for (i = 0; i < AT_VECTOR_SIZE; i += 2, p += 2) {
+		if (get_user(type, p))
+			return -EFAULT;
+		if (type == AT_NULL)
+			break;
+		if (type == AT_SYSINFO_EHDR)
+			return put_user(vdso_base(), p + 1);
+	}
+	return -ENOENT;
+}
+
+/*
+ * Called with timekeeper_lock held, so there is only one writer.
+ * Same fields and math as the timekeeper, readers in vDSO retry
+ * if they see an odd or changed seq.
+ */
+void update_vsyscall(struct timekeeper *tk)
+{
+	struct vsyscall_gtod_data *vdata = &vvar_page.gtod;
+	struct clocksource *clock = tk->tkr_mono.clock;
+	u64 nsec_per_sec_shifted = (u64)NSEC_PER_SEC << tk->tkr_mono.shift;
+
+	gtod_write_begin(vdata);
+
+	if ((clock->flags & CLOCK_SOURCE_VDSO) &&
+	    !(clock->flags & CLOCK_SOURCE_UNSTABLE))
+		vdata->vclock_mode = VCLOCK_TSC;
+	else
+		vdata->vclock_mode = VCLOCK_NONE;
+
+	vdata->cycle_last	= tk->tkr_mono.cycle_last;
+	vdata->mask		= tk->tkr_mono.mask;
+	vdata->mult		= tk->tkr_mono.mult;
+	vdata->shift		= tk->tkr_mono.shift;
+
+	vdata->wall_time_sec	= tk->xtime_sec;
+	vdata->wall_time_snsec	= tk->tkr_mono.xtime_nsec;
+
+	vdata->monotonic_time_sec = tk->xtime_sec +
+				    tk->wall_to_monotonic.tv_sec;
+	vdata->monotonic_time_snsec = tk->tkr_mono.xtime_nsec +
+				      ((u64)tk->wall_to_monotonic.tv_nsec
+					<< tk->tkr_mono.shift);
+	while (vdata->monotonic_time_snsec >= nsec_per_sec_shifted) {
+		vdata->monotonic_time_snsec -= nsec_per_sec_shifted;
+		vdata->monotonic_time_sec++;
+	}
+
+	vdata->wall_time_coarse_sec = tk->xtime_sec;
+	vdata->wall_time_coarse_nsec = tk->tkr_mono.xtime_nsec >>
+				       tk->tkr_mono.shift;
+
+	vdata->monotonic_time_coarse_sec = vdata->wall_time_coarse_sec +
+					   tk->wall_to_monotonic.tv_sec;
+	vdata->monotonic_time_coarse_nsec = vdata->wall_time_coarse_nsec +
+					    tk->wall_to_monotonic.tv_nsec;
+	while (vdata->monotonic_time_coarse_nsec >= NSEC_PER_SEC) {
+		vdata->monotonic_time_coarse_nsec -= NSEC_PER_SEC;
+		vdata->monotonic_time_coarse_sec++;
+	}
+
+	vdata->tz_minuteswest	= sys_tz.tz_minuteswest;
+	vdata->tz_dsttime	= sys_tz.tz_dsttime;
+
+	gtod_write_end(vdata);
+}
@@ -35,6 +35,8 @@ extern int alternatives_patched;
 void alternative_instructions(void);
 void apply_alternatives(struct alt_instr *start, struct alt_instr *end);
 
+void *text_poke_early(void *addr, const void *opcode, size_t len);
+
 #endif /* __ASSEMBLY__ */
 
 #define b_replacement(num)	"664"#num
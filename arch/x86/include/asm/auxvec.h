@@ -26,7 +26,11 @@
 # define AT_VECTOR_SIZE_ARCH 1
 #endif
 
-/* TODO vdso */
+/*
+ * The initial stack is built by memory component, which does not know
+ * about vDSO. Keep a placeholder, processor fills in the real address
+ * after execve (see vdso_setup_auxv()).
+ */
 #define vdso64_enabled 0
 
 /* x86-64*/
@@ -17,6 +17,7 @@
 #include <asm/page.h>
 #include <asm/pgtable.h>
 #include <asm/vsyscall.h>
+#include <asm/vdso.h>
 #include <asm/apic_types.h>
 
 #define FIXADDR_TOP	(round_up(VSYSCALL_ADDR + PAGE_SIZE, 1<<PMD_SHIFT) - \
@@ -40,6 +41,15 @@ enum fixed_addresses {
 #ifdef CONFIG_X86_VSYSCALL_EMULATION
 	VSYSCALL_PAGE = (FIXADDR_TOP - VSYSCALL_ADDR) >> PAGE_SHIFT,
 #endif
+#ifdef CONFIG_X86_VDSO
+	/*
+	 * Fixmap grows downwards, so the vvar page sits right
+	 * below the vDSO image, which is what vdso.lds assumes.
+	 */
+	FIX_VDSO_LAST,
+	FIX_VDSO_FIRST = FIX_VDSO_LAST + VDSO_NR_PAGES - 1,
+	FIX_VVAR_PAGE,
+#endif
 #ifdef CONFIG_X86_LOCAL_APIC
 	FIX_APIC_BASE,	/* local (CPU) APIC) -- required for SMP or not */
 #endif
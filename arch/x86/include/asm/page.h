@@ -52,6 +52,7 @@ static inline void *phys_to_virt(phys_addr_t address)
 }
 
 #define clear_page(page)	memset((page), 0, PAGE_SIZE)
+void clear_page_nocache(void *page);
 #define copy_page(to,from)	memcpy((to), (from), PAGE_SIZE)
 
 #endif /* __ASSEMBLY__ */
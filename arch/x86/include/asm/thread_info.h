@@ -75,6 +75,13 @@
 #define _TIF_X32		(1 << TIF_X32)
 #define _TIF_NEED_CHECKPOINT	(1 << TIF_NEED_CHECKPOINT)
 
+/* work to do in syscall entry, forces the slow path */
+#define _TIF_WORK_SYSCALL_ENTRY	(_TIF_SYSCALL_TRACE)
+
+/* work to do on any return to user space */
+#define _TIF_ALLWORK_MASK	\
+	(_TIF_SIGPENDING | _TIF_NEED_RESCHED | _TIF_NEED_CHECKPOINT)
+
 /*
  * Force syscall return via IRET by making it look as if there was
  * some work pending. IRET is our most capable (but slowest) syscall
@@ -238,6 +238,20 @@ void flush_tlb_others(const struct cpumask *cpumask, struct mm_struct *mm,
 
 #define flush_tlb()	flush_tlb_current_task()
 
+/*
+ * Between tlb_flush_batch_start() and tlb_flush_batch_finish(),
+ * flush_tlb_mm_range() flushes the local TLB right away but only
+ * queues the remote shootdowns. They are merged with other pending
+ * ones and complete in the background. finish waits for all of them.
+ */
+struct tlb_flush_batch {
+	struct cpumask		cpumask;	/* CPUs we queued shootdowns on */
+	struct tlb_flush_batch	*prev;
+};
+
+void tlb_flush_batch_start(struct tlb_flush_batch *batch);
+void tlb_flush_batch_finish(struct tlb_flush_batch *batch);
+
 #else
 /* "_up" is for UniProcessor.
  *
@@ -295,6 +309,11 @@ static inline void flush_tlb_kernel_range(unsigned long start,
 	flush_tlb_all();
 }
 
+struct tlb_flush_batch { };
+
+static inline void tlb_flush_batch_start(struct tlb_flush_batch *batch) { }
+static inline void tlb_flush_batch_finish(struct tlb_flush_batch *batch) { }
+
 #endif
 
 #endif /* _ASM_X86_TLBFLUSH_H_ */
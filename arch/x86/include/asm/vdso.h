@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _ASM_X86_VDSO_H_
+#define _ASM_X86_VDSO_H_
+
+/*
+ * Max number of pages of the vDSO image.
+ * The image is checked against this at boot.
+ */
+#define VDSO_NR_PAGES	2
+
+#ifdef CONFIG_X86_VDSO
+void map_vdso(void);
+void vdso_cpu_init(int cpu);
+int vdso_setup_auxv(unsigned long sp);
+#else
+static inline void map_vdso(void) { }
+static inline void vdso_cpu_init(int cpu) { }
+static inline int vdso_setup_auxv(unsigned long sp) { return 0; }
+#endif
+
+#endif /* _ASM_X86_VDSO_H_ */
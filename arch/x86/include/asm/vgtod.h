@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _ASM_X86_VGTOD_H_
+#define _ASM_X86_VGTOD_H_
+
+#include <lego/types.h>
+#include <lego/compiler.h>
+#include <asm/asm.h>
+#include <asm/barrier.h>
+
+#define VCLOCK_NONE	0	/* No vDSO clock, use syscall */
+#define VCLOCK_TSC	1	/* vDSO reads TSC */
+
+#define VGETCPU_NONE	0	/* No RDTSCP, use syscall */
+#define VGETCPU_RDTSCP	1	/* TSC_AUX holds (node << 12) | cpu */
+
+#define VGETCPU_CPU_MASK	0xfff
+
+/*
+ * The vvar page, mapped read-only into user space right below the
+ * vDSO image. This layout is ABI between kernel and the vDSO image
+ * built with it, nothing else should depend on it.
+ */
+struct vsyscall_gtod_data {
+	unsigned int	seq;
+
+	int		vclock_mode;
+	u64		cycle_last;
+	u64		mask;
+	u32		mult;
+	u32		shift;
+
+	/* open coded 'struct timespec', nsec is shifted */
+	u64		wall_time_snsec;
+	u64		wall_time_sec;
+	u64		monotonic_time_sec;
+	u64		monotonic_time_snsec;
+
+	u64		wall_time_coarse_sec;
+	u64		wall_time_coarse_nsec;
+	u64		monotonic_time_coarse_sec;
+	u64		monotonic_time_coarse_nsec;
+
+	int		tz_minuteswest;
+	int		tz_dsttime;
+
+	int		getcpu_mode;
+};
+
+static inline unsigned int gtod_read_begin(const struct vsyscall_gtod_data *s)
+{
+	unsigned int ret;
+
+repeat:
+	ret = READ_ONCE(s->seq);
+	if (unlikely(ret & 1)) {
+		cpu_relax();
+		goto repeat;
+	}
+	smp_rmb();
+	return ret;
+}
+
+static inline int gtod_read_retry(const struct vsyscall_gtod_data *s,
+				  unsigned int start)
+{
+	smp_rmb();
+	return unlikely(s->seq != start);
+}
+
+static inline void gtod_write_begin(struct vsyscall_gtod_data *s)
+{
+	++s->seq;
+	smp_wmb();
+}
+
+static inline void gtod_write_end(struct vsyscall_gtod_data *s)
+{
+	smp_wmb();
+	++s->seq;
+}
+
+#endif /* _ASM_X86_VGTOD_H_ */
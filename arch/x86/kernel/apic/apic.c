@@ -781,9 +781,60 @@ static int lapic_timer_shutdown(struct clock_event_device *evt)
 	return 0;
 }
 
+static struct clock_event_device lapic_clockevent;
+
+/*
+ * In one-shot mode with TSC deadline, the device counts TSC cycles
+ * instead of APIC bus clocks. See lapic_timer_set_params().
+ */
+static struct {
+	u32	mult;
+	u32	shift;
+	u64	min_delta_ns;
+	u64	max_delta_ns;
+} lapic_deadline;
+
+static void lapic_deadline_init(void)
+{
+	struct clock_event_device tmp = lapic_clockevent;
+
+	tmp.min_delta_ticks = 0xF;
+	tmp.max_delta_ticks = ~0UL;
+	clockevents_config(&tmp, tsc_khz * (1000 / TSC_DIVISOR));
+
+	lapic_deadline.mult = tmp.mult;
+	lapic_deadline.shift = tmp.shift;
+	lapic_deadline.min_delta_ns = tmp.min_delta_ns;
+	lapic_deadline.max_delta_ns = tmp.max_delta_ns;
+}
+
+/*
+ * __setup_APIC_LVTT() picks TSC deadline for one-shot mode if the CPU
+ * has it, while periodic mode always counts APIC bus clocks. Switch
+ * the conversion factors and the programming method accordingly.
+ */
+static void lapic_timer_set_params(struct clock_event_device *evt,
+				   bool oneshot)
+{
+	if (oneshot && cpu_has(X86_FEATURE_TSC_DEADLINE_TIMER)) {
+		evt->mult = lapic_deadline.mult;
+		evt->shift = lapic_deadline.shift;
+		evt->min_delta_ns = lapic_deadline.min_delta_ns;
+		evt->max_delta_ns = lapic_deadline.max_delta_ns;
+		evt->set_next_event = lapic_next_deadline;
+	} else {
+		evt->mult = lapic_clockevent.mult;
+		evt->shift = lapic_clockevent.shift;
+		evt->min_delta_ns = lapic_clockevent.min_delta_ns;
+		evt->max_delta_ns = lapic_clockevent.max_delta_ns;
+		evt->set_next_event = lapic_next_event;
+	}
+}
+
 static inline int
 lapic_timer_set_periodic_oneshot(struct clock_event_device *evt, bool oneshot)
 {
+	lapic_timer_set_params(evt, oneshot);
 	__setup_APIC_LVTT(lapic_timer_frequency, oneshot, 1);
 	return 0;
 }
@@ -848,8 +899,8 @@ apic_timer_interrupt(struct pt_regs *regs)
 
 	/*
 	 * Callback to clockevent framework, hmm, yummy
-	 * Since deadline TSC and one-shot is not supported now,
-	 * hence the handler is tick_handle_periodic():
+	 * tick_handle_periodic() in periodic mode, and
+	 * hrtimer_interrupt() in one-shot mode.
 	 */
 	levt->event_handler(levt);
 
@@ -879,29 +930,17 @@ static void setup_APIC_timer(void)
 	memcpy(levt, &lapic_clockevent, sizeof(*levt));
 	levt->cpumask = cpumask_of(cpu);
 
-	if (cpu_has(X86_FEATURE_TSC_DEADLINE_TIMER)) {
-		printk_once(
-			"TSC deadline mode is supported by your CPU. "
-			"But Lego currently does not support one-shot tick mode. "
-			"Fall back to TSC periodic mode\n");
-		goto
-			REMOVEME;
-
-		levt->features &= ~(CLOCK_EVT_FEAT_PERIODIC |
-				    CLOCK_EVT_FEAT_DUMMY);
-		levt->set_next_event = lapic_next_deadline;
-
-		/* Register tick-common handler */
-		clockevents_config_and_register(levt,
-						tsc_khz * (1000 / TSC_DIVISOR),
-						0xF, ~0UL);
-	} else {
-REMOVEME:
-		apic_printk(APIC_VERBOSE, "Using TSC periodic mode\n");
+	/*
+	 * Always start in periodic mode. High resolution timers switch
+	 * it to one-shot later, which uses TSC deadline if available.
+	 */
+	if (cpu_has(X86_FEATURE_TSC_DEADLINE_TIMER) && !lapic_deadline.mult)
+		lapic_deadline_init();
 
-		/* Register tick-common handler */
-		clockevents_register_device(levt);
-	}
+	apic_printk(APIC_VERBOSE, "Using TSC periodic mode\n");
+
+	/* Register tick-common handler */
+	clockevents_register_device(levt);
 }
 
 /*
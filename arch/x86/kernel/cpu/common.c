@@ -18,6 +18,7 @@
 #include <asm/msr.h>
 #include <asm/page.h>
 #include <asm/desc.h>
+#include <asm/vdso.h>
 #include <asm/apic.h>
 #include <asm/pgtable.h>
 #include <asm/syscalls.h>
@@ -691,6 +692,8 @@ void cpu_init(void)
 	/* Then setup the TR register to point to TSS segment */
 	load_tr_desc();
 
+	vdso_cpu_init(cpu);
+
 	atomic_inc(&init_mm.mm_count);
 	current->mm = &init_mm;
 	current->active_mm = &init_mm;
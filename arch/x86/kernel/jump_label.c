@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <lego/bug.h>
+#include <lego/init.h>
+#include <lego/string.h>
+#include <lego/kernel.h>
+#include <lego/jump_label.h>
+
+#include <asm/nops.h>
+#include <asm/alternative.h>
+
+union jump_code_union {
+	char code[JUMP_LABEL_NOP_SIZE];
+	struct {
+		char jump;
+		int offset;
+	} __packed;
+};
+
+static void __jump_label_make_code(struct jump_entry *entry,
+				   enum jump_label_type type,
+				   union jump_code_union *code)
+{
+	if (type == JUMP_LABEL_JMP) {
+		code->jump = 0xe9;
+		code->offset = entry->target -
+				(entry->code + JUMP_LABEL_NOP_SIZE);
+	} else
+		memcpy(code, ideal_nops[NOP_ATOMIC5], JUMP_LABEL_NOP_SIZE);
+}
+
+/*
+ * Sites are emitted as either P6_NOP5 or a JMP rel32,
+ * anything else means the table and the text are out of sync.
+ */
+static void jump_label_check_site(struct jump_entry *entry)
+{
+	const unsigned char default_nop[] = { STATIC_KEY_INIT_NOP };
+	const unsigned char *site = (const unsigned char *)entry->code;
+
+	if (site[0] == 0xe9)
+		return;
+	if (!memcmp(site, default_nop, JUMP_LABEL_NOP_SIZE))
+		return;
+	if (!memcmp(site, ideal_nops[NOP_ATOMIC5], JUMP_LABEL_NOP_SIZE))
+		return;
+
+	panic("jump_label: invalid site at %pS: %*ph\n",
+		(void *)entry->code, JUMP_LABEL_NOP_SIZE, site);
+}
+
+/* Boot time patching, we are the only CPU running */
+void __init arch_jump_label_transform_static(struct jump_entry *entry,
+					     enum jump_label_type type)
+{
+	union jump_code_union code;
+
+	jump_label_check_site(entry);
+	__jump_label_make_code(entry, type, &code);
+	text_poke_early((void *)entry->code, &code, JUMP_LABEL_NOP_SIZE);
+}
@@ -445,11 +445,12 @@ static int die_counter;
 int __die(const char *str, struct pt_regs *regs, long err)
 {
 	printk(KERN_DEFAULT
-	       "%s: %04lx [#%d]%s%s%s%s\n", str, err & 0xffff, ++die_counter,
+	       "%s: %04lx [#%d]%s%s%s%s%s\n", str, err & 0xffff, ++die_counter,
 	       IS_ENABLED(CONFIG_PREEMPT)	? " PREEMPT"	: "",
 	       IS_ENABLED(CONFIG_SMP)		? " SMP"	: "",
 	       IS_ENABLED(CONFIG_COMP_PROCESSOR)? " PROCESSOR"	: "",
-	       IS_ENABLED(CONFIG_COMP_MEMORY)	? " MEMORY"	: "");
+	       IS_ENABLED(CONFIG_COMP_MEMORY)	? " MEMORY"	: "",
+	       IS_ENABLED(CONFIG_COMP_STORAGE)	? " STORAGE"	: "");
 
 	show_regs(regs);
 
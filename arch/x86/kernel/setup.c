@@ -20,6 +20,7 @@
 #include <asm/pgtable.h>
 #include <asm/segment.h>
 #include <asm/vsyscall.h>
+#include <asm/vdso.h>
 #include <asm/tlbflush.h>
 #include <asm/processor.h>
 #include <asm/bootparam.h>
@@ -32,6 +33,7 @@
 #include <lego/string.h>
 #include <lego/kernel.h>
 #include <lego/jiffies.h>
+#include <lego/jump_label.h>
 #include <lego/nodemask.h>
 #include <lego/memblock.h>
 #include <lego/resource.h>
@@ -211,6 +213,7 @@ void __init setup_arch(void)
 	early_ioremap_init();
 
 	map_vsyscall();
+	map_vdso();
 
 	finish_e820_parsing();
 	max_pfn = e820_end_of_ram_pfn();
@@ -295,6 +298,7 @@ void __init setup_arch(void)
 	print_cpu_info(&default_cpu_info);
 
 	alternative_instructions();
+	jump_label_init();
 	pt_dump_init();
 
 	pr_info("x86: setup_arch done\n");
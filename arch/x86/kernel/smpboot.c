@@ -224,7 +224,9 @@ static void start_secondary_cpu(void)
 	cpu_online_callback(smp_processor_id());
 
 	set_cpu_online(smp_processor_id(), true);
-	set_cpu_active(smp_processor_id(), true);
+	/* isolcpus= are left for pin_current_thread() */
+	set_cpu_active(smp_processor_id(),
+		       !cpumask_test_cpu(smp_processor_id(), &cpu_isolated_map));
 
 	/* Enable local interrupts */
 	local_irq_enable();
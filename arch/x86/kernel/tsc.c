@@ -580,7 +580,8 @@ static struct clocksource clocksource_tsc = {
 	.read		= read_tsc,
 	.mask		= CLOCKSOURCE_MASK(64),
 	.flags		= CLOCK_SOURCE_IS_CONTINUOUS |
-			  CLOCK_SOURCE_MUST_VERIFY,
+			  CLOCK_SOURCE_MUST_VERIFY |
+			  CLOCK_SOURCE_VDSO,
 };
 
 void __init tsc_init(void)
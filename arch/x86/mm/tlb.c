@@ -98,9 +98,22 @@ void switch_mm(struct mm_struct *prev, struct mm_struct *next,
 	local_irq_restore(flags);
 }
 
+/*
+ * See Documentation/x86/tlb.txt for details.  We choose 33
+ * because it is large enough to cover the vast majority (at
+ * least 95%) of allocations, and is small enough that we are
+ * confident it will not cause too much overhead.  Each single
+ * flush is about 100 ns, so this caps the maximum overhead at
+ * _about_ 3,000 ns.
+ *
+ * This is in units of pages.
+ */
+static unsigned long tlb_single_page_flush_ceiling __read_mostly = 33;
+
 /*
  * TLB flush funcation:
  * Flush the tlb entries if the cpu uses the mm that's being flushed.
+ * Merged ranges may grow past the ceiling, flush all then.
  */
 static void flush_tlb_func(void *info)
 {
@@ -109,7 +122,9 @@ static void flush_tlb_func(void *info)
 	if (f->flush_mm != current->mm)
 		return;
 
-	if (f->flush_end == TLB_FLUSH_ALL) {
+	if (f->flush_end == TLB_FLUSH_ALL ||
+	    ((f->flush_end - f->flush_start) >> PAGE_SHIFT) >
+	     tlb_single_page_flush_ceiling) {
 		local_flush_tlb();
 	} else {
 		unsigned long addr;
@@ -121,25 +136,203 @@ static void flush_tlb_func(void *info)
 	}
 }
 
+/*
+ * Shootdowns pending on one CPU.
+ *
+ * A sender merges its range into a pending one of the same mm if they
+ * overlap or nearly touch, and only the sender finding the queue idle
+ * sends the IPI. The target drains everything queued so far at once,
+ * so a burst of shootdowns, as in pcache eviction, costs one IPI per
+ * target rather than one per page. Once the queue is full, the next
+ * drain flushes the whole TLB.
+ *
+ * @queued counts requests, @done is the count the last drain covered.
+ */
+#define TLB_FLUSH_QUEUE_LEN	8
+
+struct tlb_flush_queue {
+	spinlock_t		lock;
+	bool			kicked;
+	bool			flush_all;
+	unsigned int		nr;
+	unsigned long		queued;
+	unsigned long		done;
+	struct flush_tlb_info	info[TLB_FLUSH_QUEUE_LEN];
+	struct call_single_data	csd;
+};
+
+static void flush_tlb_queue_func(void *unused);
+
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct tlb_flush_queue, tlb_flush_queues) = {
+	.lock = __SPIN_LOCK_UNLOCKED(tlb_flush_queues.lock),
+	.csd = {
+		.func = flush_tlb_queue_func,
+	},
+};
+
+/* Runs from the IPI, irq disabled */
+static void flush_tlb_queue_func(void *unused)
+{
+	struct tlb_flush_queue *q = this_cpu_ptr(&tlb_flush_queues);
+	struct flush_tlb_info info[TLB_FLUSH_QUEUE_LEN];
+	unsigned int i, nr;
+	unsigned long queued;
+	bool flush_all;
+
+	spin_lock(&q->lock);
+	nr = q->nr;
+	flush_all = q->flush_all;
+	memcpy(info, q->info, nr * sizeof(*info));
+	queued = q->queued;
+	q->nr = 0;
+	q->flush_all = false;
+	q->kicked = false;
+	spin_unlock(&q->lock);
+
+	if (flush_all)
+		local_flush_tlb();
+	else {
+		for (i = 0; i < nr; i++)
+			flush_tlb_func(&info[i]);
+	}
+
+	smp_store_release(&q->done, queued);
+}
+
+static bool flush_tlb_merge(struct flush_tlb_info *f, struct mm_struct *mm,
+			    unsigned long start, unsigned long end)
+{
+	if (f->flush_mm != mm)
+		return false;
+
+	/* Gaps up to one page are flushed along */
+	if (start > f->flush_end && start - f->flush_end > PAGE_SIZE)
+		return false;
+	if (end < f->flush_start && f->flush_start - end > PAGE_SIZE)
+		return false;
+
+	f->flush_start = min(f->flush_start, start);
+	f->flush_end = max(f->flush_end, end);
+	return true;
+}
+
+static void flush_tlb_queue(int cpu, struct mm_struct *mm,
+			    unsigned long start, unsigned long end)
+{
+	struct tlb_flush_queue *q = &per_cpu(tlb_flush_queues, cpu);
+	struct flush_tlb_info *f;
+	unsigned long flags;
+	unsigned int i;
+	bool kick;
+
+	spin_lock_irqsave(&q->lock, flags);
+	if (q->flush_all)
+		goto queued;
+
+	for (i = 0; i < q->nr; i++) {
+		if (flush_tlb_merge(&q->info[i], mm, start, end))
+			goto queued;
+	}
+
+	if (q->nr == TLB_FLUSH_QUEUE_LEN) {
+		q->flush_all = true;
+		goto queued;
+	}
+
+	f = &q->info[q->nr++];
+	f->flush_mm = mm;
+	f->flush_start = start;
+	f->flush_end = end;
+
+queued:
+	q->queued++;
+	kick = !q->kicked;
+	q->kicked = true;
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (kick)
+		smp_call_function_single_async(cpu, &q->csd);
+}
+
+/* Wait until @cpu drained at least what we have queued on it */
+static void flush_tlb_queue_wait(int cpu)
+{
+	struct tlb_flush_queue *q = &per_cpu(tlb_flush_queues, cpu);
+	unsigned long queued = READ_ONCE(q->queued);
+
+	while ((long)(smp_load_acquire(&q->done) - queued) < 0)
+		cpu_relax();
+}
+
+/*
+ * Queue the shootdown on each other online CPU of @cpumask,
+ * and record them in @queued.
+ */
+static void flush_tlb_others_queue(const struct cpumask *cpumask,
+				   struct mm_struct *mm, unsigned long start,
+				   unsigned long end, struct cpumask *queued)
+{
+	int cpu, this_cpu = smp_processor_id();
+
+	if (end == 0)
+		end = start + PAGE_SIZE;
+
+	for_each_cpu_and(cpu, cpumask, cpu_online_mask) {
+		if (cpu == this_cpu)
+			continue;
+		flush_tlb_queue(cpu, mm, start, end);
+		cpumask_set_cpu(cpu, queued);
+	}
+}
+
+static void flush_tlb_others_wait(const struct cpumask *queued)
+{
+	int cpu;
+
+	for_each_cpu(cpu, queued)
+		flush_tlb_queue_wait(cpu);
+}
+
 DEFINE_PROFILE_POINT(flush_tlb_others)
 
 void flush_tlb_others(const struct cpumask *cpumask, struct mm_struct *mm,
 		      unsigned long start, unsigned long end)
 {
-	struct flush_tlb_info info;
+	struct cpumask queued;
 	PROFILE_POINT_TIME(flush_tlb_others)
 
-	if (end == 0)
-		end = start + PAGE_SIZE;
-	info.flush_mm = mm;
-	info.flush_start = start;
-	info.flush_end = end;
+	/*
+	 * Can deadlock when called with interrupts disabled,
+	 * like smp_call_function_many().
+	 */
+	WARN_ON_ONCE(irqs_disabled());
 
 	profile_point_start(flush_tlb_others);
-	smp_call_function_many(cpumask, flush_tlb_func, &info, 1);
+	cpumask_clear(&queued);
+	flush_tlb_others_queue(cpumask, mm, start, end, &queued);
+	flush_tlb_others_wait(&queued);
 	profile_point_leave(flush_tlb_others);
 }
 
+/*
+ * Batches nest, an inner one only waits for its own shootdowns.
+ * Must be finished by the task that started it.
+ */
+void tlb_flush_batch_start(struct tlb_flush_batch *batch)
+{
+	cpumask_clear(&batch->cpumask);
+	batch->prev = current->tlb_flush_batch;
+	current->tlb_flush_batch = batch;
+}
+
+void tlb_flush_batch_finish(struct tlb_flush_batch *batch)
+{
+	WARN_ON_ONCE(current->tlb_flush_batch != batch);
+
+	flush_tlb_others_wait(&batch->cpumask);
+	current->tlb_flush_batch = batch->prev;
+}
+
 void flush_tlb_current_task(void)
 {
 	struct mm_struct *mm = current->mm;
@@ -155,18 +348,6 @@ void flush_tlb_current_task(void)
 	preempt_enable();
 }
 
-/*
- * See Documentation/x86/tlb.txt for details.  We choose 33
- * because it is large enough to cover the vast majority (at
- * least 95%) of allocations, and is small enough that we are
- * confident it will not cause too much overhead.  Each single
- * flush is about 100 ns, so this caps the maximum overhead at
- * _about_ 3,000 ns.
- *
- * This is in units of pages.
- */
-static unsigned long tlb_single_page_flush_ceiling __read_mostly = 33;
-
 void flush_tlb_mm_range(struct mm_struct *mm,
 			unsigned long start, unsigned long end)
 {
@@ -197,8 +378,15 @@ void flush_tlb_mm_range(struct mm_struct *mm,
 		end = TLB_FLUSH_ALL;
 	}
 
-	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids)
-		flush_tlb_others(mm_cpumask(mm), mm, start, end);
+	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids) {
+		struct tlb_flush_batch *batch = current->tlb_flush_batch;
+
+		if (batch)
+			flush_tlb_others_queue(mm_cpumask(mm), mm, start, end,
+					       &batch->cpumask);
+		else
+			flush_tlb_others(mm_cpumask(mm), mm, start, end);
+	}
 
 	preempt_enable();
 }
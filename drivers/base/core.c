@@ -10,6 +10,8 @@
 #include <lego/pci.h>
 #include <lego/device.h>
 #include <lego/kernel.h>
+#include <lego/blkdev.h>
+#include <net/virtio_net.h>
 
 void __init ib_core_init(void);
 
@@ -20,6 +22,9 @@ void __init ib_core_init(void);
 void __init device_init(void)
 {
 	ib_core_init();
+	virtnet_init();
+	nvme_init();
+	virtblk_init();
 }
 
 static int __dev_printk(const char *level, const struct device *dev,
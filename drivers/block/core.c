@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define pr_fmt(fmt) "blk: " fmt
+
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/blkdev.h>
+
+/* The storage manager uses one device, the first one found */
+static struct block_device *blk_dev;
+
+int blk_register_device(struct block_device *bdev)
+{
+	if (blk_dev) {
+		pr_info("%s: ignored, already using %s\n", bdev->name, blk_dev->name);
+		return -EBUSY;
+	}
+
+	blk_dev = bdev;
+	pr_info("%s: %llu MB, %u queues, depth %u, max request %u KB\n",
+		bdev->name, bdev->nr_sectors >> (20 - SECTOR_SHIFT),
+		bdev->nr_queues, bdev->queue_depth, bdev->max_len >> 10);
+	return 0;
+}
+
+struct block_device *blk_get_device(void)
+{
+	return blk_dev;
+}
+
+/**
+ * blk_submit_wait - submit a request, polling @qid while it is full
+ *
+ * Completions reaped meanwhile have their ->end_io called as usual.
+ * The device is kicked before polling, requests queued earlier by the
+ * caller may be sent along.
+ */
+int blk_submit_wait(struct block_device *bdev, int qid, struct blk_request *req)
+{
+	int ret;
+
+	while ((ret = blk_submit(bdev, qid, req)) == -EBUSY) {
+		blk_kick(bdev, qid);
+		if (!blk_poll(bdev, qid))
+			cpu_relax();
+	}
+	return ret;
+}
+
+static void blk_rw_end_io(struct blk_request *req)
+{
+	WRITE_ONCE(*(bool *)req->private, true);
+}
+
+/* Synchronous I/O, for setup and metadata */
+int blk_rw(struct block_device *bdev, int qid, enum blk_op op,
+	   u64 sector, void *buf, unsigned int len)
+{
+	struct blk_request req;
+	bool done = false;
+	int ret;
+
+	req.op = op;
+	req.sector = sector;
+	req.buf = buf;
+	req.len = len;
+	req.error = 0;
+	req.end_io = blk_rw_end_io;
+	req.private = &done;
+
+	ret = blk_submit_wait(bdev, qid, &req);
+	if (ret)
+		return ret;
+	blk_kick(bdev, qid);
+
+	while (!READ_ONCE(done)) {
+		if (!blk_poll(bdev, qid))
+			cpu_relax();
+	}
+	return req.error;
+}
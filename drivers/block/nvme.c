@@ -0,0 +1,646 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * NVMe driver
+ *
+ * Namespace 1 of the first controller is used. Besides the admin queue
+ * there is one I/O submission/completion queue pair per block queue,
+ * up to NVME_MAX_QUEUES, so that threads doing I/O on their own queue
+ * never contend. Completion queues are created without interrupts and
+ * reaped by blk_poll(). Admin commands are only issued at probe time.
+ *
+ * Data buffers are physically contiguous. A request spanning more than
+ * two pages points PRP2 to a PRP list, each command id has its own.
+ */
+
+#define pr_fmt(fmt) "nvme: " fmt
+
+#include <lego/mm.h>
+#include <lego/pci.h>
+#include <lego/slab.h>
+#include <lego/delay.h>
+#include <lego/kernel.h>
+#include <lego/blkdev.h>
+#include <lego/bitops.h>
+#include <lego/jiffies.h>
+#include <lego/spinlock.h>
+#include <asm/io.h>
+
+/* Controller registers, in memory BAR 0 */
+#define NVME_REG_CAP		0x0000
+#define NVME_REG_VS		0x0008
+#define NVME_REG_CC		0x0014
+#define NVME_REG_CSTS		0x001c
+#define NVME_REG_AQA		0x0024
+#define NVME_REG_ASQ		0x0028
+#define NVME_REG_ACQ		0x0030
+#define NVME_REG_DBS		0x1000
+
+#define NVME_CAP_MQES(cap)	((cap) & 0xffff)
+#define NVME_CAP_TIMEOUT(cap)	(((cap) >> 24) & 0xff)	/* in 500ms */
+#define NVME_CAP_STRIDE(cap)	(((cap) >> 32) & 0xf)
+
+#define NVME_CC_ENABLE		(1 << 0)
+#define NVME_CC_CSS_NVM		(0 << 4)
+#define NVME_CC_MPS_4K		(0 << 7)
+#define NVME_CC_AMS_RR		(0 << 11)
+#define NVME_CC_IOSQES		(6 << 16)	/* 64 bytes */
+#define NVME_CC_IOCQES		(4 << 20)	/* 16 bytes */
+#define NVME_CSTS_RDY		(1 << 0)
+#define NVME_CSTS_CFS		(1 << 1)
+
+/* Admin opcodes */
+#define nvme_admin_create_sq	0x01
+#define nvme_admin_create_cq	0x05
+#define nvme_admin_identify	0x06
+#define nvme_admin_set_features	0x09
+
+#define NVME_FEAT_NUM_QUEUES	0x07
+#define NVME_QUEUE_PHYS_CONTIG	(1 << 0)
+#define NVME_ID_CNS_NS		0x00
+#define NVME_ID_CNS_CTRL	0x01
+
+/* I/O opcodes */
+#define nvme_cmd_flush		0x00
+#define nvme_cmd_write		0x01
+#define nvme_cmd_read		0x02
+
+#define NVME_MAX_QUEUES		16
+#define NVME_AQ_DEPTH		32
+#define NVME_IO_DEPTH		BITS_PER_LONG
+#define NVME_MAX_LEN		(128 * 1024)
+#define NVME_PRP_LIST_SIZE	256		/* bytes, one per command id */
+#define NVME_POLL_BUDGET	64
+#define NVME_ADMIN_TIMEOUT	(5 * HZ)
+
+/* Identify data */
+#define NVME_ID_CTRL_MDTS	77
+#define NVME_ID_NS_NSZE		0
+#define NVME_ID_NS_FLBAS	26
+#define NVME_ID_NS_LBAF		128
+
+struct nvme_command {
+	u8	opcode;
+	u8	flags;
+	u16	command_id;
+	u32	nsid;
+	u64	rsvd2;
+	u64	metadata;
+	u64	prp1;
+	u64	prp2;
+	u32	cdw10;
+	u32	cdw11;
+	u32	cdw12;
+	u32	cdw13;
+	u32	cdw14;
+	u32	cdw15;
+};
+
+struct nvme_completion {
+	u32	result;
+	u32	rsvd;
+	u16	sq_head;
+	u16	sq_id;
+	u16	command_id;
+	u16	status;		/* phase in bit 0 */
+};
+
+struct nvme_dev;
+
+struct nvme_queue {
+	struct nvme_dev		*dev;
+	spinlock_t		lock;
+	struct nvme_command	*sqes;
+	struct nvme_completion	*cqes;
+	u32 __iomem		*sq_db;
+	u32 __iomem		*cq_db;
+	u16			qid;
+	u16			depth;
+	u16			sq_tail;
+	u16			cq_head;
+	u8			cq_phase;
+	bool			sq_dirty;	/* tail moved since the last kick */
+
+	/* In-flight requests, by command id */
+	unsigned long		cmdid_map;
+	struct blk_request	*reqs[NVME_IO_DEPTH];
+	u64			*prp_lists;
+
+	unsigned long		requests;
+	unsigned long		busy;
+} ____cacheline_aligned;
+
+struct nvme_dev {
+	struct pci_dev		*pdev;
+	void __iomem		*bar;
+	u64			cap;
+	u32			db_stride;	/* in u32 */
+	unsigned int		lba_shift;
+	int			nr_queues;	/* I/O queues */
+	struct nvme_queue	adminq;
+	struct nvme_queue	queues[NVME_MAX_QUEUES];
+	struct block_device	bdev;
+};
+
+static inline struct nvme_queue *nvme_io_queue(struct block_device *bdev, int qid)
+{
+	struct nvme_dev *dev = bdev->private;
+
+	return &dev->queues[qid % dev->nr_queues];
+}
+
+static int nvme_alloc_queue(struct nvme_dev *dev, struct nvme_queue *q,
+			    u16 qid, u16 depth)
+{
+	q->depth = depth;
+	q->sqes = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+				get_order(depth * sizeof(struct nvme_command)));
+	q->cqes = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+				get_order(depth * sizeof(struct nvme_completion)));
+	if (!q->sqes || !q->cqes)
+		return -ENOMEM;
+
+	if (qid) {
+		q->prp_lists = (void *)__get_free_pages(GFP_KERNEL,
+				get_order(NVME_IO_DEPTH * NVME_PRP_LIST_SIZE));
+		if (!q->prp_lists)
+			return -ENOMEM;
+	}
+
+	spin_lock_init(&q->lock);
+	q->dev = dev;
+	q->qid = qid;
+	q->sq_tail = 0;
+	q->cq_head = 0;
+	q->cq_phase = 1;
+	q->sq_db = dev->bar + NVME_REG_DBS + 2 * qid * dev->db_stride * 4;
+	q->cq_db = dev->bar + NVME_REG_DBS + (2 * qid + 1) * dev->db_stride * 4;
+	return 0;
+}
+
+static void nvme_free_queue(struct nvme_queue *q)
+{
+	if (q->sqes)
+		free_pages((unsigned long)q->sqes,
+			   get_order(q->depth * sizeof(struct nvme_command)));
+	if (q->cqes)
+		free_pages((unsigned long)q->cqes,
+			   get_order(q->depth * sizeof(struct nvme_completion)));
+	if (q->prp_lists)
+		free_pages((unsigned long)q->prp_lists,
+			   get_order(NVME_IO_DEPTH * NVME_PRP_LIST_SIZE));
+}
+
+/* Copy @cmd to the tail of the submission queue, without ringing */
+static void __nvme_submit_cmd(struct nvme_queue *q, struct nvme_command *cmd)
+{
+	memcpy(&q->sqes[q->sq_tail], cmd, sizeof(*cmd));
+	if (++q->sq_tail == q->depth)
+		q->sq_tail = 0;
+	q->sq_dirty = true;
+}
+
+static void nvme_ring_sq(struct nvme_queue *q)
+{
+	if (!q->sq_dirty)
+		return;
+
+	/* Entries before the doorbell */
+	wmb();
+	writel(q->sq_tail, q->sq_db);
+	q->sq_dirty = false;
+}
+
+static inline bool nvme_cqe_pending(struct nvme_queue *q)
+{
+	return (READ_ONCE(q->cqes[q->cq_head].status) & 1) == q->cq_phase;
+}
+
+static void nvme_advance_cq(struct nvme_queue *q)
+{
+	if (++q->cq_head == q->depth) {
+		q->cq_head = 0;
+		q->cq_phase ^= 1;
+	}
+}
+
+/*
+ * Admin commands are issued one at a time at probe, with
+ * command id 0, and polled for.
+ */
+static int nvme_admin_cmd(struct nvme_dev *dev, struct nvme_command *cmd,
+			  u32 *result)
+{
+	struct nvme_queue *q = &dev->adminq;
+	unsigned long timeout = jiffies + NVME_ADMIN_TIMEOUT;
+	struct nvme_completion *cqe;
+	u16 status;
+
+	cmd->command_id = 0;
+	__nvme_submit_cmd(q, cmd);
+	nvme_ring_sq(q);
+
+	while (!nvme_cqe_pending(q)) {
+		if (time_after(jiffies, timeout))
+			return -ETIMEDOUT;
+		cpu_relax();
+	}
+
+	rmb();
+	cqe = &q->cqes[q->cq_head];
+	status = cqe->status >> 1;
+	if (result)
+		*result = cqe->result;
+	nvme_advance_cq(q);
+	writel(q->cq_head, q->cq_db);
+
+	if (status) {
+		pr_err("admin command %#x failed, status %#x\n", cmd->opcode, status);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Set up PRP1/PRP2 of @cmd for @req, @prp_list is free to use */
+static void nvme_setup_prps(struct nvme_command *cmd, struct blk_request *req,
+			    u64 *prp_list)
+{
+	u64 addr = __pa(req->buf);
+	unsigned int first = PAGE_SIZE - offset_in_page(addr);
+	unsigned int left;
+	int i;
+
+	cmd->prp1 = addr;
+	if (req->len <= first) {
+		cmd->prp2 = 0;
+		return;
+	}
+
+	addr = (addr & PAGE_MASK) + PAGE_SIZE;
+	left = req->len - first;
+	if (left <= PAGE_SIZE) {
+		cmd->prp2 = addr;
+		return;
+	}
+
+	for (i = 0; left; i++) {
+		prp_list[i] = addr;
+		addr += PAGE_SIZE;
+		left -= min_t(unsigned int, left, PAGE_SIZE);
+	}
+	cmd->prp2 = __pa(prp_list);
+}
+
+static int nvme_submit(struct block_device *bdev, int qid,
+		       struct blk_request *req)
+{
+	struct nvme_queue *q = nvme_io_queue(bdev, qid);
+	struct nvme_dev *dev = q->dev;
+	struct nvme_command cmd;
+	unsigned long id;
+	u64 lba = 0;
+	u32 nlb = 0;
+
+	if (req->op != BLK_OP_FLUSH) {
+		lba = req->sector >> (dev->lba_shift - SECTOR_SHIFT);
+		nlb = req->len >> dev->lba_shift;
+		if (unlikely(!nlb || req->len > bdev->max_len ||
+			     (req->len & ((1 << dev->lba_shift) - 1)) ||
+			     (req->sector << SECTOR_SHIFT) & ((1 << dev->lba_shift) - 1)))
+			return -EINVAL;
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.nsid = 1;
+
+	spin_lock(&q->lock);
+	/* Keep one slot free, the queue is full when tail meets head */
+	id = ffz(q->cmdid_map);
+	if (id >= q->depth - 1) {
+		q->busy++;
+		spin_unlock(&q->lock);
+		return -EBUSY;
+	}
+	__set_bit(id, &q->cmdid_map);
+	q->reqs[id] = req;
+
+	cmd.command_id = id;
+	switch (req->op) {
+	case BLK_OP_READ:
+	case BLK_OP_WRITE:
+		cmd.opcode = req->op == BLK_OP_READ ? nvme_cmd_read : nvme_cmd_write;
+		cmd.cdw10 = (u32)lba;
+		cmd.cdw11 = (u32)(lba >> 32);
+		cmd.cdw12 = nlb - 1;
+		nvme_setup_prps(&cmd, req,
+				(void *)q->prp_lists + id * NVME_PRP_LIST_SIZE);
+		break;
+	case BLK_OP_FLUSH:
+		cmd.opcode = nvme_cmd_flush;
+		break;
+	}
+
+	__nvme_submit_cmd(q, &cmd);
+	q->requests++;
+	spin_unlock(&q->lock);
+	return 0;
+}
+
+static void nvme_kick(struct block_device *bdev, int qid)
+{
+	struct nvme_queue *q = nvme_io_queue(bdev, qid);
+
+	spin_lock(&q->lock);
+	nvme_ring_sq(q);
+	spin_unlock(&q->lock);
+}
+
+static int nvme_poll(struct block_device *bdev, int qid)
+{
+	struct nvme_queue *q = nvme_io_queue(bdev, qid);
+	struct blk_request *done[NVME_POLL_BUDGET];
+	struct nvme_completion *cqe;
+	struct blk_request *req;
+	int i, nr = 0;
+	u16 id;
+
+	if (!nvme_cqe_pending(q))
+		return 0;
+
+	spin_lock(&q->lock);
+	while (nr < NVME_POLL_BUDGET && nvme_cqe_pending(q)) {
+		/* Read the entry only after seeing its phase */
+		rmb();
+		cqe = &q->cqes[q->cq_head];
+		id = cqe->command_id;
+
+		if (unlikely(id >= NVME_IO_DEPTH || !q->reqs[id])) {
+			pr_warn("queue %u: bogus command id %u\n", q->qid, id);
+		} else {
+			req = q->reqs[id];
+			q->reqs[id] = NULL;
+			__clear_bit(id, &q->cmdid_map);
+			req->error = (cqe->status >> 1) ? -EIO : 0;
+			done[nr++] = req;
+		}
+		nvme_advance_cq(q);
+	}
+	writel(q->cq_head, q->cq_db);
+	spin_unlock(&q->lock);
+
+	/* end_io may submit again */
+	for (i = 0; i < nr; i++)
+		done[i]->end_io(done[i]);
+	return nr;
+}
+
+static const struct block_device_ops nvme_ops = {
+	.submit		= nvme_submit,
+	.kick		= nvme_kick,
+	.poll		= nvme_poll,
+};
+
+static int nvme_wait_ready(struct nvme_dev *dev, bool enabled)
+{
+	unsigned long timeout;
+	u32 csts;
+
+	timeout = jiffies + (NVME_CAP_TIMEOUT(dev->cap) + 1) * HZ / 2;
+	for (;;) {
+		csts = readl(dev->bar + NVME_REG_CSTS);
+		if (csts == ~0U)
+			return -ENODEV;
+		if (!!(csts & NVME_CSTS_RDY) == enabled)
+			return 0;
+		if (time_after(jiffies, timeout)) {
+			pr_err("controller not %s, csts %#x\n",
+			       enabled ? "ready" : "disabled", csts);
+			return -ETIMEDOUT;
+		}
+		mdelay(1);
+	}
+}
+
+static int nvme_enable_ctrl(struct nvme_dev *dev)
+{
+	struct nvme_queue *q = &dev->adminq;
+	u32 cc;
+	int ret;
+
+	cc = readl(dev->bar + NVME_REG_CC);
+	if (cc & NVME_CC_ENABLE) {
+		writel(cc & ~NVME_CC_ENABLE, dev->bar + NVME_REG_CC);
+		ret = nvme_wait_ready(dev, false);
+		if (ret)
+			return ret;
+	}
+
+	ret = nvme_alloc_queue(dev, q, 0, NVME_AQ_DEPTH);
+	if (ret)
+		return ret;
+
+	writel((NVME_AQ_DEPTH - 1) << 16 | (NVME_AQ_DEPTH - 1),
+	       dev->bar + NVME_REG_AQA);
+	writeq(__pa(q->sqes), dev->bar + NVME_REG_ASQ);
+	writeq(__pa(q->cqes), dev->bar + NVME_REG_ACQ);
+
+	cc = NVME_CC_ENABLE | NVME_CC_CSS_NVM | NVME_CC_MPS_4K |
+	     NVME_CC_AMS_RR | NVME_CC_IOSQES | NVME_CC_IOCQES;
+	writel(cc, dev->bar + NVME_REG_CC);
+	return nvme_wait_ready(dev, true);
+}
+
+static int nvme_identify(struct nvme_dev *dev)
+{
+	struct nvme_command cmd;
+	unsigned int max_len;
+	u8 *id, mdts, flbas;
+	u32 lbaf;
+	int ret;
+
+	id = (u8 *)__get_free_page(GFP_KERNEL | __GFP_ZERO);
+	if (!id)
+		return -ENOMEM;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = nvme_admin_identify;
+	cmd.prp1 = __pa(id);
+	cmd.cdw10 = NVME_ID_CNS_CTRL;
+	ret = nvme_admin_cmd(dev, &cmd, NULL);
+	if (ret)
+		goto out;
+
+	/* In units of the minimum page size, 4K here */
+	mdts = id[NVME_ID_CTRL_MDTS];
+	max_len = NVME_MAX_LEN;
+	if (mdts && mdts < 16)
+		max_len = min_t(unsigned int, max_len, PAGE_SIZE << mdts);
+	dev->bdev.max_len = max_len;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = nvme_admin_identify;
+	cmd.nsid = 1;
+	cmd.prp1 = __pa(id);
+	cmd.cdw10 = NVME_ID_CNS_NS;
+	ret = nvme_admin_cmd(dev, &cmd, NULL);
+	if (ret)
+		goto out;
+
+	flbas = id[NVME_ID_NS_FLBAS] & 0xf;
+	memcpy(&lbaf, id + NVME_ID_NS_LBAF + 4 * flbas, sizeof(lbaf));
+	dev->lba_shift = (lbaf >> 16) & 0xff;
+	if (dev->lba_shift < SECTOR_SHIFT || dev->lba_shift > PAGE_SHIFT) {
+		pr_err("unsupported LBA size %u\n", 1U << dev->lba_shift);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	memcpy(&dev->bdev.nr_sectors, id + NVME_ID_NS_NSZE, sizeof(u64));
+	dev->bdev.nr_sectors <<= dev->lba_shift - SECTOR_SHIFT;
+	if (!dev->bdev.nr_sectors) {
+		pr_err("namespace 1 is empty\n");
+		ret = -ENODEV;
+	}
+out:
+	free_page((unsigned long)id);
+	return ret;
+}
+
+static int nvme_setup_io_queues(struct nvme_dev *dev)
+{
+	struct nvme_command cmd;
+	int i, nr, depth, ret;
+	u32 result;
+
+	nr = min_t(int, NVME_MAX_QUEUES, num_online_cpus());
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = nvme_admin_set_features;
+	cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+	cmd.cdw11 = (nr - 1) << 16 | (nr - 1);
+	ret = nvme_admin_cmd(dev, &cmd, &result);
+	if (ret)
+		return ret;
+	nr = min_t(int, nr, (result & 0xffff) + 1);
+	nr = min_t(int, nr, (result >> 16) + 1);
+
+	depth = min_t(int, NVME_CAP_MQES(dev->cap) + 1, NVME_IO_DEPTH);
+
+	for (i = 0; i < nr; i++) {
+		struct nvme_queue *q = &dev->queues[i];
+		u16 qid = i + 1;
+
+		ret = nvme_alloc_queue(dev, q, qid, depth);
+		if (ret)
+			return ret;
+
+		/* Polled, no interrupt */
+		memset(&cmd, 0, sizeof(cmd));
+		cmd.opcode = nvme_admin_create_cq;
+		cmd.prp1 = __pa(q->cqes);
+		cmd.cdw10 = (depth - 1) << 16 | qid;
+		cmd.cdw11 = NVME_QUEUE_PHYS_CONTIG;
+		ret = nvme_admin_cmd(dev, &cmd, NULL);
+		if (ret)
+			return ret;
+
+		memset(&cmd, 0, sizeof(cmd));
+		cmd.opcode = nvme_admin_create_sq;
+		cmd.prp1 = __pa(q->sqes);
+		cmd.cdw10 = (depth - 1) << 16 | qid;
+		cmd.cdw11 = qid << 16 | NVME_QUEUE_PHYS_CONTIG;
+		ret = nvme_admin_cmd(dev, &cmd, NULL);
+		if (ret)
+			return ret;
+
+		dev->nr_queues++;
+	}
+
+	dev->bdev.queue_depth = depth - 1;
+	return 0;
+}
+
+static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct nvme_dev *dev;
+	u32 vs;
+	int i, ret;
+
+	if (!(pci_resource_flags(pdev, 0) & IORESOURCE_MEM))
+		return -ENODEV;
+
+	ret = pci_enable_device(pdev);
+	if (ret)
+		return ret;
+	pci_set_master(pdev);
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+	dev->pdev = pdev;
+
+	dev->bar = ioremap(pci_resource_start(pdev, 0), pci_resource_len(pdev, 0));
+	if (!dev->bar) {
+		ret = -ENOMEM;
+		goto free_dev;
+	}
+
+	dev->cap = readq(dev->bar + NVME_REG_CAP);
+	dev->db_stride = 1 << NVME_CAP_STRIDE(dev->cap);
+	vs = readl(dev->bar + NVME_REG_VS);
+
+	ret = nvme_enable_ctrl(dev);
+	if (ret)
+		goto free_queues;
+	ret = nvme_identify(dev);
+	if (ret)
+		goto free_queues;
+	ret = nvme_setup_io_queues(dev);
+	if (ret || !dev->nr_queues) {
+		ret = ret ? ret : -ENODEV;
+		goto free_queues;
+	}
+
+	dev->bdev.name = "nvme";
+	dev->bdev.nr_queues = dev->nr_queues;
+	dev->bdev.ops = &nvme_ops;
+	dev->bdev.private = dev;
+	pci_set_drvdata(pdev, dev);
+
+	pr_info("version %u.%u, %d I/O queues, LBA size %u\n",
+		vs >> 16, (vs >> 8) & 0xff, dev->nr_queues, 1U << dev->lba_shift);
+	return blk_register_device(&dev->bdev);
+
+free_queues:
+	/* Disable the controller before the queues go away */
+	writel(0, dev->bar + NVME_REG_CC);
+	nvme_free_queue(&dev->adminq);
+	for (i = 0; i < NVME_MAX_QUEUES; i++)
+		nvme_free_queue(&dev->queues[i]);
+free_dev:
+	kfree(dev);
+	return ret;
+}
+
+static const struct pci_device_id nvme_pci_tbl[] = {
+	{ PCI_DEVICE_CLASS(PCI_CLASS_STORAGE_EXPRESS, 0xffffff) },
+	{ 0, }
+};
+
+static struct pci_driver nvme_driver = {
+	.name		= "nvme",
+	.id_table	= nvme_pci_tbl,
+	.probe		= nvme_probe,
+};
+
+int __init nvme_init(void)
+{
+	return pci_register_driver(&nvme_driver);
+}
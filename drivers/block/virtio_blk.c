@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * virtio-blk driver, legacy virtio PCI interface (QEMU/KVM default)
+ *
+ * With VIRTIO_BLK_F_MQ the device has one virtqueue per block queue,
+ * up to VIRTBLK_MAX_QUEUES. Interrupts are never enabled, completions
+ * are reaped by blk_poll(). A request takes three descriptors: the
+ * header, the data and the status byte. Header and status live in a
+ * per-queue array indexed by the head descriptor.
+ *
+ * Without VIRTIO_BLK_F_FLUSH the device has no write cache, and flush
+ * requests complete right away from blk_submit().
+ */
+
+#define pr_fmt(fmt) "virtio-blk: " fmt
+
+#include <lego/mm.h>
+#include <lego/pci.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/blkdev.h>
+#include <lego/virtio.h>
+#include <lego/spinlock.h>
+#include <asm/io.h>
+
+#define VIRTIO_PCI_BLK_DEVICE_ID	0x1001
+
+#define VIRTIO_BLK_F_SIZE_MAX		1
+#define VIRTIO_BLK_F_FLUSH		9
+#define VIRTIO_BLK_F_MQ			12
+
+/* Offsets into the block device config */
+#define VIRTIO_BLK_CFG_CAPACITY		0
+#define VIRTIO_BLK_CFG_SIZE_MAX		8
+#define VIRTIO_BLK_CFG_NUM_QUEUES	34
+
+#define VIRTIO_BLK_T_IN			0
+#define VIRTIO_BLK_T_OUT		1
+#define VIRTIO_BLK_T_FLUSH		4
+#define VIRTIO_BLK_S_OK			0
+
+#define VIRTBLK_MAX_QUEUES		16
+#define VIRTBLK_MAX_LEN			(128 * 1024)
+#define VIRTBLK_POLL_BUDGET		64
+
+struct virtio_blk_outhdr {
+	u32	type;
+	u32	ioprio;
+	u64	sector;
+};
+
+struct virtblk_cmd {
+	struct virtio_blk_outhdr	hdr;
+	u8				status;
+	struct blk_request		*req;
+};
+
+struct virtblk_queue {
+	struct virtqueue	vq;
+	spinlock_t		lock;
+	struct virtblk_cmd	*cmds;		/* one per head descriptor */
+	unsigned long		requests;
+	unsigned long		busy;
+} ____cacheline_aligned;
+
+struct virtblk {
+	struct pci_dev		*pdev;
+	unsigned long		ioaddr;
+	u32			features;
+	bool			event_idx;
+	int			nr_queues;
+	struct virtblk_queue	queues[VIRTBLK_MAX_QUEUES];
+	struct block_device	bdev;
+};
+
+static inline bool virtblk_has_feature(struct virtblk *vb, unsigned int bit)
+{
+	return vb->features & (1U << bit);
+}
+
+static inline struct virtblk_queue *virtblk_queue(struct block_device *bdev, int qid)
+{
+	struct virtblk *vb = bdev->private;
+
+	return &vb->queues[qid % vb->nr_queues];
+}
+
+static int virtblk_submit(struct block_device *bdev, int qid,
+			  struct blk_request *req)
+{
+	struct virtblk_queue *q = virtblk_queue(bdev, qid);
+	struct virtblk *vb = bdev->private;
+	struct virtblk_cmd *cmd;
+	struct virtio_sg sg[3];
+	int out, in, ret;
+
+	/* Without a write cache there is nothing to flush */
+	if (req->op == BLK_OP_FLUSH && !virtblk_has_feature(vb, VIRTIO_BLK_F_FLUSH)) {
+		req->error = 0;
+		req->end_io(req);
+		return 0;
+	}
+
+	spin_lock(&q->lock);
+	if (q->vq.num_free < 3) {
+		q->busy++;
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	cmd = &q->cmds[q->vq.free_head];
+	cmd->req = req;
+	cmd->status = ~VIRTIO_BLK_S_OK;
+	cmd->hdr.ioprio = 0;
+	cmd->hdr.sector = req->sector;
+
+	sg[0].addr = &cmd->hdr;
+	sg[0].len = sizeof(cmd->hdr);
+	out = 1;
+	in = 0;
+
+	switch (req->op) {
+	case BLK_OP_READ:
+		cmd->hdr.type = VIRTIO_BLK_T_IN;
+		sg[1].addr = req->buf;
+		sg[1].len = req->len;
+		in++;
+		break;
+	case BLK_OP_WRITE:
+		cmd->hdr.type = VIRTIO_BLK_T_OUT;
+		sg[1].addr = req->buf;
+		sg[1].len = req->len;
+		out++;
+		break;
+	case BLK_OP_FLUSH:
+		cmd->hdr.type = VIRTIO_BLK_T_FLUSH;
+		cmd->hdr.sector = 0;
+		break;
+	}
+	sg[out + in].addr = &cmd->status;
+	sg[out + in].len = sizeof(cmd->status);
+	in++;
+
+	ret = virtqueue_add(&q->vq, sg, out, in, cmd);
+	if (!ret)
+		q->requests++;
+unlock:
+	spin_unlock(&q->lock);
+	return ret;
+}
+
+static void virtblk_kick(struct block_device *bdev, int qid)
+{
+	struct virtblk_queue *q = virtblk_queue(bdev, qid);
+
+	spin_lock(&q->lock);
+	virtqueue_kick(&q->vq);
+	spin_unlock(&q->lock);
+}
+
+static int virtblk_poll(struct block_device *bdev, int qid)
+{
+	struct virtblk_queue *q = virtblk_queue(bdev, qid);
+	struct blk_request *done[VIRTBLK_POLL_BUDGET];
+	struct virtblk_cmd *cmd;
+	int i, nr = 0;
+
+	if (!virtqueue_more_used(&q->vq))
+		return 0;
+
+	spin_lock(&q->lock);
+	while (nr < VIRTBLK_POLL_BUDGET) {
+		cmd = virtqueue_get_buf(&q->vq, NULL);
+		if (!cmd)
+			break;
+
+		cmd->req->error = cmd->status == VIRTIO_BLK_S_OK ? 0 : -EIO;
+		done[nr++] = cmd->req;
+	}
+	spin_unlock(&q->lock);
+
+	/* end_io may submit again */
+	for (i = 0; i < nr; i++)
+		done[i]->end_io(done[i]);
+	return nr;
+}
+
+static const struct block_device_ops virtblk_ops = {
+	.submit		= virtblk_submit,
+	.kick		= virtblk_kick,
+	.poll		= virtblk_poll,
+};
+
+static int virtblk_setup_vqs(struct virtblk *vb)
+{
+	int i, ret;
+
+	for (i = 0; i < vb->nr_queues; i++) {
+		struct virtblk_queue *q = &vb->queues[i];
+
+		ret = virtqueue_setup(&q->vq, vb->ioaddr, i, vb->event_idx);
+		if (ret)
+			return ret;
+		virtqueue_disable_cb(&q->vq);
+
+		spin_lock_init(&q->lock);
+		q->cmds = kcalloc(q->vq.num, sizeof(*q->cmds), GFP_KERNEL);
+		if (!q->cmds)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void virtblk_free_vqs(struct virtblk *vb)
+{
+	int i;
+
+	for (i = 0; i < vb->nr_queues; i++) {
+		virtqueue_free(&vb->queues[i].vq);
+		kfree(vb->queues[i].cmds);
+	}
+}
+
+static int virtblk_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct virtblk *vb;
+	unsigned long cfg;
+	u32 host_features;
+	int ret;
+
+	if (!(pci_resource_flags(pdev, 0) & IORESOURCE_IO)) {
+		pr_err("BAR0 is not I/O, modern-only device?\n");
+		return -ENODEV;
+	}
+
+	ret = pci_enable_device(pdev);
+	if (ret)
+		return ret;
+	pci_set_master(pdev);
+
+	vb = kzalloc(sizeof(*vb), GFP_KERNEL);
+	if (!vb)
+		return -ENOMEM;
+	vb->pdev = pdev;
+	vb->ioaddr = pci_resource_start(pdev, 0);
+
+	virtio_reset(vb->ioaddr);
+
+	host_features = inl(vb->ioaddr + VIRTIO_PCI_HOST_FEATURES);
+	vb->features = host_features & ((1U << VIRTIO_BLK_F_SIZE_MAX) |
+					(1U << VIRTIO_BLK_F_FLUSH) |
+					(1U << VIRTIO_BLK_F_MQ) |
+					(1U << VIRTIO_RING_F_EVENT_IDX));
+	outl(vb->features, vb->ioaddr + VIRTIO_PCI_GUEST_FEATURES);
+	vb->event_idx = virtblk_has_feature(vb, VIRTIO_RING_F_EVENT_IDX);
+
+	/* MSI-X stays off, the config is at its MSI-X-less offset */
+	cfg = vb->ioaddr + VIRTIO_PCI_CONFIG(false);
+
+	vb->bdev.nr_sectors = inl(cfg + VIRTIO_BLK_CFG_CAPACITY) |
+			      (u64)inl(cfg + VIRTIO_BLK_CFG_CAPACITY + 4) << 32;
+	vb->bdev.max_len = VIRTBLK_MAX_LEN;
+	if (virtblk_has_feature(vb, VIRTIO_BLK_F_SIZE_MAX)) {
+		u32 size_max = inl(cfg + VIRTIO_BLK_CFG_SIZE_MAX);
+
+		if (size_max >= PAGE_SIZE)
+			vb->bdev.max_len = min_t(u32, size_max & PAGE_MASK, VIRTBLK_MAX_LEN);
+	}
+
+	vb->nr_queues = 1;
+	if (virtblk_has_feature(vb, VIRTIO_BLK_F_MQ))
+		vb->nr_queues = inw(cfg + VIRTIO_BLK_CFG_NUM_QUEUES);
+	vb->nr_queues = clamp_t(int, vb->nr_queues, 1, VIRTBLK_MAX_QUEUES);
+
+	ret = virtblk_setup_vqs(vb);
+	if (ret)
+		goto fail;
+
+	virtio_set_status(vb->ioaddr, VIRTIO_CONFIG_S_DRIVER_OK);
+
+	vb->bdev.name = "virtio-blk";
+	vb->bdev.nr_queues = vb->nr_queues;
+	/* Three descriptors per request */
+	vb->bdev.queue_depth = vb->queues[0].vq.num / 3;
+	vb->bdev.ops = &virtblk_ops;
+	vb->bdev.private = vb;
+	pci_set_drvdata(pdev, vb);
+
+	pr_info("%d queues%s%s\n", vb->nr_queues,
+		vb->event_idx ? ", event idx" : "",
+		virtblk_has_feature(vb, VIRTIO_BLK_F_FLUSH) ? ", flush" : "");
+	return blk_register_device(&vb->bdev);
+
+fail:
+	virtblk_free_vqs(vb);
+	virtio_set_status(vb->ioaddr, VIRTIO_CONFIG_S_FAILED);
+	kfree(vb);
+	return ret;
+}
+
+static const struct pci_device_id virtblk_pci_tbl[] = {
+	{ PCI_DEVICE(VIRTIO_PCI_VENDOR_ID, VIRTIO_PCI_BLK_DEVICE_ID) },
+	{ 0, }
+};
+
+static struct pci_driver virtblk_driver = {
+	.name		= "virtio-blk",
+	.id_table	= virtblk_pci_tbl,
+	.probe		= virtblk_probe,
+};
+
+int __init virtblk_init(void)
+{
+	return pci_register_driver(&virtblk_driver);
+}
@@ -0,0 +1,650 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * virtio-net driver, legacy virtio PCI interface (QEMU/KVM default)
+ *
+ * The device is set up with up to CONFIG_VIRTIO_NET_MAX_QUEUES pairs of
+ * RX/TX virtqueues. Virtqueue 2i is RX and 2i+1 is TX of pair i, the
+ * control virtqueue comes last and is used to switch on multiqueue.
+ *
+ * Receive is NAPI-style: each queue pair has its own MSI-X vector and its
+ * own poll thread. The irq handler only masks further interrupts of the
+ * pair and wakes the thread, which processes up to VIRTNET_RX_BUDGET
+ * frames per round and unmasks only once the queue is empty. Under load
+ * the device does not interrupt at all. Without MSI-X, one shared INTx
+ * line wakes all poll threads.
+ *
+ * With VIRTIO_RING_F_EVENT_IDX the device interrupts once per unmask,
+ * and queue kicks are skipped while the device is still working on the
+ * ring. Buffers are added in batches with a single kick per batch.
+ *
+ * Completed TX frames are reclaimed by virtnet_xmit() and by every round
+ * of the poll thread of the pair. A TX queue interrupts only once per
+ * sleep of the thread, so the last frames of a burst are not held until
+ * the next send.
+ *
+ * Frames are never copied. An RX buffer is a page and is handed to the
+ * rx handler as is, the ring is refilled with new pages. A frame to send
+ * is a scatter list of kernel addresses which must stay valid until the
+ * tx_done handler is called for it.
+ */
+
+#define pr_fmt(fmt) "virtio-net: " fmt
+
+#include <lego/mm.h>
+#include <lego/pci.h>
+#include <lego/irq.h>
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/kthread.h>
+#include <lego/spinlock.h>
+#include <lego/irqdesc.h>
+#include <lego/virtio.h>
+#include <asm/io.h>
+
+#include <net/virtio_net.h>
+
+#define VIRTIO_PCI_NET_DEVICE_ID	0x1000
+
+#define VIRTIO_NET_F_MAC		5
+#define VIRTIO_NET_F_CTRL_VQ		17
+#define VIRTIO_NET_F_MQ			22
+
+/* Offsets into the net device config */
+#define VIRTIO_NET_CFG_MAC		0
+#define VIRTIO_NET_CFG_MAX_PAIRS	8
+
+#define VIRTIO_NET_CTRL_MQ		4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
+#define VIRTIO_NET_OK			0
+
+#define VIRTNET_MAX_QUEUES		CONFIG_VIRTIO_NET_MAX_QUEUES
+#define VIRTNET_MAX_SG			16
+#define VIRTNET_RX_BUDGET		64
+
+/* Frame data starts here in an RX page, after the device header */
+#define VIRTNET_RX_DATA_OFF		(VIRTNET_RX_HEADROOM + 16)
+
+/* Without VIRTIO_NET_F_MRG_RXBUF */
+struct virtio_net_hdr {
+	u8	flags;
+	u8	gso_type;
+	u16	hdr_len;
+	u16	gso_size;
+	u16	csum_start;
+	u16	csum_offset;
+};
+
+struct virtio_net_ctrl {
+	u8	class;
+	u8	cmd;
+	u16	pairs;
+	u8	ack;
+} __packed;
+
+struct virtnet;
+
+struct virtnet_rq {
+	struct virtqueue	vq;
+	struct virtnet		*vi;
+	int			qid;
+	struct task_struct	*task;
+	unsigned long		packets;
+	unsigned long		polls;
+};
+
+struct virtnet_sq {
+	struct virtqueue	vq;
+	spinlock_t		lock;
+	struct virtio_net_hdr	*hdrs;		/* one per head descriptor */
+	unsigned long		packets;
+	unsigned long		busy;
+};
+
+struct virtnet {
+	struct pci_dev		*pdev;
+	unsigned long		ioaddr;
+	u32			features;
+	bool			msix;
+	bool			event_idx;
+	u8			mac[6];
+	int			nr_pairs;
+
+	struct virtnet_rq	rq[VIRTNET_MAX_QUEUES];
+	struct virtnet_sq	sq[VIRTNET_MAX_QUEUES];
+	struct virtqueue	cvq;
+	bool			has_cvq;
+	struct msix_entry	msix_entries[VIRTNET_MAX_QUEUES];
+
+	virtnet_rx_fn		rx;
+	void			*rx_arg;
+	virtnet_tx_done_fn	tx_done;
+};
+
+static struct virtnet *virtnet_dev;
+
+static inline bool virtnet_has_feature(struct virtnet *vi, unsigned int bit)
+{
+	return vi->features & (1U << bit);
+}
+
+/*
+ * RX
+ */
+
+static int virtnet_add_rx_buf(struct virtqueue *vq)
+{
+	struct virtio_sg sg[2];
+	unsigned long page;
+	int ret;
+
+	page = __get_free_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	sg[0].addr = (void *)page + VIRTNET_RX_HEADROOM;
+	sg[0].len = sizeof(struct virtio_net_hdr);
+	sg[1].addr = (void *)page + VIRTNET_RX_DATA_OFF;
+	sg[1].len = PAGE_SIZE - VIRTNET_RX_DATA_OFF;
+
+	ret = virtqueue_add(vq, sg, 0, 2, (void *)page);
+	if (ret)
+		free_page(page);
+	return ret;
+}
+
+/* Fill all free slots, kick once */
+static void virtnet_refill_rx(struct virtnet_rq *rq)
+{
+	struct virtqueue *vq = &rq->vq;
+
+	while (vq->num_free >= 2) {
+		if (virtnet_add_rx_buf(vq))
+			break;
+	}
+	virtqueue_kick(vq);
+}
+
+static int virtnet_poll_rx(struct virtnet *vi, struct virtnet_rq *rq, int budget)
+{
+	unsigned int len;
+	void *page;
+	int done;
+
+	for (done = 0; done < budget; done++) {
+		page = virtqueue_get_buf(&rq->vq, &len);
+		if (!page)
+			break;
+
+		if (unlikely(len <= sizeof(struct virtio_net_hdr) || !vi->rx)) {
+			free_page((unsigned long)page);
+			continue;
+		}
+
+		vi->rx(vi->rx_arg, rq->qid, page, page + VIRTNET_RX_DATA_OFF,
+		       len - sizeof(struct virtio_net_hdr));
+		rq->packets++;
+	}
+	rq->polls++;
+	return done;
+}
+
+static void virtnet_reclaim_tx(struct virtnet *vi, struct virtnet_sq *sq);
+
+/*
+ * Ask for an interrupt on the next TX completion, frames may be queued
+ * by virtnet_xmit() while we sleep. Return false if some completed
+ * meanwhile, the caller polls again.
+ */
+static bool virtnet_enable_tx_cb(struct virtnet_sq *sq)
+{
+	bool idle;
+
+	spin_lock(&sq->lock);
+	idle = virtqueue_enable_cb(&sq->vq);
+	spin_unlock(&sq->lock);
+	return idle;
+}
+
+static int virtnet_rx_thread(void *_rq)
+{
+	struct virtnet_rq *rq = _rq;
+	struct virtnet *vi = rq->vi;
+	struct virtnet_sq *sq = &vi->sq[rq->qid];
+	int done;
+
+	while (!kthread_should_stop()) {
+		spin_lock(&sq->lock);
+		virtnet_reclaim_tx(vi, sq);
+		spin_unlock(&sq->lock);
+
+		done = virtnet_poll_rx(vi, rq, VIRTNET_RX_BUDGET);
+		virtnet_refill_rx(rq);
+
+		if (done == VIRTNET_RX_BUDGET) {
+			/* More to do, stay in polling mode */
+			cond_resched();
+			continue;
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (virtqueue_enable_cb(&rq->vq) && virtnet_enable_tx_cb(sq))
+			schedule();
+		__set_current_state(TASK_RUNNING);
+		virtqueue_disable_cb(&rq->vq);
+		virtqueue_disable_cb(&sq->vq);
+	}
+	return 0;
+}
+
+static irqreturn_t virtnet_pair_interrupt(int irq, void *_rq)
+{
+	struct virtnet_rq *rq = _rq;
+
+	virtqueue_disable_cb(&rq->vq);
+	virtqueue_disable_cb(&rq->vi->sq[rq->qid].vq);
+	wake_up_process(rq->task);
+	return IRQ_HANDLED;
+}
+
+/* Shared INTx, reading ISR acks it */
+static irqreturn_t virtnet_intx_interrupt(int irq, void *_vi)
+{
+	struct virtnet *vi = _vi;
+	int i;
+
+	if (!inb(vi->ioaddr + VIRTIO_PCI_ISR))
+		return IRQ_NONE;
+
+	for (i = 0; i < vi->nr_pairs; i++)
+		virtnet_pair_interrupt(irq, &vi->rq[i]);
+	return IRQ_HANDLED;
+}
+
+void virtnet_free_rx_buf(void *page)
+{
+	free_page((unsigned long)page);
+}
+
+/*
+ * TX
+ */
+
+static void virtnet_reclaim_tx(struct virtnet *vi, struct virtnet_sq *sq)
+{
+	void *token;
+
+	while ((token = virtqueue_get_buf(&sq->vq, NULL)) != NULL) {
+		if (vi->tx_done)
+			vi->tx_done(token);
+	}
+}
+
+/**
+ * virtnet_xmit - send one frame
+ * @qid: TX queue to use, any number, folded onto the active queues
+ * @sg: pieces of the frame
+ * @nr_sg: number of pieces, at most VIRTNET_MAX_SG
+ * @token: passed to tx_done once the device is done with @sg
+ *
+ * tx_done of earlier frames is called from here or from the poll thread
+ * of the pair, with the queue lock held.
+ * Return 0 if queued, -EBUSY if the queue is full.
+ */
+int virtnet_xmit(int qid, struct virtio_sg *sg, int nr_sg, void *token)
+{
+	struct virtnet *vi = virtnet_dev;
+	struct virtio_sg vsg[VIRTNET_MAX_SG + 1];
+	struct virtio_net_hdr *hdr;
+	struct virtnet_sq *sq;
+	int ret;
+
+	if (unlikely(!vi))
+		return -ENODEV;
+	if (unlikely(nr_sg < 1 || nr_sg > VIRTNET_MAX_SG))
+		return -EINVAL;
+
+	sq = &vi->sq[qid % vi->nr_pairs];
+	spin_lock(&sq->lock);
+
+	virtnet_reclaim_tx(vi, sq);
+
+	if (sq->vq.num_free < nr_sg + 1) {
+		sq->busy++;
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	/* The header slot is owned by the head descriptor */
+	hdr = &sq->hdrs[sq->vq.free_head];
+	memset(hdr, 0, sizeof(*hdr));
+	vsg[0].addr = hdr;
+	vsg[0].len = sizeof(*hdr);
+	memcpy(&vsg[1], sg, nr_sg * sizeof(*sg));
+
+	ret = virtqueue_add(&sq->vq, vsg, nr_sg + 1, 0, token);
+	if (!ret) {
+		virtqueue_kick(&sq->vq);
+		sq->packets++;
+	}
+
+unlock:
+	spin_unlock(&sq->lock);
+	return ret;
+}
+
+/*
+ * Setup
+ */
+
+bool virtnet_present(void)
+{
+	return virtnet_dev != NULL;
+}
+
+void virtnet_get_mac(u8 *mac)
+{
+	memcpy(mac, virtnet_dev->mac, sizeof(virtnet_dev->mac));
+}
+
+int virtnet_nr_queues(void)
+{
+	return virtnet_dev ? virtnet_dev->nr_pairs : 0;
+}
+
+/*
+ * Set the handlers before traffic is expected. Frames received
+ * without an rx handler are dropped.
+ */
+void virtnet_set_handlers(virtnet_rx_fn rx, void *rx_arg,
+			  virtnet_tx_done_fn tx_done)
+{
+	struct virtnet *vi = virtnet_dev;
+
+	vi->rx_arg = rx_arg;
+	vi->tx_done = tx_done;
+	smp_wmb();
+	vi->rx = rx;
+}
+
+static void virtnet_read_config(struct virtnet *vi, int *max_pairs)
+{
+	unsigned long cfg = vi->ioaddr + VIRTIO_PCI_CONFIG(vi->msix);
+	int i;
+
+	if (virtnet_has_feature(vi, VIRTIO_NET_F_MAC)) {
+		for (i = 0; i < 6; i++)
+			vi->mac[i] = inb(cfg + VIRTIO_NET_CFG_MAC + i);
+	} else {
+		/* QEMU's default */
+		static const u8 mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+		memcpy(vi->mac, mac, 6);
+	}
+
+	*max_pairs = 1;
+	if (virtnet_has_feature(vi, VIRTIO_NET_F_MQ))
+		*max_pairs = inw(cfg + VIRTIO_NET_CFG_MAX_PAIRS);
+}
+
+/* Tell the device how many queue pairs we use, wait for the ack */
+static int virtnet_set_queues(struct virtnet *vi)
+{
+	struct virtio_net_ctrl *ctrl;
+	struct virtio_sg sg[3];
+	unsigned long timeout = 1000000;
+	int ret;
+
+	if (vi->nr_pairs == 1)
+		return 0;
+
+	ctrl = kmalloc(sizeof(*ctrl), GFP_KERNEL);
+	if (!ctrl)
+		return -ENOMEM;
+
+	ctrl->class = VIRTIO_NET_CTRL_MQ;
+	ctrl->cmd = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+	ctrl->pairs = vi->nr_pairs;
+	ctrl->ack = ~VIRTIO_NET_OK;
+
+	sg[0].addr = &ctrl->class;
+	sg[0].len = 2;
+	sg[1].addr = &ctrl->pairs;
+	sg[1].len = sizeof(ctrl->pairs);
+	sg[2].addr = &ctrl->ack;
+	sg[2].len = sizeof(ctrl->ack);
+
+	ret = virtqueue_add(&vi->cvq, sg, 2, 1, ctrl);
+	if (ret)
+		goto out;
+	virtqueue_kick(&vi->cvq);
+
+	while (!virtqueue_get_buf(&vi->cvq, NULL) && --timeout)
+		cpu_relax();
+
+	if (!timeout || ctrl->ack != VIRTIO_NET_OK)
+		ret = -EIO;
+out:
+	kfree(ctrl);
+	return ret;
+}
+
+/* One vector per queue pair, or a shared INTx line if that fails */
+static void virtnet_enable_msix(struct virtnet *vi)
+{
+	int i, ret;
+
+	for (i = 0; i < vi->nr_pairs; i++)
+		vi->msix_entries[i].entry = i;
+
+	ret = pci_enable_msix_range(vi->pdev, vi->msix_entries,
+				    vi->nr_pairs, vi->nr_pairs);
+	if (ret < 0) {
+		pr_info("MSI-X unavailable (%d), using INTx\n", ret);
+		vi->msix = false;
+		return;
+	}
+	vi->msix = true;
+
+	outw(VIRTIO_MSI_NO_VECTOR, vi->ioaddr + VIRTIO_MSI_CONFIG_VECTOR);
+}
+
+/* Bind queue @index to MSI-X @vector, after the queue is set up */
+static int virtnet_bind_vector(struct virtnet *vi, unsigned int index, u16 vector)
+{
+	if (!vi->msix)
+		return 0;
+
+	outw(index, vi->ioaddr + VIRTIO_PCI_QUEUE_SEL);
+	outw(vector, vi->ioaddr + VIRTIO_MSI_QUEUE_VECTOR);
+	if (inw(vi->ioaddr + VIRTIO_MSI_QUEUE_VECTOR) != vector)
+		return -EBUSY;
+	return 0;
+}
+
+static int virtnet_setup_vqs(struct virtnet *vi, int max_pairs)
+{
+	int i, ret;
+
+	for (i = 0; i < vi->nr_pairs; i++) {
+		struct virtnet_rq *rq = &vi->rq[i];
+		struct virtnet_sq *sq = &vi->sq[i];
+
+		rq->vi = vi;
+		rq->qid = i;
+		ret = virtqueue_setup(&rq->vq, vi->ioaddr, 2 * i, vi->event_idx);
+		if (ret)
+			return ret;
+		ret = virtnet_bind_vector(vi, 2 * i, i);
+		if (ret)
+			return ret;
+		virtqueue_disable_cb(&rq->vq);
+
+		ret = virtqueue_setup(&sq->vq, vi->ioaddr, 2 * i + 1, vi->event_idx);
+		if (ret)
+			return ret;
+		ret = virtnet_bind_vector(vi, 2 * i + 1, i);
+		if (ret)
+			return ret;
+		virtqueue_disable_cb(&sq->vq);
+
+		spin_lock_init(&sq->lock);
+		sq->hdrs = kcalloc(sq->vq.num, sizeof(*sq->hdrs), GFP_KERNEL);
+		if (!sq->hdrs)
+			return -ENOMEM;
+	}
+
+	if (vi->has_cvq) {
+		ret = virtqueue_setup(&vi->cvq, vi->ioaddr, 2 * max_pairs, vi->event_idx);
+		if (ret)
+			return ret;
+		ret = virtnet_bind_vector(vi, 2 * max_pairs, VIRTIO_MSI_NO_VECTOR);
+		if (ret)
+			return ret;
+		virtqueue_disable_cb(&vi->cvq);
+	}
+	return 0;
+}
+
+static void virtnet_free_vqs(struct virtnet *vi)
+{
+	int i;
+
+	for (i = 0; i < vi->nr_pairs; i++) {
+		virtqueue_free(&vi->rq[i].vq);
+		virtqueue_free(&vi->sq[i].vq);
+		kfree(vi->sq[i].hdrs);
+	}
+	virtqueue_free(&vi->cvq);
+}
+
+/* Fill the RX rings, start the poll threads, then open the interrupts */
+static int virtnet_start_rx(struct virtnet *vi)
+{
+	int i, ret;
+
+	for (i = 0; i < vi->nr_pairs; i++) {
+		struct virtnet_rq *rq = &vi->rq[i];
+
+		virtnet_refill_rx(rq);
+
+		rq->task = kthread_run(virtnet_rx_thread, rq, "virtnet-rx/%d", i);
+		if (IS_ERR(rq->task))
+			return PTR_ERR(rq->task);
+
+		if (!vi->msix)
+			continue;
+
+		ret = request_irq(vi->msix_entries[i].vector, virtnet_pair_interrupt,
+				  0, "virtio-net", rq);
+		if (ret)
+			return ret;
+	}
+
+	if (!vi->msix)
+		return request_irq(vi->pdev->irq, virtnet_intx_interrupt,
+				   IRQF_SHARED, "virtio-net", vi);
+	return 0;
+}
+
+static int virtnet_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct virtnet *vi;
+	u32 host_features;
+	int max_pairs, ret;
+
+	if (!(pci_resource_flags(pdev, 0) & IORESOURCE_IO)) {
+		pr_err("BAR0 is not I/O, modern-only device?\n");
+		return -ENODEV;
+	}
+
+	ret = pci_enable_device(pdev);
+	if (ret)
+		return ret;
+	pci_set_master(pdev);
+
+	vi = kzalloc(sizeof(*vi), GFP_KERNEL);
+	if (!vi)
+		return -ENOMEM;
+	vi->pdev = pdev;
+	vi->ioaddr = pci_resource_start(pdev, 0);
+
+	virtio_reset(vi->ioaddr);
+
+	host_features = inl(vi->ioaddr + VIRTIO_PCI_HOST_FEATURES);
+	vi->features = host_features & ((1U << VIRTIO_NET_F_MAC) |
+					(1U << VIRTIO_NET_F_CTRL_VQ) |
+					(1U << VIRTIO_NET_F_MQ) |
+					(1U << VIRTIO_RING_F_EVENT_IDX));
+	if (!virtnet_has_feature(vi, VIRTIO_NET_F_CTRL_VQ))
+		vi->features &= ~(1U << VIRTIO_NET_F_MQ);
+	outl(vi->features, vi->ioaddr + VIRTIO_PCI_GUEST_FEATURES);
+
+	vi->event_idx = virtnet_has_feature(vi, VIRTIO_RING_F_EVENT_IDX);
+	vi->has_cvq = virtnet_has_feature(vi, VIRTIO_NET_F_CTRL_VQ);
+
+	/* Config is at its MSI-X-less offset until MSI-X is on */
+	virtnet_read_config(vi, &max_pairs);
+	vi->nr_pairs = min_t(int, max_pairs, VIRTNET_MAX_QUEUES);
+	vi->nr_pairs = min_t(int, vi->nr_pairs, num_online_cpus());
+	vi->nr_pairs = max(vi->nr_pairs, 1);
+
+	virtnet_enable_msix(vi);
+
+	ret = virtnet_setup_vqs(vi, max_pairs);
+	if (ret)
+		goto fail;
+
+	virtio_set_status(vi->ioaddr, VIRTIO_CONFIG_S_DRIVER_OK);
+
+	ret = virtnet_set_queues(vi);
+	if (ret) {
+		pr_warn("failed to set %d queue pairs (%d), using 1\n",
+			vi->nr_pairs, ret);
+		vi->nr_pairs = 1;
+	}
+
+	virtnet_dev = vi;
+	pci_set_drvdata(pdev, vi);
+
+	ret = virtnet_start_rx(vi);
+	if (ret) {
+		/* Threads and vectors cannot be taken back, leave it up */
+		pr_err("failed to start RX (%d)\n", ret);
+		return ret;
+	}
+
+	pr_info("%pM, %d queue pairs, %s%s\n", vi->mac, vi->nr_pairs,
+		vi->msix ? "MSI-X" : "INTx", vi->event_idx ? ", event idx" : "");
+	return 0;
+
+fail:
+	virtnet_free_vqs(vi);
+	virtio_set_status(vi->ioaddr, VIRTIO_CONFIG_S_FAILED);
+	kfree(vi);
+	return ret;
+}
+
+static const struct pci_device_id virtnet_pci_tbl[] = {
+	{ PCI_DEVICE(VIRTIO_PCI_VENDOR_ID, VIRTIO_PCI_NET_DEVICE_ID) },
+	{ 0, }
+};
+
+static struct pci_driver virtnet_driver = {
+	.name		= "virtio-net",
+	.id_table	= virtnet_pci_tbl,
+	.probe		= virtnet_probe,
+};
+
+int __init virtnet_init(void)
+{
+	return pci_register_driver(&virtnet_driver);
+}
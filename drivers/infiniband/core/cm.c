@@ -3750,10 +3750,8 @@ int ib_cm_init(void)
 
 #ifdef CONFIG_WORK_QUEUE
 	cm.wq = create_workqueue("ib_cm");
-	if (!cm.wq) {
-		ret = -ENOMEM;
-		goto error1;
-	}
+	if (!cm.wq)
+		return -ENOMEM;
 #endif
 
 	ret = ib_register_client(&cm_client);
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Split virtqueues of the legacy virtio PCI interface
+ *
+ * A virtqueue is not locked here, callers serialize adds and gets on
+ * the same queue. With VIRTIO_RING_F_EVENT_IDX the device interrupts
+ * once per unmask, and kicks are skipped while the device is still
+ * working on the ring.
+ */
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/virtio.h>
+#include <asm/io.h>
+
+static inline u16 *vring_used_event(struct virtqueue *vq)
+{
+	return &vq->avail->ring[vq->num];
+}
+
+static inline u16 *vring_avail_event(struct virtqueue *vq)
+{
+	return (u16 *)&vq->used->ring[vq->num];
+}
+
+/* Has the index moved past @event_idx with this update? */
+static inline bool vring_need_event(u16 event_idx, u16 new_idx, u16 old)
+{
+	return (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old);
+}
+
+static unsigned long vring_size(unsigned int num)
+{
+	return ALIGN(sizeof(struct vring_desc) * num + sizeof(u16) * (3 + num),
+		     VIRTIO_PCI_VRING_ALIGN) +
+	       ALIGN(sizeof(u16) * 3 + sizeof(struct vring_used_elem) * num,
+		     VIRTIO_PCI_VRING_ALIGN);
+}
+
+/**
+ * virtqueue_setup - allocate virtqueue @index and hand it to the device
+ * @vq: the queue
+ * @ioaddr: I/O BAR of the device
+ * @index: queue index of the device
+ * @event_idx: VIRTIO_RING_F_EVENT_IDX was negotiated
+ */
+int virtqueue_setup(struct virtqueue *vq, unsigned long ioaddr,
+		    unsigned int index, bool event_idx)
+{
+	unsigned int num, i;
+	unsigned long size;
+
+	outw(index, ioaddr + VIRTIO_PCI_QUEUE_SEL);
+	num = inw(ioaddr + VIRTIO_PCI_QUEUE_NUM);
+	if (!num || (num & (num - 1)))
+		return -ENOENT;
+	if (inl(ioaddr + VIRTIO_PCI_QUEUE_PFN))
+		return -EBUSY;
+
+	size = vring_size(num);
+	vq->ring_order = get_order(size);
+	vq->ring = __get_free_pages(GFP_KERNEL | __GFP_ZERO, vq->ring_order);
+	if (!vq->ring)
+		return -ENOMEM;
+
+	vq->data = kcalloc(num, sizeof(*vq->data), GFP_KERNEL);
+	if (!vq->data) {
+		free_pages(vq->ring, vq->ring_order);
+		vq->ring = 0;
+		return -ENOMEM;
+	}
+
+	vq->ioaddr = ioaddr;
+	vq->event_idx = event_idx;
+	vq->index = index;
+	vq->num = num;
+	vq->desc = (struct vring_desc *)vq->ring;
+	vq->avail = (void *)vq->desc + num * sizeof(struct vring_desc);
+	vq->used = (void *)ALIGN((unsigned long)&vq->avail->ring[num + 1],
+				 VIRTIO_PCI_VRING_ALIGN);
+
+	vq->free_head = 0;
+	vq->num_free = num;
+	for (i = 0; i < num - 1; i++)
+		vq->desc[i].next = i + 1;
+
+	outl(__pa(vq->ring) >> VIRTIO_PCI_QUEUE_ADDR_SHIFT,
+	     ioaddr + VIRTIO_PCI_QUEUE_PFN);
+	return 0;
+}
+
+void virtqueue_free(struct virtqueue *vq)
+{
+	if (!vq->ring)
+		return;
+
+	outw(vq->index, vq->ioaddr + VIRTIO_PCI_QUEUE_SEL);
+	outl(0, vq->ioaddr + VIRTIO_PCI_QUEUE_PFN);
+	free_pages(vq->ring, vq->ring_order);
+	kfree(vq->data);
+	vq->ring = 0;
+}
+
+/*
+ * Chain @out device-readable and @in device-writable pieces of @sg
+ * into the ring. The device does not see them before virtqueue_kick().
+ */
+int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sg,
+		  int out, int in, void *data)
+{
+	u16 head, idx, prev = 0;
+	int i;
+
+	if (vq->num_free < out + in)
+		return -ENOSPC;
+
+	head = idx = vq->free_head;
+	for (i = 0; i < out + in; i++) {
+		struct vring_desc *desc = &vq->desc[idx];
+
+		desc->addr = __pa(sg[i].addr);
+		desc->len = sg[i].len;
+		desc->flags = VRING_DESC_F_NEXT;
+		if (i >= out)
+			desc->flags |= VRING_DESC_F_WRITE;
+		prev = idx;
+		idx = desc->next;
+	}
+	vq->desc[prev].flags &= ~VRING_DESC_F_NEXT;
+
+	vq->free_head = idx;
+	vq->num_free -= out + in;
+	vq->data[head] = data;
+
+	vq->avail->ring[vq->avail_idx & (vq->num - 1)] = head;
+	vq->avail_idx++;
+	vq->num_added++;
+
+	/* Descriptors and ring entry before the index */
+	wmb();
+	vq->avail->idx = vq->avail_idx;
+	return 0;
+}
+
+void virtqueue_kick(struct virtqueue *vq)
+{
+	u16 new, old;
+	bool needs;
+
+	if (!vq->num_added)
+		return;
+
+	/* Publish avail->idx before reading the suppression fields */
+	mb();
+	new = vq->avail_idx;
+	old = new - vq->num_added;
+	vq->num_added = 0;
+
+	if (vq->event_idx)
+		needs = vring_need_event(READ_ONCE(*vring_avail_event(vq)), new, old);
+	else
+		needs = !(READ_ONCE(vq->used->flags) & VRING_USED_F_NO_NOTIFY);
+
+	if (needs)
+		outw(vq->index, vq->ioaddr + VIRTIO_PCI_QUEUE_NOTIFY);
+}
+
+/* Detach the next completed chain, return its token */
+void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
+{
+	struct vring_used_elem *elem;
+	void *data;
+	u16 id, i;
+
+	if (!virtqueue_more_used(vq))
+		return NULL;
+
+	/* Read the used entry only after seeing the index */
+	rmb();
+	elem = &vq->used->ring[vq->last_used_idx & (vq->num - 1)];
+	id = elem->id;
+	if (len)
+		*len = elem->len;
+	vq->last_used_idx++;
+
+	data = vq->data[id];
+	vq->data[id] = NULL;
+
+	i = id;
+	vq->num_free++;
+	while (vq->desc[i].flags & VRING_DESC_F_NEXT) {
+		i = vq->desc[i].next;
+		vq->num_free++;
+	}
+	vq->desc[i].next = vq->free_head;
+	vq->free_head = id;
+
+	return data;
+}
+
+void virtqueue_disable_cb(struct virtqueue *vq)
+{
+	if (vq->event_idx)
+		*vring_used_event(vq) = vq->last_used_idx - 1;
+	else
+		vq->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+/*
+ * Ask for an interrupt on the next used buffer.
+ * Return false if buffers came in meanwhile, the caller polls again.
+ */
+bool virtqueue_enable_cb(struct virtqueue *vq)
+{
+	if (vq->event_idx)
+		*vring_used_event(vq) = vq->last_used_idx;
+	else
+		vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+
+	/* Publish it before checking the used index again */
+	mb();
+	return !virtqueue_more_used(vq);
+}
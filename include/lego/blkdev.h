@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Block devices
+ *
+ * There is no request queue or elevator. A device has a number of
+ * hardware queues, callers pick one by @qid (folded onto what the
+ * device has) and use it as an async interface: queue any number of
+ * requests by blk_submit(), notify the device once by blk_kick(), and
+ * reap completions by blk_poll(). Devices never interrupt, a request
+ * completes only from blk_poll() on its queue, which calls ->end_io.
+ *
+ * Queues are locked by the driver, so sharing one is fine, but the
+ * best is to have one queue per thread doing I/O.
+ */
+
+#ifndef _LEGO_BLKDEV_H_
+#define _LEGO_BLKDEV_H_
+
+#include <lego/types.h>
+#include <lego/errno.h>
+
+#define SECTOR_SHIFT		9
+#define SECTOR_SIZE		(1 << SECTOR_SHIFT)
+
+enum blk_op {
+	BLK_OP_READ,
+	BLK_OP_WRITE,
+	BLK_OP_FLUSH,
+};
+
+struct blk_request;
+typedef void (*blk_end_io_fn)(struct blk_request *req);
+
+struct blk_request {
+	enum blk_op		op;
+	u64			sector;
+	void			*buf;		/* physically contiguous */
+	unsigned int		len;		/* in bytes */
+	int			error;
+	blk_end_io_fn		end_io;
+	void			*private;
+};
+
+struct block_device;
+
+struct block_device_ops {
+	/* Return 0 if queued, -EBUSY if the queue is full */
+	int (*submit)(struct block_device *bdev, int qid, struct blk_request *req);
+	void (*kick)(struct block_device *bdev, int qid);
+	/* Complete finished requests, return how many */
+	int (*poll)(struct block_device *bdev, int qid);
+};
+
+struct block_device {
+	const char			*name;
+	u64				nr_sectors;
+	unsigned int			nr_queues;
+	unsigned int			queue_depth;
+	unsigned int			max_len;	/* per request, in bytes */
+	const struct block_device_ops	*ops;
+	void				*private;
+};
+
+static inline int blk_submit(struct block_device *bdev, int qid,
+			     struct blk_request *req)
+{
+	return bdev->ops->submit(bdev, qid, req);
+}
+
+static inline void blk_kick(struct block_device *bdev, int qid)
+{
+	bdev->ops->kick(bdev, qid);
+}
+
+static inline int blk_poll(struct block_device *bdev, int qid)
+{
+	return bdev->ops->poll(bdev, qid);
+}
+
+#ifdef CONFIG_BLK_DEV
+int blk_register_device(struct block_device *bdev);
+struct block_device *blk_get_device(void);
+int blk_submit_wait(struct block_device *bdev, int qid, struct blk_request *req);
+int blk_rw(struct block_device *bdev, int qid, enum blk_op op,
+	   u64 sector, void *buf, unsigned int len);
+#else
+static inline struct block_device *blk_get_device(void) { return NULL; }
+#endif
+
+#ifdef CONFIG_VIRTIO_BLK
+int virtblk_init(void);
+#else
+static inline int virtblk_init(void) { return 0; }
+#endif
+
+#ifdef CONFIG_NVME
+int nvme_init(void);
+#else
+static inline int nvme_init(void) { return 0; }
+#endif
+
+#endif /* _LEGO_BLKDEV_H_ */
@@ -169,6 +169,7 @@ static inline bool clockevent_state_oneshot_stopped(struct clock_event_device *d
 /* Clock event layer functions */
 u64 clockevent_delta2ns(unsigned long latch, struct clock_event_device *evt);
 void clockevents_register_device(struct clock_event_device *dev);
+void clockevents_config(struct clock_event_device *dev, u32 freq);
 
 void clockevents_config_and_register(struct clock_event_device *dev,
 				    u32 freq, unsigned long min_delta,
@@ -32,6 +32,13 @@ void __init manager_init(void);
 int pin_current_thread(void);
 void pin_registered_threads(void);
 
+#ifdef CONFIG_FILE_STRIPE_NODES
+/* From stripe_nodes=, see managers/lib/stripe_nodes.c */
+#define MAX_STRIPE_NODES	8
+extern int stripe_nodes[MAX_STRIPE_NODES];
+extern int nr_stripe_nodes;
+#endif
+
 #ifdef CONFIG_SOFT_WATCHDOG
 void __init soft_watchdog_init(void);
 #else
@@ -25,4 +25,10 @@
 
 #define PREFETCH_ORDER 7 /* prefetching 128 pages a time */
 
+#ifdef CONFIG_COMP_STORAGE
+void __init storage_manager_init(void);
+#else
+static inline void storage_manager_init(void) { }
+#endif
+
 #endif
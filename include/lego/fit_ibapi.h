@@ -13,6 +13,7 @@
 #include <lego/types.h>
 #include <lego/errno.h>
 #include <lego/atomic.h>
+#include <lego/slab.h>
 #include <net/arch/cc.h>
 
 #include <uapi/fit.h>
@@ -85,7 +86,7 @@ struct fit_sglist {
 void ibapi_free_recv_buf(void *input_buf);
 
 /* IMM related */
-#ifdef CONFIG_COMP_MEMORY
+#if defined(CONFIG_COMP_MEMORY) || defined(CONFIG_COMP_STORAGE)
 inline int ibapi_reply_message(void *addr, int size, uintptr_t descriptor);
 #endif
 
@@ -116,6 +117,13 @@ int ibapi_multicast_send_reply_timeout(int num_nodes, int *target_node,
 int ibapi_get_node_id(void);
 int ibapi_num_connected_nodes(void);
 
+#ifdef CONFIG_FIT_ONESIDED_READ
+int ibapi_rdma_read(int target_node, void *local_addr, u64 remote_addr,
+		    u32 rkey, int size);
+u32 ibapi_get_local_rkey(void);
+u64 ibapi_get_dma_addr(void *addr, int size);
+#endif
+
 #ifdef CONFIG_SOCKET_O_IB
 
 int ibapi_sock_send_message(int target_node, int dest_port, int if_internal_port, void *buf, int size, unsigned long timeout_sec, int if_userspace); 
@@ -172,4 +180,25 @@ static inline int ibapi_sock_send_message(int target_node, int port, int if_inte
 static inline int ibapi_sock_receive_message(int *target_node, int port, uintptr_t *ret_addr, int ret_size, int if_userspace, int sock_type) {return 0; };
 #endif /* CONFIG_FIT*/
 
+#ifdef CONFIG_FIT_MR_CACHE
+int ibapi_register_dma_region(void *addr, size_t len);
+void *ibapi_alloc_dma_buf(size_t size);
+void ibapi_free_dma_buf(void *buf, size_t size);
+#else
+static inline int ibapi_register_dma_region(void *addr, size_t len)
+{
+	return 0;
+}
+
+static inline void *ibapi_alloc_dma_buf(size_t size)
+{
+	return kmalloc(size, GFP_KERNEL);
+}
+
+static inline void ibapi_free_dma_buf(void *buf, size_t size)
+{
+	kfree(buf);
+}
+#endif
+
 #endif /* _INCLUDE_FIT_API_H */
@@ -202,6 +202,14 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline int __init futex_init(void) { return 0; }
 #endif /* CONFIG_FUTEX */
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+void futex_mm_init(struct mm_struct *mm);
+void futex_mm_exit(struct mm_struct *mm);
+#else
+static inline void futex_mm_init(struct mm_struct *mm) { }
+static inline void futex_mm_exit(struct mm_struct *mm) { }
+#endif
+
 /* Well... */
 #include <asm/futex.h>
 
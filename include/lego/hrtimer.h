@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_HRTIMER_H_
+#define _LEGO_HRTIMER_H_
+
+#include <lego/time.h>
+#include <lego/ktime.h>
+#include <lego/rbtree.h>
+#include <lego/percpu.h>
+#include <lego/spinlock.h>
+#include <lego/timekeeping.h>
+
+struct hrtimer_cpu_base;
+struct clock_event_device;
+
+/*
+ * Mode arguments of hrtimer_start()
+ */
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,	/* Time value is absolute */
+	HRTIMER_MODE_REL,	/* Time value is relative to now */
+};
+
+/*
+ * Return values for the callback function
+ */
+enum hrtimer_restart {
+	HRTIMER_NORESTART,	/* Timer is not restarted */
+	HRTIMER_RESTART,	/* Timer must be restarted */
+};
+
+#define HRTIMER_STATE_INACTIVE	0x00
+#define HRTIMER_STATE_ENQUEUED	0x01
+
+/**
+ * struct hrtimer - the basic hrtimer structure
+ * @node:	rbtree node, sorted by @expires
+ * @expires:	absolute expiry time, always in CLOCK_MONOTONIC
+ * @function:	timer expiry callback function, called with irq disabled
+ * @base:	pointer to the per-cpu base the timer belongs to
+ * @clockid:	CLOCK_MONOTONIC or CLOCK_REALTIME, used by absolute start
+ * @state:	HRTIMER_STATE_*
+ */
+struct hrtimer {
+	struct rb_node			node;
+	ktime_t				expires;
+	enum hrtimer_restart		(*function)(struct hrtimer *);
+	struct hrtimer_cpu_base		*base;
+	clockid_t			clockid;
+	u8				state;
+};
+
+/**
+ * struct hrtimer_sleeper - simple sleeper structure
+ * @timer:	embedded timer structure
+ * @task:	task to wake up, cleared on expiry
+ */
+struct hrtimer_sleeper {
+	struct hrtimer			timer;
+	struct task_struct		*task;
+};
+
+/**
+ * struct hrtimer_cpu_base - the per cpu hrtimer queue
+ * @lock:		protects this base and all its timers
+ * @cpu:		cpu number
+ * @hres_active:	the local clockevent is in one-shot mode
+ * @in_hrtirq:		hrtimer_interrupt() is running
+ * @expires_next:	absolute time the clockevent is programmed for
+ * @running:		timer whose callback is running now
+ * @active:		queued timers
+ * @nr_events:		number of hrtimer interrupts
+ */
+struct hrtimer_cpu_base {
+	spinlock_t			lock;
+	unsigned int			cpu;
+	bool				hres_active;
+	bool				in_hrtirq;
+	ktime_t				expires_next;
+	struct hrtimer			*running;
+	struct rb_root			active;
+	unsigned long			nr_events;
+} ____cacheline_aligned;
+
+DECLARE_PER_CPU(struct hrtimer_cpu_base, hrtimer_bases);
+
+static inline void hrtimer_set_expires(struct hrtimer *timer, ktime_t time)
+{
+	timer->expires = time;
+}
+
+static inline ktime_t hrtimer_get_expires(const struct hrtimer *timer)
+{
+	return timer->expires;
+}
+
+static inline bool hrtimer_is_queued(struct hrtimer *timer)
+{
+	return timer->state & HRTIMER_STATE_ENQUEUED;
+}
+
+void hrtimer_init(struct hrtimer *timer, clockid_t which_clock,
+		  enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim,
+		   const enum hrtimer_mode mode);
+int hrtimer_try_to_cancel(struct hrtimer *timer);
+int hrtimer_cancel(struct hrtimer *timer);
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval);
+
+/*
+ * Restart at the stored expiry, which is already CLOCK_MONOTONIC.
+ * Only meant for CLOCK_MONOTONIC timers.
+ */
+static inline void hrtimer_start_expires(struct hrtimer *timer,
+					 enum hrtimer_mode mode)
+{
+	hrtimer_start(timer, hrtimer_get_expires(timer), mode);
+}
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer,
+				      ktime_t interval)
+{
+	return hrtimer_forward(timer, ktime_get(), interval);
+}
+
+/* Precise sleep */
+void hrtimer_init_sleeper(struct hrtimer_sleeper *sl, struct task_struct *task);
+int schedule_hrtimeout(ktime_t *expires, const enum hrtimer_mode mode);
+
+/* Called by tick and clockevent */
+void hrtimer_run_queues(void);
+void hrtimer_interrupt(struct clock_event_device *dev);
+bool hrtimer_needs_tick(void);
+
+/*
+ * Is the local clockevent programmed for hrtimers,
+ * or do hrtimers expire at tick boundary?
+ */
+static inline bool hrtimer_hres_active(void)
+{
+	return this_cpu_ptr(&hrtimer_bases)->hres_active;
+}
+
+void hrtimers_init(void);
+
+#endif /* _LEGO_HRTIMER_H_ */
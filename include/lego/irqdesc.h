@@ -115,6 +115,7 @@ struct irq_data {
 	struct irq_domain	*domain;
 	struct irq_data		*parent_data;
 	void			*chip_data;
+	struct rcu_head		rcu;		/* parent levels are freed by RCU */
 };
 
 /**
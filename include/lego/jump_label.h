@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_JUMP_LABEL_H_
+#define _LEGO_JUMP_LABEL_H_
+
+/*
+ * Static keys (jump labels)
+ *
+ * A static key is a boolean which is read in hot paths and written almost
+ * never, e.g. debug and profiling hooks. Instead of loading and testing a
+ * variable, every branch site is a 5-byte NOP or JMP, and the kernel text
+ * is patched when the key is flipped. A disabled hook costs a NOP.
+ *
+ *	DEFINE_STATIC_KEY_FALSE(key);
+ *
+ *	if (static_branch_unlikely(&key))
+ *		do_unlikely_code();
+ *
+ *	static_branch_enable(&key);
+ *
+ * Keys can only be flipped at boot, before jump_label_init() patches the
+ * sites, i.e. from boot parameters. Patching live text would need every
+ * CPU to stop, and pinned pollers never do. Later flips are refused with
+ * a warning.
+ *
+ * Without CONFIG_JUMP_LABEL, this falls back to testing an atomic_t.
+ */
+
+#ifndef __ASSEMBLY__
+
+#include <lego/types.h>
+#include <lego/atomic.h>
+#include <lego/compiler.h>
+
+struct static_key {
+	atomic_t enabled;
+};
+
+#ifdef CONFIG_JUMP_LABEL
+#include <asm/jump_label.h>
+#endif
+
+enum jump_label_type {
+	JUMP_LABEL_NOP = 0,
+	JUMP_LABEL_JMP,
+};
+
+static inline bool static_key_enabled(struct static_key *key)
+{
+	return atomic_read(&key->enabled) > 0;
+}
+
+#ifdef CONFIG_JUMP_LABEL
+
+static inline struct static_key *jump_entry_key(struct jump_entry *entry)
+{
+	return (struct static_key *)((unsigned long)entry->key & ~1UL);
+}
+
+static inline bool jump_entry_branch(struct jump_entry *entry)
+{
+	return (unsigned long)entry->key & 1UL;
+}
+
+void __init jump_label_init(void);
+void __init arch_jump_label_transform_static(struct jump_entry *entry,
+					     enum jump_label_type type);
+
+#else
+
+static inline void jump_label_init(void) { }
+
+#endif /* CONFIG_JUMP_LABEL */
+
+#define STATIC_KEY_INIT_TRUE	{ .enabled = ATOMIC_INIT(1) }
+#define STATIC_KEY_INIT_FALSE	{ .enabled = ATOMIC_INIT(0) }
+
+void static_key_enable(struct static_key *key);
+void static_key_disable(struct static_key *key);
+
+/*
+ * Type-safe keys, the default value is part of the type so that
+ * static_branch_likely() and static_branch_unlikely() can lay out
+ * the code for the common case:
+ *
+ *   type\branch|  likely (1)            |  unlikely (0)
+ *  ------------+------------------------+------------------------
+ *              |                        |
+ *   true (1)   |    ...                 |    ...
+ *              |    NOP                 |    JMP L
+ *              |    <br-stmts>          | 1: ...
+ *              | L: ...                 |
+ *              |                        |
+ *              |                        | L: <br-stmts>
+ *              |                        |    jmp 1b
+ *              |                        |
+ *  ------------+------------------------+------------------------
+ *              |                        |
+ *   false (0)  |    ...                 |    ...
+ *              |    JMP L               |    NOP
+ *              |    <br-stmts>          | 1: ...
+ *              | L: ...                 |
+ *              |                        |
+ *              |                        | L: <br-stmts>
+ *              |                        |    jmp 1b
+ *              |                        |
+ *  ------------+------------------------+------------------------
+ *
+ * The branch bit of a jump_entry records which instruction the site
+ * has when the key is at its default value: NOP if type == branch.
+ */
+struct static_key_true {
+	struct static_key key;
+};
+
+struct static_key_false {
+	struct static_key key;
+};
+
+#define STATIC_KEY_TRUE_INIT	(struct static_key_true) { .key = STATIC_KEY_INIT_TRUE, }
+#define STATIC_KEY_FALSE_INIT	(struct static_key_false){ .key = STATIC_KEY_INIT_FALSE, }
+
+#define DEFINE_STATIC_KEY_TRUE(name)	\
+	struct static_key_true name = STATIC_KEY_TRUE_INIT
+
+#define DECLARE_STATIC_KEY_TRUE(name)	\
+	extern struct static_key_true name
+
+#define DEFINE_STATIC_KEY_FALSE(name)	\
+	struct static_key_false name = STATIC_KEY_FALSE_INIT
+
+#define DECLARE_STATIC_KEY_FALSE(name)	\
+	extern struct static_key_false name
+
+extern bool ____wrong_branch_error(void);
+
+#define static_key_enabled_type(x)	static_key_enabled(&(x)->key)
+
+#ifdef CONFIG_JUMP_LABEL
+
+#define static_branch_likely(x)							\
+({										\
+	bool branch;								\
+	if (__builtin_types_compatible_p(typeof(*x), struct static_key_true))	\
+		branch = !arch_static_branch(&(x)->key, true);			\
+	else if (__builtin_types_compatible_p(typeof(*x), struct static_key_false)) \
+		branch = !arch_static_branch_jump(&(x)->key, true);		\
+	else									\
+		branch = ____wrong_branch_error();				\
+	branch;									\
+})
+
+#define static_branch_unlikely(x)						\
+({										\
+	bool branch;								\
+	if (__builtin_types_compatible_p(typeof(*x), struct static_key_true))	\
+		branch = arch_static_branch_jump(&(x)->key, false);		\
+	else if (__builtin_types_compatible_p(typeof(*x), struct static_key_false)) \
+		branch = arch_static_branch(&(x)->key, false);			\
+	else									\
+		branch = ____wrong_branch_error();				\
+	branch;									\
+})
+
+#else
+
+#define static_branch_likely(x)		likely(static_key_enabled(&(x)->key))
+#define static_branch_unlikely(x)	unlikely(static_key_enabled(&(x)->key))
+
+#endif /* CONFIG_JUMP_LABEL */
+
+#define static_branch_enable(x)		static_key_enable(&(x)->key)
+#define static_branch_disable(x)	static_key_disable(&(x)->key)
+
+#endif /* __ASSEMBLY__ */
+#endif /* _LEGO_JUMP_LABEL_H_ */
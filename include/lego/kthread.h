@@ -85,6 +85,8 @@ bool kthread_should_park(void);
 int kthread_park(struct task_struct *k);
 void kthread_unpark(struct task_struct *k);
 void kthread_bind(struct task_struct *p, unsigned int cpu);
+void kthread_bind_mask(struct task_struct *p, const struct cpumask *mask);
+void *kthread_data(struct task_struct *k);
 void kthread_parkme(void);
 int kthread_stop(struct task_struct *k);
 
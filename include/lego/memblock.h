@@ -242,6 +242,19 @@ static inline void * __init memblock_virt_alloc(phys_addr_t size,
 					    NUMA_NO_NODE);
 }
 
+void *memblock_virt_alloc_try_nid_raw(phys_addr_t size,
+		phys_addr_t align, phys_addr_t min_addr,
+		phys_addr_t max_addr, int nid);
+
+/* Memory is not cleared */
+static inline void * __init memblock_virt_alloc_raw(phys_addr_t size,
+						    phys_addr_t align)
+{
+	return memblock_virt_alloc_try_nid_raw(size, align, 0,
+					       BOOTMEM_ALLOC_ACCESSIBLE,
+					       NUMA_NO_NODE);
+}
+
 void __memblock_free_early(phys_addr_t base, phys_addr_t size);
 
 static inline void __init memblock_free_early(
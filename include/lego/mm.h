@@ -176,6 +176,12 @@ void __init free_area_init_nodes(unsigned long *max_zone_pfn);
 void __init sparse_init(void);
 void __init arch_zone_init(void);
 void __init memory_init(void);
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+void __init page_alloc_init_late(void);
+#else
+static inline void page_alloc_init_late(void) { }
+#endif
 void __init memory_present(int nid, unsigned long start, unsigned long end);
 
 void sparse_mem_maps_populate_node(struct page **map_map,
@@ -286,11 +292,12 @@ static inline unsigned int page_order(struct page *page)
 
 void reserve_bootmem_region(phys_addr_t start, phys_addr_t end);
 
-void __free_pages_bootmem(struct page *page, unsigned long pfn,
-			unsigned int order);
+unsigned long __free_pages_bootmem(struct page *page, unsigned long pfn,
+				   unsigned int order);
 
 void __free_pages(struct page *page, unsigned int order);
 void free_pages(unsigned long addr, unsigned int order);
+void split_page(struct page *page, unsigned int order);
 
 #define __free_page(page) __free_pages((page), 0)
 #define free_page(addr) free_pages((addr), 0)
@@ -125,6 +125,14 @@ struct mm_struct {
 	int gpid;
 	struct list_head list;
 
+#ifdef CONFIG_PCACHE_ONESIDED_READ
+	struct pcache_xlate_table *pcache_xlate;	/* remote page translations */
+#endif
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	struct futex_hash_bucket *futex_hash;	/* private futex buckets */
+#endif
+
 	cpumask_var_t cpu_vm_mask_var;		/* CPUs this VM has run on */
 };
 
@@ -272,6 +272,15 @@ typedef struct pglist_data {
 						   range, including holes */
 	int node_id;
 
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+	/*
+	 * Number of pages initialised at early boot, and the first pfn
+	 * left for page_alloc_init_late(). ULONG_MAX if nothing is deferred.
+	 */
+	unsigned long static_init_pgcnt;
+	unsigned long first_deferred_pfn;
+#endif
+
 	ZONE_PADDING(_pad2_)
 	atomic_long_t		vm_stat[NR_VM_NODE_STAT_ITEMS];
 } pg_data_t;
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_PARALLEL_H_
+#define _LEGO_PARALLEL_H_
+
+/**
+ * struct parallel_job - boot time work split across all online CPUs
+ * @thread_fn: called for every chunk, [start, end) of the job range
+ * @fn_arg: passed to @thread_fn
+ * @start: start of the job range
+ * @size: size of the job range
+ * @align: chunk boundaries are multiple of @align from @start
+ * @min_chunk: do not bother a new thread for less than this much work
+ * @name: name of the helper threads
+ *
+ * The unit of @start, @size and friends is up to the user, it can be
+ * pfns, bytes or array indexes. Chunks never overlap, so @thread_fn only
+ * has to care about concurrency if it touches things outside its range.
+ */
+struct parallel_job {
+	void		(*thread_fn)(unsigned long start, unsigned long end, void *arg);
+	void		*fn_arg;
+	unsigned long	start;
+	unsigned long	size;
+	unsigned long	align;
+	unsigned long	min_chunk;
+	const char	*name;
+};
+
+void __init parallel_do_job(struct parallel_job *job);
+void __init parallel_clear(void *ptr, unsigned long size, const char *name);
+
+#endif /* _LEGO_PARALLEL_H_ */
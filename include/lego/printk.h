@@ -52,6 +52,18 @@ int printk(const char *fmt, ...);
 
 int vprintk(const char *fmt, va_list args);
 
+#ifdef CONFIG_PRINTK_ASYNC
+void printk_init(void);
+void printk_late_init(void);
+void printk_tick(void);
+void printk_flush_on_panic(void);
+#else
+static inline void printk_init(void) { }
+static inline void printk_late_init(void) { }
+static inline void printk_tick(void) { }
+static inline void printk_flush_on_panic(void) { }
+#endif
+
 #ifndef pr_fmt
 #define pr_fmt(fmt) fmt
 #endif
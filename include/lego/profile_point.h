@@ -13,9 +13,10 @@
 #include <lego/kernel.h>
 #include <lego/atomic.h>
 #include <lego/stringify.h>
+#include <lego/jump_label.h>
 
 struct profile_point {
-	bool		enabled;
+	struct static_key_true	key;
 	char		pp_name[64];
 	atomic_long_t	nr;
 	atomic_long_t	time_ns;
@@ -30,30 +31,37 @@ struct profile_point {
 
 /*
  * Define a profile point
- * It is ON by default.
+ * It is ON by default. The on/off switch is a static key,
+ * so a disabled point costs a NOP at start. Keys are only
+ * flipped at boot, see profile_points= and jump_label.h.
  */
 #define DEFINE_PROFILE_POINT(name)							\
 	struct profile_point _PP_NAME(name) __profile_point = {				\
-		.enabled	=	true,						\
+		.key		=	STATIC_KEY_TRUE_INIT,				\
 		.pp_name	=	__stringify(name),				\
 	};
 
 /*
  * This is just a solution if per-cpu is not used.
  * Stack is per-thread, thus SMP safe.
+ *
+ * The key is only tested at start. A start time of 0 means
+ * the point was off, and leave skips it.
  */
 #define PROFILE_POINT_TIME(name)							\
-	unsigned long _PP_TIME(name) __maybe_unused;
+	unsigned long _PP_TIME(name) __maybe_unused = 0;
 
 #define profile_point_start(name)							\
 	do {										\
-		if (_PP_NAME(name).enabled)						\
+		if (static_branch_likely(&_PP_NAME(name).key))				\
 			_PP_TIME(name) = sched_clock();					\
+		else									\
+			_PP_TIME(name) = 0;						\
 	} while (0)
 
 #define profile_point_leave(name)							\
 	do {										\
-		if (_PP_NAME(name).enabled) {						\
+		if (_PP_TIME(name)) {							\
 			unsigned long __PP_end_time;					\
 			unsigned long __PP_diff_time;					\
 			__PP_end_time = sched_clock();					\
@@ -78,6 +86,9 @@ struct profile_point {
 		atomic_long_add(__PP_diff_time, &(_PP_NAME(name).time_ns));		\
 	} while (0)
 
+#define profile_point_enable(name)	static_branch_enable(&_PP_NAME(name).key)
+#define profile_point_disable(name)	static_branch_disable(&_PP_NAME(name).key)
+
 void print_profile_point(struct profile_point *pp);
 void print_profile_points(void);
 
@@ -89,6 +100,8 @@ void print_profile_points(void);
 #define profile_point_leave(name)	do { } while (0)
 #define PROFILE_START(name)		do { } while (0)
 #define PROFILE_LEAVE(name)		do { } while (0)
+#define profile_point_enable(name)	do { } while (0)
+#define profile_point_disable(name)	do { } while (0)
 
 static inline void print_profile_point(struct profile_point *pp) { }
 static inline void print_profile_points(void) { }
@@ -10,6 +10,10 @@
 #ifndef _LEGO_RADIXTREE_H_
 #define _LEGO_RADIXTREE_H_
 
+#include <lego/bug.h>
+#include <lego/types.h>
+#include <lego/rcupdate.h>
+
 /*
  * An indirect pointer (root->rnode pointing to a radix_tree_node, rather
  * than a data item) is signalled by the low bit set in the root->rnode
@@ -155,8 +159,56 @@ do {									\
  * excluded from concurrency.
  *
  * radix_tree_tagged is able to be called without locking or RCU.
+ *
+ * Deleted and shrunk nodes are freed by call_rcu(), so a lockless lookup
+ * never walks through freed memory.
  */
 
+/**
+ * radix_tree_deref_slot	- dereference a slot
+ * @pslot:	pointer to slot, returned by radix_tree_lookup_slot
+ * Returns:	item that was stored in that slot with any direct pointer flag
+ *		removed.
+ *
+ * For use with radix_tree_lookup_slot().  Caller must hold tree read locked
+ * across slot lookup and dereference. Not required if write lock is held
+ * (ie. items cannot be concurrently inserted).
+ *
+ * radix_tree_deref_retry must be used to confirm validity of the pointer if
+ * only the read lock is held.
+ */
+static inline void *radix_tree_deref_slot(void **pslot)
+{
+	return rcu_dereference(*pslot);
+}
+
+/**
+ * radix_tree_deref_retry	- check radix_tree_deref_slot
+ * @arg:	pointer returned by radix_tree_deref_slot
+ * Returns:	0 if retry is not required, otherwise retry is required
+ *
+ * radix_tree_deref_retry must be used with radix_tree_deref_slot.
+ */
+static inline int radix_tree_deref_retry(void *arg)
+{
+	return unlikely((unsigned long)arg & RADIX_TREE_INDIRECT_PTR);
+}
+
+/**
+ * radix_tree_replace_slot	- replace item in a slot
+ * @pslot:	pointer to slot, returned by radix_tree_lookup_slot
+ * @item:	new item to store in the slot.
+ *
+ * For use with radix_tree_lookup_slot().  Caller must hold tree write locked
+ * across slot lookup and replacement. Lockless readers see either the old
+ * or the new item, the old one must be freed after a grace period.
+ */
+static inline void radix_tree_replace_slot(void **pslot, void *item)
+{
+	BUG_ON(radix_tree_is_indirect_ptr(item));
+	rcu_assign_pointer(*pslot, item);
+}
+
 int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 			struct radix_tree_node **nodep, void ***slotp);
 int radix_tree_insert(struct radix_tree_root *root,
@@ -1,8 +1,11 @@
 #ifndef _LEGO_RCUPDATE_H_
 #define _LEGO_RCUPDATE_H_
 
+#include <lego/types.h>
 #include <lego/kernel.h>
+#include <lego/percpu.h>
 #include <lego/compiler.h>
+#include <lego/preempt.h>
 
 /**
  * RCU_INITIALIZER() - statically initialize an RCU-protected global variable
@@ -88,4 +91,68 @@
 
 #define rcu_dereference_raw(p) rcu_dereference_check(p, 1) /*@@@ needed? @@@*/
 
+/**
+ * rcu_dereference() - fetch RCU-protected pointer for dereferencing
+ * @p: The pointer to read, prior to dereferencing
+ *
+ * Must be called within rcu_read_lock(), and the returned pointer
+ * must not be used after the matching rcu_read_unlock().
+ */
+#define rcu_dereference(p) rcu_dereference_check(p, 0)
+
+/*
+ * Fetch the pointer only to test or print it, never to dereference it.
+ * No read-side critical section needed.
+ */
+#define rcu_access_pointer(p)	((typeof(*p) __force __kernel *)READ_ONCE(p))
+
+/*
+ * Assign without ordering. Only for NULL, or when readers can not
+ * reach the pointer yet.
+ */
+#define RCU_INIT_POINTER(p, v)					\
+	do {							\
+		WRITE_ONCE(p, RCU_INITIALIZER(v));		\
+	} while (0)
+
+/*
+ * Read-side critical sections
+ *
+ * Lego kernel is not preemptible, readers only have to not sleep.
+ * A CPU is in a quiescent state, out of any reader, whenever it
+ * context switches, calls cond_resched(), or takes a tick in user
+ * mode or idle. See kernel/rcu/update.c.
+ */
+static inline void rcu_read_lock(void)
+{
+	preempt_disable();
+}
+
+static inline void rcu_read_unlock(void)
+{
+	preempt_enable();
+}
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+DECLARE_PER_CPU(unsigned long, rcu_qs_ctr);
+
+/* Report a quiescent state of this CPU */
+static inline void rcu_qs(void)
+{
+	unsigned long *ctr = this_cpu_ptr(&rcu_qs_ctr);
+
+	/* Order the readers before, pairs with rcu_gp_wait_cpus() */
+	smp_store_release(ctr, *ctr + 1);
+}
+
+void rcu_note_context_switch(void);
+void rcu_check_callbacks(int user);
+
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head *head, rcu_callback_t func);
+
+void rcu_init(void);
+void rcu_spawn_gp_kthread(void);
+
 #endif /* _LEGO_RCUPDATE_H_ */
@@ -30,6 +30,7 @@ struct m2s_read_write_payload {
 	int	flags;
 	size_t	len;
 	loff_t	offset;
+	__u64	fh;		/* storage file handle, 0 if unknown */
 };
 
 struct m2s_lseek_struct {
@@ -85,6 +85,35 @@ struct p2m_replica_msg {
 } __packed __aligned(8);
 void handle_p2m_replica(void *_msg, struct thpool_buffer *tb);
 
+/*
+ * P2M_PCACHE_XLATE
+ * Ask memory for the DMA addresses of a window of user pages,
+ * used by processor to do one-sided pcache fill later.
+ * Only present and writable pages are reported.
+ */
+#define PCACHE_XLATE_MAX_PAGES	64
+
+struct p2m_pcache_xlate_msg {
+	struct common_header	header;
+	__u32			pid;
+	__u32			nr_pages;
+	__u64			start_vaddr;
+};
+
+struct p2m_pcache_xlate_entry {
+	__u64			vaddr;
+	__u64			dma_addr;
+};
+
+struct p2m_pcache_xlate_reply {
+	__u32				nr_entries;
+	__u32				rkey;
+	struct p2m_pcache_xlate_entry	entries[PCACHE_XLATE_MAX_PAGES];
+};
+
+void handle_p2m_pcache_xlate(struct p2m_pcache_xlate_msg *msg,
+			     struct thpool_buffer *tb);
+
 /*
  * P2M_READ
  * P2M_WRITE
@@ -106,7 +135,34 @@ struct p2m_read_write_payload {
 	int	flags;
 	ssize_t	len;
 	loff_t	offset;
+	__u64	fh;		/* storage file handle from open */
+	__u32	lease_ms;	/* P2M_READ: read lease wanted, 0 for none */
+};
+
+/*
+ * P2M_READ reply
+ * If @lease_ms is not 0, the memory pgcache will not apply writes
+ * from other processors to this file within @lease_ms, so the reader
+ * can keep serving the data locally until then.
+ */
+struct p2m_read_reply {
+	ssize_t	retval;		/* nr of bytes read, or error */
+	__u32	lease_ms;	/* read lease granted */
+	__u32	__pad;
+	char	buf[0];		/* the content */
 };
+
+/*
+ * P2M_WRITE and P2M_RENAME reply
+ * If @retval is -EAGAIN, the file is leased to another processor,
+ * retry after @retry_ms.
+ */
+struct p2m_write_reply {
+	ssize_t	retval;
+	__u32	retry_ms;
+	__u32	__pad;
+};
+
 void handle_p2m_read(struct p2m_read_write_payload *payload,
 		     struct common_header *hdr, struct thpool_buffer *tb);
 void handle_p2m_write(struct p2m_read_write_payload *payload,
@@ -21,6 +21,15 @@ struct p2s_open_struct{
 	int	flags;
 };
 
+/*
+ * Storage file handle, valid as long as the file is not unlinked or
+ * renamed. Later requests carrying it skip the path lookup.
+ */
+struct p2s_open_ret_struct {
+	int	retval;
+	__u64	fh;
+};
+
 struct p2s_access_struct {
 	char filename[MAX_FILENAME_LENGTH];
 	int mode;
@@ -295,6 +295,11 @@ struct restart_block {
 			u64 time;
 			u32 __user *uaddr2;
 		} futex;
+		/* For nanosleep */
+		struct {
+			struct timespec __user *rmtp;
+			u64 expires;
+		} nanosleep;
 	};
 };
 
@@ -382,6 +387,9 @@ struct task_struct {
 
 	struct mm_struct *mm, *active_mm;
 
+	/* Remote TLB shootdowns in flight, see tlb_flush_batch_start() */
+	struct tlb_flush_batch	*tlb_flush_batch;
+
 /* Scheduler bits, serialized by scheduler locks */
 	unsigned		sched_reset_on_fork:1;
 	unsigned		sched_contributes_to_load:1;
@@ -479,6 +487,9 @@ struct task_struct {
 
 	struct wake_q_node wake_q;
 
+	/* release_task() drops its reference after a grace period */
+	struct rcu_head rcu;
+
 	/*
 	 * Protection of (de-)allocation: mm, files, fs, tty, keyrings,
 	 * mems_allowed, mempolicy
@@ -777,12 +788,19 @@ void __init sched_init(void);
 void __init sched_init_idle(struct task_struct *idle, int cpu);
 
 long schedule_timeout(long timeout);
+long schedule_timeout_interruptible(long timeout);
+long schedule_timeout_killable(long timeout);
+long schedule_timeout_uninterruptible(long timeout);
 asmlinkage void schedule(void);
 void schedule_preempt_disabled(void);
 
 /* Called periodically in every tick */
 void scheduler_tick(void);
 
+#ifdef CONFIG_NO_HZ_FULL
+bool sched_can_stop_tick(void);
+#endif
+
 /* Reschedule IPI */
 #ifdef CONFIG_SMP
 void sched_ttwu_pending(void);
@@ -816,6 +834,10 @@ static inline int set_cpus_allowed_ptr(struct task_struct *p,
 
 int set_cpus_allowed_ptr(struct task_struct *p, const struct cpumask *new_mask);
 long sched_setaffinity(pid_t pid, const struct cpumask *new_mask);
+void set_user_nice(struct task_struct *p, long nice);
+
+/* CPUs from isolcpus=, kept out of cpu_active_mask */
+extern struct cpumask cpu_isolated_map;
 
 int wake_up_state(struct task_struct *p, unsigned int state);
 int wake_up_process(struct task_struct *p);
@@ -44,6 +44,7 @@ struct call_single_data {
  * Call a function on all other processors
  */
 int smp_call_function_single(int cpu, smp_call_func_t func, void *info, int wait);
+int smp_call_function_single_async(int cpu, struct call_single_data *csd);
 int smp_call_function(smp_call_func_t func, void *info, int wait);
 void smp_call_function_many(const struct cpumask *mask,
 			    smp_call_func_t func, void *info, bool wait);
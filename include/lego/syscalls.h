@@ -20,6 +20,7 @@
 #include <lego/time.h>
 #include <lego/getcpu.h>
 #include <lego/socket.h>
+#include <lego/jump_label.h>
 
 #include <asm/syscalls.h>
 #include <asm/stat.h>
@@ -30,33 +31,53 @@ struct epoll_event;
 struct pollfd;
 
 #ifdef CONFIG_DEBUG_SYSCALL
-#define debug_syscall_print()			\
-	pr_info("%s() cpu(%d) tsk(%d/%s)\n",	\
-		__func__, smp_processor_id(), current->pid, current->comm);
+/*
+ * The dumps can be silenced at boot with "debug_syscall=off",
+ * each of them is a NOP then.
+ */
+DECLARE_STATIC_KEY_TRUE(debug_syscall_key);
+
+#define debug_syscall_print()							\
+do {										\
+	if (static_branch_likely(&debug_syscall_key))				\
+		pr_info("%s() cpu(%d) tsk(%d/%s)\n",				\
+			__func__, smp_processor_id(), current->pid,		\
+			current->comm);						\
+} while (0)
 
 #define syscall_enter(fmt, ...)							\
 do {										\
-	pr_info("%s() cpu(%d) tsk(%u/%u/%s) user-ip:%#lx\n",			\
-		__func__, smp_processor_id(), current->pid, current->tgid,	\
-		current->comm,	current_pt_regs()->ip);				\
-	pr_info("    "fmt, __VA_ARGS__);					\
+	if (static_branch_likely(&debug_syscall_key)) {				\
+		pr_info("%s() cpu(%d) tsk(%u/%u/%s) user-ip:%#lx\n",		\
+			__func__, smp_processor_id(), current->pid,		\
+			current->tgid, current->comm, current_pt_regs()->ip);	\
+		pr_info("    "fmt, __VA_ARGS__);				\
+	}									\
 } while (0)
 
 #define __syscall_enter()							\
 do {										\
-	pr_info("%s() cpu(%d) tsk(%u/%u/%s) from-ip:%#lx\n",			\
-		__func__, smp_processor_id(), current->pid, current->tgid,	\
-		current->comm,	current_pt_regs()->ip);				\
+	if (static_branch_likely(&debug_syscall_key))				\
+		pr_info("%s() cpu(%d) tsk(%u/%u/%s) from-ip:%#lx\n",		\
+			__func__, smp_processor_id(), current->pid,		\
+			current->tgid, current->comm, current_pt_regs()->ip);	\
 } while (0)
 
 #define syscall_exit(ret)							\
-	pr_info("%s() cpu(%d) tsk(%u/%u/%s) ret: %#lx (%ld)\n",			\
-		__func__, smp_processor_id(), current->pid, current->tgid,	\
-		current->comm, (unsigned long)ret, (long)ret);
+do {										\
+	if (static_branch_likely(&debug_syscall_key))				\
+		pr_info("%s() cpu(%d) tsk(%u/%u/%s) ret: %#lx (%ld)\n",	\
+			__func__, smp_processor_id(), current->pid,		\
+			current->tgid, current->comm,				\
+			(unsigned long)ret, (long)ret);				\
+} while (0)
 
 static inline int syscall_filename(const char __user *pathname)
 {
 	char kbuf[FILENAME_LEN_DEFAULT];
+
+	if (!static_branch_likely(&debug_syscall_key))
+		return 0;
 	if (strncpy_from_user(kbuf, pathname, FILENAME_LEN_DEFAULT) < 0) {
 		return -EFAULT;
 	}
@@ -142,6 +163,8 @@ asmlinkage long sys_readlink(const char __user *path, char __user *buf, int bufs
 
 asmlinkage long sys_ioctl(unsigned int fd, unsigned int cmd, unsigned long arg);
 
+asmlinkage long sys_syslog(int type, char __user *buf, int len);
+
 asmlinkage long sys_getuid(void);
 asmlinkage long sys_geteuid(void);
 asmlinkage long sys_getgid(void);
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_TICK_H_
+#define _LEGO_TICK_H_
+
+#include <lego/cpumask.h>
+
+#ifdef CONFIG_NO_HZ_FULL
+extern struct cpumask tick_nohz_full_mask;
+extern bool tick_nohz_full_running;
+
+static inline bool tick_nohz_full_cpu(int cpu)
+{
+	if (!tick_nohz_full_running)
+		return false;
+	return cpumask_test_cpu(cpu, &tick_nohz_full_mask);
+}
+
+void tick_nohz_full_kick_cpu(int cpu);
+void tick_nohz_full_restart(void);
+#else
+static inline bool tick_nohz_full_cpu(int cpu) { return false; }
+static inline void tick_nohz_full_kick_cpu(int cpu) { }
+static inline void tick_nohz_full_restart(void) { }
+#endif
+
+#endif /* _LEGO_TICK_H_ */
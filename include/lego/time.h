@@ -39,6 +39,8 @@ struct timezone {
 	int			tz_dsttime;	/* type of dst correction */
 };
 
+extern struct timezone sys_tz;
+
 /*
  * Names of the interval timers,
  * and structure defining a timer setting:
@@ -140,6 +140,9 @@ void do_timer(unsigned long ticks);
 /* Update all wall time based on our clocksource */
 void update_wall_time(void);
 
+/* Export the timekeeper to vDSO */
+void update_vsyscall(struct timekeeper *tk);
+
 /*
  * ktime_t based interfaces
  */
@@ -134,6 +134,7 @@ int del_timer_sync(struct timer_list *timer);
 #endif
 
 void run_local_timers(void);
+bool local_timers_pending(void);
 
 void __init init_timers(void);
 void msleep(unsigned int msecs);
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Legacy virtio PCI interface and split virtqueues,
+ * shared by the virtio-net and virtio-blk drivers.
+ */
+
+#ifndef _LEGO_VIRTIO_H_
+#define _LEGO_VIRTIO_H_
+
+#include <lego/types.h>
+#include <lego/compiler.h>
+#include <asm/io.h>
+
+#define VIRTIO_PCI_VENDOR_ID		0x1af4
+
+/* Legacy virtio PCI registers, in I/O BAR 0 */
+#define VIRTIO_PCI_HOST_FEATURES	0
+#define VIRTIO_PCI_GUEST_FEATURES	4
+#define VIRTIO_PCI_QUEUE_PFN		8
+#define VIRTIO_PCI_QUEUE_NUM		12
+#define VIRTIO_PCI_QUEUE_SEL		14
+#define VIRTIO_PCI_QUEUE_NOTIFY		16
+#define VIRTIO_PCI_STATUS		18
+#define VIRTIO_PCI_ISR			19
+#define VIRTIO_MSI_CONFIG_VECTOR	20
+#define VIRTIO_MSI_QUEUE_VECTOR		22
+#define VIRTIO_MSI_NO_VECTOR		0xffff
+
+/* Device specific config moves once MSI-X is enabled */
+#define VIRTIO_PCI_CONFIG(msix)		((msix) ? 24 : 20)
+
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT	12
+#define VIRTIO_PCI_VRING_ALIGN		4096
+
+#define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
+#define VIRTIO_CONFIG_S_DRIVER		2
+#define VIRTIO_CONFIG_S_DRIVER_OK	4
+#define VIRTIO_CONFIG_S_FAILED		0x80
+
+#define VIRTIO_RING_F_EVENT_IDX		29
+
+#define VRING_DESC_F_NEXT		1
+#define VRING_DESC_F_WRITE		2
+#define VRING_AVAIL_F_NO_INTERRUPT	1
+#define VRING_USED_F_NO_NOTIFY		1
+
+struct vring_desc {
+	u64	addr;
+	u32	len;
+	u16	flags;
+	u16	next;
+};
+
+struct vring_avail {
+	u16	flags;
+	u16	idx;
+	u16	ring[];
+};
+
+struct vring_used_elem {
+	u32	id;
+	u32	len;
+};
+
+struct vring_used {
+	u16			flags;
+	u16			idx;
+	struct vring_used_elem	ring[];
+};
+
+/* One piece of a buffer, a kernel virtual address */
+struct virtio_sg {
+	void			*addr;
+	unsigned int		len;
+};
+
+struct virtqueue {
+	unsigned long		ioaddr;
+	bool			event_idx;
+	unsigned int		index;
+	unsigned int		num;
+	struct vring_desc	*desc;
+	struct vring_avail	*avail;
+	struct vring_used	*used;
+	unsigned long		ring;
+	unsigned int		ring_order;
+
+	u16			free_head;
+	u16			num_free;
+	u16			avail_idx;	/* shadow of avail->idx */
+	u16			num_added;	/* since the last kick */
+	u16			last_used_idx;
+
+	/* Token of each in-flight chain, by head descriptor */
+	void			**data;
+};
+
+static inline bool virtqueue_more_used(struct virtqueue *vq)
+{
+	return vq->last_used_idx != READ_ONCE(vq->used->idx);
+}
+
+int virtqueue_setup(struct virtqueue *vq, unsigned long ioaddr,
+		    unsigned int index, bool event_idx);
+void virtqueue_free(struct virtqueue *vq);
+int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sg,
+		  int out, int in, void *data);
+void virtqueue_kick(struct virtqueue *vq);
+void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len);
+void virtqueue_disable_cb(struct virtqueue *vq);
+bool virtqueue_enable_cb(struct virtqueue *vq);
+
+static inline void virtio_set_status(unsigned long ioaddr, u8 status)
+{
+	u8 old = inb(ioaddr + VIRTIO_PCI_STATUS);
+
+	outb(old | status, ioaddr + VIRTIO_PCI_STATUS);
+}
+
+/* Reset the device and tell it we have found it and know how to drive it */
+static inline void virtio_reset(unsigned long ioaddr)
+{
+	outb(0, ioaddr + VIRTIO_PCI_STATUS);
+	virtio_set_status(ioaddr, VIRTIO_CONFIG_S_ACKNOWLEDGE);
+	virtio_set_status(ioaddr, VIRTIO_CONFIG_S_DRIVER);
+}
+
+#endif /* _LEGO_VIRTIO_H_ */
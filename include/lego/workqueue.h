@@ -15,6 +15,7 @@
 #include <lego/atomic.h>
 #include <lego/cpumask.h>
 
+struct task_struct;
 struct workqueue_struct;
 struct work_struct;
 
@@ -27,6 +28,13 @@ void delayed_work_timer_fn(unsigned long __data);
  */
 #define work_data_bits(work) ((unsigned long *)(&(work)->data))
 
+/**
+ * work_pending - Find out whether a work item is currently pending
+ * @work: The work item in question
+ */
+#define work_pending(work) \
+	test_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))
+
 enum {
 	WORK_STRUCT_PENDING_BIT	= 0,	/* work item is pending execution */
 	WORK_STRUCT_DELAYED_BIT	= 1,	/* work item is delayed */
@@ -201,10 +209,27 @@ enum {
 #define WQ_UNBOUND_MAX_ACTIVE	\
 	max_t(int, WQ_MAX_ACTIVE, num_possible_cpus() * WQ_MAX_UNBOUND_PER_CPU)
 
+/*
+ * System-wide workqueues, always there:
+ *
+ * system_wq is per-cpu and the one schedule_work() uses.
+ * system_highpri_wq is per-cpu, served by nice -20 workers.
+ * system_unbound_wq is not bound to any cpu, works are run on the
+ * node they are queued on, by as many workers as needed.
+ */
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_highpri_wq;
+extern struct workqueue_struct *system_unbound_wq;
+
 #ifdef CONFIG_WORK_QUEUE
 bool queue_work_on(int cpu, struct workqueue_struct *wq, struct work_struct *work);
-struct workqueue_struct * __alloc_workqueue(unsigned int flags, int max_active);
+struct workqueue_struct * __alloc_workqueue(const char *name,
+					    unsigned int flags, int max_active);
 int init_workqueues(void);
+
+/* Concurrency management hooks, called by schedule() */
+void wq_worker_running(struct task_struct *task);
+void wq_worker_sleeping(struct task_struct *task);
 #else
 static inline bool queue_work_on(int cpu, struct workqueue_struct *wq,
 				 struct work_struct *work)
@@ -214,13 +239,16 @@ static inline bool queue_work_on(int cpu, struct workqueue_struct *wq,
 }
 
 static inline struct workqueue_struct *
-__alloc_workqueue(unsigned int flags, int max_active)
+__alloc_workqueue(const char *name, unsigned int flags, int max_active)
 {
 	WARN_ON_ONCE(1);
 	return NULL;
 }
 
 static inline int init_workqueues(void) { return 0; }
+
+static inline void wq_worker_running(struct task_struct *task) { }
+static inline void wq_worker_sleeping(struct task_struct *task) { }
 #endif /* CONFIG_WORK_QUEUE */
 
 /**
@@ -239,9 +267,33 @@ static inline bool queue_work(struct workqueue_struct *wq,
 	return queue_work_on(smp_processor_id(), wq, work);
 }
 
+/**
+ * schedule_work_on - put work task on a specific cpu
+ * @cpu: cpu to put the work task on
+ * @work: job to be done
+ *
+ * This puts a job on a specific cpu
+ */
+static inline bool schedule_work_on(int cpu, struct work_struct *work)
+{
+	return queue_work_on(cpu, system_wq, work);
+}
+
+/**
+ * schedule_work - put work task in global workqueue
+ * @work: job to be done
+ *
+ * Returns %false if @work was already on the kernel-global workqueue and
+ * %true otherwise.
+ */
+static inline bool schedule_work(struct work_struct *work)
+{
+	return queue_work(system_wq, work);
+}
+
 #define create_workqueue(name)						\
-	__alloc_workqueue(0, 1)
+	__alloc_workqueue((name), 0, 1)
 #define create_singlethread_workqueue(name)				\
-	__alloc_workqueue(0, 1)
+	__alloc_workqueue((name), 0, 1)
 
 #endif /* _LEGO_WORKQUEUE_H_ */
@@ -31,10 +31,11 @@ ssize_t storage_read(struct lego_task_struct *tsk,
 			    struct lego_file *file,
 			    char *buf, size_t count, loff_t *pos);
 
-ssize_t __storage_read(struct lego_task_struct *tsk, char *f_name,
+/* @fh is the storage file handle from open(), 0 if unknown */
+ssize_t __storage_read(struct lego_task_struct *tsk, char *f_name, u64 fh,
 		       char __user *buf, size_t count, loff_t *pos);
 
-ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name,
+ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name, u64 fh,
 			const char *buf, size_t count, loff_t *pos);
 
 #endif /* _LEGO_MEMORY_FILE_OPS_H_ */
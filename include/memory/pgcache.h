@@ -14,6 +14,7 @@
 #include <lego/slab.h>
 #include <lego/comp_memory.h>
 #include <lego/comp_common.h>
+#include <memory/vm.h>
 #include <memory/task.h>
 #include <memory/thread_pool.h>
 #include <lego/types.h>
@@ -34,6 +35,9 @@ static inline void pgcache_debug(const char *fmt, ...) {  }
 #define aligned_pos(x)		x & POS_MASK
 #define chunk_offset(x)		x & (~POS_MASK)
 
+/* Max adjacent dirty cachelines written back in one M2S_WRITE */
+#define PGCACHE_FLUSH_BATCH	4
+
 struct lego_pgcache_struct {
 
 	loff_t			pos;		/* aligned pos */
@@ -67,9 +71,17 @@ struct lego_pgcache_file {
 	spinlock_t 		dirtylist_lock;
 
 	unsigned int 		storage_node;		/* will be used later */
+
+	/* Read leases held by processors, protected by dirtylist_lock */
+	unsigned long		lease_expires;		/* jiffies */
+	int			lease_node;		/* holder, or -1 if many */
+	int			nr_lease_breakers;	/* writers applying */
+	unsigned long		lease_blocked;		/* no grant until, jiffies */
 };
 
 /* alloc.c */
+void *pgcache_alloc_pages(void);
+void pgcache_free_pages(void *pages);
 struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
 		unsigned int storage_node);
 void __free_pgcache_locked(struct lego_pgcache_struct *pgc);
@@ -99,6 +111,7 @@ int handle_p2m_fsync(char *payload, struct common_header *hdr, 			\
 		     struct thpool_buffer *tb);
 
 /* read_write.c */
+ssize_t flush_cachelines(struct lego_pgcache_struct **pgcs, int nr);
 ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc);
 ssize_t lego_pgcache_read(struct lego_task_struct *tsk, char *f_name,		\
 		unsigned int storage_node, char __user *buf,			\
@@ -108,6 +121,29 @@ ssize_t lego_pgcache_write(struct lego_task_struct *tsk, char *f_name,	\
 		unsigned int storage_node, char __user *buf,			\
 		size_t count, loff_t *pos);
 
+int lego_pgcache_get_pages(char *f_name, unsigned int storage_node,		\
+		loff_t pos, unsigned int nr_pages, unsigned long *pages);
+
+/*
+ * Processors flush dirty lines straight into the mapped page, so pgcache
+ * pages are only mapped where nobody writes them through the mapping:
+ * read faults of anything but shared writable mappings. Private mappings
+ * get their own copy when they are written, see do_wp_page().
+ */
+static inline bool pgcache_can_map(struct vm_area_struct *vma, unsigned int flags)
+{
+	if (flags & FAULT_FLAG_WRITE)
+		return false;
+	return (vma->vm_flags & (VM_SHARED | VM_WRITE)) != (VM_SHARED | VM_WRITE);
+}
+
+/* lease.c */
+#define PGCACHE_MAX_LEASE_MS	1000
+
+unsigned int lego_pgcache_grant_lease(char *f_name, int nid, unsigned int lease_ms);
+unsigned int lego_pgcache_break_lease(struct lego_pgcache_file *file, int nid);
+void lego_pgcache_unblock_lease(struct lego_pgcache_file *file);
+
 /* eviction.c */
 void update_lirs_structure(struct lego_pgcache_struct *pgc);
 void pgcache_evict_one(void);
@@ -28,6 +28,9 @@ enum memory_manager_stat_item {
 
 	NR_BATCHED_LOG_FLUSH,
 
+	NR_ZEROPOOL_HIT,
+	NR_ZEROPOOL_MISS,
+
 	NR_MEMORY_MANAGER_STAT_ITEMS,
 };
 
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_MEMORY_STRIPE_H_
+#define _LEGO_MEMORY_STRIPE_H_
+
+#include <lego/types.h>
+#include <lego/errno.h>
+
+#ifdef CONFIG_MEM_FILE_STRIPE
+bool file_striped(unsigned int storage_node);
+ssize_t stripe_read(char *f_name, unsigned int storage_node,
+		    void *buf, size_t count, loff_t pos);
+ssize_t stripe_write(char *f_name, unsigned int storage_node,
+		     const void *buf, size_t count, loff_t pos);
+ssize_t stripe_file_size(char *f_name, unsigned int storage_node);
+#else
+static inline bool file_striped(unsigned int storage_node)
+{
+	return false;
+}
+
+static inline ssize_t stripe_read(char *f_name, unsigned int storage_node,
+				  void *buf, size_t count, loff_t pos)
+{
+	return -EIO;
+}
+
+static inline ssize_t stripe_write(char *f_name, unsigned int storage_node,
+				   const void *buf, size_t count, loff_t pos)
+{
+	return -EIO;
+}
+
+static inline ssize_t stripe_file_size(char *f_name, unsigned int storage_node)
+{
+	return -EIO;
+}
+#endif /* CONFIG_MEM_FILE_STRIPE */
+
+#endif /* _LEGO_MEMORY_STRIPE_H_ */
@@ -312,6 +312,24 @@ static inline void add_thpool_worker_total_queuing(struct thpool_worker *tw, uns
 static inline void inc_thpool_worker_nr_handled(struct thpool_worker *tw) { }
 #endif /* CONFIG_COUNTER_THPOOL */
 
+/*
+ * Inline handlers run on FIT polling thread, before the request
+ * is queued to any worker. They must not sleep. Return 0 if the
+ * reply is ready, or -EAGAIN to pass the request to thpool.
+ */
+typedef int (*thpool_inline_handler_t)(void *msg, struct thpool_buffer *tb);
+
+#ifdef CONFIG_THPOOL_INLINE_HANDLERS
+int register_thpool_inline_handler(u32 opcode, thpool_inline_handler_t handler);
+int handle_p2m_flush_one_inline(void *_msg, struct thpool_buffer *tb);
+#else
+static inline int
+register_thpool_inline_handler(u32 opcode, thpool_inline_handler_t handler)
+{
+	return 0;
+}
+#endif
+
 void fit_ack_reply_callback(struct thpool_buffer *b);
 void thpool_callback(void *fit_ctx, void *fit_imm,
 		     void *rx, int rx_size, int node_id, int fit_offset);
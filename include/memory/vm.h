@@ -378,6 +378,7 @@ int faultin_page(struct vm_area_struct *vma, unsigned long start,
 		 unsigned long flags, unsigned long *kvaddr);
 
 unsigned long find_page(struct vm_area_struct *vma, unsigned long address);
+unsigned long find_writable_page(struct vm_area_struct *vma, unsigned long address);
 
 long get_user_pages(struct lego_task_struct *tsk, unsigned long start,
 		    unsigned long nr_pages, unsigned int gup_flags,
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_MEMORY_ZEROPOOL_H_
+#define _LEGO_MEMORY_ZEROPOOL_H_
+
+#include <lego/mm.h>
+#include <lego/init.h>
+
+#ifdef CONFIG_MEM_ZERO_POOL
+unsigned long zeropool_get_page(void);
+void zeropool_put_page(unsigned long vaddr);
+void __init zeropool_init(void);
+void print_zeropool_stats(void);
+#else
+static inline unsigned long zeropool_get_page(void)
+{
+	return __get_free_page(GFP_KERNEL | __GFP_ZERO);
+}
+
+static inline void zeropool_put_page(unsigned long vaddr)
+{
+	free_page(vaddr);
+}
+
+static inline void zeropool_init(void) { }
+static inline void print_zeropool_stats(void) { }
+#endif
+
+#endif /* _LEGO_MEMORY_ZEROPOOL_H_ */
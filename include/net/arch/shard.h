@@ -0,0 +1,90 @@
+#ifndef LWIP_ARCH_SHARD_H
+#define LWIP_ARCH_SHARD_H
+
+/*
+ * lwIP shards
+ *
+ * With LWIP_SHARDS > 1 the stack runs as independent instances, one per
+ * core. Each shard has its own TCP PCB lists, TCP timers and segment
+ * decoding state, and is entered by taking its lock. TCP segments are
+ * steered to the shard owning their flow by a hash of the remote address
+ * and both ports; active opens pick a local port that hashes to the
+ * shard they are made from. ARP, UDP, raw, ICMP and IP reassembly are
+ * left to shard 0.
+ *
+ * Work for another shard is queued on its lock-free list and run by its
+ * thread, which also drives the shard's timers.
+ */
+
+#include <lego/hash.h>
+#include <lego/llist.h>
+#include <lego/percpu.h>
+#include <lego/spinlock.h>
+
+#include "net/lwip/opt.h"
+#include "net/lwip/err.h"
+#include "net/lwip/tcp.h"
+#include "net/lwip/pbuf.h"
+#include "net/lwip/netif.h"
+
+struct lwip_work;
+typedef void (*lwip_work_fn)(struct lwip_work *work);
+
+/* A call to make from within a shard, see lwip_shard_queue() */
+struct lwip_work {
+	struct llist_node	node;
+	lwip_work_fn		fn;
+};
+
+struct lwip_shard {
+#if LWIP_SHARDS > 1
+	struct tcp_shard_state	tcp;
+#endif
+	int			id;
+	int			cpu;
+	spinlock_t		lock;
+	struct llist_head	work;
+	struct task_struct	*task;
+
+	/* In jiffies */
+	unsigned long		next_tcp_tmr;
+	unsigned long		next_arp_tmr;
+	unsigned long		next_ip_tmr;
+} ____cacheline_aligned;
+
+extern struct lwip_shard lwip_shards[LWIP_SHARDS];
+extern int lwip_nr_shards;
+
+DECLARE_PER_CPU(struct lwip_shard *, lwip_cur_shard);
+
+/*
+ * The shard entered on this cpu. Code outside of any shard, i.e. setup
+ * and callers that drive the stack on their own, works on shard 0 and
+ * must serialize itself as before.
+ */
+static inline struct lwip_shard *lwip_this_shard(void)
+{
+	struct lwip_shard *s = this_cpu_read(lwip_cur_shard);
+
+	return s ? s : &lwip_shards[0];
+}
+
+/* Shard owning a TCP flow. @rip is in network order, ports in host order */
+static inline int lwip_flow_shard(u32_t rip, u16_t rport, u16_t lport)
+{
+	return hash_32(rip ^ ((u32_t)rport << 16 | lport), 16) % lwip_nr_shards;
+}
+
+void lwip_shard_lock(struct lwip_shard *s);
+void lwip_shard_unlock(struct lwip_shard *s);
+struct lwip_shard *lwip_shard_steer(struct pbuf *p);
+void lwip_shard_queue(struct lwip_shard *s, struct lwip_work *work);
+err_t lwip_shard_input(struct lwip_shard *s, struct pbuf *p, struct netif *inp);
+void lwip_shard_for_each(void (*fn)(void *arg), void *arg);
+
+void lwip_arp_lock(void);
+void lwip_arp_unlock(void);
+
+int lwip_shards_init(void);
+
+#endif
@@ -780,6 +780,24 @@
 #define PBUF_LINK_HLEN                  14
 #endif
 
+/**
+ * LWIP_SUPPORT_CUSTOM_PBUF==1: Support for custom pbufs, whose payload
+ * memory is owned by the driver and freed by a callback. Used to hand
+ * received DMA buffers to the stack without copying.
+ */
+#ifndef LWIP_SUPPORT_CUSTOM_PBUF
+#define LWIP_SUPPORT_CUSTOM_PBUF        0
+#endif
+
+/**
+ * LWIP_SHARDS: Number of independent TCP instances, one per core. Each
+ * has its own PCB lists and timers, see net/arch/shard.h. The port has
+ * to provide the shard layer if this is larger than 1.
+ */
+#ifndef LWIP_SHARDS
+#define LWIP_SHARDS                     1
+#endif
+
 /**
  * PBUF_POOL_BUFSIZE: the size of each pbuf in the pbuf pool. The default is
  * designed to accomodate single full size TCP frame in one pbuf, including
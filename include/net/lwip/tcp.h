@@ -537,8 +537,32 @@ void tcp_zero_window_probe(struct tcp_pcb *pcb);
 u16_t tcp_eff_send_mss(u16_t sendmss, struct ip_addr *addr);
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
 
+#ifndef TCP_LOCAL_PORT_RANGE_START
+#define TCP_LOCAL_PORT_RANGE_START 4096
+#define TCP_LOCAL_PORT_RANGE_END   0x7fff
+#endif
+
+/* Decoded segment under input, see tcp_in.c */
+struct tcp_input_state {
+  struct tcp_seg inseg;
+  struct tcp_hdr *tcphdr;
+  struct ip_hdr *iphdr;
+  u32_t seqno, ackno;
+  u8_t flags;
+  u16_t tcplen;
+
+  u8_t recv_flags;
+  struct pbuf *recv_data;
+};
+
+#if LWIP_SHARDS > 1
+/* Each shard has its own TCP state, see net/arch/shard.h */
+#define tcp_input_pcb (lwip_this_shard()->tcp.input_pcb)
+#define tcp_ticks     (lwip_this_shard()->tcp.ticks)
+#else
 extern struct tcp_pcb *tcp_input_pcb;
 extern u32_t tcp_ticks;
+#endif /* LWIP_SHARDS > 1 */
 
 #if TCP_DEBUG || TCP_INPUT_DEBUG || TCP_OUTPUT_DEBUG
 void tcp_debug_print(struct tcp_hdr *tcphdr);
@@ -565,6 +589,29 @@ union tcp_listen_pcbs_t { /* List of all TCP PCBs in LISTEN state. */
   struct tcp_pcb_listen *listen_pcbs; 
   struct tcp_pcb *pcbs;
 };
+
+#if LWIP_SHARDS > 1
+/* TCP state of one shard, the globals of tcp.c and tcp_in.c */
+struct tcp_shard_state {
+  struct tcp_pcb *bound_pcbs;
+  union tcp_listen_pcbs_t listen_pcbs;
+  struct tcp_pcb *active_pcbs;
+  struct tcp_pcb *tw_pcbs;
+  struct tcp_pcb *tmp_pcb;
+  struct tcp_pcb *input_pcb;
+  struct tcp_input_state in;
+  u32_t ticks;
+  u32_t iss;
+  u16_t port;
+  u8_t timer;
+};
+
+#define tcp_bound_pcbs  (lwip_this_shard()->tcp.bound_pcbs)
+#define tcp_listen_pcbs (lwip_this_shard()->tcp.listen_pcbs)
+#define tcp_active_pcbs (lwip_this_shard()->tcp.active_pcbs)
+#define tcp_tw_pcbs     (lwip_this_shard()->tcp.tw_pcbs)
+#define tcp_tmp_pcb     (lwip_this_shard()->tcp.tmp_pcb)
+#else
 extern union tcp_listen_pcbs_t tcp_listen_pcbs;
 extern struct tcp_pcb *tcp_active_pcbs;  /* List of all TCP PCBs that are in a
               state in which they accept or send
@@ -572,6 +619,7 @@ extern struct tcp_pcb *tcp_active_pcbs;  /* List of all TCP PCBs that are in a
 extern struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. */
 
 extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
+#endif /* LWIP_SHARDS > 1 */
 
 /* Axioms about the above lists:   
    1) Every TCP PCB that is not CLOSED is in one of the lists.
@@ -636,6 +684,10 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 }
 #endif
 
+#if LWIP_SHARDS > 1
+#include "net/arch/shard.h"
+#endif /* LWIP_SHARDS > 1 */
+
 #endif /* LWIP_TCP */
 
 #endif /* __LWIP_TCP_H__ */
@@ -37,6 +37,17 @@ void *memcpy(void *dst, const void *src, size_t n);
 #define PBUF_POOL_SIZE		512
 #define PBUF_POOL_BUFSIZE	2000
 
+// virtio-net hands its RX pages to lwip as custom pbufs
+#define LWIP_SUPPORT_CUSTOM_PBUF	1
+
+// One lwip instance per core, see net/arch/shard.h. The pools and the
+// heap are shared by all of them and by the virtio-net RX threads.
+#ifdef CONFIG_LWIP_SHARDS
+#define LWIP_SHARDS		CONFIG_LWIP_SHARDS
+#define SYS_LIGHTWEIGHT_PROT	1
+#define LWIP_ALLOW_MEM_FREE_FROM_OTHER_CONTEXT	1
+#endif
+
 #define TCP_MSS			1460
 #define TCP_WND			24000
 #define TCP_SND_BUF		(16 * TCP_MSS)
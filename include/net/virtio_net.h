@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_NET_VIRTIO_NET_H_
+#define _LEGO_NET_VIRTIO_NET_H_
+
+#include <lego/types.h>
+#include <lego/virtio.h>
+
+/*
+ * Bytes free for the consumer at the start of each RX page,
+ * in front of the device header and the frame.
+ */
+#define VIRTNET_RX_HEADROOM	256
+
+/*
+ * Called from the RX poll thread of @qid for each received frame.
+ * @page is the RX page, @data points into it. The consumer owns the
+ * page from now on and releases it by virtnet_free_rx_buf().
+ */
+typedef void (*virtnet_rx_fn)(void *arg, int qid, void *page,
+			      void *data, unsigned int len);
+
+/*
+ * Called once the device is done with a frame passed to virtnet_xmit(),
+ * from virtnet_xmit() or from the RX poll thread of the queue pair.
+ */
+typedef void (*virtnet_tx_done_fn)(void *token);
+
+#ifdef CONFIG_VIRTIO_NET
+int virtnet_init(void);
+bool virtnet_present(void);
+void virtnet_get_mac(u8 *mac);
+int virtnet_nr_queues(void);
+void virtnet_set_handlers(virtnet_rx_fn rx, void *rx_arg,
+			  virtnet_tx_done_fn tx_done);
+int virtnet_xmit(int qid, struct virtio_sg *sg, int nr_sg, void *token);
+void virtnet_free_rx_buf(void *page);
+#else
+static inline int virtnet_init(void) { return 0; }
+static inline bool virtnet_present(void) { return false; }
+#endif
+
+#endif /* _LEGO_NET_VIRTIO_NET_H_ */
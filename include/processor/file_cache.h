@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_PROCESSOR_FILE_CACHE_H_
+#define _LEGO_PROCESSOR_FILE_CACHE_H_
+
+#include <lego/files.h>
+
+#ifdef CONFIG_PROCESSOR_FILE_CACHE
+ssize_t file_cache_read(struct file *f, char __user *buf, size_t count,
+			loff_t *off);
+void file_cache_invalidate(const char *f_name);
+void file_cache_drop(void);
+#else
+static inline ssize_t file_cache_read(struct file *f, char __user *buf,
+				      size_t count, loff_t *off)
+{
+	return -ENOENT;
+}
+static inline void file_cache_invalidate(const char *f_name) { }
+static inline void file_cache_drop(void) { }
+#endif
+
+#endif /* _LEGO_PROCESSOR_FILE_CACHE_H_ */
@@ -51,6 +51,11 @@ int dev_file_open(struct file *, char *f_name);
 
 extern struct file_operations default_p2s_f_ops;
 
+struct p2m_read_reply;
+struct p2m_read_reply *p2m_read_rpc(struct file *f, size_t count, loff_t pos,
+				    unsigned int lease_ms);
+void p2m_read_rpc_free(struct p2m_read_reply *reply, size_t count);
+
 static inline int default_file_open(struct file *f, char *f_name)
 {
 	f->f_op = &default_p2s_f_ops;
@@ -59,6 +64,21 @@ static inline int default_file_open(struct file *f, char *f_name)
 
 void do_close_on_exec(struct files_struct *files);
 
+#ifdef CONFIG_PROCESSOR_FILE_STRIPE
+long p2s_stripe_truncate(const char *kname, long length);
+long p2s_stripe_unlink(const char *kname);
+#else
+static inline long p2s_stripe_truncate(const char *kname, long length)
+{
+	return 0;
+}
+
+static inline long p2s_stripe_unlink(const char *kname)
+{
+	return 0;
+}
+#endif
+
 /* common llseeks */
 loff_t dev_llseek(struct file *file, loff_t offset, int whence);
 loff_t no_llseek(struct file *file, loff_t offset, int whence);
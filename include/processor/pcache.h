@@ -15,6 +15,7 @@
 #include <lego/bitops.h>
 #include <lego/jiffies.h>
 #include <lego/spinlock.h>
+#include <lego/errno.h>
 
 #include <processor/pcache_types.h>
 #include <processor/pcache_stat.h>
@@ -552,6 +553,7 @@ struct pcache_meta *pcache_alloc(unsigned long address,
 				 enum piggyback_options piggyback);
 
 int pcache_flush_one(struct pcache_meta *pcm);
+int pcache_writeback_one(struct pcache_meta *pcm);
 void clflush_one(struct task_struct *tsk, unsigned long user_va, void *cache_addr);
 void __clflush_one(pid_t tgid, unsigned long user_va,
 		   unsigned int m_nid, unsigned int rep_nid, void *cache_addr);
@@ -627,6 +629,7 @@ void pcache_remove_rmap(struct pcache_meta *pcm, pte_t *ptep, unsigned long addr
 int fork_dup_pcache(struct task_struct *dst_task,
 		    struct mm_struct *dst_mm, struct mm_struct *src_mm, void *_vmainfo);
 void __init pcache_print_info(void);
+void __init init_pcache_rmap_map(void);
 #else
 static inline int fork_dup_pcache(struct task_struct *t,
 				  struct mm_struct *m1, struct mm_struct *m2,
@@ -638,11 +641,45 @@ static inline int fork_dup_pcache(struct task_struct *t,
 static inline void pcache_print_info(void) { }
 #endif
 
+#ifdef CONFIG_PCACHE_ONESIDED_READ
+int pcache_xlate_init(struct mm_struct *mm);
+void pcache_xlate_exit(struct mm_struct *mm);
+void pcache_xlate_invalidate(struct mm_struct *mm,
+			     unsigned long start, unsigned long end);
+void pcache_xlate_unmap_begin(struct mm_struct *mm,
+			      unsigned long start, unsigned long end);
+void pcache_xlate_unmap_end(struct mm_struct *mm);
+void pcache_xlate_brk_begin(struct mm_struct *mm, unsigned long brk);
+void pcache_xlate_brk_end(struct mm_struct *mm, unsigned long brk);
+int pcache_xlate_fill(struct mm_struct *mm, unsigned long address,
+		      int nid, void *va_cache);
+void pcache_xlate_fetch(struct mm_struct *mm, unsigned long address, int nid);
+#else
+static inline int pcache_xlate_init(struct mm_struct *mm) { return 0; }
+static inline void pcache_xlate_exit(struct mm_struct *mm) { }
+static inline void pcache_xlate_invalidate(struct mm_struct *mm,
+			     unsigned long start, unsigned long end) { }
+static inline void pcache_xlate_unmap_begin(struct mm_struct *mm,
+			     unsigned long start, unsigned long end) { }
+static inline void pcache_xlate_unmap_end(struct mm_struct *mm) { }
+static inline void pcache_xlate_brk_begin(struct mm_struct *mm, unsigned long brk) { }
+static inline void pcache_xlate_brk_end(struct mm_struct *mm, unsigned long brk) { }
+static inline int pcache_xlate_fill(struct mm_struct *mm, unsigned long address,
+				    int nid, void *va_cache)
+{
+	return -ENOENT;
+}
+static inline void pcache_xlate_fetch(struct mm_struct *mm,
+				      unsigned long address, int nid) { }
+#endif
+
 int rmap_walk(struct pcache_meta *pcm, struct rmap_walk_control *rwc);
 int pcache_try_to_unmap(struct pcache_meta *pcm);
 bool pcache_try_to_unmap_check_dirty(struct pcache_meta *pcm);
 bool pcache_try_to_unmap_reserve_check_dirty(struct pcache_meta *pcm);
 int pcache_wrprotect(struct pcache_meta *pcm);
+int pcache_wrprotect_dirty(struct pcache_meta *pcm);
+bool pcache_dirty(struct pcache_meta *pcm);
 int pcache_referenced(struct pcache_meta *pcm);
 void pcache_referenced_trylock(struct pcache_meta *pcm,
 			       int *pte_referenced, int *pte_contention);
@@ -30,6 +30,16 @@ int __init evict_sweep_init(void);
 static inline int evict_sweep_init(void) { return 0; }
 #endif
 
+/*
+ * Background cleaner, which writes back dirty lines
+ * before they reach the eviction end of LRU list.
+ */
+#ifdef CONFIG_PCACHE_BACKGROUND_CLEAN
+int __init pcache_clean_init(void);
+#else
+static inline int pcache_clean_init(void) { return 0; }
+#endif
+
 /*
  * Eviction Algorithm
  * 	Least Recently Used
@@ -106,6 +116,10 @@ struct pcache_meta *evict_find_line_lru(struct pcache_set *pset);
 
 void kevict_sweepd_lru(void);
 
+/* Callback: find dirty candidates for background cleaner */
+int clean_find_lines_lru(struct pcache_set *pset, struct pcache_meta **pcms,
+			 int nr_scan, int max);
+
 #else
 static inline void
 add_to_lru_list(struct pcache_meta *pcm, struct pcache_set *pset) { }
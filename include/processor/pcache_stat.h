@@ -12,6 +12,7 @@
 
 #include <lego/percpu.h>
 #include <lego/sched.h>
+#include <lego/jump_label.h>
 #include <processor/pcache_types.h>
 
 /*
@@ -46,6 +47,8 @@ enum pcache_event_item {
 	PCACHE_FAULT_FILL_FROM_MEMORY,	/* nr of pcache fill from remote memory */
 	PCACHE_FAULT_FILL_FROM_MEMORY_PIGGYBACK,
 	PCACHE_FAULT_FILL_FROM_MEMORY_PIGGYBACK_FB,
+	PCACHE_FAULT_FILL_FROM_MEMORY_ONESIDED,	/* nr of fill by one-sided RDMA READ */
+	PCACHE_XLATE_FETCH,		/* nr of translation window fetched */
 	PCACHE_FAULT_FILL_FROM_VICTIM,	/* nr of pcache fill from victim cache */
 
 	/*
@@ -97,6 +100,12 @@ enum pcache_event_item {
 	PCACHE_SWEEP_NR_PSET,		/* nr of pset that have been sweeped */
 	PCACHE_SWEEP_NR_MOVED_PCM,	/* nr of moved pcache lines */
 
+	PCACHE_CLEAN_RUN,		/* nr of whole pcache clean runned */
+	PCACHE_CLEAN_NR_SCANNED,	/* nr of lines checked by cleaner */
+	PCACHE_CLEAN_NR_CLEANED,	/* nr of dirty lines written back by cleaner */
+	PCACHE_CLEAN_NR_REDIRTY,	/* nr of cleaned lines found dirty again */
+	PCACHE_CLEAN_BACKOFF,		/* nr of times cleaner backed off */
+
 	PCACHE_MREMAP_PSET_SAME,
 	PCACHE_MREMAP_PSET_DIFF,
 
@@ -121,9 +130,16 @@ extern struct pcache_event_stat pcache_event_stats;
 extern atomic_long_t nr_used_cachelines;
 
 #ifdef CONFIG_COUNTER_PCACHE
+/*
+ * Event and pset counters can be turned off at boot with "pcache_stat=off",
+ * a static key then reduces each of them to a NOP.
+ */
+DECLARE_STATIC_KEY_TRUE(pcache_stat_key);
+
 static inline void inc_pcache_event(enum pcache_event_item item)
 {
-	atomic_long_inc(&pcache_event_stats.event[item]);
+	if (static_branch_likely(&pcache_stat_key))
+		atomic_long_inc(&pcache_event_stats.event[item]);
 }
 
 static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit)
@@ -132,6 +148,12 @@ static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit)
 		inc_pcache_event(item);
 }
 
+static inline void add_pcache_event(enum pcache_event_item item, long nr)
+{
+	if (static_branch_likely(&pcache_stat_key))
+		atomic_long_add(nr, &pcache_event_stats.event[item]);
+}
+
 static inline unsigned long pcache_event(enum pcache_event_item item)
 {
 	return atomic_long_read(&pcache_event_stats.event[item]);
@@ -143,19 +165,22 @@ static inline unsigned long pcache_event(enum pcache_event_item item)
 static inline void mod_pset_event(int i, struct pcache_set *pset,
 				  enum pcache_set_stat_item item)
 {
-	atomic_add(i, &pset->stat[item]);
+	if (static_branch_likely(&pcache_stat_key))
+		atomic_add(i, &pset->stat[item]);
 }
 
 static inline void inc_pset_event(struct pcache_set *pset,
 				  enum pcache_set_stat_item item)
 {
-	atomic_inc(&pset->stat[item]);
+	if (static_branch_likely(&pcache_stat_key))
+		atomic_inc(&pset->stat[item]);
 }
 
 static inline void dec_pset_event(struct pcache_set *pset,
 				 enum pcache_set_stat_item item)
 {
-	atomic_dec(&pset->stat[item]);
+	if (static_branch_likely(&pcache_stat_key))
+		atomic_dec(&pset->stat[item]);
 }
 
 /*
@@ -179,6 +204,7 @@ static inline long pcache_used(void)
 #else
 static inline void inc_pcache_event(enum pcache_event_item i) { }
 static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit) { }
+static inline void add_pcache_event(enum pcache_event_item item, long nr) { }
 static inline unsigned long pcache_event(enum pcache_event_item i) { return 0; }
 static inline void mod_pset_event(int i, struct pcache_set *pset,
 				  enum pcache_set_stat_item item) { }
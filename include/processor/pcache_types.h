@@ -380,6 +380,9 @@ PSET_FLAGS(Sweeping, sweeping)
  * 			A following pcache_alloc from the same CPU, with
  * 			ENABLE_PIGGYBACK will get it. Check piggyback.h
  *
+ * PC_cleaned:		Pcacheline was written back by background cleaner,
+ * 			used to detect lines that are re-dirtied quickly.
+ *
  * Hack: remember to update the pcacheflag_names array in debug file.
  *
  * 1) PC_valid is more like the traditional cache valid bit. It is set when
@@ -393,6 +396,7 @@ enum pcache_meta_bits {
 	PC_writeback,
 	PC_piggyback,
 	PC_piggyback_cached,
+	PC_cleaned,
 
 	__NR_PCLBITS,
 };
@@ -469,6 +473,7 @@ PCACHE_META_BITS(Reclaim, reclaim)
 PCACHE_META_BITS(Writeback, writeback)
 PCACHE_META_BITS(Piggyback, piggyback)
 PCACHE_META_BITS(PiggybackCached, piggyback_cached)
+PCACHE_META_BITS(Cleaned, cleaned)
 
 /*
  * Flags checked when a pcache is freed.
@@ -477,6 +482,7 @@ PCACHE_META_BITS(PiggybackCached, piggyback_cached)
  */
 #define PCACHE_FLAGS_CHECK_AT_FREE					\
 	(1UL << PC_locked | 1UL << PC_valid | 1UL << PC_dirty |		\
-	 1UL << PC_reclaim | 1UL << PC_writeback | 1UL << PC_piggyback)
+	 1UL << PC_reclaim | 1UL << PC_writeback | 1UL << PC_piggyback |	\
+	 1UL << PC_cleaned)
 
 #endif /* _LEGO_PROCESSOR_PCACHE_TYPES_H_ */
@@ -22,6 +22,7 @@
 #include <lego/wait.h>
 #include <lego/timex.h>
 #include <lego/futex.h>
+#include <lego/hrtimer.h>
 #include <lego/timer.h>
 #include <lego/delay.h>
 #include <lego/sched.h>
@@ -39,6 +40,7 @@
 #include <lego/irqdomain.h>
 #include <lego/fit_ibapi.h>
 #include <lego/radixtree.h>
+#include <lego/rcupdate.h>
 #include <lego/workqueue.h>
 #include <lego/completion.h>
 #include <lego/stop_machine.h>
@@ -127,6 +129,18 @@ static int kernel_init(void *unused)
 	 */
 	cpu_stop_init();
 
+	/*
+	 * Initialize the rest of struct pages in parallel,
+	 * now that all CPUs and kthreadd are up.
+	 */
+	page_alloc_init_late();
+
+	/* Run call_rcu() callbacks from now on */
+	rcu_spawn_gp_kthread();
+
+	/* The console is written asynchronously from now on */
+	printk_late_init();
+
 	init_workqueues();
 
 	/*
@@ -241,6 +255,9 @@ asmlinkage void __init start_kernel(void)
 	 */
 	cpu_init();
 
+	/* printk() can log into per-cpu buffers now */
+	printk_init();
+
 	/* Allocate pid mapping array */
 	pid_init();
 	fork_init();
@@ -275,6 +292,7 @@ asmlinkage void __init start_kernel(void)
 	 * IRQ subsystem is the first user of radix tree
 	 * If we have something come up, good luck remmebering this..
 	 */
+	rcu_init();
 	radix_tree_init();
 	irq_init();
 
@@ -296,6 +314,7 @@ asmlinkage void __init start_kernel(void)
 	 * But they can be the same device. (Well, normally is different I think)
 	 */
 	init_timers();
+	hrtimers_init();
 	timekeeping_init();
 	register_refined_jiffies(CLOCK_TICK_RATE);
 	time_init();
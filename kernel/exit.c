@@ -12,6 +12,7 @@
 #include <lego/wait.h>
 #include <lego/sched.h>
 #include <lego/kernel.h>
+#include <lego/rcupdate.h>
 #include <lego/syscalls.h>
 #include <lego/profile.h>
 #include <lego/debug_locks.h>
@@ -32,12 +33,14 @@
  * This function is called with tasklist_lock locked.
  * It will do necessary cleanup, a counterpart of fork.
  *
- * TODO:
- * Still need to detach/release PID
+ * Once the PID is released, find_task_by_pid() can not find @p,
+ * which stays valid for readers under rcu_read_lock() that found
+ * it before. See release_task().
  */
 static void __unhash_process(struct task_struct *p, bool group_dead)
 {
 	nr_threads--;
+	free_pid(p->pid);
 
 	if (group_dead) {
 		list_del(&p->tasks);
@@ -115,6 +118,13 @@ static void __exit_signal(struct task_struct *tsk)
 	}
 }
 
+static void delayed_put_task_struct(struct rcu_head *rhp)
+{
+	struct task_struct *tsk = container_of(rhp, struct task_struct, rcu);
+
+	put_task_struct(tsk);
+}
+
 void release_task(struct task_struct *p)
 {
 	struct task_struct *leader;
@@ -149,8 +159,11 @@ repeat:
 	 * The task->usage is 2 when initalized.
 	 * Thus when we drop 1 here, p will not be freed.
 	 * The last free maybe performed by finish_task_switch().
+	 *
+	 * Dropped after a grace period, so that RCU readers which
+	 * found p by PID can still take a reference.
 	 */
-	put_task_struct(p);
+	call_rcu(&p->rcu, delayed_put_task_struct);
 
 	p = leader;
 	if (unlikely(zap_leader))
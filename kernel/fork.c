@@ -186,6 +186,8 @@ void __mmdrop(struct mm_struct *mm)
 
 	/* Processor: Free distributed VMA resource */
 	processor_distvm_exit(mm);
+	pcache_xlate_exit(mm);
+	futex_mm_exit(mm);
 
 	mm_free_pgd(mm);
 	check_mm(mm);
@@ -338,6 +340,7 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	mm->map_count = 0;
 	mm->pinned_vm = 0;
 	mm_init_cpumask(mm);
+	futex_mm_init(mm);
 	spin_lock_init(&mm->page_table_lock);
 	init_rwsem(&mm->mmap_sem);
 
@@ -358,6 +361,14 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 		return NULL;
 	}
 
+	/* Processor: remote page translation cache */
+	if (pcache_xlate_init(mm)) {
+		processor_distvm_exit(mm);
+		pgd_free(mm, mm->pgd);
+		kfree(mm);
+		return NULL;
+	}
+
 	return mm;
 }
 
@@ -798,6 +809,7 @@ struct task_struct *copy_process(unsigned long clone_flags,
 #ifdef CONFIG_FUTEX
 	p->robust_list = NULL;
 #endif
+	p->tlb_flush_batch = NULL;
 
 	/*
 	 * sigaltstack should be cleared when sharing the same VM
@@ -957,6 +969,13 @@ pid_t do_fork(unsigned long clone_flags,
 			return PTR_ERR(vmainfo);
 		}
 
+		/*
+		 * Memory has write-protected our pages for COW,
+		 * cached translations of them are not valid anymore.
+		 */
+		if (!(clone_flags & CLONE_VM))
+			pcache_xlate_invalidate(current->mm, 0, TASK_SIZE);
+
 		/*
 		 * This step has to be postponed here after
 		 * we got VMA info from remote memory.
@@ -16,12 +16,15 @@
  * 2) Lego does NOT support PI-futex, it will return ENOSYS if called.
  */
 
+#include <lego/mm.h>
 #include <lego/pid.h>
 #include <lego/time.h>
 #include <lego/plist.h>
 #include <lego/ktime.h>
 #include <lego/jhash.h>
 #include <lego/futex.h>
+#include <lego/hrtimer.h>
+#include <lego/rcupdate.h>
 #include <lego/memblock.h>
 #include <lego/syscalls.h>
 
@@ -100,7 +103,7 @@
  * Where (A) orders the waiters increment and the futex value read through
  * atomic operations (see hb_waiters_inc) and where (B) orders the write
  * to futex and the waiters read -- this is done by the barriers for both
- * shared and private futexes in get_futex_key_refs().
+ * shared and private futexes in get_futex_key().
  *
  * This yields the following case (where X:=waiters, Y:=futex):
  *
@@ -201,6 +204,17 @@ static struct {
 #define futex_queues   (__futex_data.queues)
 #define futex_hashsize (__futex_data.hashsize)
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * Private futexes hash into a table owned by their mm, so that
+ * unrelated processes never contend on the same bucket lock.
+ * It is allocated by the first operation that may queue a waiter.
+ */
+#define FUTEX_PRIVATE_HASHSIZE	64
+#define FUTEX_PRIVATE_HASH_ORDER \
+	get_order(FUTEX_PRIVATE_HASHSIZE * sizeof(struct futex_hash_bucket))
+#endif
+
 int fixup_user_fault(struct task_struct *tsk, struct mm_struct *mm,
 		     unsigned long address, unsigned int fault_flags,
 		     bool *unlocked)
@@ -254,21 +268,98 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 #endif
 }
 
+/*
+ * Private futexes hold no reference on an inode or mm.
+ */
+static inline bool futex_key_private(union futex_key *key)
+{
+	return !(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED));
+}
+
 /**
- * hash_futex - Return the hash bucket in the global hash
+ * hash_futex - Return the hash bucket of a futex key
  * @key:	Pointer to the futex key for which the hash is calculated
  *
  * We hash on the keys returned from get_futex_key (see below) and return the
- * corresponding hash bucket in the global hash.
+ * corresponding hash bucket in the global hash, or in the hash of the mm
+ * for private futexes. NULL if that mm never had a waiter.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
-	u32 hash = jhash2((u32*)&key->both.word,
-			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
-			  key->both.offset);
-	return &futex_queues[hash & (futex_hashsize - 1)];
+	struct futex_hash_bucket *queues = futex_queues;
+	unsigned long hashsize = futex_hashsize;
+	u32 hash;
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	if (futex_key_private(key)) {
+		queues = READ_ONCE(key->private.mm->futex_hash);
+		if (!queues)
+			return NULL;
+		hashsize = FUTEX_PRIVATE_HASHSIZE;
+	}
+#endif
+
+	hash = jhash2((u32*)&key->both.word,
+		      (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
+		      key->both.offset);
+	return &queues[hash & (hashsize - 1)];
+}
+
+static void futex_hash_init(struct futex_hash_bucket *queues,
+			    unsigned long hashsize)
+{
+	unsigned long i;
+
+	for (i = 0; i < hashsize; i++) {
+		atomic_set(&queues[i].waiters, 0);
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
 }
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * Make sure current->mm has its private hash before queueing.
+ * The cmpxchg publishes the initialized buckets. Wakers never
+ * allocate: an mm without hash has no waiter to wake.
+ */
+static int futex_private_hash_alloc(unsigned int flags)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *queues;
+
+	if ((flags & FLAGS_SHARED) || likely(READ_ONCE(mm->futex_hash)))
+		return 0;
+
+	queues = (void *)__get_free_pages(GFP_KERNEL, FUTEX_PRIVATE_HASH_ORDER);
+	if (!queues)
+		return -ENOMEM;
+	futex_hash_init(queues, FUTEX_PRIVATE_HASHSIZE);
+
+	if (cmpxchg(&mm->futex_hash, NULL, queues))
+		free_pages((unsigned long)queues, FUTEX_PRIVATE_HASH_ORDER);
+	return 0;
+}
+
+void futex_mm_init(struct mm_struct *mm)
+{
+	mm->futex_hash = NULL;
+}
+
+/* Called when the last reference to @mm is gone */
+void futex_mm_exit(struct mm_struct *mm)
+{
+	if (mm->futex_hash)
+		free_pages((unsigned long)mm->futex_hash,
+			   FUTEX_PRIVATE_HASH_ORDER);
+}
+#else
+static inline int futex_private_hash_alloc(unsigned int flags)
+{
+	return 0;
+}
+#endif /* CONFIG_FUTEX_PRIVATE_HASH */
+
 /**
  * match_futex - Check whether two futex keys are equal
  * @key1:	Pointer to key1
@@ -387,7 +478,11 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 	if (!fshared) {
 		key->private.mm = mm;
 		key->private.address = address;
-		get_futex_key_refs(key);  /* implies smp_mb(); (B) */
+		/*
+		 * No reference to take, and none to drop later in
+		 * put_futex_key(). Only the barrier is needed.
+		 */
+		smp_mb(); /* explicit smp_mb(); (B) */
 		return 0;
 	}
 
@@ -406,6 +501,8 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 
 static inline void put_futex_key(union futex_key *key)
 {
+	if (futex_key_private(key))
+		return;
 	drop_futex_key_refs(key);
 }
 
@@ -552,7 +649,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 	hb = hash_futex(&key);
 
 	/* Make sure we really have tasks to wakeup */
-	if (!hb_waiters_pending(hb))
+	if (!hb || !hb_waiters_pending(hb))
 		goto out_put_key;
 
 	spin_lock(&hb->lock);
@@ -591,6 +688,10 @@ futex_wake_op(u32 __user *uaddr1, unsigned int flags, u32 __user *uaddr2,
 	int ret, op_ret;
 	WAKE_Q(wake_q);
 
+	ret = futex_private_hash_alloc(flags);
+	if (unlikely(ret))
+		return ret;
+
 retry:
 	ret = get_futex_key(uaddr1, flags & FLAGS_SHARED, &key1, VERIFY_READ);
 	if (unlikely(ret != 0))
@@ -679,7 +780,8 @@ void requeue_futex(struct futex_q *q, struct futex_hash_bucket *hb1,
 		plist_add(&q->list, &hb2->chain);
 		q->lock_ptr = &hb2->lock;
 	}
-	get_futex_key_refs(key2);
+	if (!futex_key_private(key2))
+		get_futex_key_refs(key2);
 	q->key = *key2;
 }
 
@@ -711,6 +813,10 @@ static int futex_requeue(u32 __user *uaddr1, unsigned int flags,
 	struct futex_q *this, *next;
 	WAKE_Q(wake_q);
 
+	ret = futex_private_hash_alloc(flags);
+	if (unlikely(ret))
+		return ret;
+
 retry:
 	ret = get_futex_key(uaddr1, flags & FLAGS_SHARED, &key1, VERIFY_READ);
 	if (unlikely(ret != 0))
@@ -785,7 +891,7 @@ out_unlock:
 	 * hold the references to key1.
 	 */
 	while (--drop_count >= 0)
-		drop_futex_key_refs(&key1);
+		put_futex_key(&key1);
 
 out_put_keys:
 	put_futex_key(&key2);
@@ -909,7 +1015,7 @@ retry:
 		ret = 1;
 	}
 
-	drop_futex_key_refs(&q->key);
+	put_futex_key(&q->key);
 	return ret;
 }
 
@@ -917,9 +1023,10 @@ retry:
  * futex_wait_queue_me() - queue_me() and wait for wakeup, timeout, or signal
  * @hb:		the futex hash bucket, must be locked by the caller
  * @q:		the futex_q to queue up on
- * @timeout:	the prepared hrtimer_sleeper, or null for no timeout
+ * @timeout:	the armed hrtimer_sleeper, or null for no timeout
  */
-static void futex_wait_queue_me(struct futex_hash_bucket *hb, struct futex_q *q)
+static void futex_wait_queue_me(struct futex_hash_bucket *hb, struct futex_q *q,
+				struct hrtimer_sleeper *timeout)
 {
 	/*
 	 * The task state is guaranteed to be set before another task can
@@ -934,8 +1041,15 @@ static void futex_wait_queue_me(struct futex_hash_bucket *hb, struct futex_q *q)
 	 * If we have been removed from the hash list, then another task
 	 * has tried to wake us, and we can skip the call to schedule().
 	 */
-	if (likely(!plist_node_empty(&q->list)))
-		schedule();
+	if (likely(!plist_node_empty(&q->list))) {
+		/*
+		 * If the timer has already expired, current will already be
+		 * flagged for rescheduling. Only call schedule if there
+		 * is no timeout, or if it has yet to expire.
+		 */
+		if (!timeout || timeout->task)
+			schedule();
+	}
 	__set_current_state(TASK_RUNNING);
 }
 
@@ -980,6 +1094,10 @@ static int futex_wait_setup(u32 __user *uaddr, u32 val, unsigned int flags,
 	 * absorb a wakeup if *uaddr does not match the desired values
 	 * while the syscall executes.
 	 */
+	ret = futex_private_hash_alloc(flags);
+	if (unlikely(ret))
+		return ret;
+
 retry:
 	ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &q->key, VERIFY_READ);
 	if (unlikely(ret != 0))
@@ -1015,11 +1133,81 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_FUTEX_SPIN_ON_OWNER
+/* Upper bound of one spin */
+#define FUTEX_SPIN_NS		(10 * NSEC_PER_USEC)
+
+/*
+ * Find the thread of our process named @tid and pin it.
+ * A released task is freed only after a grace period.
+ */
+static struct task_struct *futex_find_owner(pid_t tid)
+{
+	struct task_struct *owner;
+
+	rcu_read_lock();
+	owner = find_task_by_pid(tid);
+	if (owner && same_thread_group(owner, current))
+		get_task_struct(owner);
+	else
+		owner = NULL;
+	rcu_read_unlock();
+	return owner;
+}
+
+/*
+ * Lock words following the TID protocol (robust and PI mutexes) name
+ * their owner, and carry FUTEX_WAITERS once contended. If that owner
+ * runs on another CPU it will likely release the lock soon: watch the
+ * word for a short while rather than paying for a sleep and a wakeup.
+ *
+ * Return true if @uaddr no longer holds @val.
+ */
+static bool futex_spin_on_owner(u32 __user *uaddr, u32 val)
+{
+	pid_t tid = val & FUTEX_TID_MASK;
+	unsigned long long deadline;
+	struct task_struct *owner;
+	bool changed = false;
+	u32 uval;
+
+	if (!(val & FUTEX_WAITERS) || !tid || tid == current->pid ||
+	    num_online_cpus() == 1)
+		return false;
+
+	owner = futex_find_owner(tid);
+	if (!owner)
+		return false;
+
+	deadline = sched_clock() + FUTEX_SPIN_NS;
+	while (READ_ONCE(owner->on_cpu) && !need_resched()) {
+		if (get_futex_value_locked(&uval, uaddr))
+			break;
+		if (uval != val) {
+			changed = true;
+			break;
+		}
+		if (sched_clock() > deadline)
+			break;
+		cpu_relax();
+	}
+
+	put_task_struct(owner);
+	return changed;
+}
+#else
+static inline bool futex_spin_on_owner(u32 __user *uaddr, u32 val)
+{
+	return false;
+}
+#endif /* CONFIG_FUTEX_SPIN_ON_OWNER */
+
 static long futex_wait_restart(struct restart_block *restart);
 
 static int futex_wait(u32 __user *uaddr, unsigned int flags, u32 val,
 		      ktime_t *abs_time, u32 bitset)
 {
+	struct hrtimer_sleeper timeout, *to = NULL;
 	struct restart_block *restart;
 	struct futex_hash_bucket *hb;
 	struct futex_q q = futex_q_init;
@@ -1029,6 +1217,24 @@ static int futex_wait(u32 __user *uaddr, unsigned int flags, u32 val,
 		return -EINVAL;
 	q.bitset = bitset;
 
+	if (futex_spin_on_owner(uaddr, val))
+		return -EWOULDBLOCK;
+
+	if (abs_time) {
+		to = &timeout;
+
+		hrtimer_init(&to->timer, (flags & FLAGS_CLOCKRT) ?
+			     CLOCK_REALTIME : CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+		hrtimer_init_sleeper(to, current);
+
+		/*
+		 * Arm it once, a spurious wakeup retries with the same
+		 * deadline. If it fires before we are queued, to->task
+		 * is cleared and futex_wait_queue_me() won't sleep.
+		 */
+		hrtimer_start(&to->timer, *abs_time, HRTIMER_MODE_ABS);
+	}
+
 retry:
 	/*
 	 * Prepare to wait on uaddr.
@@ -1039,13 +1245,16 @@ retry:
 		goto out;
 
 	/* queue_me and wait for wakeup, timeout, or a signal. */
-	futex_wait_queue_me(hb, &q);
+	futex_wait_queue_me(hb, &q, to);
 
 	/* If we were woken (and unqueued), we succeeded, whatever. */
 	ret = 0;
 	/* unqueue_me() drops q.key ref */
 	if (!unqueue_me(&q))
 		goto out;
+	ret = -ETIMEDOUT;
+	if (to && !to->task)
+		goto out;
 
 	/*
 	 * We expect signal_pending(current), but we might be the
@@ -1069,6 +1278,8 @@ retry:
 	ret = -ERESTART_RESTARTBLOCK;
 
 out:
+	if (to)
+		hrtimer_cancel(&to->timer);
 	return ret;
 }
 
@@ -1325,6 +1536,12 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 		if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET && \
 		    cmd != FUTEX_WAIT_REQUEUE_PI)
 			return -ENOSYS;
+		/*
+		 * FUTEX_WAIT takes a relative timeout, which the
+		 * syscall has already turned into a CLOCK_MONOTONIC one.
+		 */
+		if (cmd == FUTEX_WAIT)
+			flags &= ~FLAGS_CLOCKRT;
 	}
 
 	switch (cmd) {
@@ -1425,7 +1642,6 @@ static void __init futex_detect_cmpxchg(void)
 int __init futex_init(void)
 {
 	unsigned int futex_shift;
-	unsigned long i;
 
 	/*
 	 * Lego won't have too many futex at the same time..
@@ -1444,12 +1660,7 @@ int __init futex_init(void)
 	futex_hashsize = 1UL << futex_shift;
 
 	futex_detect_cmpxchg();
-
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	futex_hash_init(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -15,6 +15,7 @@
 #include <lego/kernel.h>
 #include <lego/cpumask.h>
 #include <lego/mutex.h>
+#include <lego/rcupdate.h>
 
 static LIST_HEAD(irq_domain_list);
 static DEFINE_MUTEX(irq_domain_mutex);
@@ -187,6 +188,7 @@ unsigned int irq_find_mapping(struct irq_domain *domain,
 			      irq_hw_number_t hwirq)
 {
 	struct irq_data *data;
+	unsigned int virq;
 
 	/* Look for default domain if nececssary */
 	if (domain == NULL)
@@ -205,16 +207,20 @@ unsigned int irq_find_mapping(struct irq_domain *domain,
 		return domain->linear_revmap[hwirq];
 
 	/*
-	 * HACK!!!
-	 *
-	 * We don't have RCU, so have to use mutex to sync
-	 * with concurrent writers. Fortunately, the write
-	 * will NOT happen frequently (at least in current codebase).
+	 * Writers still serialize on revmap_trees_mutex,
+	 * the lookup itself is lockless.
 	 */
-	mutex_lock(&revmap_trees_mutex);
+	rcu_read_lock();
 	data = radix_tree_lookup(&domain->revmap_tree, hwirq);
-	mutex_unlock(&revmap_trees_mutex);
-	return data ? data->irq : 0;
+	virq = data ? data->irq : 0;
+	rcu_read_unlock();
+	return virq;
+}
+
+/* irq_find_mapping() may still see it in the revmap tree */
+static void irq_data_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct irq_data, rcu));
 }
 
 static void irq_domain_free_irq_data(unsigned int virq, unsigned int nr_irqs)
@@ -231,7 +237,7 @@ static void irq_domain_free_irq_data(unsigned int virq, unsigned int nr_irqs)
 		while (tmp) {
 			irq_data = tmp;
 			tmp = tmp->parent_data;
-			kfree(irq_data);
+			call_rcu(&irq_data->rcu, irq_data_free_rcu);
 		}
 	}
 }
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Static keys. See include/lego/jump_label.h for the API.
+ *
+ * All branch sites are collected into __jump_table by the linker.
+ * jump_label_init() patches every site according to the current key
+ * value. Keys are boot-time only, they can not be flipped once the
+ * sites are patched.
+ */
+
+#include <lego/init.h>
+#include <lego/list.h>
+#include <lego/kernel.h>
+#include <lego/printk.h>
+#include <lego/jump_label.h>
+
+#ifdef CONFIG_JUMP_LABEL
+
+/* Defined in linker script */
+extern struct jump_entry __start___jump_table[];
+extern struct jump_entry __stop___jump_table[];
+
+static bool jump_label_initialized __read_mostly;
+
+/*
+ * The branch bit tells the default state of the site. The site is a NOP
+ * when the key is at the value the branch was laid out for, a JMP otherwise.
+ */
+static enum jump_label_type jump_label_type(struct jump_entry *entry)
+{
+	struct static_key *key = jump_entry_key(entry);
+	bool enabled = static_key_enabled(key);
+	bool branch = jump_entry_branch(entry);
+
+	return enabled ^ branch;
+}
+
+void __init jump_label_init(void)
+{
+	struct jump_entry *start = __start___jump_table;
+	struct jump_entry *stop = __stop___jump_table;
+	struct jump_entry *entry;
+	unsigned long nr = stop - start;
+
+	for (entry = start; entry < stop; entry++)
+		arch_jump_label_transform_static(entry, jump_label_type(entry));
+
+	jump_label_initialized = true;
+	pr_info("jump_label: %lu static branch sites\n", nr);
+}
+
+static void __static_key_set(struct static_key *key, int enabled)
+{
+	/*
+	 * Only record the value, jump_label_init() will patch accordingly.
+	 * Afterwards, patching would have to stop every CPU, which never
+	 * happens while pinned pollers spin.
+	 */
+	if (WARN_ONCE(jump_label_initialized,
+		      "jump_label: key %pS flipped after boot\n", key))
+		return;
+
+	atomic_set(&key->enabled, enabled);
+}
+
+#else
+
+static inline void __static_key_set(struct static_key *key, int enabled)
+{
+	atomic_set(&key->enabled, enabled);
+}
+
+#endif /* CONFIG_JUMP_LABEL */
+
+/**
+ * static_key_enable - turn a static key on
+ * @key: the key
+ *
+ * Meant for boot parameters. With CONFIG_JUMP_LABEL, it is ignored
+ * once jump_label_init() has run.
+ */
+void static_key_enable(struct static_key *key)
+{
+	__static_key_set(key, 1);
+}
+
+/**
+ * static_key_disable - turn a static key off
+ * @key: the key
+ *
+ * Meant for boot parameters. With CONFIG_JUMP_LABEL, it is ignored
+ * once jump_label_init() has run.
+ */
+void static_key_disable(struct static_key *key)
+{
+	__static_key_set(key, 0);
+}
@@ -65,6 +65,19 @@ static struct kthread *to_live_kthread(struct task_struct *k)
 	return NULL;
 }
 
+/**
+ * kthread_data - return data value specified on kthread creation
+ * @task: kthread task in question
+ *
+ * Return the data value specified when kthread @task was created.
+ * The caller is responsible for ensuring the validity of @task when
+ * calling this function.
+ */
+void *kthread_data(struct task_struct *task)
+{
+	return to_kthread(task)->data;
+}
+
 /**
  * kthread_should_stop - should this kthread return now?
  *
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Split large boot time initialization across all online CPUs.
+ *
+ * Walking every struct page, every pcache line, or clearing gigabytes
+ * of buffers is way too slow on a single CPU. Once SMP is up and kthreadd
+ * is running, users can describe the work as a range, and this file
+ * spreads it over one pinned thread per CPU. The caller works on the
+ * first chunk itself and returns when all chunks are done.
+ */
+
+#include <lego/slab.h>
+#include <lego/sizes.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/string.h>
+#include <lego/parallel.h>
+#include <lego/completion.h>
+
+#include <asm/numa.h>
+
+struct parallel_control {
+	struct parallel_job	*job;
+	atomic_t		nr_pending;
+	struct completion	done;
+};
+
+struct parallel_work {
+	struct parallel_control	*pc;
+	unsigned long		start;
+	unsigned long		end;
+};
+
+static void parallel_work_done(struct parallel_work *pw)
+{
+	struct parallel_control *pc = pw->pc;
+
+	pc->job->thread_fn(pw->start, pw->end, pc->job->fn_arg);
+	if (atomic_dec_and_test(&pc->nr_pending))
+		complete(&pc->done);
+}
+
+static int parallel_thread_fn(void *_pw)
+{
+	parallel_work_done(_pw);
+	return 0;
+}
+
+/**
+ * parallel_do_job - run a job on all online CPUs
+ * @job: description of the job
+ *
+ * Must be called from a context that can sleep, after kthreadd is up.
+ * Falls back to the calling thread if helper threads can not be created.
+ */
+void __init parallel_do_job(struct parallel_job *job)
+{
+	struct parallel_control pc;
+	struct parallel_work *works, *pw;
+	unsigned long nr_works, chunk, start, end;
+	struct task_struct *p;
+	int i, cpu, this_cpu;
+
+	if (!job->size)
+		return;
+
+	nr_works = DIV_ROUND_UP(job->size, max(job->min_chunk, 1UL));
+	nr_works = clamp_t(unsigned long, nr_works, 1, num_online_cpus());
+
+	chunk = DIV_ROUND_UP(job->size, nr_works);
+	chunk = roundup(chunk, max(job->align, 1UL));
+	nr_works = DIV_ROUND_UP(job->size, chunk);
+
+	works = kmalloc_array(nr_works, sizeof(*works), GFP_KERNEL);
+	if (!works || nr_works == 1) {
+		job->thread_fn(job->start, job->start + job->size, job->fn_arg);
+		kfree(works);
+		return;
+	}
+
+	pc.job = job;
+	atomic_set(&pc.nr_pending, nr_works);
+	init_completion(&pc.done);
+
+	start = job->start;
+	end = job->start + job->size;
+	for (i = 0; i < nr_works; i++) {
+		pw = &works[i];
+		pw->pc = &pc;
+		pw->start = start;
+		pw->end = min(start + chunk, end);
+		start = pw->end;
+	}
+
+	/*
+	 * works[0] is left for ourselves,
+	 * the rest go to other CPUs, one each.
+	 */
+	this_cpu = smp_processor_id();
+	i = 1;
+	for_each_online_cpu(cpu) {
+		if (cpu == this_cpu)
+			continue;
+		if (i >= nr_works)
+			break;
+
+		pw = &works[i];
+		p = kthread_create_on_node(parallel_thread_fn, pw, cpu_to_node(cpu),
+					   0, "%s/%d", job->name, cpu);
+		if (IS_ERR(p))
+			break;
+		kthread_bind(p, cpu);
+		wake_up_process(p);
+		i++;
+	}
+
+	/* Whatever is left is ours */
+	for (; i < nr_works; i++)
+		parallel_work_done(&works[i]);
+	parallel_work_done(&works[0]);
+
+	wait_for_completion(&pc.done);
+	kfree(works);
+}
+
+static void __init parallel_clear_fn(unsigned long start, unsigned long end, void *base)
+{
+	memset(base + start, 0, end - start);
+}
+
+/**
+ * parallel_clear - clear a large buffer on all online CPUs
+ * @ptr: start of the buffer
+ * @size: size of the buffer in bytes
+ * @name: name of the helper threads
+ */
+void __init parallel_clear(void *ptr, unsigned long size, const char *name)
+{
+	struct parallel_job job = {
+		.thread_fn	= parallel_clear_fn,
+		.fn_arg		= ptr,
+		.start		= 0,
+		.size		= size,
+		.align		= PAGE_SIZE,
+		.min_chunk	= SZ_64M,
+		.name		= name,
+	};
+
+	parallel_do_job(&job);
+}
@@ -51,7 +51,7 @@ void free_pid(pid_t pid)
 	spin_lock(&pid_lock);
 	BUG_ON(!test_and_clear_bit(pid, pid_map));
 	BUG_ON(!pid_task_map[pid]);
-	pid_task_map[pid] = NULL;
+	WRITE_ONCE(pid_task_map[pid], NULL);
 	spin_unlock(&pid_lock);
 }
 
@@ -60,7 +60,7 @@ struct task_struct *find_task_by_pid(pid_t pid)
 	if (pid <= 0 || pid >= DEFAULT_MAX_PID)
 		return NULL;
 
-	return pid_task_map[pid];
+	return READ_ONCE(pid_task_map[pid]);
 }
 
 void __init pid_init(void)
@@ -8,11 +8,17 @@
  */
 
 #include <lego/tty.h>
+#include <lego/tick.h>
+#include <lego/slab.h>
 #include <lego/sched.h>
 #include <lego/kernel.h>
+#include <lego/percpu.h>
 #include <lego/printk.h>
+#include <lego/kthread.h>
 #include <lego/linkage.h>
+#include <lego/uaccess.h>
 #include <lego/spinlock.h>
+#include <lego/syscalls.h>
 #include <lego/ratelimit.h>
 
 #define LOG_LINE_MAX	2048
@@ -30,7 +36,7 @@ static inline int printk_get_level(const char *buffer)
 	return 0;
 }
 
-static size_t print_time(unsigned char *buf, u64 ts)
+static size_t print_time(char *buf, u64 ts)
 {
 	unsigned long rem_nsec;
 
@@ -40,34 +46,24 @@ static size_t print_time(unsigned char *buf, u64 ts)
 		(unsigned long)ts, rem_nsec / 1000);
 }
 
+#ifndef CONFIG_PRINTK_ASYNC
 static DEFINE_SPINLOCK(printk_lock);
 
 static char TEXTBUF[LOG_LINE_MAX];
 
-/**
- * printk - print a kernel message
- * @fmt: format string
- *
- * See the vsnprintf() documentation for format string extensions over C99.
- */
-asmlinkage __printf(1, 2)
-int printk(const char *fmt, ...)
+int vprintk(const char *fmt, va_list args)
 {
 	unsigned char *text = TEXTBUF;
 	unsigned char *output_buf;
 	size_t time_len, fmt_len, len, ret_len;
-	va_list args;
 	unsigned long flags;
 
 	spin_lock_irqsave(&printk_lock, flags);
-	memset(text, 0, LOG_LINE_MAX);
 
-	time_len = print_time(text, sched_clock());
+	time_len = print_time((char *)text, sched_clock());
 	text += time_len;
 
-	va_start(args, fmt);
 	fmt_len = vsnprintf(text, LOG_LINE_MAX - time_len, fmt, args);
-	va_end(args);
 
 	switch (printk_get_level(text)) {
 	case '0' ... '7':
@@ -93,44 +89,590 @@ int printk(const char *fmt, ...)
 	return ret_len;
 }
 
+SYSCALL_DEFINE3(syslog, int, type, char __user *, buf, int, len)
+{
+	return -ENOSYS;
+}
+#else
+/*
+ * Per-cpu lockless log buffers
+ *
+ * printk() formats into a per-cpu scratch buffer and appends a record
+ * to the ring of its own CPU, with irq disabled. No lock is shared with
+ * other CPUs, the only shared write is the global sequence number that
+ * orders records across rings. A full ring overwrites its oldest records.
+ *
+ * The tty is written by the printk kthread, which merges all rings in
+ * sequence order. The tick wakes it up if the local ring has something
+ * new. Before the kthread runs and after panic, printk() drains the rings
+ * itself, like the old synchronous printk did.
+ *
+ * Readers never block the writer: a record copied out is only valid if
+ * the ring tail did not pass it meanwhile, otherwise the copy is retried.
+ */
+
+#define LOG_CPU_BUF_SIZE	(1UL << CONFIG_LOG_CPU_BUF_SHIFT)
+#define LOG_CPU_BUF_MASK	(LOG_CPU_BUF_SIZE - 1)
+
+#define LOG_PREFIX_MAX		32
+
+#define LOG_CONT		0x01	/* KERN_CONT, no prefix */
+#define LOG_PAD			0x02	/* fills the ring up to its end */
+
+struct printk_log {
+	u32	size;		/* header + text, 8 byte aligned */
+	u16	text_len;
+	u8	level;
+	u8	flags;
+	u64	seq;
+	u64	ts_nsec;
+};
+
+/**
+ * struct printk_ring - per cpu log buffer
+ * @head:	position of the next record, only moved by the owner CPU
+ * @tail:	position of the oldest record
+ * @nesting:	printk() is running on this CPU, NMI re-entry is dropped
+ * @storing:	a record has taken its seq but is not published yet
+ * @textbuf:	scratch buffer to format into
+ *
+ * Positions increase monotonically, the offset in @buf is pos & mask.
+ */
+struct printk_ring {
+	unsigned long		head;
+	unsigned long		tail;
+	int			nesting;
+	int			storing;
+	char			textbuf[LOG_LINE_MAX];
+	char			buf[LOG_CPU_BUF_SIZE] __aligned(8);
+};
+
+static DEFINE_PER_CPU(struct printk_ring, printk_rings);
+
+static atomic64_t log_next_seq = ATOMIC64_INIT(1);
+static u64 syslog_clear_seq;
+
+/* Set once per-cpu areas are in place, printk() is synchronous before */
+static bool printk_rings_ready __read_mostly;
+static bool printk_sync __read_mostly = true;
+static struct task_struct *printk_task;
+
+/* Console state, under console_lock */
+static DEFINE_SPINLOCK(console_lock);
+static unsigned long console_pos[NR_CPUS];
+static u64 console_seq;
+static char console_text[LOG_PREFIX_MAX + LOG_LINE_MAX];
+
+/* Position after the record at @pos, the owner CPU only */
+static unsigned long log_next(struct printk_ring *r, unsigned long pos)
+{
+	unsigned long off = pos & LOG_CPU_BUF_MASK;
+
+	if (LOG_CPU_BUF_SIZE - off < sizeof(struct printk_log))
+		return pos + LOG_CPU_BUF_SIZE - off;
+	return pos + ((struct printk_log *)(r->buf + off))->size;
+}
+
+static void log_store(struct printk_ring *r, int level, u8 flags,
+		      const char *text, size_t text_len)
+{
+	struct printk_log *log;
+	unsigned long pos, off, pad, size, end;
+
+	text_len = min_t(size_t, text_len, LOG_LINE_MAX);
+	size = ALIGN(sizeof(*log) + text_len, 8);
+
+	pos = r->head;
+	off = pos & LOG_CPU_BUF_MASK;
+	pad = 0;
+	if (off + size > LOG_CPU_BUF_SIZE)
+		pad = LOG_CPU_BUF_SIZE - off;
+	end = pos + pad + size;
+
+	/* Free up the space, readers check tail after their copy */
+	while (end - r->tail > LOG_CPU_BUF_SIZE)
+		WRITE_ONCE(r->tail, log_next(r, r->tail));
+	smp_wmb();
+
+	if (pad >= sizeof(*log)) {
+		log = (struct printk_log *)(r->buf + off);
+		log->size = pad;
+		log->flags = LOG_PAD;
+	}
+
+	/* Readers wait for us if they see a later seq, see console_wait_stores() */
+	WRITE_ONCE(r->storing, 1);
+	smp_mb();
+
+	log = (struct printk_log *)(r->buf + ((pos + pad) & LOG_CPU_BUF_MASK));
+	log->size = size;
+	log->text_len = text_len;
+	log->level = level;
+	log->flags = flags;
+	log->seq = atomic64_inc_return(&log_next_seq);
+	log->ts_nsec = sched_clock();
+	memcpy(log + 1, text, text_len);
+
+	/* Publish the record */
+	smp_wmb();
+	WRITE_ONCE(r->head, end);
+	smp_wmb();
+	WRITE_ONCE(r->storing, 0);
+}
+
+/*
+ * Copy the record at *@pos of @r into @log and @text, at most
+ * @size bytes of text. Skip records that have been overwritten,
+ * their number is added to *@lost if it is not NULL.
+ *
+ * Return true and advance *@pos if there was one.
+ */
+static bool log_read(struct printk_ring *r, unsigned long *pos,
+		     struct printk_log *log, char *text, size_t size,
+		     unsigned long *lost)
+{
+	unsigned long tail, head, off;
+	struct printk_log *p;
+	bool valid;
+
+again:
+	tail = READ_ONCE(r->tail);
+	if ((long)(*pos - tail) < 0) {
+		if (lost)
+			(*lost)++;
+		*pos = tail;
+	}
+
+	head = READ_ONCE(r->head);
+	smp_rmb();
+	if (*pos == head)
+		return false;
+
+	off = *pos & LOG_CPU_BUF_MASK;
+	if (LOG_CPU_BUF_SIZE - off < sizeof(*log)) {
+		*pos += LOG_CPU_BUF_SIZE - off;
+		goto again;
+	}
+
+	p = (struct printk_log *)(r->buf + off);
+	memcpy(log, p, sizeof(*log));
+	valid = log->size >= sizeof(*log) &&
+		log->size <= LOG_CPU_BUF_SIZE - off &&
+		log->text_len <= log->size - sizeof(*log);
+	if (valid && text && !(log->flags & LOG_PAD))
+		memcpy(text, p + 1, min_t(size_t, log->text_len, size));
+
+	/* Did the writer overwrite it while we were copying? */
+	smp_rmb();
+	if ((long)(*pos - READ_ONCE(r->tail)) < 0)
+		goto again;
+
+	if (WARN_ON_ONCE(!valid)) {
+		*pos = head;
+		return false;
+	}
+
+	*pos += log->size;
+	if (log->flags & LOG_PAD)
+		goto again;
+	return true;
+}
+
+/* Sequence number of the record at @pos, 0 if none */
+static u64 log_peek_seq(struct printk_ring *r, unsigned long pos)
+{
+	struct printk_log log;
+
+	if (!log_read(r, &pos, &log, NULL, 0, NULL))
+		return 0;
+	return log.seq;
+}
+
+/*
+ * Pick the CPU whose next record at pos[cpu] is the oldest one.
+ * Return -1 if all rings are empty.
+ */
+static int log_oldest_cpu(unsigned long *pos)
+{
+	u64 seq, min_seq = 0;
+	int cpu, oldest = -1;
+
+	for_each_possible_cpu(cpu) {
+		seq = log_peek_seq(per_cpu_ptr(&printk_rings, cpu), pos[cpu]);
+		if (seq && (!min_seq || seq < min_seq)) {
+			min_seq = seq;
+			oldest = cpu;
+		}
+	}
+	return oldest;
+}
+
+/* The text is at @out + LOG_PREFIX_MAX, prepend the timestamp */
+static size_t __log_format(u8 flags, u64 ts_nsec, size_t text_len, char *out)
+{
+	size_t len = 0;
+
+	if (!(flags & LOG_CONT))
+		len = print_time(out, ts_nsec);
+	memmove(out + len, out + LOG_PREFIX_MAX, text_len);
+	return len + text_len;
+}
+
+static inline size_t log_format(struct printk_log *log, char *out)
+{
+	return __log_format(log->flags, log->ts_nsec, log->text_len, out);
+}
+
+/*
+ * A record with a smaller seq may still be in flight on another CPU,
+ * which has irq disabled while storing. Wait for it a little, but do
+ * not hang on a CPU that was stopped in the middle.
+ */
+static void console_wait_stores(void)
+{
+	int cpu, spins;
+
+	smp_rmb();
+	for_each_possible_cpu(cpu) {
+		for (spins = 0; spins < 100000; spins++) {
+			if (!READ_ONCE(per_cpu(printk_rings, cpu).storing))
+				break;
+			cpu_relax();
+		}
+	}
+}
+
+/*
+ * Write the oldest pending record to the tty.
+ * Called with console_lock held and irq disabled.
+ *
+ * Return false if there is nothing left.
+ */
+static bool __console_flush_one(void)
+{
+	struct printk_ring *r;
+	struct printk_log log;
+	unsigned long lost;
+	bool waited = false;
+	size_t len;
+	int cpu;
+
+again:
+	cpu = log_oldest_cpu(console_pos);
+	if (cpu < 0)
+		return false;
+
+	r = per_cpu_ptr(&printk_rings, cpu);
+
+	/* A gap, the missing ones may be stored right now */
+	if (!waited && console_seq &&
+	    log_peek_seq(r, console_pos[cpu]) != console_seq + 1) {
+		console_wait_stores();
+		waited = true;
+		goto again;
+	}
+
+	lost = 0;
+	if (!log_read(r, &console_pos[cpu], &log,
+		      console_text + LOG_PREFIX_MAX, LOG_LINE_MAX, &lost))
+		return true;
+
+	if (unlikely(lost)) {
+		char msg[64];
+
+		len = sprintf(msg, "** CPU%d: printk messages lost **\n", cpu);
+		tty_write(msg, len);
+	}
+
+	console_seq = log.seq;
+	len = log_format(&log, console_text);
+	tty_write(console_text, len);
+	return true;
+}
+
+static bool console_pending(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (READ_ONCE(per_cpu(printk_rings, cpu).head) != console_pos[cpu])
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Drain the rings if nobody else is doing so. Whoever holds
+ * console_lock will print our records before it stops, check
+ * again after unlock for records that came in just before that.
+ *
+ * The tty is slow, so irq are only disabled for one record at a time.
+ */
+static void console_flush(void)
+{
+	unsigned long flags;
+	bool more;
+
+	do {
+		local_irq_save(flags);
+		if (!spin_trylock(&console_lock)) {
+			local_irq_restore(flags);
+			return;
+		}
+		more = __console_flush_one();
+		spin_unlock(&console_lock);
+		local_irq_restore(flags);
+	} while (more || console_pending());
+}
+
 int vprintk(const char *fmt, va_list args)
 {
-	unsigned char *text = TEXTBUF;
-	unsigned char *output_buf;
-	size_t time_len, fmt_len, len, ret_len;
+	struct printk_ring *r;
 	unsigned long flags;
+	char *text;
+	size_t len;
+	int level;
+	u8 log_flags = 0;
 
-	spin_lock_irqsave(&printk_lock, flags);
+	/* Early boot, only one CPU is running */
+	if (unlikely(!printk_rings_ready)) {
+		len = vscnprintf(console_text + LOG_PREFIX_MAX, LOG_LINE_MAX, fmt, args);
+		text = console_text + LOG_PREFIX_MAX;
+		if (printk_get_level(text)) {
+			if (text[1] == 'c')
+				log_flags = LOG_CONT;
+			memmove(text, text + 2, len - 2);
+			len -= 2;
+		}
+		return tty_write(console_text, __log_format(log_flags,
+							    sched_clock(), len,
+							    console_text));
+	}
 
-	time_len = print_time(text, sched_clock());
-	text += time_len;
+	local_irq_save(flags);
+	r = this_cpu_ptr(&printk_rings);
+	if (unlikely(r->nesting)) {
+		local_irq_restore(flags);
+		return 0;
+	}
+	r->nesting++;
 
-	fmt_len = vsnprintf(text, LOG_LINE_MAX - time_len, fmt, args);
+	text = r->textbuf;
+	len = vscnprintf(text, LOG_LINE_MAX, fmt, args);
 
+	level = LOGLEVEL_DEFAULT;
 	switch (printk_get_level(text)) {
 	case '0' ... '7':
+		level = text[1] - '0';
+		/* fall through */
 	case 'd':
-		output_buf = TEXTBUF;
-		len = time_len + fmt_len - 2;
-		memmove(text, text + 2, fmt_len - 2);
+		text += 2;
+		len -= 2;
 		break;
 	case 'c':
-		/* Contiguous printk(). Do not print prefix */
-		output_buf = text;
-		len = fmt_len - 2;
-		memmove(text, text+ 2, fmt_len - 2);
+		log_flags = LOG_CONT;
+		text += 2;
+		len -= 2;
 		break;
-	default:
-		output_buf = TEXTBUF;
-		len = time_len + fmt_len;
-	};
+	}
 
-	ret_len = tty_write(output_buf, len);
-	spin_unlock_irqrestore(&printk_lock, flags);
+	log_store(r, level, log_flags, text, len);
+	r->nesting--;
+	local_irq_restore(flags);
 
-	return ret_len;
+	if (unlikely(READ_ONCE(printk_sync)))
+		console_flush();
+	return len;
+}
+
+static inline bool ring_pending(int cpu)
+{
+	return READ_ONCE(per_cpu(printk_rings, cpu).head) !=
+	       READ_ONCE(console_pos[cpu]);
 }
 
+/*
+ * Called by the tick on every CPU, with irq disabled.
+ * Kick the console kthread if this CPU has logged something.
+ *
+ * nohz_full CPUs may not have a tick for long, CPU0 always has one
+ * and checks their rings for them.
+ */
+void printk_tick(void)
+{
+	int cpu = smp_processor_id();
+
+	if (unlikely(!printk_task || READ_ONCE(printk_sync)))
+		return;
+
+	if (ring_pending(cpu))
+		goto wake;
+
+#ifdef CONFIG_NO_HZ_FULL
+	if (cpu == 0 && tick_nohz_full_running) {
+		for_each_cpu(cpu, &tick_nohz_full_mask) {
+			if (ring_pending(cpu))
+				goto wake;
+		}
+	}
+#endif
+	return;
+
+wake:
+	wake_up_process(printk_task);
+}
+
+static int printk_thread(void *unused)
+{
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!console_pending())
+			schedule_timeout(HZ);
+		__set_current_state(TASK_RUNNING);
+
+		console_flush();
+		cond_resched();
+	}
+	return 0;
+}
+
+/* Per-cpu areas are set up, start logging into the rings */
+void __init printk_init(void)
+{
+	printk_rings_ready = true;
+}
+
+/* Hand the tty over to the kthread */
+void __init printk_late_init(void)
+{
+	struct task_struct *tsk;
+
+	tsk = kthread_run(printk_thread, NULL, "printkd");
+	if (IS_ERR(tsk)) {
+		pr_err("Fail to create printkd, printk stays synchronous\n");
+		return;
+	}
+
+	printk_task = tsk;
+	smp_wmb();
+	WRITE_ONCE(printk_sync, false);
+}
+
+/*
+ * The system is going down, print everything we have now and print
+ * synchronously from now on. Take over console_lock if its holder
+ * does not give it back, it may have been stopped while printing.
+ */
+void printk_flush_on_panic(void)
+{
+	unsigned long timeout = 1000000;
+
+	WRITE_ONCE(printk_sync, true);
+
+	while (!spin_trylock(&console_lock)) {
+		if (!--timeout) {
+			spin_lock_init(&console_lock);
+			continue;
+		}
+		cpu_relax();
+	}
+	while (__console_flush_one())
+		;
+	spin_unlock(&console_lock);
+}
+
+/*
+ * dmesg reader
+ */
+#define SYSLOG_ACTION_READ_ALL		3
+#define SYSLOG_ACTION_READ_CLEAR	4
+#define SYSLOG_ACTION_CLEAR		5
+#define SYSLOG_ACTION_SIZE_BUFFER	10
+
+/* Copy out all records newer than syslog_clear_seq, oldest first */
+static int syslog_read_all(char __user *buf, int size, bool clear)
+{
+	unsigned long *pos;
+	struct printk_log log;
+	char *text;
+	int cpu, len, copied = 0;
+	u64 last_seq = 0;
+
+	pos = kmalloc(sizeof(*pos) * nr_cpu_ids, GFP_KERNEL);
+	text = kmalloc(LOG_PREFIX_MAX + LOG_LINE_MAX, GFP_KERNEL);
+	if (!pos || !text) {
+		copied = -ENOMEM;
+		goto out;
+	}
+
+	for_each_possible_cpu(cpu)
+		pos[cpu] = READ_ONCE(per_cpu(printk_rings, cpu).tail);
+
+	while ((cpu = log_oldest_cpu(pos)) >= 0) {
+		if (!log_read(per_cpu_ptr(&printk_rings, cpu), &pos[cpu], &log,
+			      text + LOG_PREFIX_MAX, LOG_LINE_MAX, NULL))
+			continue;
+		if (log.seq <= syslog_clear_seq)
+			continue;
+
+		len = log_format(&log, text);
+		if (copied + len > size)
+			break;
+		if (copy_to_user(buf + copied, text, len)) {
+			copied = -EFAULT;
+			goto out;
+		}
+		copied += len;
+		last_seq = log.seq;
+	}
+
+	if (clear && last_seq)
+		syslog_clear_seq = last_seq;
+out:
+	kfree(text);
+	kfree(pos);
+	return copied;
+}
+
+SYSCALL_DEFINE3(syslog, int, type, char __user *, buf, int, len)
+{
+	switch (type) {
+	case SYSLOG_ACTION_READ_ALL:
+	case SYSLOG_ACTION_READ_CLEAR:
+		if (!buf || len < 0)
+			return -EINVAL;
+		if (!len)
+			return 0;
+		return syslog_read_all(buf, len,
+				       type == SYSLOG_ACTION_READ_CLEAR);
+	case SYSLOG_ACTION_CLEAR:
+		syslog_clear_seq = atomic64_read(&log_next_seq) - 1;
+		return 0;
+	case SYSLOG_ACTION_SIZE_BUFFER:
+		return LOG_CPU_BUF_SIZE * num_possible_cpus();
+	}
+	return -EINVAL;
+}
+#endif /* CONFIG_PRINTK_ASYNC */
+
+/**
+ * printk - print a kernel message
+ * @fmt: format string
+ *
+ * See the vsnprintf() documentation for format string extensions over C99.
+ */
+asmlinkage __printf(1, 2)
+int printk(const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vprintk(fmt, args);
+	va_end(args);
+
+	return ret;
+}
 /*
  * printk rate limiting, lifted from the networking subsystem.
  *
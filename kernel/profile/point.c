@@ -8,6 +8,8 @@
  */
 
 #include <lego/bug.h>
+#include <lego/init.h>
+#include <lego/string.h>
 #include <lego/kernel.h>
 #include <lego/atomic.h>
 #include <lego/profile.h>
@@ -15,6 +17,23 @@
 /* Profile Point */
 extern struct profile_point __sprofilepoint[], __eprofilepoint[];
 
+/*
+ * profile_points=off turns all points off at boot.
+ * Like all static keys, this can not be changed later.
+ */
+static int __init profile_points_setup(char *str)
+{
+	struct profile_point *pp;
+
+	if (!str || strcmp(str, "off"))
+		return -EINVAL;
+
+	for (pp = __sprofilepoint; pp < __eprofilepoint; pp++)
+		static_branch_disable(&pp->key);
+	return 0;
+}
+__setup("profile_points", profile_points_setup);
+
 void print_profile_point(struct profile_point *pp)
 {
 	struct timespec ts = {0, 0};
@@ -31,7 +50,7 @@ void print_profile_point(struct profile_point *pp)
 
 print:
 	pr_info("%s  %35s  %6Ld.%09Ld  %16ld  %16ld\n",
-		pp->enabled? "     on" : "    off",
+		static_key_enabled_type(&pp->key) ? "     on" : "    off",
 		pp->pp_name,
 		(s64)ts.tv_sec, (s64)ts.tv_nsec,
 		nr,
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Read-Copy Update
+ *
+ * Lego kernel is not preemptible, so a reader only has to not sleep
+ * inside rcu_read_lock(). Each CPU counts its quiescent states, points
+ * where it can not be inside a reader: context switch, cond_resched(),
+ * and a tick that interrupted user mode or the idle loop.
+ *
+ * A grace period snapshots the counter of all other online CPUs, and
+ * ends once each of them moved. Grace periods are serialized, callers
+ * that arrive while one is running share the next one.
+ *
+ * Pinned kernel threads that busy poll, e.g. thpool workers and FIT
+ * polling threads, never schedule and may run with irq disabled. They
+ * report a quiescent state by calling rcu_qs() in their polling loops.
+ *
+ * A nohz_full CPU running user code or idle has no tick to report its
+ * quiescent state. A CPU lagging behind is sent a reschedule IPI, which
+ * restarts its tick for at least one period.
+ *
+ * call_rcu() callbacks are queued per-cpu and run in batches by the
+ * rcu_gp kthread, after one grace period for the whole batch.
+ */
+
+#define pr_fmt(fmt) "rcu: " fmt
+
+#include <lego/smp.h>
+#include <lego/init.h>
+#include <lego/wait.h>
+#include <lego/mutex.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/kthread.h>
+#include <lego/cpumask.h>
+#include <lego/jiffies.h>
+#include <lego/rcupdate.h>
+
+#define ULONG_CMP_LT(a, b)	(ULONG_MAX / 2 < (a) - (b))
+
+DEFINE_PER_CPU(unsigned long, rcu_qs_ctr);
+
+/*
+ * Low bit set while a grace period is running,
+ * the rest counts completed grace periods.
+ */
+static unsigned long rcu_gp_seq;
+static DEFINE_MUTEX(rcu_gp_mutex);
+
+/* Counter snapshots of the running grace period */
+static DEFINE_PER_CPU(unsigned long, rcu_qs_snap);
+
+/* Jiffies to wait before kicking a lagging CPU */
+#define RCU_KICK_DELAY		2
+
+void rcu_note_context_switch(void)
+{
+	rcu_qs();
+}
+
+/*
+ * Called from the tick, irq disabled. Interrupts do not nest,
+ * so the tick interrupted @user mode or the idle loop directly.
+ */
+void rcu_check_callbacks(int user)
+{
+	if (user || (current->flags & PF_IDLE))
+		rcu_qs();
+}
+
+static void rcu_gp_wait_cpus(struct cpumask *pending)
+{
+	unsigned long kick = jiffies + RCU_KICK_DELAY;
+	int cpu;
+
+	for (;;) {
+		for_each_cpu(cpu, pending) {
+			if (smp_load_acquire(per_cpu_ptr(&rcu_qs_ctr, cpu)) !=
+			    per_cpu(rcu_qs_snap, cpu))
+				cpumask_clear_cpu(cpu, pending);
+		}
+		if (cpumask_empty(pending))
+			break;
+
+		if (time_after(jiffies, kick)) {
+			for_each_cpu(cpu, pending)
+				smp_send_reschedule(cpu);
+			kick = jiffies + RCU_KICK_DELAY;
+		}
+		schedule_timeout_uninterruptible(1);
+	}
+}
+
+static void rcu_gp(void)
+{
+	struct cpumask pending;
+	int cpu, this_cpu;
+
+	WRITE_ONCE(rcu_gp_seq, rcu_gp_seq + 1);
+
+	/* Order removal by the updater before the snapshots */
+	smp_mb();
+
+	/*
+	 * We are running, so this CPU is not inside a reader.
+	 * Migrating away during the wait does not matter either.
+	 */
+	this_cpu = get_cpu();
+	cpumask_copy(&pending, cpu_online_mask);
+	cpumask_clear_cpu(this_cpu, &pending);
+	put_cpu();
+
+	for_each_cpu(cpu, &pending)
+		per_cpu(rcu_qs_snap, cpu) = READ_ONCE(per_cpu(rcu_qs_ctr, cpu));
+
+	rcu_gp_wait_cpus(&pending);
+
+	/* Order the end of all readers before the caller frees */
+	smp_mb();
+	WRITE_ONCE(rcu_gp_seq, rcu_gp_seq + 1);
+}
+
+/**
+ * synchronize_rcu - wait until a grace period has elapsed
+ *
+ * Upon return, all RCU read-side critical sections that were running
+ * when synchronize_rcu() was called have completed. Must not be called
+ * from within a reader, or from atomic context.
+ */
+void synchronize_rcu(void)
+{
+	unsigned long done;
+
+	if (num_online_cpus() == 1)
+		return;
+
+	/* A grace period running now may have started before us */
+	done = (READ_ONCE(rcu_gp_seq) + 3) & ~1UL;
+
+	mutex_lock(&rcu_gp_mutex);
+	if (ULONG_CMP_LT(READ_ONCE(rcu_gp_seq), done))
+		rcu_gp();
+	mutex_unlock(&rcu_gp_mutex);
+}
+
+struct rcu_cblist {
+	spinlock_t		lock;
+	struct rcu_head		*head;
+	struct rcu_head		**tail;
+};
+
+static DEFINE_PER_CPU(struct rcu_cblist, rcu_cblist);
+static DEFINE_WAIT_QUEUE_HEAD(rcu_gp_wq);
+static bool rcu_cbs_queued;
+
+/**
+ * call_rcu - queue a callback to run after a grace period
+ * @head: structure to be used for queueing the RCU updates
+ * @func: actual callback function to be invoked after the grace period
+ *
+ * The callback runs in the rcu_gp kthread, it may sleep.
+ * Can be called from any context.
+ */
+void call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+	struct rcu_cblist *cbl;
+	unsigned long flags;
+
+	head->func = func;
+	head->next = NULL;
+
+	local_irq_save(flags);
+	cbl = this_cpu_ptr(&rcu_cblist);
+	spin_lock(&cbl->lock);
+	*cbl->tail = head;
+	cbl->tail = &head->next;
+	spin_unlock(&cbl->lock);
+	local_irq_restore(flags);
+
+	if (!READ_ONCE(rcu_cbs_queued)) {
+		WRITE_ONCE(rcu_cbs_queued, true);
+		wake_up(&rcu_gp_wq);
+	}
+}
+
+/* Steal the callbacks queued on all CPUs so far */
+static struct rcu_head *rcu_collect_callbacks(void)
+{
+	struct rcu_head *list = NULL, **tail = &list;
+	unsigned long flags;
+	int cpu;
+
+	WRITE_ONCE(rcu_cbs_queued, false);
+	smp_mb();
+
+	for_each_possible_cpu(cpu) {
+		struct rcu_cblist *cbl = &per_cpu(rcu_cblist, cpu);
+
+		spin_lock_irqsave(&cbl->lock, flags);
+		if (cbl->head) {
+			*tail = cbl->head;
+			tail = cbl->tail;
+			cbl->head = NULL;
+			cbl->tail = &cbl->head;
+		}
+		spin_unlock_irqrestore(&cbl->lock, flags);
+	}
+	return list;
+}
+
+static int rcu_gp_kthread(void *unused)
+{
+	struct rcu_head *list, *next;
+
+	for (;;) {
+		wait_event(rcu_gp_wq, READ_ONCE(rcu_cbs_queued));
+
+		list = rcu_collect_callbacks();
+		if (!list)
+			continue;
+
+		synchronize_rcu();
+
+		for (; list; list = next) {
+			next = list->next;
+			list->func(list);
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+void __init rcu_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rcu_cblist *cbl = &per_cpu(rcu_cblist, cpu);
+
+		spin_lock_init(&cbl->lock);
+		cbl->head = NULL;
+		cbl->tail = &cbl->head;
+	}
+}
+
+/* Callbacks queued before this run once the kthread is up */
+void __init rcu_spawn_gp_kthread(void)
+{
+	struct task_struct *p;
+
+	p = kthread_run(rcu_gp_kthread, NULL, "rcu_gp");
+	if (IS_ERR(p))
+		panic("rcu: fail to create rcu_gp kthread\n");
+	WRITE_ONCE(rcu_cbs_queued, true);
+	wake_up(&rcu_gp_wq);
+}
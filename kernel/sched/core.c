@@ -8,7 +8,10 @@
  */
 
 #include <lego/smp.h>
+#include <lego/init.h>
 #include <lego/pid.h>
+#include <lego/tick.h>
+#include <lego/workqueue.h>
 #include <lego/time.h>
 #include <lego/mutex.h>
 #include <lego/sched.h>
@@ -18,6 +21,7 @@
 #include <lego/jiffies.h>
 #include <lego/cpumask.h>
 #include <lego/spinlock.h>
+#include <lego/rcupdate.h>
 #include <lego/syscalls.h>
 #include <lego/stop_machine.h>
 #include <asm/numa.h>
@@ -136,6 +140,10 @@ enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	update_rq_clock(rq);
 	p->sched_class->enqueue_task(rq, p, flags);
+
+	/* Need the tick back to preempt */
+	if (rq->nr_running > 1)
+		tick_nohz_full_kick_cpu(cpu_of(rq));
 }
 
 static inline void
@@ -502,7 +510,8 @@ static int __set_cpus_allowed_ptr(struct task_struct *p,
 	if (cpumask_equal(&p->cpus_allowed, new_mask))
 		goto out;
 
-	if (!cpumask_intersects(new_mask, cpu_active_mask)) {
+	if (!cpumask_intersects(new_mask, cpu_active_mask) &&
+	    !cpumask_intersects(new_mask, &cpu_isolated_map)) {
 		ret = -EINVAL;
 		goto out;
 	}
@@ -514,6 +523,8 @@ static int __set_cpus_allowed_ptr(struct task_struct *p,
 		goto out;
 
 	dest_cpu = cpumask_any_and(cpu_active_mask, new_mask);
+	if (dest_cpu >= nr_cpu_ids)
+		dest_cpu = cpumask_any_and(&cpu_isolated_map, new_mask);
 	if (task_running(rq, p) || p->state == TASK_WAKING) {
 		struct migration_arg arg = { p, dest_cpu };
 
@@ -562,6 +573,25 @@ __set_cpus_allowed_ptr(struct task_struct *p, const struct cpumask *new_mask,
 
 #endif
 
+struct cpumask cpu_isolated_map;
+
+/*
+ * isolcpus= CPUs are never marked active, so the scheduler does not
+ * put anything there by itself. They are reserved for threads that
+ * pin themselves with pin_current_thread(). CPU 0 is never isolated.
+ */
+static int __init isolated_cpu_setup(char *str)
+{
+	if (cpulist_parse(str, &cpu_isolated_map) < 0) {
+		pr_err("sched: Error, invalid isolcpus= list: %s\n", str);
+		cpumask_clear(&cpu_isolated_map);
+		return -EINVAL;
+	}
+	cpumask_clear_cpu(0, &cpu_isolated_map);
+	return 0;
+}
+__setup("isolcpus", isolated_cpu_setup);
+
 /**
  * sched_setscheduler_nocheck - change the scheduling policy and/or RT priority of a thread from kernelspace.
  * @p: the task in question.
@@ -581,6 +611,58 @@ int sched_setscheduler_nocheck(struct task_struct *p, int policy,
 	return 0;
 }
 
+void set_user_nice(struct task_struct *p, long nice)
+{
+	bool queued, running;
+	int old_prio, delta;
+	unsigned long flags;
+	struct rq *rq;
+
+	if (task_nice(p) == nice || nice < MIN_NICE || nice > MAX_NICE)
+		return;
+
+	rq = task_rq_lock(p, &flags);
+	update_rq_clock(rq);
+
+	/*
+	 * The RT priorities are set via sched_setscheduler(), but we still
+	 * allow the 'normal' nice value to be set - but as expected
+	 * it wont have any effect on scheduling until the task is
+	 * SCHED_DEADLINE, SCHED_FIFO or SCHED_RR:
+	 */
+	if (task_has_rt_policy(p)) {
+		p->static_prio = NICE_TO_PRIO(nice);
+		goto out_unlock;
+	}
+
+	queued = task_on_rq_queued(p);
+	running = task_current(rq, p);
+	if (queued)
+		dequeue_task(rq, p, DEQUEUE_SAVE);
+	if (running)
+		put_prev_task(rq, p);
+
+	p->static_prio = NICE_TO_PRIO(nice);
+	set_load_weight(p);
+	old_prio = p->prio;
+	p->prio = effective_prio(p);
+	delta = p->prio - old_prio;
+
+	if (queued) {
+		enqueue_task(rq, p, ENQUEUE_RESTORE);
+		/*
+		 * If the task increased its priority or is running and
+		 * lowered its priority, then reschedule its CPU:
+		 */
+		if (delta < 0 || (delta > 0 && task_running(rq, p)))
+			resched_curr(rq);
+	}
+	if (running)
+		p->sched_class->set_curr_task(rq);
+out_unlock:
+	task_rq_unlock(rq, p, &flags);
+}
+
 void sched_set_stop_task(int cpu, struct task_struct *stop)
 {
 	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
@@ -928,6 +1010,54 @@ context_switch(struct rq *rq, struct task_struct *prev, struct task_struct *next
 	return finish_task_switch(prev);
 }
 
+#ifdef CONFIG_SCHED_HRTICK
+/*
+ * Use HR-timers to deliver accurate preemption points.
+ */
+static void hrtick_clear(struct rq *rq)
+{
+	if (hrtimer_is_queued(&rq->hrtick_timer))
+		hrtimer_try_to_cancel(&rq->hrtick_timer);
+}
+
+/*
+ * High-resolution timer tick.
+ * Runs from hardirq context with interrupts disabled.
+ */
+static enum hrtimer_restart hrtick(struct hrtimer *timer)
+{
+	struct rq *rq = container_of(timer, struct rq, hrtick_timer);
+
+	WARN_ON_ONCE(cpu_of(rq) != smp_processor_id());
+
+	spin_lock(&rq->lock);
+	update_rq_clock(rq);
+	rq->curr->sched_class->task_tick(rq, rq->curr, 1);
+	spin_unlock(&rq->lock);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Called with the local rq->lock held and irq disabled.
+ */
+void hrtick_start(struct rq *rq, u64 delay)
+{
+	/* Don't schedule slices shorter than 10000ns */
+	delay = max_t(u64, delay, 10000ULL);
+	hrtimer_start(&rq->hrtick_timer, ns_to_ktime(delay), HRTIMER_MODE_REL);
+}
+
+static void init_rq_hrtick(struct rq *rq)
+{
+	hrtimer_init(&rq->hrtick_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	rq->hrtick_timer.function = hrtick;
+}
+#else
+static inline void hrtick_clear(struct rq *rq) { }
+static inline void init_rq_hrtick(struct rq *rq) { }
+#endif
+
 /*
  * __schedule() is the main scheduler function.
  *
@@ -979,8 +1109,11 @@ static void __sched __schedule(bool preempt)
 	prev = rq->curr;
 
 	local_irq_disable();
+	rcu_note_context_switch();
 	spin_lock(&rq->lock);
 
+	hrtick_clear(rq);
+
 	/*
 	 *		CPU0, task p
 	 *
@@ -1041,13 +1174,39 @@ static void __sched __schedule(bool preempt)
 	balance_callback(rq);
 }
 
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state)
+		return;
+
+	/*
+	 * If a worker went to sleep, notify and ask workqueue whether
+	 * it wants to wake up a task to maintain concurrency.
+	 */
+	if (tsk->flags & PF_WQ_WORKER) {
+		preempt_disable();
+		wq_worker_sleeping(tsk);
+		preempt_enable_no_resched();
+	}
+}
+
+static inline void sched_update_worker(struct task_struct *tsk)
+{
+	if (tsk->flags & PF_WQ_WORKER)
+		wq_worker_running(tsk);
+}
+
 asmlinkage __visible void __sched schedule(void)
 {
+	struct task_struct *tsk = current;
+
+	sched_submit_work(tsk);
 	do {
 		preempt_disable();
 		__schedule(false);
 		preempt_enable_no_resched();
 	} while (need_resched());
+	sched_update_worker(tsk);
 }
 
 /**
@@ -1106,6 +1265,7 @@ int __sched _cond_resched(void)
 		preempt_schedule_common();
 		return 1;
 	}
+	rcu_note_context_switch();
 	return 0;
 }
 #endif
@@ -1145,6 +1305,19 @@ void scheduler_tick(void)
 	spin_unlock(&rq->lock);
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Called with interrupts disabled, at the end of the tick.
+ * With a single runnable task, nobody needs to be preempted.
+ */
+bool sched_can_stop_tick(void)
+{
+	struct rq *rq = this_rq();
+
+	return rq->nr_running <= 1;
+}
+#endif
+
 /*
  * resched_curr - mark rq's current task 'to be rescheduled now'.
  *
@@ -1185,12 +1358,6 @@ static inline void ttwu_activate(struct rq *rq, struct task_struct *p, int en_fl
 {
 	activate_task(rq, p, en_flags);
 	p->on_rq = TASK_ON_RQ_QUEUED;
-
-#if 0
-	/* if a worker is waking up, notify workqueue */
-	if (p->flags & PF_WQ_WORKER)
-		wq_worker_waking_up(p, cpu_of(rq));
-#endif
 }
 
 static void
@@ -1236,6 +1403,8 @@ void sched_ttwu_pending(void)
 
 void scheduler_ipi(void)
 {
+	tick_nohz_full_restart();
+
 	if (llist_empty(&this_rq()->wake_list))
 		return;
 	sched_ttwu_pending();
@@ -1942,6 +2111,7 @@ void __init sched_init(void)
 		init_cfs_rq(&rq->cfs);
 		init_rt_rq(&rq->rt);
 		init_dl_rq(&rq->dl);
+		init_rq_hrtick(rq);
 
 #ifdef CONFIG_SMP
 		rq->cpu = i;
@@ -259,6 +259,8 @@ static void dump_cpumasks(void)
 	pr_debug("%s", buf);
 	sprintf(buf, "Active CPU: %*pbl\n", nr_cpu_ids, cpu_active_mask);
 	pr_debug("%s", buf);
+	sprintf(buf, "Isolated CPU: %*pbl\n", nr_cpu_ids, &cpu_isolated_map);
+	pr_debug("%s", buf);
 }
 
 /*
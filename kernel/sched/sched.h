@@ -14,6 +14,7 @@
 #include <lego/rbtree.h>
 #include <lego/sched.h>
 #include <lego/sched_rt.h>
+#include <lego/hrtimer.h>
 
 /*
  * Helpers for converting nanosecond timing to jiffy resolution
@@ -155,6 +156,11 @@ struct rq {
 
 	atomic_t		nr_iowait;
 
+#ifdef CONFIG_SCHED_HRTICK
+	/* preempt at the end of slice, not at the next tick: */
+	struct hrtimer		hrtick_timer;
+#endif
+
 #ifdef CONFIG_SMP
 	/* cpu of this runqueue: */
 	int			cpu;
@@ -366,6 +372,26 @@ extern unsigned int sysctl_sched_wakeup_granularity;
 void update_rq_clock(struct rq *rq);
 void check_preempt_curr(struct rq *rq, struct task_struct *p, int flags);
 void resched_curr(struct rq *rq);
+
+#ifdef CONFIG_SCHED_HRTICK
+/*
+ * Use hrtick when the local clockevent is one-shot.
+ * Called with the local rq->lock held.
+ */
+static inline int hrtick_enabled(struct rq *rq)
+{
+	if (!cpu_active(cpu_of(rq)))
+		return 0;
+	return hrtimer_hres_active();
+}
+
+void hrtick_start(struct rq *rq, u64 delay);
+#else
+static inline int hrtick_enabled(struct rq *rq)
+{
+	return 0;
+}
+#endif
 int try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags);
 
 #endif /* _KERNEL_SCHED_SCHED_H_ */
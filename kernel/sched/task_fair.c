@@ -674,6 +674,35 @@ pick_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *curr)
 	return se;
 }
 
+#ifdef CONFIG_SCHED_HRTICK
+/*
+ * Arm hrtick to preempt @p exactly when its slice is used up,
+ * instead of at the next tick after that.
+ */
+static void hrtick_start_fair(struct rq *rq, struct task_struct *p)
+{
+	struct sched_entity *se = &p->se;
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+
+	if (cfs_rq->nr_running > 1) {
+		u64 slice = sched_slice(cfs_rq, se);
+		u64 ran = se->sum_exec_runtime - se->prev_sum_exec_runtime;
+		s64 delta = slice - ran;
+
+		if (delta < 0) {
+			if (rq->curr == p)
+				resched_curr(rq);
+			return;
+		}
+		hrtick_start(rq, delta);
+	}
+}
+#else
+static inline void hrtick_start_fair(struct rq *rq, struct task_struct *p)
+{
+}
+#endif
+
 static struct task_struct *
 pick_next_task_fair(struct rq *rq, struct task_struct *prev)
 {
@@ -690,6 +719,8 @@ pick_next_task_fair(struct rq *rq, struct task_struct *prev)
 	set_next_entity(cfs_rq, se);
 
 	p = task_of(se);
+	if (hrtick_enabled(rq))
+		hrtick_start_fair(rq, p);
 	return p;
 }
 
@@ -869,6 +900,15 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 	/* Update run-time statistics of the 'current'. */
 	update_curr(cfs_rq);
 
+	/*
+	 * hrtick is armed to match the slice,
+	 * don't bother validating it and just reschedule.
+	 */
+	if (queued) {
+		resched_curr(rq);
+		return;
+	}
+
 	if (cfs_rq->nr_running > 1)
 		check_preempt_tick(cfs_rq, se);
 }
@@ -7,6 +7,7 @@
  * (at your option) any later version.
  */
 
+#include <lego/init.h>
 #include <lego/stat.h>
 #include <lego/files.h>
 #include <lego/sched.h>
@@ -22,6 +23,26 @@
 
 #include <asm/numa.h>
 
+#ifdef CONFIG_DEBUG_SYSCALL
+DEFINE_STATIC_KEY_TRUE(debug_syscall_key);
+
+/* debug_syscall=on|off, dumps are on by default */
+static int __init debug_syscall_setup(char *str)
+{
+	if (!str)
+		return -EINVAL;
+
+	if (!strcmp(str, "off"))
+		static_branch_disable(&debug_syscall_key);
+	else if (!strcmp(str, "on"))
+		static_branch_enable(&debug_syscall_key);
+	else
+		return -EINVAL;
+	return 0;
+}
+__setup("debug_syscall", debug_syscall_setup);
+#endif
+
 /* Non-implemented system calls get redirected here. */
 asmlinkage long sys_ni_syscall(void)
 {
@@ -586,12 +607,6 @@ SYSCALL_DEFINE2(access, const char __user *, filename, int, mode)
 	BUG();
 }
 
-SYSCALL_DEFINE3(getcpu, unsigned __user *, cpup, unsigned __user *, nodep,
-		struct getcpu_cache __user *, unused)
-{
-	BUG();
-}
-
 SYSCALL_DEFINE5(waitid, int, which, pid_t, upid, struct siginfo __user *,
 		infop, int, options, struct rusage __user *, ru)
 {
@@ -609,6 +624,118 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 {
 	BUG();
 }
+
+SYSCALL_DEFINE4(pread64, unsigned int, fd, char __user *, buf,
+		size_t, count, loff_t, pos)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE4(pwrite64, unsigned int, fd, const char __user *, buf,
+		size_t, count, loff_t, pos)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE4(openat, int, dfd, const char __user *, filename,
+		int, flags, umode_t, mode)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE4(newfstatat, int, dfd, const char __user *, filename,
+		struct stat __user *, statbuf, int, flag)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE0(sync)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(truncate, const char __user *, path, long, length)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(ftruncate, unsigned int, fd, unsigned long, length)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(creat, const char  __user *, pathname, umode_t, mode)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE1(unlink, const char __user *, pathname)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE3(unlinkat, int, dfd, const char __user *, pathname, int, flag)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(mkdir, const char __user *, pathname, umode_t, mode)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE1(rmdir, const char __user *, pathname)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(getcwd, char __user *, buf, unsigned long, size)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(statfs, const char __user *, pathname, struct statfs __user *, buf)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE3(getdents, unsigned int, fd,
+		struct lego_dirent __user *, dirent, unsigned int, count)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE3(readlink, const char __user *, path, char __user *, buf,
+		int, bufsiz)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(pipe2, int __user *, flides, int, flags)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE1(pipe, int __user *, flides)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE2(rename, const char __user *, oldname,
+		const char __user *, newname)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE0(drop_page_cache)
+{
+	BUG();
+}
+
+SYSCALL_DEFINE1(fsync, unsigned int, fd)
+{
+	BUG();
+}
 #endif
 
 /*
@@ -0,0 +1,672 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * High-resolution kernel timers
+ *
+ * Each CPU keeps its hrtimers in a rbtree sorted by CLOCK_MONOTONIC
+ * expiry time. Two modes:
+ *
+ * - low resolution: the local clockevent runs the periodic tick, and
+ *   expired hrtimers are run from the tick, with jiffies granularity.
+ * - high resolution: once the system is up, the local clockevent is
+ *   switched to one-shot mode and always programmed for the first
+ *   hrtimer. The periodic tick itself becomes an hrtimer (tick-sched.c).
+ *
+ * Callbacks run in hardirq context with interrupts disabled.
+ */
+
+#include <lego/smp.h>
+#include <lego/init.h>
+#include <lego/sched.h>
+#include <lego/tick.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/percpu.h>
+#include <lego/hrtimer.h>
+#include <lego/uaccess.h>
+#include <lego/syscalls.h>
+#include <lego/clockevent.h>
+#include <lego/timekeeping.h>
+
+#include "tick-internal.h"
+
+DEFINE_PER_CPU(struct hrtimer_cpu_base, hrtimer_bases);
+
+/*
+ * Placeholder while a timer moves between two bases,
+ * see lock_hrtimer_base() and switch_hrtimer_base().
+ */
+static struct hrtimer_cpu_base migration_cpu_base;
+
+static bool hrtimer_hres_enabled __read_mostly = IS_ENABLED(CONFIG_HIGH_RES_TIMERS);
+
+static int __init setup_hrtimer_hres(char *str)
+{
+	if (!strcmp(str, "off"))
+		hrtimer_hres_enabled = false;
+	else if (!strcmp(str, "on"))
+		hrtimer_hres_enabled = IS_ENABLED(CONFIG_HIGH_RES_TIMERS);
+	else
+		return 1;
+	return 0;
+}
+__setup("highres", setup_hrtimer_hres);
+
+/*
+ * Return the base @timer currently belongs to, with its lock held.
+ * @timer may be moving to another base concurrently, retry then.
+ */
+static struct hrtimer_cpu_base *
+lock_hrtimer_base(struct hrtimer *timer, unsigned long *flags)
+{
+	struct hrtimer_cpu_base *base;
+
+	for (;;) {
+		base = READ_ONCE(timer->base);
+		if (likely(base != &migration_cpu_base)) {
+			spin_lock_irqsave(&base->lock, *flags);
+			if (likely(base == timer->base))
+				return base;
+			spin_unlock_irqrestore(&base->lock, *flags);
+		}
+		cpu_relax();
+	}
+}
+
+static inline ktime_t __hrtimer_get_next_event(struct hrtimer_cpu_base *base)
+{
+	struct rb_node *node = rb_first(&base->active);
+
+	if (!node)
+		return KTIME_MAX;
+	return rb_entry(node, struct hrtimer, node)->expires;
+}
+
+/*
+ * Program the local clockevent for the first timer in @base.
+ * Called with base->lock held, irq disabled.
+ */
+static void hrtimer_force_reprogram(struct hrtimer_cpu_base *base)
+{
+	ktime_t expires_next = __hrtimer_get_next_event(base);
+
+	base->expires_next = expires_next;
+	if (expires_next != KTIME_MAX)
+		tick_program_event(expires_next, 1);
+}
+
+/*
+ * @timer was just queued as the first timer of @base. Reprogram the
+ * clockevent if it would fire too late. Only possible for local base,
+ * a timer is only queued remotely while its callback runs over there,
+ * and that CPU will reprogram at the end of hrtimer_interrupt().
+ */
+static void hrtimer_reprogram(struct hrtimer *timer,
+			      struct hrtimer_cpu_base *base)
+{
+	ktime_t expires = hrtimer_get_expires(timer);
+
+	if (!base->hres_active || base->in_hrtirq)
+		return;
+	if (base != this_cpu_ptr(&hrtimer_bases))
+		return;
+	if (expires >= base->expires_next)
+		return;
+
+	base->expires_next = expires;
+	tick_program_event(expires, 1);
+}
+
+/* Return true if @timer is the new first timer */
+static bool enqueue_hrtimer(struct hrtimer *timer,
+			    struct hrtimer_cpu_base *base)
+{
+	struct rb_node **link = &base->active.rb_node;
+	struct rb_node *parent = NULL;
+	bool leftmost = true;
+
+	while (*link) {
+		struct hrtimer *entry;
+
+		parent = *link;
+		entry = rb_entry(parent, struct hrtimer, node);
+		if (timer->expires < entry->expires) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	rb_link_node(&timer->node, parent, link);
+	rb_insert_color(&timer->node, &base->active);
+	timer->state = HRTIMER_STATE_ENQUEUED;
+
+	return leftmost;
+}
+
+static void __remove_hrtimer(struct hrtimer *timer,
+			     struct hrtimer_cpu_base *base, bool reprogram)
+{
+	bool was_first = rb_first(&base->active) == &timer->node;
+
+	rb_erase(&timer->node, &base->active);
+	RB_CLEAR_NODE(&timer->node);
+	timer->state = HRTIMER_STATE_INACTIVE;
+
+	/*
+	 * Removing the first timer of a remote base leaves that CPU
+	 * with an early event, which is harmless: it just finds
+	 * nothing to run and reprograms.
+	 */
+	if (reprogram && was_first && base->hres_active && !base->in_hrtirq &&
+	    base == this_cpu_ptr(&hrtimer_bases))
+		hrtimer_force_reprogram(base);
+}
+
+static int remove_hrtimer(struct hrtimer *timer,
+			  struct hrtimer_cpu_base *base, bool restart)
+{
+	if (!hrtimer_is_queued(timer))
+		return 0;
+
+	__remove_hrtimer(timer, base, !restart);
+	return 1;
+}
+
+/*
+ * Move @timer to local base, unless its callback is running now,
+ * the running base must keep it for hrtimer_cancel() to see.
+ */
+static struct hrtimer_cpu_base *
+switch_hrtimer_base(struct hrtimer *timer, struct hrtimer_cpu_base *base)
+{
+	struct hrtimer_cpu_base *new_base = this_cpu_ptr(&hrtimer_bases);
+
+	if (base == new_base || base->running == timer)
+		return base;
+
+	WRITE_ONCE(timer->base, &migration_cpu_base);
+	spin_unlock(&base->lock);
+	spin_lock(&new_base->lock);
+	WRITE_ONCE(timer->base, new_base);
+
+	return new_base;
+}
+
+/**
+ * hrtimer_init - initialize a timer to the given clock
+ * @timer:	the timer to be initialized
+ * @clock_id:	CLOCK_MONOTONIC or CLOCK_REALTIME
+ * @mode:	timer mode, unused
+ */
+void hrtimer_init(struct hrtimer *timer, clockid_t clock_id,
+		  enum hrtimer_mode mode)
+{
+	memset(timer, 0, sizeof(*timer));
+
+	if (clock_id != CLOCK_REALTIME)
+		clock_id = CLOCK_MONOTONIC;
+	timer->clockid = clock_id;
+	timer->base = raw_cpu_ptr(&hrtimer_bases);
+	RB_CLEAR_NODE(&timer->node);
+}
+
+/**
+ * hrtimer_start - (re)start an hrtimer on the current CPU
+ * @timer:	the timer to be added
+ * @tim:	expiry time
+ * @mode:	HRTIMER_MODE_ABS or HRTIMER_MODE_REL
+ *
+ * Absolute CLOCK_REALTIME expiry is converted to CLOCK_MONOTONIC here.
+ * A later settimeofday() does not move an already queued timer.
+ */
+void hrtimer_start(struct hrtimer *timer, ktime_t tim,
+		   const enum hrtimer_mode mode)
+{
+	struct hrtimer_cpu_base *base, *new_base;
+	unsigned long flags;
+	bool leftmost;
+
+	base = lock_hrtimer_base(timer, &flags);
+
+	remove_hrtimer(timer, base, true);
+
+	if (mode == HRTIMER_MODE_REL) {
+		tim = ktime_add(tim, ktime_get());
+		/* Overflow, never expire */
+		if (tim < 0)
+			tim = KTIME_MAX;
+	} else {
+		if (timer->clockid == CLOCK_REALTIME)
+			tim = ktime_sub(tim,
+				ktime_sub(ktime_get_with_offset(TK_OFFS_REAL),
+					  ktime_get()));
+		/* Already in the past, expire at once */
+		if (tim < 0)
+			tim = 0;
+	}
+	hrtimer_set_expires(timer, tim);
+
+	new_base = switch_hrtimer_base(timer, base);
+	leftmost = enqueue_hrtimer(timer, new_base);
+	if (leftmost)
+		hrtimer_reprogram(timer, new_base);
+
+	/* Low resolution: it is run by the tick */
+	if (!new_base->hres_active)
+		tick_nohz_full_kick_cpu(new_base->cpu);
+
+	spin_unlock_irqrestore(&new_base->lock, flags);
+}
+
+/**
+ * hrtimer_try_to_cancel - try to deactivate a timer
+ * @timer:	hrtimer to stop
+ *
+ * Returns:
+ *  0 when the timer was not active
+ *  1 when the timer was active
+ * -1 when the timer is currently executing the callback function and
+ *    cannot be stopped
+ */
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	struct hrtimer_cpu_base *base;
+	unsigned long flags;
+	int ret = -1;
+
+	base = lock_hrtimer_base(timer, &flags);
+	if (base->running != timer)
+		ret = remove_hrtimer(timer, base, false);
+	spin_unlock_irqrestore(&base->lock, flags);
+
+	return ret;
+}
+
+/**
+ * hrtimer_cancel - cancel a timer and wait for the handler to finish.
+ * @timer:	the timer to be cancelled
+ *
+ * Returns:
+ *  0 when the timer was not active
+ *  1 when the timer was active
+ */
+int hrtimer_cancel(struct hrtimer *timer)
+{
+	for (;;) {
+		int ret = hrtimer_try_to_cancel(timer);
+
+		if (ret >= 0)
+			return ret;
+		cpu_relax();
+	}
+}
+
+/**
+ * hrtimer_forward - forward the timer expiry so it expires after @now
+ * @timer:	hrtimer to forward
+ * @now:	forward past this time
+ * @interval:	the interval to forward
+ *
+ * Must not be called on a queued timer.
+ * Returns the number of overruns.
+ */
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval)
+{
+	u64 orun = 1;
+	ktime_t delta;
+
+	delta = ktime_sub(now, hrtimer_get_expires(timer));
+	if (delta < 0)
+		return 0;
+
+	if (WARN_ON(hrtimer_is_queued(timer)))
+		return 0;
+
+	if (unlikely(delta >= interval)) {
+		orun = ktime_to_ns(delta) / ktime_to_ns(interval);
+		timer->expires = ktime_add_ns(timer->expires, interval * orun);
+		if (timer->expires > now)
+			return orun;
+		orun++;
+	}
+	timer->expires = ktime_add(timer->expires, interval);
+
+	return orun;
+}
+
+/*
+ * Called with base->lock held, irq disabled.
+ * The lock is dropped while the callback runs.
+ */
+static void __run_hrtimer(struct hrtimer_cpu_base *base,
+			  struct hrtimer *timer)
+{
+	enum hrtimer_restart (*fn)(struct hrtimer *);
+	enum hrtimer_restart restart;
+
+	__remove_hrtimer(timer, base, false);
+	base->running = timer;
+	fn = timer->function;
+
+	spin_unlock(&base->lock);
+	restart = fn(timer);
+	spin_lock(&base->lock);
+
+	/*
+	 * The callback may have started the timer by itself,
+	 * do not queue it twice.
+	 */
+	if (restart != HRTIMER_NORESTART && !hrtimer_is_queued(timer))
+		enqueue_hrtimer(timer, base);
+
+	base->running = NULL;
+}
+
+static void __hrtimer_run_queues(struct hrtimer_cpu_base *base, ktime_t now)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&base->active))) {
+		struct hrtimer *timer;
+
+		timer = rb_entry(node, struct hrtimer, node);
+		if (now < hrtimer_get_expires(timer))
+			break;
+
+		__run_hrtimer(base, timer);
+	}
+}
+
+/*
+ * High resolution timer interrupt
+ * Called with interrupts disabled
+ */
+void hrtimer_interrupt(struct clock_event_device *dev)
+{
+	struct hrtimer_cpu_base *base = this_cpu_ptr(&hrtimer_bases);
+	ktime_t expires_next, now;
+	int retries = 0;
+
+	BUG_ON(!base->hres_active);
+	base->nr_events++;
+	dev->next_event = KTIME_MAX;
+
+	spin_lock(&base->lock);
+	now = ktime_get();
+retry:
+	base->in_hrtirq = true;
+	/*
+	 * Timers started by callbacks on this CPU must not
+	 * reprogram the device, we do it below.
+	 */
+	base->expires_next = KTIME_MAX;
+
+	__hrtimer_run_queues(base, now);
+
+	expires_next = __hrtimer_get_next_event(base);
+	base->expires_next = expires_next;
+	base->in_hrtirq = false;
+
+	if (expires_next == KTIME_MAX ||
+	    !tick_program_event(expires_next, 0)) {
+		spin_unlock(&base->lock);
+		return;
+	}
+
+	/*
+	 * The next timer has expired while we were running the
+	 * callbacks. Run it now, but not forever.
+	 */
+	now = ktime_get();
+	if (++retries < 3)
+		goto retry;
+
+	tick_program_event(expires_next, 1);
+	spin_unlock(&base->lock);
+}
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * Switch the local clockevent into one-shot mode.
+ * Called from the periodic tick with interrupts disabled.
+ */
+static bool hrtimer_switch_to_hres(void)
+{
+	struct hrtimer_cpu_base *base = this_cpu_ptr(&hrtimer_bases);
+
+	if (tick_switch_to_oneshot(hrtimer_interrupt)) {
+		/* Do not retry on every tick */
+		hrtimer_hres_enabled = false;
+		pr_warn("hrtimer: Could not switch to high resolution mode "
+			"on CPU %d\n", base->cpu);
+		return false;
+	}
+
+	spin_lock(&base->lock);
+	base->hres_active = true;
+	base->expires_next = KTIME_MAX;
+	spin_unlock(&base->lock);
+
+	tick_setup_sched_timer();
+
+	/* Queued timers may expire before the tick */
+	spin_lock(&base->lock);
+	hrtimer_force_reprogram(base);
+	spin_unlock(&base->lock);
+
+	pr_info("hrtimer: Switched to high resolution mode on CPU %d\n",
+		base->cpu);
+	return true;
+}
+#else
+static inline bool hrtimer_switch_to_hres(void) { return false; }
+#endif
+
+/*
+ * Called from the periodic tick, with interrupts disabled.
+ *
+ * Run expired timers at tick granularity, until the system is up
+ * and we can move this CPU into high resolution mode.
+ */
+void hrtimer_run_queues(void)
+{
+	struct hrtimer_cpu_base *base = this_cpu_ptr(&hrtimer_bases);
+
+	if (base->hres_active)
+		return;
+
+	if (hrtimer_hres_enabled && system_state == SYSTEM_RUNNING) {
+		if (hrtimer_switch_to_hres())
+			return;
+	}
+
+	if (RB_EMPTY_ROOT(&base->active))
+		return;
+
+	spin_lock(&base->lock);
+	__hrtimer_run_queues(base, ktime_get());
+	spin_unlock(&base->lock);
+}
+
+/*
+ * In low resolution mode, queued hrtimers are run by the tick,
+ * nohz_full must not stop it then. Called with irq disabled.
+ */
+bool hrtimer_needs_tick(void)
+{
+	struct hrtimer_cpu_base *base = this_cpu_ptr(&hrtimer_bases);
+
+	return !base->hres_active && !RB_EMPTY_ROOT(&base->active);
+}
+
+static enum hrtimer_restart hrtimer_wakeup(struct hrtimer *timer)
+{
+	struct hrtimer_sleeper *t =
+		container_of(timer, struct hrtimer_sleeper, timer);
+	struct task_struct *task = t->task;
+
+	t->task = NULL;
+	if (task)
+		wake_up_process(task);
+
+	return HRTIMER_NORESTART;
+}
+
+void hrtimer_init_sleeper(struct hrtimer_sleeper *sl, struct task_struct *task)
+{
+	sl->timer.function = hrtimer_wakeup;
+	sl->task = task;
+}
+
+/**
+ * schedule_hrtimeout - sleep until timeout
+ * @expires:	timeout value (ktime_t), NULL means sleep forever
+ * @mode:	timer mode, HRTIMER_MODE_ABS or HRTIMER_MODE_REL
+ *
+ * The current task state must be set before calling this.
+ *
+ * Returns 0 when the timer has expired, otherwise -EINTR
+ */
+int __sched schedule_hrtimeout(ktime_t *expires, const enum hrtimer_mode mode)
+{
+	struct hrtimer_sleeper t;
+
+	if (!expires) {
+		schedule();
+		return -EINTR;
+	}
+
+	if (mode == HRTIMER_MODE_REL && *expires <= 0) {
+		__set_current_state(TASK_RUNNING);
+		return 0;
+	}
+
+	hrtimer_init(&t.timer, CLOCK_MONOTONIC, mode);
+	hrtimer_init_sleeper(&t, current);
+	hrtimer_start(&t.timer, *expires, mode);
+
+	if (likely(t.task))
+		schedule();
+
+	hrtimer_cancel(&t.timer);
+	__set_current_state(TASK_RUNNING);
+
+	return !t.task ? 0 : -EINTR;
+}
+
+/* Return 1 when the sleep has completed */
+static int __sched do_nanosleep(struct hrtimer_sleeper *t,
+				enum hrtimer_mode mode)
+{
+	hrtimer_init_sleeper(t, current);
+
+	do {
+		set_current_state(TASK_INTERRUPTIBLE);
+		hrtimer_start_expires(&t->timer, mode);
+
+		if (likely(t->task))
+			schedule();
+
+		hrtimer_cancel(&t->timer);
+		mode = HRTIMER_MODE_ABS;
+	} while (t->task && !signal_pending(current));
+
+	__set_current_state(TASK_RUNNING);
+
+	return t->task == NULL;
+}
+
+static int update_rmtp(struct hrtimer *timer, struct timespec __user *rmtp)
+{
+	struct timespec rmt;
+	ktime_t rem;
+
+	rem = ktime_sub(hrtimer_get_expires(timer), ktime_get());
+	if (rem <= 0)
+		return 0;
+	rmt = ktime_to_timespec(rem);
+
+	if (copy_to_user(rmtp, &rmt, sizeof(*rmtp)))
+		return -EFAULT;
+	return 1;
+}
+
+static long __sched hrtimer_nanosleep_restart(struct restart_block *restart)
+{
+	struct hrtimer_sleeper t;
+	struct timespec __user *rmtp;
+	int ret;
+
+	hrtimer_init(&t.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	hrtimer_set_expires(&t.timer, restart->nanosleep.expires);
+
+	if (do_nanosleep(&t, HRTIMER_MODE_ABS))
+		return 0;
+
+	rmtp = restart->nanosleep.rmtp;
+	if (rmtp) {
+		ret = update_rmtp(&t.timer, rmtp);
+		if (ret <= 0)
+			return ret;
+	}
+
+	/* The other values in restart are already filled in */
+	return -ERESTART_RESTARTBLOCK;
+}
+
+SYSCALL_DEFINE2(nanosleep, struct timespec __user *, rqtp,
+		struct timespec __user *, rmtp)
+{
+	struct restart_block *restart;
+	struct hrtimer_sleeper t;
+	struct timespec tu;
+	int ret;
+
+	if (copy_from_user(&tu, rqtp, sizeof(tu)))
+		return -EFAULT;
+
+	if (!timespec_valid(&tu))
+		return -EINVAL;
+
+	hrtimer_init(&t.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_set_expires(&t.timer, timespec_to_ktime(tu));
+
+	if (do_nanosleep(&t, HRTIMER_MODE_REL))
+		return 0;
+
+	if (rmtp) {
+		ret = update_rmtp(&t.timer, rmtp);
+		if (ret <= 0)
+			return ret;
+	}
+
+	restart = &current->restart_block;
+	restart->fn = hrtimer_nanosleep_restart;
+	restart->nanosleep.expires = hrtimer_get_expires(&t.timer);
+	restart->nanosleep.rmtp = rmtp;
+
+	return -ERESTART_RESTARTBLOCK;
+}
+
+void __init hrtimers_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct hrtimer_cpu_base *base = &per_cpu(hrtimer_bases, cpu);
+
+		spin_lock_init(&base->lock);
+		base->cpu = cpu;
+		base->active = RB_ROOT;
+		base->expires_next = KTIME_MAX;
+	}
+}
@@ -13,11 +13,13 @@
 #include <lego/time.h>
 #include <lego/timer.h>
 #include <lego/kernel.h>
+#include <lego/hrtimer.h>
 #include <lego/cpumask.h>
 #include <lego/irqdesc.h>
 #include <lego/percpu.h>
 #include <lego/profile.h>
 #include <lego/jiffies.h>
+#include <lego/rcupdate.h>
 #include <lego/clockevent.h>
 #include <lego/clocksource.h>
 #include <lego/timekeeping.h>
@@ -186,8 +188,11 @@ static void tick_setup_device(struct tick_device *td,
 	if (td->mode == TICKDEV_MODE_PERIODIC) {
 		tick_setup_periodic(newdev, 0);
 	} else {
+#ifdef CONFIG_TICK_ONESHOT
+		tick_setup_oneshot(newdev, handler, next_event);
+#else
 		panic("No support for one-shot mode\n");
-		//tick_setup_oneshot(newdev, handler, next_event);
+#endif
 	}
 }
 
@@ -254,18 +259,34 @@ void tick_handle_noop(struct clock_event_device *dev)
  */
 void tick_handle_periodic(struct clock_event_device *dev)
 {
-	int cpu = smp_processor_id();
+	tick_periodic(smp_processor_id(), 1);
+
+	/* Run hrtimers, or switch this CPU to high resolution mode */
+	hrtimer_run_queues();
+
+	/* Stop the tick if this is a quiet nohz_full CPU */
+	tick_nohz_full_check(dev);
+}
+
+/*
+ * The tick work, done by either the periodic handler above, or by
+ * the emulated tick in high resolution mode. @ticks is the number
+ * of tick periods passed, more than 1 if the emulated tick is late.
+ */
+void tick_periodic(int cpu, unsigned long ticks)
+{
 	int user_tick = user_mode(get_irq_regs());
 
 	/*
 	 * Things only one CPU core should do...
 	 */
 	if (cpu == tick_do_timer_cpu) {
-		/* jiffies += 1 */
-		do_timer(1);
+		/* jiffies += ticks */
+		do_timer(ticks);
 
 		/* Keep track of the next tick event */
-		tick_next_period = ktime_add(tick_next_period, tick_period);
+		tick_next_period = ktime_add(tick_next_period,
+					     ticks * tick_period);
 
 		update_wall_time();
 	}
@@ -274,6 +295,8 @@ void tick_handle_periodic(struct clock_event_device *dev)
 	 * Things every CPU core should do...
 	 */
 	account_process_tick(current, user_tick);
+	rcu_check_callbacks(user_tick);
+	printk_tick();
 	run_local_timers();
 	scheduler_tick();
 
@@ -20,6 +20,11 @@ struct tick_device {
 	enum tick_device_mode mode;
 };
 
+DECLARE_PER_CPU(struct tick_device, tick_devices);
+extern int tick_do_timer_cpu;
+extern ktime_t tick_next_period;
+extern ktime_t tick_period;
+
 void tick_check_new_device(struct clock_event_device *newdev);
 
 /* Check, if the device is functional or a dummy for broadcast */
@@ -31,4 +36,26 @@ static inline int tick_device_is_functional(struct clock_event_device *dev)
 int clockevents_program_event(struct clock_event_device *dev, ktime_t expires,
 			      bool force);
 
+void tick_periodic(int cpu, unsigned long ticks);
+
+#ifdef CONFIG_TICK_ONESHOT
+int tick_program_event(ktime_t expires, int force);
+void tick_setup_oneshot(struct clock_event_device *newdev,
+			void (*handler)(struct clock_event_device *),
+			ktime_t next_event);
+int tick_switch_to_oneshot(void (*handler)(struct clock_event_device *));
+#else
+static inline int tick_program_event(ktime_t expires, int force) { return 0; }
+#endif
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+void tick_setup_sched_timer(void);
+#endif
+
+#ifdef CONFIG_NO_HZ_FULL
+void tick_nohz_full_check(struct clock_event_device *dev);
+#else
+static inline void tick_nohz_full_check(struct clock_event_device *dev) { }
+#endif
+
 #endif /* _TICK_INTERNAL_H_ */
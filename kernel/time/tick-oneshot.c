@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * One-shot mode of the per-cpu tick device, used by high resolution
+ * timers. The device is programmed for each event by hrtimer code.
+ */
+
+#include <lego/smp.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/clockevent.h>
+
+#include "tick-internal.h"
+
+/**
+ * tick_program_event - program the local tick device
+ * @expires:	absolute expiry time (monotonic clock)
+ * @force:	program minimum delay if @expires is in the past
+ *
+ * Returns 0 on success, -ETIME when @expires is in the past.
+ */
+int tick_program_event(ktime_t expires, int force)
+{
+	struct clock_event_device *dev = this_cpu_ptr(&tick_devices)->evtdev;
+
+	return clockevents_program_event(dev, expires, force);
+}
+
+/*
+ * A new device replaces the one-shot tick device,
+ * keep the handler and the pending event.
+ */
+void tick_setup_oneshot(struct clock_event_device *newdev,
+			void (*handler)(struct clock_event_device *),
+			ktime_t next_event)
+{
+	newdev->event_handler = handler;
+	clockevents_switch_state(newdev, CLOCK_EVT_STATE_ONESHOT);
+	clockevents_program_event(newdev, next_event, true);
+}
+
+/*
+ * Switch the local tick device to one-shot mode, with @handler
+ * called for each event. Called with interrupts disabled.
+ */
+int tick_switch_to_oneshot(void (*handler)(struct clock_event_device *))
+{
+	struct tick_device *td = this_cpu_ptr(&tick_devices);
+	struct clock_event_device *dev = td->evtdev;
+
+	if (!dev || !(dev->features & CLOCK_EVT_FEAT_ONESHOT) ||
+	    !tick_device_is_functional(dev)) {
+		pr_info("Clockevents: could not switch to one-shot mode: %s\n",
+			dev ? dev->name : "no tick device");
+		return -EINVAL;
+	}
+
+	td->mode = TICKDEV_MODE_ONESHOT;
+	dev->event_handler = handler;
+	clockevents_switch_state(dev, CLOCK_EVT_STATE_ONESHOT);
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Emulated tick and full dynticks
+ *
+ * In high resolution mode the tick device is one-shot, and the periodic
+ * tick is an hrtimer, sched_timer, re-armed every tick_period.
+ *
+ * A nohz_full= CPU stops its tick when it runs at most one task and
+ * has no pending timer, which is the case for pinned polling threads.
+ * In periodic mode the tick device is shut down, in high resolution
+ * mode sched_timer is simply not re-armed. Timekeeping stays on
+ * tick_do_timer_cpu, which is never nohz_full.
+ *
+ * The tick is restarted as soon as a second task is queued or a timer
+ * is armed on that CPU. A remote CPU does so by a reschedule IPI.
+ */
+
+#include <lego/smp.h>
+#include <lego/init.h>
+#include <lego/tick.h>
+#include <lego/sched.h>
+#include <lego/timer.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/hrtimer.h>
+#include <lego/clockevent.h>
+
+#include "tick-internal.h"
+
+/**
+ * struct tick_sched - per cpu tick state
+ * @sched_timer:	the emulated tick in high resolution mode
+ * @tick_stopped:	nohz_full stopped the tick
+ */
+struct tick_sched {
+	struct hrtimer		sched_timer;
+	bool			tick_stopped;
+};
+
+static DEFINE_PER_CPU(struct tick_sched, tick_cpu_sched);
+
+#ifdef CONFIG_NO_HZ_FULL
+struct cpumask tick_nohz_full_mask;
+bool tick_nohz_full_running;
+
+static int __init tick_nohz_full_setup(char *str)
+{
+	if (cpulist_parse(str, &tick_nohz_full_mask) < 0) {
+		pr_warn("NO_HZ: Incorrect nohz_full cpumask\n");
+		return -EINVAL;
+	}
+
+	/* Boot CPU does timekeeping, it always keeps the tick */
+	if (cpumask_test_cpu(0, &tick_nohz_full_mask)) {
+		pr_warn("NO_HZ: Clearing CPU 0 from nohz_full range\n");
+		cpumask_clear_cpu(0, &tick_nohz_full_mask);
+	}
+
+	tick_nohz_full_running = !cpumask_empty(&tick_nohz_full_mask);
+	if (tick_nohz_full_running)
+		pr_info("NO_HZ: Full dynticks CPUs: %*pbl\n",
+			nr_cpumask_bits, &tick_nohz_full_mask);
+	return 0;
+}
+__setup("nohz_full", tick_nohz_full_setup);
+
+/*
+ * Called at the end of each tick, irq disabled.
+ * Return true if the tick can be stopped.
+ *
+ * Mark the tick stopped before checking, pairs with the barrier
+ * in tick_nohz_full_kick_cpu(): either we see the new task or
+ * timer, or the kicker sees tick_stopped and restarts us.
+ */
+static bool tick_nohz_full_stop_tick(void)
+{
+	struct tick_sched *ts = this_cpu_ptr(&tick_cpu_sched);
+	int cpu = smp_processor_id();
+
+	if (!tick_nohz_full_cpu(cpu) || cpu == tick_do_timer_cpu)
+		return false;
+
+	ts->tick_stopped = true;
+	smp_mb();
+
+	if (!sched_can_stop_tick() || local_timers_pending() ||
+	    hrtimer_needs_tick()) {
+		ts->tick_stopped = false;
+		return false;
+	}
+	return true;
+}
+
+/* End of a tick in periodic mode */
+void tick_nohz_full_check(struct clock_event_device *dev)
+{
+	/* The tick may have just switched to one-shot mode */
+	if (!clockevent_state_periodic(dev))
+		return;
+
+	if (tick_nohz_full_stop_tick())
+		clockevents_shutdown(dev);
+}
+#else
+static inline bool tick_nohz_full_stop_tick(void) { return false; }
+#endif /* CONFIG_NO_HZ_FULL */
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
+{
+	u64 ticks;
+
+	ticks = hrtimer_forward_now(timer, tick_period);
+	tick_periodic(smp_processor_id(), ticks);
+
+	if (tick_nohz_full_stop_tick())
+		return HRTIMER_NORESTART;
+	return HRTIMER_RESTART;
+}
+
+static void tick_sched_timer_start(struct tick_sched *ts)
+{
+	hrtimer_forward_now(&ts->sched_timer, tick_period);
+	hrtimer_start_expires(&ts->sched_timer, HRTIMER_MODE_ABS);
+}
+
+/*
+ * Called by hrtimer code when this CPU switches to high resolution
+ * mode. Keep the emulated tick in phase with tick_next_period.
+ */
+void tick_setup_sched_timer(void)
+{
+	struct tick_sched *ts = this_cpu_ptr(&tick_cpu_sched);
+
+	hrtimer_init(&ts->sched_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ts->sched_timer.function = tick_sched_timer;
+
+	hrtimer_set_expires(&ts->sched_timer, tick_next_period);
+	tick_sched_timer_start(ts);
+}
+#endif /* CONFIG_HIGH_RES_TIMERS */
+
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Called from the reschedule IPI, or by the local CPU
+ * with irq disabled.
+ */
+void tick_nohz_full_restart(void)
+{
+	struct tick_sched *ts = this_cpu_ptr(&tick_cpu_sched);
+	struct tick_device *td = this_cpu_ptr(&tick_devices);
+
+	if (!ts->tick_stopped)
+		return;
+	ts->tick_stopped = false;
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+	if (td->mode == TICKDEV_MODE_ONESHOT) {
+		tick_sched_timer_start(ts);
+		return;
+	}
+#endif
+	clockevents_switch_state(td->evtdev, CLOCK_EVT_STATE_PERIODIC);
+}
+
+/*
+ * A task or timer was just queued on @cpu.
+ * Make sure it has the tick to run them.
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	smp_mb();
+	if (!per_cpu(tick_cpu_sched, cpu).tick_stopped)
+		return;
+
+	if (cpu == smp_processor_id())
+		tick_nohz_full_restart();
+	else
+		smp_send_reschedule(cpu);
+}
+#endif /* CONFIG_NO_HZ_FULL */
@@ -367,11 +367,13 @@ SYSCALL_DEFINE2(gettimeofday, struct timeval __user *, tv,
 	return 0;
 }
 
-/* 
+/*
  * allow get real time, boot time, mono time
  * TODO: currently we assume no one use settime/settimeofday,
  * suspend system, etc.
  * Thus mono time is identical to boot time.
+ *
+ * This is also the fallback of vDSO clock_gettime().
  */
 SYSCALL_DEFINE2(clock_gettime, const clockid_t, which_clock,
 		struct timespec __user *, tp)
@@ -388,7 +390,7 @@ SYSCALL_DEFINE2(clock_gettime, const clockid_t, which_clock,
 	case CLOCK_MONOTONIC_COARSE:
 	case CLOCK_MONOTONIC_RAW:
 	case CLOCK_BOOTTIME:
-		getboottime(&kts);
+		get_monotonic_boottime(&kts);
 		break;
 	case CLOCK_PROCESS_CPUTIME_ID:
 	case CLOCK_THREAD_CPUTIME_ID:
@@ -400,5 +402,7 @@ SYSCALL_DEFINE2(clock_gettime, const clockid_t, which_clock,
 		ret = -EINVAL;
 	}
 
+	if (!ret && copy_to_user(tp, &kts, sizeof(kts)))
+		ret = -EFAULT;
 	return ret;
 }
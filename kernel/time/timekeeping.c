@@ -246,9 +246,9 @@ static inline void tk_update_ktime_data(struct timekeeper *tk)
 	tk->ktime_sec = seconds;
 }
 
-void update_vsyscall(struct timekeeper *tk)
+/* Architecture with vDSO overrides this */
+void __weak update_vsyscall(struct timekeeper *tk)
 {
-	/* TODO vsyscall */
 }
 
 /* must hold timekeeper_lock */
@@ -9,6 +9,7 @@
 
 #include <lego/irq.h>
 #include <lego/list.h>
+#include <lego/tick.h>
 #include <lego/sched.h>
 #include <lego/timer.h>
 #include <lego/kernel.h>
@@ -520,6 +521,39 @@ static struct timer_base *lock_timer_base(struct timer_list *timer,
 	}
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * A nohz_full CPU may run without tick for a long time, and its
+ * base->clk falls behind. If nothing is queued, catch up at once
+ * instead of computing wheel index against a stale clk.
+ */
+static inline void forward_timer_base(struct timer_base *base)
+{
+	if (bitmap_empty(base->pending_map, WHEEL_SIZE) &&
+	    time_after(jiffies, base->clk))
+		base->clk = jiffies;
+}
+#else
+static inline void forward_timer_base(struct timer_base *base) { }
+#endif
+
+/*
+ * Return true if this CPU has any timer queued.
+ * Called with irq disabled.
+ */
+bool local_timers_pending(void)
+{
+	int i;
+
+	for (i = 0; i < NR_BASES; i++) {
+		struct timer_base *base = this_cpu_ptr(&timer_bases[i]);
+
+		if (!bitmap_empty(base->pending_map, WHEEL_SIZE))
+			return true;
+	}
+	return false;
+}
+
 static inline int
 __mod_timer(struct timer_list *timer, unsigned long expires, bool pending_only)
 {
@@ -589,6 +623,8 @@ __mod_timer(struct timer_list *timer, unsigned long expires, bool pending_only)
 		}
 	}
 
+	forward_timer_base(base);
+
 	timer->expires = expires;
 	/*
 	 * If 'idx' was calculated above and the base time did not advance
@@ -601,6 +637,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires, bool pending_only)
 		enqueue_timer(base, timer, idx);
 	else
 		internal_add_timer(base, timer);
+	tick_nohz_full_kick_cpu(base->cpu);
 
 out_unlock:
 	spin_unlock_irqrestore(&base->lock, flags);
@@ -701,7 +738,9 @@ void add_timer_on(struct timer_list *timer, int cpu)
 			   (timer->flags & ~TIMER_BASEMASK) | cpu);
 	}
 
+	forward_timer_base(base);
 	internal_add_timer(base, timer);
+	tick_nohz_full_kick_cpu(base->cpu);
 	spin_unlock_irqrestore(&base->lock, flags);
 }
 
@@ -920,6 +959,7 @@ void run_local_timers(void)
 		return;
 
 	spin_lock_irqsave(&base->lock, flags);
+	forward_timer_base(base);
 
 	while (time_after_eq(jiffies, base->clk)) {
 
@@ -1083,20 +1123,3 @@ unsigned long msleep_interruptible(unsigned int msecs)
 		timeout = schedule_timeout_interruptible(timeout);
 	return jiffies_to_msecs(timeout);
 }
-
-SYSCALL_DEFINE2(nanosleep, struct timespec __user *, rqtp,
-		struct timespec __user *, rmtp)
-{
-	struct timespec tu;
-
-	if (copy_from_user(&tu, rqtp, sizeof(tu)))
-		return -EFAULT;
-
-	if (!timespec_valid(&tu))
-		return -EINVAL;
-
-	set_current_state(TASK_INTERRUPTIBLE);
-	schedule_timeout(timespec_to_jiffies(&tu));
-	set_current_state(TASK_RUNNING);
-	return 0;
-}
@@ -7,6 +7,26 @@
  * (at your option) any later version.
  */
 
+/*
+ * Concurrency managed workqueue
+ *
+ * Every possible CPU has two bound worker pools, normal and highpri.
+ * Every NUMA node with online CPUs has two unbound pools, whose workers
+ * may run on any CPU of that node. A workqueue relays its work items to
+ * these pools through its pool_workqueues: one per CPU for a bound
+ * workqueue, one per node for a WQ_UNBOUND one.
+ *
+ * A bound pool only keeps as many workers running as needed to keep the
+ * CPU busy: the scheduler tells us when a worker blocks, typically on a
+ * network RPC, and another worker is woken up to process the rest of
+ * the worklist. There is always an idle worker in reserve, the one that
+ * takes the last idle slot creates a new one before starting to work.
+ * Idle workers beyond what is needed are reaped after a while.
+ *
+ * Unbound workers never count as running, so an unbound pool runs as
+ * many works in parallel as max_active of the workqueue allows.
+ */
+
 #include <lego/kernel.h>
 #include <lego/sched.h>
 #include <lego/init.h>
@@ -14,9 +34,13 @@
 #include <lego/jiffies.h>
 #include <lego/completion.h>
 #include <lego/workqueue.h>
+#include <lego/hashtable.h>
 #include <lego/slab.h>
+#include <lego/mm.h>
 #include <lego/kthread.h>
 
+#include <asm/numa.h>
+
 enum {
 	/*
 	 * worker_pool flags
@@ -29,12 +53,10 @@ enum {
 	 * While DISASSOCIATED, the cpu may be offline and all workers have
 	 * %WORKER_UNBOUND set and concurrency management disabled, and may
 	 * be executing on any CPU.  The pool behaves as an unbound one.
-	 *
-	 * Note that DISASSOCIATED should be flipped only while holding
-	 * manager_mutex to avoid changing binding state while
-	 * create_worker() is in progress.
+	 * Unbound pools are always DISASSOCIATED.
 	 */
 	POOL_MANAGE_WORKERS	= 1 << 0,	/* need to manage workers */
+	POOL_MANAGER_ACTIVE	= 1 << 1,	/* being managed */
 	POOL_DISASSOCIATED	= 1 << 2,	/* cpu can't serve workers */
 	POOL_FREEZING		= 1 << 3,	/* freeze in progress */
 
@@ -56,6 +78,7 @@ enum {
 	BUSY_WORKER_HASH_ORDER	= 6,		/* 64 pointers */
 
 	MAX_IDLE_WORKERS_RATIO	= 4,		/* 1/4 of busy can be idle */
+	IDLE_WORKER_TIMEOUT	= 300 * HZ,	/* keep idle ones for 5 mins */
 
 	/*
 	 * Rescue workers are used only on emergencies and shared by
@@ -83,22 +106,14 @@ enum {
  *    cpu or grabbing pool->lock is enough for read access.  If
  *    POOL_DISASSOCIATED is set, it's identical to L.
  *
- * MG: pool->manager_mutex and pool->lock protected.  Writes require both
- *     locks.  Reads can happen under either lock.
- *
- * PL: wq_pool_lock protected.
- *
- * PR: wq_pool_lock protected for writes.  Sched-RCU protected for reads.
+ * PL: wq_pool_mutex protected.
  *
  * WQ: wq->mutex protected.
  *
- * WR: wq->mutex protected for writes.  Sched-RCU protected for reads.
- *
- * MD: wq_mayday_lock protected.
+ * pool->lock is also taken by the idle timer from the timer interrupt,
+ * always grab it with irq disabled.
  */
 
-/* struct worker is defined in workqueue_internal.h */
-
 struct worker_pool {
 	spinlock_t		lock;		/* the pool lock */
 	int			cpu;		/* I: the associated cpu */
@@ -108,17 +123,16 @@ struct worker_pool {
 
 	struct list_head	worklist;	/* L: list of pending works */
 	int			nr_workers;	/* L: total number of workers */
+	int			next_worker_id;	/* L: for worker names */
 
 	/* nr_idle includes the ones off idle_list for rebinding */
 	int			nr_idle;	/* L: currently idle ones */
 
 	struct list_head	idle_list;	/* X: list of idle workers */
-//	struct timer_list	idle_timer;	/* L: worker idle timeout */
+	struct timer_list	idle_timer;	/* L: worker idle timeout */
 
-	/* see manage_workers() for details on the two manager mutexes */
-//	struct mutex		manager_arb;	/* manager arbitration */
-//	struct mutex		manager_mutex;	/* manager exclusion */
-//	struct idr		worker_idr;	/* MG: worker IDs and iteration */
+	/* L: hash of busy workers, keyed by the work they run */
+	DECLARE_HASHTABLE(busy_hash, BUSY_WORKER_HASH_ORDER);
 
 	int			refcnt;		/* PL: refcnt for unbound pools */
 
@@ -129,32 +143,22 @@ struct worker_pool {
 	 * from other CPUs during try_to_wake_up(), put it in a separate
 	 * cacheline.
 	 */
-	atomic_t		nr_running;
-
-	/*
-	 * Destruction of pool is sched-RCU protected to allow dereferences
-	 * from get_work_pool().
-	 */
-//	struct rcu_head		rcu;
-}; // ____cacheline_aligned_in_smp;
+	atomic_t		nr_running ____cacheline_aligned_in_smp;
+} ____cacheline_aligned_in_smp;
 
 /*
  * The externally visible workqueue.  It relays the issued work items to
  * the appropriate worker_pool through its pool_workqueues.
  */
 struct workqueue_struct {
-	struct list_head	pwqs;		/* WR: all pwqs of this wq */
+	struct list_head	pwqs;		/* WQ: all pwqs of this wq */
 	struct list_head	list;		/* PL: list of all workqueues */
 
 	struct mutex		mutex;		/* protects this wq */
 	int			work_color;	/* WQ: current work color */
 	int			flush_color;	/* WQ: current flush color */
 	atomic_t		nr_pwqs_to_flush; /* flush in progress */
-	//struct wq_flusher	*first_flusher;	/* WQ: first flusher */
 	struct list_head	flusher_queue;	/* WQ: flush waiters */
-	//struct list_head	flusher_overflow; /* WQ: flush overflow list */
-
-	//struct list_head	maydays;	/* MD: pwqs requesting rescue */
 
 	int			nr_drainers;	/* WQ: drain in progress */
 	int			saved_max_active; /* WQ: saved pwq max_active */
@@ -163,39 +167,38 @@ struct workqueue_struct {
 	/* hot fields used during command issue, aligned to cacheline */
 	unsigned int		flags ____cacheline_aligned; /* WQ: WQ_* flags */
 	struct pool_workqueue __percpu *cpu_pwqs; /* I: per-cpu pwqs */
+	struct pool_workqueue	*numa_pwq_tbl[]; /* I: unbound pwqs indexed by node */
 };
 
 /*
-* The per-pool workqueue.  While queued, the lower WORK_STRUCT_FLAG_BITS
-* of work_struct->data are used for flags and the remaining high bits
-* point to the pwq; thus, pwqs need to be aligned at two's power of the
-* number of flag bits.
-*/
+ * The per-pool workqueue.  While queued, the lower WORK_STRUCT_FLAG_BITS
+ * of work_struct->data are used for flags and the remaining high bits
+ * point to the pwq; thus, pwqs need to be aligned at two's power of the
+ * number of flag bits.
+ */
 struct pool_workqueue {
-       struct worker_pool	*pool;		/* I: the associated pool */
-       struct workqueue_struct	*wq;		/* I: the owning workqueue */
-       int			work_color;	/* L: current color */
-       int			flush_color;	/* L: flushing color */
-       int			refcnt;		/* L: reference count */
-//       int			nr_in_flight[WORK_NR_COLORS];
-       int			nr_active;	/* L: nr of active works */
-       int			max_active;	/* L: max active works */
-       struct list_head		delayed_works;	/* L: delayed works */
-	struct list_head	pwqs_node;	/* WR: node on wq->pwqs */
-}; // __aligned(1 << WORK_STRUCT_FLAG_BITS);
+	struct worker_pool	*pool;		/* I: the associated pool */
+	struct workqueue_struct	*wq;		/* I: the owning workqueue */
+	int			work_color;	/* L: current color */
+	int			flush_color;	/* L: flushing color */
+	int			refcnt;		/* L: reference count */
+	int			nr_active;	/* L: nr of active works */
+	int			max_active;	/* L: max active works */
+	struct list_head	delayed_works;	/* L: delayed works */
+	struct list_head	pwqs_node;	/* WQ: node on wq->pwqs */
+} __aligned(1 << WORK_STRUCT_FLAG_BITS);
 
 /*
  * The poor guys doing the actual heavy lifting.  All on-duty workers are
  * either serving the manager role, on idle list or on busy hash.  For
- * details on the locking annotation (L, I, X...), refer to workqueue.c.
- *
+ * details on the locking annotation (L, I, X...), refer to above.
  */
 struct worker {
 	/* on idle list while idle, on busy hash table while busy */
-//	union {
-		struct list_head	entry;	/* L: while idle/busy */
-//		struct hlist_node	hentry;	/* L: while busy */
-//	};
+	union {
+		struct list_head	entry;	/* L: while idle */
+		struct hlist_node	hentry;	/* L: while busy */
+	};
 
 	struct work_struct	*current_work;	/* L: work being processed */
 	work_func_t		current_func;	/* L: current_work's fn */
@@ -207,16 +210,13 @@ struct worker {
 
 	struct task_struct	*task;		/* I: worker task */
 	struct worker_pool	*pool;		/* I: the associated pool */
-						/* L: for rescuers */
 
 	unsigned long		last_active;	/* L: last active timestamp */
 	unsigned int		flags;		/* X: flags */
 	int			id;		/* I: worker id */
+	int			sleeping;	/* None */
 };
 
-struct worker_pool *global_pool;
-
-//static DEFINE_SPINLOCK(wq_pool_lock);	/* protects pools and workqueues list */
 static DEFINE_MUTEX(wq_pool_mutex);	/* protects pools and workqueues list */
 static LIST_HEAD(workqueues);		/* PL: list of all workqueues */
 
@@ -224,6 +224,17 @@ static LIST_HEAD(workqueues);		/* PL: list of all workqueues */
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct worker_pool [NR_STD_WORKER_POOLS],
 				     cpu_worker_pools);
 
+/* I: the unbound pools, NR_STD_WORKER_POOLS per node, NULL if no cpu */
+static struct worker_pool *unbound_std_pools[MAX_NUMNODES];
+
+/* I: pool ID to pool, the last pool of an off-queue work is recorded */
+static struct worker_pool **worker_pools;
+static int nr_worker_pools;
+
+struct workqueue_struct *system_wq __read_mostly;
+struct workqueue_struct *system_highpri_wq __read_mostly;
+struct workqueue_struct *system_unbound_wq __read_mostly;
+
 #define for_each_cpu_worker_pool(pool, cpu)				\
 	for ((pool) = &per_cpu(cpu_worker_pools, cpu)[0];		\
 	     (pool) < &per_cpu(cpu_worker_pools, cpu)[NR_STD_WORKER_POOLS]; \
@@ -234,15 +245,24 @@ static DEFINE_PER_CPU_SHARED_ALIGNED(struct worker_pool [NR_STD_WORKER_POOLS],
  * @pwq: iteration cursor
  * @wq: the target workqueue
  *
- * This must be called either with wq->mutex held or sched RCU read locked.
- * If the pwq needs to be used beyond the locking in effect, the caller is
- * responsible for guaranteeing that the pwq stays online.
- *
- * The if/else clause exists only for the lockdep assertion and can be
- * ignored.
+ * This must be called with wq->mutex held.
  */
 #define for_each_pwq(pwq, wq)						\
-	list_for_each_entry((pwq), &(wq)->pwqs, pwqs_node)		
+	list_for_each_entry((pwq), &(wq)->pwqs, pwqs_node)
+
+/* The node unbound works queued on @cpu go to */
+static inline int wq_cpu_node(int cpu)
+{
+	int node = cpu_to_node(cpu);
+
+	return node == NUMA_NO_NODE ? 0 : node;
+}
+
+static struct pool_workqueue *unbound_pwq_by_node(struct workqueue_struct *wq,
+						  int node)
+{
+	return wq->numa_pwq_tbl[node];
+}
 
 static struct pool_workqueue *get_work_pwq(struct work_struct *work)
 {
@@ -254,6 +274,53 @@ static struct pool_workqueue *get_work_pwq(struct work_struct *work)
 		return NULL;
 }
 
+/**
+ * get_work_pool - return the worker_pool a given work was associated with
+ * @work: the work item of interest
+ *
+ * Return the pool @work is queued on, or the one it last ran on.
+ * Must be called with irq disabled.
+ */
+static struct worker_pool *get_work_pool(struct work_struct *work)
+{
+	unsigned long data = atomic_long_read(&work->data);
+	unsigned long pool_id;
+
+	if (data & WORK_STRUCT_PWQ)
+		return ((struct pool_workqueue *)
+			(data & WORK_STRUCT_WQ_DATA_MASK))->pool;
+
+	pool_id = data >> WORK_OFFQ_POOL_SHIFT;
+	if (pool_id >= nr_worker_pools)
+		return NULL;
+	return worker_pools[pool_id];
+}
+
+/**
+ * find_worker_executing_work - find worker which is executing a work
+ * @pool: pool of interest
+ * @work: work to find worker for
+ *
+ * A work item is identified by its address and its function, as a
+ * work may be freed and recycled while still running.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock).
+ */
+static struct worker *find_worker_executing_work(struct worker_pool *pool,
+						 struct work_struct *work)
+{
+	struct worker *worker;
+
+	hash_for_each_possible(pool->busy_hash, worker, hentry,
+			       (unsigned long)work)
+		if (worker->current_work == work &&
+		    worker->current_func == work->func)
+			return worker;
+
+	return NULL;
+}
+
 /*
  * Policy functions.  These define the policies on how the global worker
  * pools are managed.  Unless noted otherwise, these functions assume that
@@ -278,6 +345,12 @@ static bool need_more_worker(struct worker_pool *pool)
 	return !list_empty(&pool->worklist) && __need_more_worker(pool);
 }
 
+/* Can I start working?  Called from busy but !running workers. */
+static bool may_start_working(struct worker_pool *pool)
+{
+	return pool->nr_idle;
+}
+
 /* Do I need to keep working?  Called from currently running workers. */
 static bool keep_working(struct worker_pool *pool)
 {
@@ -285,30 +358,16 @@ static bool keep_working(struct worker_pool *pool)
 		atomic_read(&pool->nr_running) <= 1;
 }
 
-#if 0
-/* Can I start working?  Called from busy but !running workers. */
-static bool may_start_working(struct worker_pool *pool)
-{
-	return pool->nr_idle;
-}
-
 /* Do we need a new worker?  Called from manager. */
 static bool need_to_create_worker(struct worker_pool *pool)
 {
 	return need_more_worker(pool) && !may_start_working(pool);
 }
 
-/* Do I need to be the manager? */
-static bool need_to_manage_workers(struct worker_pool *pool)
-{
-	return need_to_create_worker(pool) ||
-		(pool->flags & POOL_MANAGE_WORKERS);
-}
-
 /* Do we have too many workers and should some go away? */
 static bool too_many_workers(struct worker_pool *pool)
 {
-	bool managing = mutex_is_locked(&pool->manager_arb);
+	bool managing = pool->flags & POOL_MANAGER_ACTIVE;
 	int nr_idle = pool->nr_idle + managing; /* manager is considered idle */
 	int nr_busy = pool->nr_workers - nr_idle;
 
@@ -321,14 +380,13 @@ static bool too_many_workers(struct worker_pool *pool)
 
 	return nr_idle > 2 && (nr_idle - 2) * MAX_IDLE_WORKERS_RATIO >= nr_busy;
 }
-#endif
 
 /*
  * Wake up functions.
  */
 
-/* Return the first worker.  Safe with preemption disabled */
-__used static struct worker *first_worker(struct worker_pool *pool)
+/* Return the first idle worker.  Safe with preemption disabled */
+static struct worker *first_worker(struct worker_pool *pool)
 {
 	if (unlikely(list_empty(&pool->idle_list)))
 		return NULL;
@@ -347,13 +405,161 @@ __used static struct worker *first_worker(struct worker_pool *pool)
  */
 static void wake_up_worker(struct worker_pool *pool)
 {
-#if 0 
-// XXX
 	struct worker *worker = first_worker(pool);
 
 	if (likely(worker))
 		wake_up_process(worker->task);
-#endif
+}
+
+/**
+ * wq_worker_running - a worker is running again
+ * @task: task waking up
+ *
+ * This function is called from schedule() when a worker returns
+ * from sleeping.
+ */
+void wq_worker_running(struct task_struct *task)
+{
+	struct worker *worker = kthread_data(task);
+
+	if (!worker->sleeping)
+		return;
+	if (!(worker->flags & WORKER_NOT_RUNNING))
+		atomic_inc(&worker->pool->nr_running);
+	worker->sleeping = 0;
+}
+
+/**
+ * wq_worker_sleeping - a worker is going to sleep
+ * @task: task going to sleep
+ *
+ * This function is called from schedule() when a busy worker is going
+ * to sleep, e.g. waiting for a network reply. If it was the last running
+ * one and there is still work to do, wake up an idle worker to do it.
+ *
+ * CONTEXT:
+ * Preemption disabled.
+ */
+void wq_worker_sleeping(struct task_struct *task)
+{
+	struct worker *worker = kthread_data(task);
+	struct worker_pool *pool;
+
+	/*
+	 * Rescuers, which may not have all the fields set up like normal
+	 * workers, also reach here, let's not access anything before
+	 * checking NOT_RUNNING.
+	 */
+	if (worker->flags & WORKER_NOT_RUNNING)
+		return;
+
+	pool = worker->pool;
+
+	if (WARN_ON_ONCE(worker->sleeping))
+		return;
+
+	worker->sleeping = 1;
+	spin_lock_irq(&pool->lock);
+
+	/*
+	 * The counterpart of the following dec_and_test, implied mb,
+	 * worklist not empty test sequence is in insert_work().
+	 * Please read comment there.
+	 */
+	if (atomic_dec_and_test(&pool->nr_running) &&
+	    !list_empty(&pool->worklist))
+		wake_up_worker(pool);
+	spin_unlock_irq(&pool->lock);
+}
+
+/**
+ * worker_set_flags - set worker flags and adjust nr_running accordingly
+ * @worker: self
+ * @flags: flags to set
+ *
+ * Set @flags in @worker->flags and adjust nr_running accordingly.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock)
+ */
+static inline void worker_set_flags(struct worker *worker, unsigned int flags)
+{
+	struct worker_pool *pool = worker->pool;
+
+	WARN_ON_ONCE(worker->task != current);
+
+	/* If transitioning into NOT_RUNNING, adjust nr_running. */
+	if ((flags & WORKER_NOT_RUNNING) &&
+	    !(worker->flags & WORKER_NOT_RUNNING))
+		atomic_dec(&pool->nr_running);
+
+	worker->flags |= flags;
+}
+
+/**
+ * worker_clr_flags - clear worker flags and adjust nr_running accordingly
+ * @worker: self
+ * @flags: flags to clear
+ *
+ * Clear @flags in @worker->flags and adjust nr_running accordingly.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock)
+ */
+static inline void worker_clr_flags(struct worker *worker, unsigned int flags)
+{
+	struct worker_pool *pool = worker->pool;
+	unsigned int oflags = worker->flags;
+
+	WARN_ON_ONCE(worker->task != current);
+
+	worker->flags &= ~flags;
+
+	/*
+	 * If transitioning out of NOT_RUNNING, increment nr_running.  Note
+	 * that the nested NOT_RUNNING is not a noop.  NOT_RUNNING is mask
+	 * of multiple flags, not a single flag.
+	 */
+	if ((flags & WORKER_NOT_RUNNING) && (oflags & WORKER_NOT_RUNNING))
+		if (!(worker->flags & WORKER_NOT_RUNNING))
+			atomic_inc(&pool->nr_running);
+}
+
+static void pwq_activate_delayed_work(struct work_struct *work)
+{
+	struct pool_workqueue *pwq = get_work_pwq(work);
+
+	list_move_tail(&work->entry, &pwq->pool->worklist);
+	__clear_bit(WORK_STRUCT_DELAYED_BIT, work_data_bits(work));
+	pwq->nr_active++;
+}
+
+static void pwq_activate_first_delayed(struct pool_workqueue *pwq)
+{
+	struct work_struct *work = list_first_entry(&pwq->delayed_works,
+						    struct work_struct, entry);
+
+	pwq_activate_delayed_work(work);
+}
+
+/**
+ * pwq_dec_nr_in_flight - decrement pwq's nr_in_flight
+ * @pwq: pwq of interest
+ *
+ * A work either has completed or is removed from pending queue,
+ * activate a delayed one if max_active allows.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock).
+ */
+static void pwq_dec_nr_in_flight(struct pool_workqueue *pwq)
+{
+	pwq->nr_active--;
+	pwq->refcnt--;
+
+	if (!list_empty(&pwq->delayed_works) &&
+	    pwq->nr_active < pwq->max_active)
+		pwq_activate_first_delayed(pwq);
 }
 
 /**
@@ -369,9 +575,6 @@ static void pwq_adjust_max_active(struct pool_workqueue *pwq)
 	struct workqueue_struct *wq = pwq->wq;
 	bool freezable = wq->flags & WQ_FREEZABLE;
 
-	/* for @wq->saved_max_active */
-//	lockdep_assert_held(&wq->mutex);
-
 	/* fast exit for non-freezable wqs */
 	if (!freezable && pwq->max_active == wq->saved_max_active)
 		return;
@@ -381,15 +584,15 @@ static void pwq_adjust_max_active(struct pool_workqueue *pwq)
 	if (!freezable || !(pwq->pool->flags & POOL_FREEZING)) {
 		pwq->max_active = wq->saved_max_active;
 
-//		while (!list_empty(&pwq->delayed_works) &&
-//		       pwq->nr_active < pwq->max_active)
-//			pwq_activate_first_delayed(pwq);
+		while (!list_empty(&pwq->delayed_works) &&
+		       pwq->nr_active < pwq->max_active)
+			pwq_activate_first_delayed(pwq);
 
 		/*
 		 * Need to kick a worker after thawed or an unbound wq's
 		 * max_active is bumped.  It's a slow path.  Do it always.
 		 */
-//		wake_up_worker(pwq->pool);
+		wake_up_worker(pwq->pool);
 	} else {
 		pwq->max_active = 0;
 	}
@@ -401,7 +604,7 @@ static void pwq_adjust_max_active(struct pool_workqueue *pwq)
 static void init_pwq(struct pool_workqueue *pwq, struct workqueue_struct *wq,
 		     struct worker_pool *pool)
 {
-//	BUG_ON((unsigned long)pwq & WORK_STRUCT_FLAG_MASK);
+	BUG_ON((unsigned long)pwq & WORK_STRUCT_FLAG_MASK);
 
 	memset(pwq, 0, sizeof(*pwq));
 
@@ -411,8 +614,6 @@ static void init_pwq(struct pool_workqueue *pwq, struct workqueue_struct *wq,
 	pwq->refcnt = 1;
 	INIT_LIST_HEAD(&pwq->delayed_works);
 	INIT_LIST_HEAD(&pwq->pwqs_node);
-	//INIT_LIST_HEAD(&pwq->mayday_node);
-	//INIT_WORK(&pwq->unbound_release_work, pwq_unbound_release_workfn);
 }
 
 /* sync @pwq with the current state of its associated wq and link it */
@@ -420,8 +621,6 @@ static void link_pwq(struct pool_workqueue *pwq)
 {
 	struct workqueue_struct *wq = pwq->wq;
 
-//	lockdep_assert_held(&wq->mutex);
-
 	/* may be called multiple times, ignore if already linked */
 	if (!list_empty(&pwq->pwqs_node))
 		return;
@@ -437,7 +636,48 @@ static void link_pwq(struct pool_workqueue *pwq)
 
 	/* link in @pwq */
 	list_add(&pwq->pwqs_node, &wq->pwqs);
-	//list_add_rcu(&pwq->pwqs_node, &wq->pwqs);
+}
+
+/*
+ * Unbound pwqs of a workqueue are allocated in one go. kmalloc() does
+ * not give the alignment pwqs need, take whole pages.
+ */
+static unsigned int unbound_pwqs_order(void)
+{
+	return get_order(nr_node_ids * sizeof(struct pool_workqueue));
+}
+
+static int alloc_and_link_unbound_pwqs(struct workqueue_struct *wq)
+{
+	bool highpri = wq->flags & WQ_HIGHPRI;
+	struct pool_workqueue *pwqs, *dfl_pwq = NULL;
+	int node;
+
+	pwqs = (void *)__get_free_pages(GFP_KERNEL, unbound_pwqs_order());
+	if (!pwqs)
+		return -ENOMEM;
+
+	for (node = 0; node < nr_node_ids; node++) {
+		struct pool_workqueue *pwq = &pwqs[node];
+
+		if (!unbound_std_pools[node])
+			continue;
+
+		init_pwq(pwq, wq, &unbound_std_pools[node][highpri]);
+		wq->numa_pwq_tbl[node] = pwq;
+		if (!dfl_pwq)
+			dfl_pwq = pwq;
+
+		mutex_lock(&wq->mutex);
+		link_pwq(pwq);
+		mutex_unlock(&wq->mutex);
+	}
+
+	/* Nodes without cpu: nobody queues there, but be safe */
+	for (node = 0; node < nr_node_ids; node++)
+		if (!wq->numa_pwq_tbl[node])
+			wq->numa_pwq_tbl[node] = dfl_pwq;
+	return 0;
 }
 
 static int alloc_and_link_pwqs(struct workqueue_struct *wq)
@@ -445,6 +685,9 @@ static int alloc_and_link_pwqs(struct workqueue_struct *wq)
 	bool highpri = wq->flags & WQ_HIGHPRI;
 	int cpu;
 
+	if (wq->flags & WQ_UNBOUND)
+		return alloc_and_link_unbound_pwqs(wq);
+
 	wq->cpu_pwqs = alloc_percpu(struct pool_workqueue);
 	if (!wq->cpu_pwqs)
 		return -ENOMEM;
@@ -455,8 +698,6 @@ static int alloc_and_link_pwqs(struct workqueue_struct *wq)
 		struct worker_pool *cpu_pools =
 			per_cpu(cpu_worker_pools, cpu);
 
-		//pr_info("%s cpu %d cpu_pwqs %p pwq %p cpupool %p\n",
-		//	__func__, cpu, wq->cpu_pwqs, pwq, cpu_pools);
 		init_pwq(pwq, wq, &cpu_pools[highpri]);
 
 		mutex_lock(&wq->mutex);
@@ -478,17 +719,23 @@ static int wq_clamp_max_active(int max_active, unsigned int flags,
 	return clamp_val(max_active, 1, lim);
 }
 
-struct workqueue_struct *__alloc_workqueue(unsigned int flags,
-					       int max_active)
+struct workqueue_struct *__alloc_workqueue(const char *name,
+					   unsigned int flags, int max_active)
 {
 	size_t tbl_size = 0;
 	struct workqueue_struct *wq;
 	struct pool_workqueue *pwq;
 
+	/* allocate wq and format name */
+	if (flags & WQ_UNBOUND)
+		tbl_size = nr_node_ids * sizeof(wq->numa_pwq_tbl[0]);
+
 	wq = kzalloc(sizeof(*wq) + tbl_size, GFP_KERNEL);
 	if (!wq)
 		return NULL;
 
+	strlcpy(wq->name, name, sizeof(wq->name));
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, wq->name);
 
@@ -504,7 +751,7 @@ struct workqueue_struct *__alloc_workqueue(unsigned int flags,
 		goto err_free_wq;
 
 	/*
-	 * wq_pool_lock protects global freeze state and workqueues list.
+	 * wq_pool_mutex protects global freeze state and workqueues list.
 	 * Grab it, adjust max_active and add the new @wq to workqueues
 	 * list.
 	 */
@@ -521,17 +768,12 @@ struct workqueue_struct *__alloc_workqueue(unsigned int flags,
 err_free_wq:
 	kfree(wq);
 	return NULL;
-#if 0
-err_destroy:
-	//destroy_workqueue(wq);
-	return NULL;
-#endif
 }
 
 static inline void set_work_data(struct work_struct *work, unsigned long data,
 				 unsigned long flags)
 {
-	//WARN_ON_ONCE(!work_pending(work));
+	WARN_ON_ONCE(!work_pending(work));
 	atomic_long_set(&work->data, data | flags);
 }
 
@@ -552,7 +794,8 @@ static void set_work_pool_and_clear_pending(struct work_struct *work,
 	 * owner.
 	 */
 	smp_wmb();
-	set_work_data(work, (unsigned long)pool_id << WORK_OFFQ_POOL_SHIFT, 0);
+	atomic_long_set(&work->data,
+			(unsigned long)pool_id << WORK_OFFQ_POOL_SHIFT);
 }
 
 /**
@@ -571,7 +814,7 @@ static void set_work_pool_and_clear_pending(struct work_struct *work,
 static void insert_work(struct pool_workqueue *pwq, struct work_struct *work,
 			struct list_head *head, unsigned int extra_flags)
 {
-//	struct worker_pool *pool = pwq->pool;
+	struct worker_pool *pool = pwq->pool;
 
 	/* we own @work, set data and link */
 	set_work_pwq(work, pwq, extra_flags);
@@ -585,49 +828,65 @@ static void insert_work(struct pool_workqueue *pwq, struct work_struct *work,
 	 */
 	smp_mb();
 
-// XXX
-//	if (__need_more_worker(pool))
-//		wake_up_worker(pool);
+	if (__need_more_worker(pool))
+		wake_up_worker(pool);
 }
 
 static void __queue_work(int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
 	struct pool_workqueue *pwq;
+	struct worker_pool *last_pool;
 	struct list_head *worklist;
-	unsigned int work_flags;
+	unsigned int work_flags = 0;
 	unsigned int req_cpu = cpu;
 
-	pr_info("%s cpu %d wq %p work %p\n", __func__, cpu, wq, work);
 	/*
 	 * While a work item is PENDING && off queue, a task trying to
 	 * steal the PENDING will busy-loop waiting for it to either get
 	 * queued or lose PENDING.  Grabbing PENDING and queueing should
 	 * happen with IRQ disabled.
 	 */
-	//WARN_ON_ONCE(!irqs_disabled());
+	WARN_ON_ONCE(!irqs_disabled());
 
-//retry:
 	if (req_cpu == WORK_CPU_UNBOUND)
 		cpu = smp_processor_id();
 
 	/* pwq which will be used unless @work is executing elsewhere */
-//	if (!(wq->flags & WQ_UNBOUND))
+	if (!(wq->flags & WQ_UNBOUND))
 		pwq = per_cpu_ptr(wq->cpu_pwqs, cpu);
-//	else
-//`		pwq = unbound_pwq_by_node(wq, cpu_to_node(cpu));
+	else
+		pwq = unbound_pwq_by_node(wq, wq_cpu_node(cpu));
 
-	/* pwq determined, queue */
-	spin_lock(&pwq->pool->lock);
+	/*
+	 * If @work was previously on a different pool, it might still be
+	 * running there, in which case the work needs to be queued on that
+	 * pool to guarantee non-reentrancy.
+	 */
+	last_pool = get_work_pool(work);
+	if (last_pool && last_pool != pwq->pool) {
+		struct worker *worker;
+
+		spin_lock(&last_pool->lock);
+
+		worker = find_worker_executing_work(last_pool, work);
+
+		if (worker && worker->current_pwq->wq == wq) {
+			pwq = worker->current_pwq;
+		} else {
+			/* meh... not running there, queue here */
+			spin_unlock(&last_pool->lock);
+			spin_lock(&pwq->pool->lock);
+		}
+	} else {
+		spin_lock(&pwq->pool->lock);
+	}
 
 	if (WARN_ON(!list_empty(&work->entry))) {
 		spin_unlock(&pwq->pool->lock);
 		return;
 	}
 
-	//pwq->nr_in_flight[pwq->work_color]++;
-	//work_flags = work_color_to_flags(pwq->work_color);
-
 	if (likely(pwq->nr_active < pwq->max_active)) {
 		pwq->nr_active++;
 		worklist = &pwq->pool->worklist;
@@ -649,7 +908,7 @@ static void __queue_work(int cpu, struct workqueue_struct *wq,
  * Returns %false if @work was already on a queue, %true otherwise.
  *
  * We queue the work to a specific CPU, the caller must ensure it
- * can't go away.
+ * can't go away. For a WQ_UNBOUND workqueue, @cpu only selects the node.
  */
 bool queue_work_on(int cpu, struct workqueue_struct *wq,
 		   struct work_struct *work)
@@ -668,72 +927,6 @@ bool queue_work_on(int cpu, struct workqueue_struct *wq,
 	return ret;
 }
 
-#if 0
-static void __queue_delayed_work(int cpu, struct workqueue_struct *wq,
-				struct delayed_work *dwork, unsigned long delay)
-{
-	struct timer_list *timer = &dwork->timer;
-	struct work_struct *work = &dwork->work;
-
-	WARN_ON_ONCE(timer->function != delayed_work_timer_fn ||
-		     timer->data != (unsigned long)dwork);
-	WARN_ON_ONCE(timer_pending(timer));
-	WARN_ON_ONCE(!list_empty(&work->entry));
-
-	/*
-	 * If @delay is 0, queue @dwork->work immediately.  This is for
-	 * both optimization and correctness.  The earliest @timer can
-	 * expire is on the closest next tick and delayed_work users depend
-	 * on that there's no such delay when @delay is 0.
-	 */
-	if (!delay) {
-		__queue_work(cpu, wq, &dwork->work);
-		return;
-	}
-
-	timer_stats_timer_set_start_info(&dwork->timer);
-
-	dwork->wq = wq;
-	dwork->cpu = cpu;
-	timer->expires = jiffies + delay;
-
-	if (unlikely(cpu != WORK_CPU_UNBOUND))
-		add_timer_on(timer, cpu);
-	else
-		add_timer(timer);
-}
-
-/**
- * queue_delayed_work_on - queue work on specific CPU after delay
- * @cpu: CPU number to execute work on
- * @wq: workqueue to use
- * @dwork: work to queue
- * @delay: number of jiffies to wait before queueing
- *
- * Returns %false if @work was already on a queue, %true otherwise.  If
- * @delay is zero and @dwork is idle, it will be scheduled for immediate
- * execution.
- */
-bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
-			   struct delayed_work *dwork, unsigned long delay)
-{
-	struct work_struct *work = &dwork->work;
-	bool ret = false;
-	unsigned long flags;
-
-	/* read the comment in __queue_work() */
-	local_irq_save(flags);
-
-	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
-		__queue_delayed_work(cpu, wq, dwork, delay);
-		ret = true;
-	}
-
-	local_irq_restore(flags);
-	return ret;
-}
-#endif
-
 /**
  * process_one_work - process single work
  * @worker: self
@@ -749,28 +942,50 @@ bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
  * spin_lock_irq(pool->lock) which is released and regrabbed.
  */
 static void process_one_work(struct worker *worker, struct work_struct *work)
-//__releases(&pool->lock)
-//__acquires(&pool->lock)
 {
 	struct pool_workqueue *pwq = get_work_pwq(work);
 	struct worker_pool *pool = worker->pool;
-	//bool cpu_intensive = pwq->wq->flags & WQ_CPU_INTENSIVE;
-	//int work_color;
+	bool cpu_intensive = pwq->wq->flags & WQ_CPU_INTENSIVE;
+	struct worker *collision;
+
+	/*
+	 * A single work shouldn't be executed concurrently by
+	 * multiple workers on a single cpu.  Check whether anyone is
+	 * already processing the work.  If so, defer the work to the
+	 * currently executing one.
+	 */
+	collision = find_worker_executing_work(pool, work);
+	if (unlikely(collision)) {
+		list_move_tail(&work->entry, &collision->scheduled);
+		return;
+	}
 
-	pr_info("%s pid %d worker %p work %p cpu %d\n", 
-		__func__, current->pid, worker, work, smp_processor_id());
 	/* claim and dequeue */
-	//hash_add(pool->busy_hash, &worker->hentry, (unsigned long)work);
+	hash_add(pool->busy_hash, &worker->hentry, (unsigned long)work);
 	worker->current_work = work;
 	worker->current_func = work->func;
 	worker->current_pwq = pwq;
-	//work_color = get_work_color(work);
 
 	list_del_init(&work->entry);
 
-// XXX
-//	if (need_more_worker(pool))
-//		wake_up_worker(pool);
+	/*
+	 * CPU intensive works don't participate in concurrency management.
+	 * They're the scheduler's responsibility.  This takes @worker out
+	 * of concurrency management and the next code block will chain
+	 * execution of the pending work items.
+	 */
+	if (unlikely(cpu_intensive))
+		worker_set_flags(worker, WORKER_CPU_INTENSIVE);
+
+	/*
+	 * Wake up another worker if necessary.  The condition is always
+	 * false for normal per-cpu workers since nr_running would always
+	 * be >= 1 at this point.  This is used to chain execution of the
+	 * pending work items for WORKER_NOT_RUNNING workers such as the
+	 * UNBOUND and CPU_INTENSIVE ones.
+	 */
+	if (need_more_worker(pool))
+		wake_up_worker(pool);
 
 	/*
 	 * Record the last pool and clear PENDING which should be the last
@@ -782,103 +997,82 @@ static void process_one_work(struct worker *worker, struct work_struct *work)
 
 	spin_unlock_irq(&pool->lock);
 
-//	lock_map_acquire_read(&pwq->wq->lockdep_map);
-//	lock_map_acquire(&lockdep_map);
-	//trace_workqueue_execute_start(work);
 	worker->current_func(work);
+
 	/*
 	 * While we must be careful to not use "work" after this, the trace
 	 * point will only record its address.
-	 */
-	//trace_workqueue_execute_end(work);
-
-	/*
+	 *
 	 * The following prevents a kworker from hogging CPU on !PREEMPT
 	 * kernels, where a requeueing work item waiting for something to
-	 * happen could deadlock with stop_machine as such work item could
-	 * indefinitely requeue itself while all other CPUs are trapped in
-	 * stop_machine.
+	 * happen could starve other tasks on this CPU.
 	 */
-	//cond_resched();
-	schedule();
+	cond_resched();
 
 	spin_lock_irq(&pool->lock);
 
+	/* clear cpu intensive status */
+	if (unlikely(cpu_intensive))
+		worker_clr_flags(worker, WORKER_CPU_INTENSIVE);
+
 	/* we're done with it, release */
-	//hash_del(&worker->hentry);
+	hash_del(&worker->hentry);
 	worker->current_work = NULL;
 	worker->current_func = NULL;
 	worker->current_pwq = NULL;
 	worker->desc_valid = false;
-	pwq->nr_active--;
-	//pwq_dec_nr_in_flight(pwq, work_color);
+	pwq_dec_nr_in_flight(pwq);
 }
 
 /**
- * worker_clr_flags - clear worker flags and adjust nr_running accordingly
+ * process_scheduled_works - process scheduled works
  * @worker: self
- * @flags: flags to clear
  *
- * Clear @flags in @worker->flags and adjust nr_running accordingly.
+ * Process all scheduled works, which were deferred to us because we
+ * were running them when they got queued again.
  *
  * CONTEXT:
- * spin_lock_irq(pool->lock)
+ * spin_lock_irq(pool->lock) which may be released and regrabbed
+ * multiple times.
  */
-static inline void worker_clr_flags(struct worker *worker, unsigned int flags)
+static void process_scheduled_works(struct worker *worker)
 {
-	struct worker_pool *pool = worker->pool;
-	unsigned int oflags = worker->flags;
-
-	//WARN_ON_ONCE(worker->task != current);
-
-	worker->flags &= ~flags;
-
-	/*
-	 * If transitioning out of NOT_RUNNING, increment nr_running.  Note
-	 * that the nested NOT_RUNNING is not a noop.  NOT_RUNNING is mask
-	 * of multiple flags, not a single flag.
-	 */
-	if ((flags & WORKER_NOT_RUNNING) && (oflags & WORKER_NOT_RUNNING))
-		if (!(worker->flags & WORKER_NOT_RUNNING))
-			atomic_inc(&pool->nr_running);
+	while (!list_empty(&worker->scheduled)) {
+		struct work_struct *work = list_first_entry(&worker->scheduled,
+						struct work_struct, entry);
+		process_one_work(worker, work);
+	}
 }
 
 /**
- * worker_set_flags - set worker flags and adjust nr_running accordingly
- * @worker: self
- * @flags: flags to set
- * @wakeup: wakeup an idle worker if necessary
+ * worker_enter_idle - enter idle state
+ * @worker: worker which is entering idle state
  *
- * Set @flags in @worker->flags and adjust nr_running accordingly.  If
- * nr_running becomes zero and @wakeup is %true, an idle worker is
- * woken up.
+ * @worker is entering idle state.  Update stats and idle timer if
+ * necessary.
  *
- * CONTEXT:
- * spin_lock_irq(pool->lock)
+ * LOCKING:
+ * spin_lock_irq(pool->lock).
  */
-static inline void worker_set_flags(struct worker *worker, unsigned int flags,
-				    bool wakeup)
+static void worker_enter_idle(struct worker *worker)
 {
 	struct worker_pool *pool = worker->pool;
 
-	WARN_ON_ONCE(worker->task != current);
+	if (WARN_ON_ONCE(worker->flags & WORKER_IDLE) ||
+	    WARN_ON_ONCE(!list_empty(&worker->entry) &&
+			 (worker->hentry.next || worker->hentry.pprev)))
+		return;
 
-	/*
-	 * If transitioning into NOT_RUNNING, adjust nr_running and
-	 * wake up an idle worker as necessary if requested by
-	 * @wakeup.
-	 */
-	if ((flags & WORKER_NOT_RUNNING) &&
-	    !(worker->flags & WORKER_NOT_RUNNING)) {
-		if (wakeup) {
-			if (atomic_dec_and_test(&pool->nr_running) &&
-			    !list_empty(&pool->worklist))
-				wake_up_worker(pool);
-		} else
-			atomic_dec(&pool->nr_running);
-	}
+	/* can't use worker_set_flags(), also called from create_worker() */
+	worker->flags |= WORKER_IDLE;
+	pool->nr_idle++;
+	worker->last_active = jiffies;
 
-	worker->flags |= flags;
+	/* idle_list is LIFO */
+	list_add(&worker->entry, &pool->idle_list);
+
+	if (too_many_workers(pool) && !timer_pending(&pool->idle_timer))
+		mod_timer(&pool->idle_timer, jiffies + IDLE_WORKER_TIMEOUT);
 }
 
 /**
@@ -894,39 +1088,173 @@ static void worker_leave_idle(struct worker *worker)
 {
 	struct worker_pool *pool = worker->pool;
 
-	if (!(worker->flags & WORKER_IDLE))
+	if (WARN_ON_ONCE(!(worker->flags & WORKER_IDLE)))
 		return;
-	worker_clr_flags(worker, WORKER_IDLE);
+	worker->flags &= ~WORKER_IDLE;
 	pool->nr_idle--;
 	list_del_init(&worker->entry);
 }
 
+static int worker_thread(void *__worker);
+
 /**
- * worker_enter_idle - enter idle state
- * @worker: worker which is entering idle state
+ * create_worker - create a new workqueue worker
+ * @pool: pool the new worker will belong to
  *
- * @worker is entering idle state.  Update stats and idle timer if
- * necessary.
+ * Create and start a new worker which is attached to @pool.
+ * Bound workers are bound to the cpu of @pool, unbound ones
+ * to the cpus of its node.
  *
- * LOCKING:
+ * CONTEXT:
+ * Might sleep.  Does GFP_KERNEL allocations.
+ *
+ * Return: 0 on success, -errno on failure.
+ */
+static int create_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+	int id;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&worker->entry);
+	INIT_LIST_HEAD(&worker->scheduled);
+	/* on creation a worker is in !idle && prep state */
+	worker->flags = WORKER_PREP;
+	worker->pool = pool;
+
+	spin_lock_irq(&pool->lock);
+	id = pool->next_worker_id++;
+	spin_unlock_irq(&pool->lock);
+	worker->id = id;
+
+	if (pool->cpu >= 0)
+		worker->task = kthread_create_on_node(worker_thread, worker,
+					pool->node, 0, "kworker/%d:%d%s",
+					pool->cpu, id,
+					pool->attrs->nice < 0 ? "H" : "");
+	else
+		worker->task = kthread_create_on_node(worker_thread, worker,
+					pool->node, 0, "kworker/u%d:%d%s",
+					pool->node, id,
+					pool->attrs->nice < 0 ? "H" : "");
+	if (IS_ERR_OR_NULL(worker->task)) {
+		kfree(worker);
+		return -ENOMEM;
+	}
+
+	set_user_nice(worker->task, pool->attrs->nice);
+	kthread_bind_mask(worker->task, pool->attrs->cpumask);
+
+	spin_lock_irq(&pool->lock);
+	if (pool->flags & POOL_DISASSOCIATED)
+		worker->flags |= WORKER_UNBOUND;
+	worker->flags |= WORKER_STARTED;
+	pool->nr_workers++;
+	worker_enter_idle(worker);
+	wake_up_process(worker->task);
+	spin_unlock_irq(&pool->lock);
+
+	return 0;
+}
+
+/**
+ * destroy_worker - destroy a workqueue worker
+ * @worker: worker to be destroyed
+ *
+ * Take an idle @worker out of @pool and let it exit.
+ * The worker frees itself.
+ *
+ * CONTEXT:
  * spin_lock_irq(pool->lock).
  */
-static void worker_enter_idle(struct worker *worker)
+static void destroy_worker(struct worker *worker)
 {
 	struct worker_pool *pool = worker->pool;
 
-	if ((worker->flags & WORKER_IDLE) ||
-	    (!list_empty(&worker->entry)))// &&
-			// (worker->hentry.next || worker->hentry.pprev)))
+	/* sanity check frenzy */
+	if (WARN_ON(worker->current_work) ||
+	    WARN_ON(!list_empty(&worker->scheduled)) ||
+	    WARN_ON(!(worker->flags & WORKER_IDLE)))
 		return;
 
-	/* can't use worker_set_flags(), also called from start_worker() */
-	worker->flags |= WORKER_IDLE;
-	pool->nr_idle++;
-	worker->last_active = jiffies;
+	pool->nr_workers--;
+	pool->nr_idle--;
 
-	/* idle_list is LIFO */
-	list_add(&worker->entry, &pool->idle_list);
+	list_del_init(&worker->entry);
+	worker->flags |= WORKER_DIE;
+	wake_up_process(worker->task);
+}
+
+/*
+ * Reap workers idle for IDLE_WORKER_TIMEOUT.
+ * Called from the timer interrupt, irq disabled.
+ */
+static void idle_worker_timeout(unsigned long __pool)
+{
+	struct worker_pool *pool = (void *)__pool;
+
+	spin_lock(&pool->lock);
+
+	while (too_many_workers(pool)) {
+		struct worker *worker;
+		unsigned long expires;
+
+		/* idle_list is kept in LIFO order, check the last one */
+		worker = list_entry(pool->idle_list.prev, struct worker, entry);
+		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
+
+		if (time_before(jiffies, expires)) {
+			mod_timer(&pool->idle_timer, expires);
+			break;
+		}
+
+		destroy_worker(worker);
+	}
+
+	spin_unlock(&pool->lock);
+}
+
+/**
+ * manage_workers - manage worker pool
+ * @worker: self
+ *
+ * Make sure there is an idle worker in reserve before @worker starts
+ * working: if it blocks, the reserve takes over the worklist.
+ * Only one worker manages a pool at a time.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock) which may be released and regrabbed
+ * multiple times.
+ *
+ * Return:
+ * %false if no action was taken and pool->lock stayed locked, %true
+ * if a new worker was created.
+ */
+static bool manage_workers(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+	int ret;
+
+	if ((pool->flags & POOL_MANAGER_ACTIVE) || !need_to_create_worker(pool))
+		return false;
+
+	pool->flags |= POOL_MANAGER_ACTIVE;
+	spin_unlock_irq(&pool->lock);
+
+	ret = create_worker(pool);
+
+	spin_lock_irq(&pool->lock);
+	pool->flags &= ~POOL_MANAGER_ACTIVE;
+
+	if (ret) {
+		/* Proceed without reserve, this worker still does the work */
+		pr_warn_once("workqueue: failed to create worker: %d\n", ret);
+		return false;
+	}
+	return true;
 }
 
 /**
@@ -934,45 +1262,49 @@ static void worker_enter_idle(struct worker *worker)
  * @__worker: self
  *
  * The worker thread function.  All workers belong to a worker_pool -
- * either a per-cpu one or dynamic unbound one.  These workers process all
- * work items regardless of their specific target workqueue.  The only
- * exception is work items which belong to workqueues with a rescuer which
- * will be explained in rescuer_thread().
+ * either a per-cpu one or an unbound one.  These workers process all
+ * work items regardless of their specific target workqueue.
  */
 static int worker_thread(void *__worker)
 {
 	struct worker *worker = __worker;
 	struct worker_pool *pool = worker->pool;
 
-	//pr_info("%s pid %d worker %p pool %p\n", __func__, current->pid, worker, pool);
 	/* tell the scheduler that this is a workqueue worker */
-// XXX	worker->task->flags |= PF_WQ_WORKER;
+	current->flags |= PF_WQ_WORKER;
 woke_up:
 	spin_lock_irq(&pool->lock);
 
+	/* am I supposed to die? */
+	if (unlikely(worker->flags & WORKER_DIE)) {
+		spin_unlock_irq(&pool->lock);
+		current->flags &= ~PF_WQ_WORKER;
+		kfree(worker);
+		return 0;
+	}
+
 	worker_leave_idle(worker);
-//recheck:
+recheck:
 	/* no more worker necessary? */
 	if (!need_more_worker(pool))
 		goto sleep;
 
 	/* do we need to manage? */
-	//if (unlikely(!may_start_working(pool)) && manage_workers(worker))
-	//	goto recheck;
+	if (unlikely(!may_start_working(pool)) && manage_workers(worker))
+		goto recheck;
 
 	/*
 	 * ->scheduled list can only be filled while a worker is
 	 * preparing to process a work or actually processing it.
 	 * Make sure nobody diddled with it while I was sleeping.
 	 */
-	//WARN_ON_ONCE(!list_empty(&worker->scheduled));
+	WARN_ON_ONCE(!list_empty(&worker->scheduled));
 
 	/*
 	 * Finish PREP stage.  We're guaranteed to have at least one idle
 	 * worker or that someone else has already assumed the manager
 	 * role.  This is where @worker starts participating in concurrency
-	 * management if applicable and concurrency management is restored
-	 * after being rebound.  See rebind_workers() for details.
+	 * management if applicable.
 	 */
 	worker_clr_flags(worker, WORKER_PREP | WORKER_REBOUND);
 
@@ -981,22 +1313,13 @@ woke_up:
 			list_first_entry(&pool->worklist,
 					 struct work_struct, entry);
 
-//		if (likely(!(*work_data_bits(work) & WORK_STRUCT_LINKED))) {
-			/* optimization path, not strictly necessary */
-			process_one_work(worker, work);
-//			if (unlikely(!list_empty(&worker->scheduled)))
-//				process_scheduled_works(worker);
-//		} else {
-//			move_linked_works(work, &worker->scheduled, NULL);
-//			process_scheduled_works(worker);
-//		}
+		process_one_work(worker, work);
+		if (unlikely(!list_empty(&worker->scheduled)))
+			process_scheduled_works(worker);
 	} while (keep_working(pool));
 
-	worker_set_flags(worker, WORKER_PREP, false);
+	worker_set_flags(worker, WORKER_PREP);
 sleep:
-//	if (unlikely(need_to_manage_workers(pool)) && manage_workers(worker))
-//		goto recheck;
-
 	/*
 	 * pool->lock is held and there's no work to process and no need to
 	 * manage, sleep.  Workers are woken up only while holding
@@ -1009,51 +1332,6 @@ sleep:
 	spin_unlock_irq(&pool->lock);
 	schedule();
 	goto woke_up;
-
-	return 0;
-}
-
-/**
- * create_and_start_worker - create and start a worker for a pool
- * @pool: the target pool
- *
- * Grab the managership of @pool and create and start a new worker for it.
- */
-static int create_and_start_worker(struct worker_pool *pool)
-{
-	struct worker *worker = NULL;
-	struct task_struct *p;
-
-	//pr_info("%s pool %p\n", __func__, pool);
-	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
-	if (!worker)
-		return -ENOMEM;
-
-	INIT_LIST_HEAD(&worker->entry);
-	INIT_LIST_HEAD(&worker->scheduled);
-	/* on creation a worker is in !idle && prep state */
-	worker->flags = WORKER_PREP;
-
-	worker->pool = pool;
-
-	if (pool->flags & POOL_DISASSOCIATED)
-		worker->flags |= WORKER_UNBOUND;
-	//worker->task = kthread_create_on_node(worker_thread, worker, pool->node,
-	//				      "kworker/%s", id_buf);
-	//if (IS_ERR(worker->task))
-	//	kfree(worker);
-	//	return 0;
-	/* prevent userland from meddling with cpumask of workqueue workers */
-	//worker->task->flags |= PF_NO_SETAFFINITY;
-	// XXX need to set up worker->task
-
-	worker->flags |= WORKER_STARTED;
-	worker->pool->nr_workers++;
-	worker_enter_idle(worker);
-	//wake_up_process(worker->task);
-	p = kthread_run(worker_thread, worker, "kworker");
-
-	return p->pid;
 }
 
 void free_workqueue_attrs(struct workqueue_attrs *attrs)
@@ -1082,39 +1360,70 @@ fail:
  * init_worker_pool - initialize a newly zalloc'd worker_pool
  * @pool: worker_pool to initialize
  *
- * Initiailize a newly zalloc'd @pool.  It also allocates @pool->attrs.
- * Returns 0 on success, -errno on failure.  Even on failure, all fields
- * inside @pool proper are initialized and put_unbound_pool() can be called
- * on @pool safely to release it.
+ * Initiailize a newly zalloc'd @pool and assign it an ID.
+ * It also allocates @pool->attrs.
+ * Returns 0 on success, -errno on failure.
  */
 static int init_worker_pool(struct worker_pool *pool)
 {
 	spin_lock_init(&pool->lock);
-	pool->id = 0;
+	pool->id = nr_worker_pools;
+	pool->cpu = -1;
+	pool->node = NUMA_NO_NODE;
 	pool->flags |= POOL_DISASSOCIATED;
 	INIT_LIST_HEAD(&pool->worklist);
 	INIT_LIST_HEAD(&pool->idle_list);
+	hash_init(pool->busy_hash);
 
-//	init_timer_deferrable(&pool->idle_timer);
-//	pool->idle_timer.function = idle_worker_timeout;
-//	pool->idle_timer.data = (unsigned long)pool;
-
-//	mutex_init(&pool->manager_arb);
-//	mutex_init(&pool->manager_mutex);
-//	idr_init(&pool->worker_idr);
+	setup_timer(&pool->idle_timer, idle_worker_timeout,
+		    (unsigned long)pool);
 
 	pool->refcnt = 1;
 
 	pool->attrs = alloc_workqueue_attrs(GFP_KERNEL);
 	if (!pool->attrs)
 		return -ENOMEM;
+
+	worker_pools[nr_worker_pools++] = pool;
 	return 0;
 }
 
-int init_workqueues(void)
+/* Create the unbound pools of @node, made of the online cpus there */
+static void __init init_unbound_pools(int node)
+{
+	int std_nice[NR_STD_WORKER_POOLS] = { 0, HIGHPRI_NICE_LEVEL };
+	struct worker_pool *pools;
+	int cpu, i;
+
+	pools = kzalloc(NR_STD_WORKER_POOLS * sizeof(*pools), GFP_KERNEL);
+	BUG_ON(!pools);
+
+	for (i = 0; i < NR_STD_WORKER_POOLS; i++) {
+		struct worker_pool *pool = &pools[i];
+
+		BUG_ON(init_worker_pool(pool));
+		pool->node = node;
+		pool->attrs->nice = std_nice[i];
+
+		cpumask_clear(pool->attrs->cpumask);
+		for_each_online_cpu(cpu)
+			if (wq_cpu_node(cpu) == node)
+				cpumask_set_cpu(cpu, pool->attrs->cpumask);
+
+		BUG_ON(create_worker(pool));
+	}
+	unbound_std_pools[node] = pools;
+}
+
+int __init init_workqueues(void)
 {
 	int std_nice[NR_STD_WORKER_POOLS] = { 0, HIGHPRI_NICE_LEVEL };
-	int i, cpu, mycpu;
+	int i, cpu, node;
+
+	worker_pools = kzalloc((nr_cpu_ids + nr_node_ids) *
+			       NR_STD_WORKER_POOLS * sizeof(*worker_pools),
+			       GFP_KERNEL);
+	BUG_ON(!worker_pools);
 
 	/* initialize CPU pools */
 	for_each_possible_cpu(cpu) {
@@ -1126,27 +1435,31 @@ int init_workqueues(void)
 			pool->cpu = cpu;
 			cpumask_copy(pool->attrs->cpumask, cpumask_of(cpu));
 			pool->attrs->nice = std_nice[i++];
-			//pool->node = cpu_to_node(cpu);
+			pool->node = cpu_to_node(cpu);
 		}
 	}
 
-	mycpu = smp_processor_id();
 	/* create the initial worker */
 	for_each_online_cpu(cpu) {
 		struct worker_pool *pool;
-		int pid;
 
-		//pr_info("%s cpu %d\n", __func__, cpu);
 		for_each_cpu_worker_pool(pool, cpu) {
 			pool->flags &= ~POOL_DISASSOCIATED;
-			pid = create_and_start_worker(pool);
-			BUG_ON(pid < 0);
-			if (mycpu != cpu) {
-				//pr_info("%s scheduling pid %d to cpu %d\n", __func__, pid, cpu);
-				sched_setaffinity(pid, cpumask_of(cpu));
-			}
+			BUG_ON(create_worker(pool));
 		}
 	}
 
+	/* unbound pools, one set per node with online cpus */
+	for_each_online_cpu(cpu) {
+		node = wq_cpu_node(cpu);
+		if (!unbound_std_pools[node])
+			init_unbound_pools(node);
+	}
+
+	system_wq = __alloc_workqueue("events", 0, 0);
+	system_highpri_wq = __alloc_workqueue("events_highpri", WQ_HIGHPRI, 0);
+	system_unbound_wq = __alloc_workqueue("events_unbound", WQ_UNBOUND,
+					      WQ_UNBOUND_MAX_ACTIVE);
+	BUG_ON(!system_wq || !system_highpri_wq || !system_unbound_wq);
 	return 0;
 }
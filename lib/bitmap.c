@@ -10,6 +10,7 @@
 #include <lego/bitmap.h>
 #include <lego/bitops.h>
 #include <lego/kernel.h>
+#include <lego/ctype.h>
 
 int __bitmap_equal(const unsigned long *bitmap1,
 		const unsigned long *bitmap2, unsigned int bits)
@@ -323,3 +324,46 @@ void __bitmap_or(unsigned long *dst, const unsigned long *bitmap1,
 	for (k = 0; k < nr; k++)
 		dst[k] = bitmap1[k] | bitmap2[k];
 }
+
+/**
+ * bitmap_parselist - convert list format ASCII string to bitmap
+ * @buf: nul-terminated string, e.g. "0,4-7"
+ * @maskp: write resulting mask here
+ * @nmaskbits: number of bits in mask to be written
+ *
+ * Return 0 on success, -EINVAL on bad format, -ERANGE if
+ * a number is not less than @nmaskbits.
+ */
+int bitmap_parselist(const char *buf, unsigned long *maskp, int nmaskbits)
+{
+	unsigned int a, b;
+	char *end;
+
+	bitmap_zero(maskp, nmaskbits);
+	while (*buf) {
+		if (!isdigit(*buf))
+			return -EINVAL;
+		a = b = simple_strtoul(buf, &end, 10);
+		buf = end;
+
+		if (*buf == '-') {
+			buf++;
+			if (!isdigit(*buf))
+				return -EINVAL;
+			b = simple_strtoul(buf, &end, 10);
+			buf = end;
+		}
+
+		if (a > b)
+			return -EINVAL;
+		if (b >= nmaskbits)
+			return -ERANGE;
+		bitmap_set(maskp, a, b - a + 1);
+
+		if (*buf == ',')
+			buf++;
+		else if (*buf)
+			return -EINVAL;
+	}
+	return 0;
+}
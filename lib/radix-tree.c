@@ -135,9 +135,10 @@ static inline unsigned long radix_tree_maxindex(unsigned int height)
 	return height_to_maxindex[height];
 }
 
-static inline void
-radix_tree_node_free(struct radix_tree_node *node)
+static void radix_tree_node_rcu_free(struct rcu_head *head)
 {
+	struct radix_tree_node *node =
+			container_of(head, struct radix_tree_node, rcu_head);
 	int i;
 
 	/*
@@ -154,6 +155,16 @@ radix_tree_node_free(struct radix_tree_node *node)
 	kfree(node);
 }
 
+/*
+ * Lockless lookups may still be walking through @node,
+ * free it after a grace period.
+ */
+static inline void
+radix_tree_node_free(struct radix_tree_node *node)
+{
+	call_rcu(&node->rcu_head, radix_tree_node_rcu_free);
+}
+
 static struct radix_tree_node *
 radix_tree_node_alloc(struct radix_tree_root *root)
 {
@@ -16,9 +16,6 @@
 #include <linux/sched.h>
 #include <linux/kthread.h>
 
-const char *log_fname = "/home/yilun/lego-gsm-log";
-static struct file *log;
-
 int global_storage_id[NUM_STORAGE_NODE];
 
 static void init_storage_lid(void)
@@ -27,28 +24,6 @@ static void init_storage_lid(void)
 	global_storage_id[1] = 4;
 }
 
-void log_vnode(struct lego_vnode_struct *mm_vnode, bool delete)
-{
-	struct raw_vnode_struct raw_vnode;
-	ssize_t ret;
-
-	if (IS_ERR_OR_NULL(log))
-		return;
-
-	raw_vnode.vid = mm_vnode->vid;
-	raw_vnode.sid = mm_vnode->storage_node_id;
-
-	if (delete)
-		raw_vnode.valid = false;
-	else
-		raw_vnode.valid = true;
-
-	ret = kernel_write(log, (char *) &raw_vnode, sizeof(raw_vnode), log->f_pos);
-
-	if (ret != sizeof(raw_vnode))
-		pr_warn("Fail to log vnode");
-}
-
 struct lego_vnode_struct *alloc_lego_vnode(int vid, int sid)
 {
 	struct lego_vnode_struct *mm_vnode;
@@ -67,17 +42,15 @@ static int __init lego_gsm_module_init(void)
 {
 
 	init_storage_lid();
-	log = filp_open(log_fname, O_RDWR | O_CREAT | O_APPEND, 0644);
-	if (!IS_ERR_OR_NULL(log))
-		reconstruct_hash_table(log);
-	
+	gsm_log_init();
+
 	return 0;
 }
 
 static void __exit lego_gsm_module_exit(void)
 {
-	if (!IS_ERR_OR_NULL(log))
-		filp_close(log, NULL);
+	/* Final flush and snapshot */
+	gsm_log_exit();
 
 	/* free hashtable */
 	clear_hash_table();
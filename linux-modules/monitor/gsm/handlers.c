@@ -29,7 +29,15 @@ int handle_p2sm_alloc_nodes(int *payload, uintptr_t desc)
 
 		ht_insert_lego_vnode(mm_vnode);
 	}
-	
+
+	/*
+	 * The placement must survive a GSM restart. Also done when
+	 * it is found, an earlier commit of it may have failed.
+	 */
+	ret = gsm_log_commit();
+	if (unlikely(ret))
+		goto reply;
+
 	res.sid = mm_vnode->storage_node_id;
 
 	if (mm_vnode->pgcache_node_id == -1) {
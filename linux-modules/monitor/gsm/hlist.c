@@ -11,31 +11,44 @@
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
 #include <linux/hashtable.h>
 
 #define GSM_HASH_SHIFT		10
 
-static DEFINE_SPINLOCK(gsm_hash_lock);
+/*
+ * Serializes table updates with their log records, so the log order
+ * is the update order. A mutex, because logging may sleep.
+ */
+static DEFINE_MUTEX(gsm_hash_mutex);
 static DEFINE_HASHTABLE(gsm_hash, GSM_HASH_SHIFT);
 
+static struct lego_vnode_struct *__ht_find_lego_vnode(int vid)
+{
+	struct lego_vnode_struct *mm_vnode;
+
+	hash_for_each_possible(gsm_hash, mm_vnode, hlink, vid) {
+		if (likely(mm_vnode->vid == vid))
+			return mm_vnode;
+	}
+	return NULL;
+}
+
 /* check before insert */
 int ht_insert_lego_vnode(struct lego_vnode_struct *mm_vnode)
 {
-	struct lego_vnode_struct *p;
-
 	if (IS_ERR_OR_NULL(mm_vnode))
 		return -EFAULT;
 
-	spin_lock(&gsm_hash_lock);
-	hash_for_each_possible(gsm_hash, p, hlink, mm_vnode->vid) {
-		if (unlikely(p->vid == mm_vnode->vid)) {
-			spin_unlock(&gsm_hash_lock);
-			return -EEXIST;
-		}
+	mutex_lock(&gsm_hash_mutex);
+	if (unlikely(__ht_find_lego_vnode(mm_vnode->vid))) {
+		mutex_unlock(&gsm_hash_mutex);
+		return -EEXIST;
 	}
 	hash_add(gsm_hash, &mm_vnode->hlink, mm_vnode->vid);
 	log_vnode(mm_vnode, false);
-	spin_unlock(&gsm_hash_lock);
+	mutex_unlock(&gsm_hash_mutex);
 
 	return 0;
 }
@@ -46,11 +59,11 @@ int ht_remove_lego_vnode(struct lego_vnode_struct *mm_vnode)
 	if (IS_ERR_OR_NULL(mm_vnode))
 		return -EINVAL;
 
-	spin_lock(&gsm_hash_lock);
+	mutex_lock(&gsm_hash_mutex);
 	hash_del(&mm_vnode->hlink);
 	log_vnode(mm_vnode, true);
 	kfree(mm_vnode);
-	spin_unlock(&gsm_hash_lock);
+	mutex_unlock(&gsm_hash_mutex);
 	return 0;
 }
 
@@ -59,60 +72,84 @@ struct lego_vnode_struct *ht_find_lego_vnode(int vid)
 {
 	struct lego_vnode_struct *mm_vnode;
 
-	spin_lock(&gsm_hash_lock);
-	hash_for_each_possible(gsm_hash, mm_vnode, hlink, vid) {
-		if (likely(mm_vnode->vid == vid)) {
-			spin_unlock(&gsm_hash_lock);
-			return mm_vnode;
+	mutex_lock(&gsm_hash_mutex);
+	mm_vnode = __ht_find_lego_vnode(vid);
+	mutex_unlock(&gsm_hash_mutex);
+	return mm_vnode;
+}
+
+/*
+ * Apply one snapshot or log record at module load, without logging it.
+ * Records are replayed in order, the last one of a vid wins.
+ */
+int replay_lego_vnode(struct raw_vnode_struct *raw_vnode)
+{
+	struct lego_vnode_struct *mm_vnode;
+	int ret = 0;
+
+	mutex_lock(&gsm_hash_mutex);
+	mm_vnode = __ht_find_lego_vnode(raw_vnode->vid);
+	if (!raw_vnode->valid) {
+		if (mm_vnode) {
+			hash_del(&mm_vnode->hlink);
+			kfree(mm_vnode);
 		}
+		goto unlock;
 	}
-	spin_unlock(&gsm_hash_lock);
-	return NULL;
+
+	if (mm_vnode) {
+		mm_vnode->storage_node_id = raw_vnode->sid;
+		goto unlock;
+	}
+
+	mm_vnode = alloc_lego_vnode(raw_vnode->vid, raw_vnode->sid);
+	if (unlikely(!mm_vnode)) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+	hash_add(gsm_hash, &mm_vnode->hlink, mm_vnode->vid);
+
+unlock:
+	mutex_unlock(&gsm_hash_mutex);
+	return ret;
 }
 
-int reconstruct_hash_table(struct file *log)
+/*
+ * Copy all vnodes for a snapshot. The log records not written yet
+ * are grabbed at the same time, so the snapshot is exactly the state
+ * after them. Return a vmalloc'ed array, NULL if empty.
+ */
+struct raw_vnode_struct *collect_hash_table(int *nr, struct list_head *batch,
+					    u64 *seq)
 {
-	size_t len_log, cur;
+	struct raw_vnode_struct *raw = NULL;
+	struct lego_vnode_struct *mm_vnode;
+	int bkt, i = 0;
 
-	if (IS_ERR_OR_NULL(log)) {
-		pr_warn("No log file exist.\n");
-		return -ENOENT;
-	}
+	mutex_lock(&gsm_hash_mutex);
+	hash_for_each(gsm_hash, bkt, mm_vnode, hlink)
+		i++;
 
-	len_log = i_size_read(log->f_inode);
-	cur = 0;
-
-	while(cur != len_log) {
-		struct lego_vnode_struct *mm_vnode;
-		struct raw_vnode_struct raw_vnode;
-		size_t retlen;
-
-		retlen = kernel_read(log, cur, (char *) &raw_vnode, sizeof(raw_vnode));
-		if (unlikely(retlen != sizeof(raw_vnode)))
-			return -EIO;
-
-		if (!raw_vnode.valid) {
-			mm_vnode = ht_find_lego_vnode(raw_vnode.vid);
-			if (!mm_vnode) {
-				cur += sizeof(raw_vnode);
-				continue;
-			}
-			ht_remove_lego_vnode(mm_vnode);
-		} else {
-			mm_vnode = alloc_lego_vnode(raw_vnode.vid, raw_vnode.sid);
-			if (unlikely(!mm_vnode))
-				return -ENOMEM;
-			
-			pr_info("insert hashtable with vnode->(id: %d, sid: %d)\n",
-					mm_vnode->vid, mm_vnode->storage_node_id);
-			ht_insert_lego_vnode(mm_vnode);
+	if (i) {
+		raw = vmalloc(i * sizeof(*raw));
+		if (!raw) {
+			mutex_unlock(&gsm_hash_mutex);
+			return ERR_PTR(-ENOMEM);
 		}
-
-		cur += sizeof(raw_vnode);
 	}
 
-	return 0;
+	*nr = i;
+	i = 0;
+	hash_for_each(gsm_hash, bkt, mm_vnode, hlink) {
+		raw[i].vid = mm_vnode->vid;
+		raw[i].sid = mm_vnode->storage_node_id;
+		raw[i].valid = true;
+		i++;
+	}
+	grab_log_records(batch, seq);
+	mutex_unlock(&gsm_hash_mutex);
 
+	return raw;
 }
 
 void clear_hash_table(void)
@@ -121,7 +158,7 @@ void clear_hash_table(void)
 	struct lego_vnode_struct *mm_vnode;
 	struct hlist_node *tmp;
 
-	spin_lock(&gsm_hash_lock);
+	mutex_lock(&gsm_hash_mutex);
 	hash_for_each_safe(gsm_hash, bkt, tmp, mm_vnode, hlink) {
 		hash_del(&mm_vnode->hlink);
 
@@ -130,7 +167,7 @@ void clear_hash_table(void)
 		kfree(mm_vnode);
 	}
 
-	spin_unlock(&gsm_hash_lock);
+	mutex_unlock(&gsm_hash_mutex);
 
 	if (hash_empty(gsm_hash))
 		pr_info("Successfully free Hash Table.\n");
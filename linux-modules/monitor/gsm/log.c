@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * GSM metadata log and snapshots
+ *
+ * Every vnode change appends a record to an in-memory list. The
+ * lego-gsm-logd thread writes all pending records with one write
+ * and one fsync (group commit), then wakes up the callers waiting
+ * in gsm_log_commit(). A batch that fails to reach the disk is cut
+ * off the log and put back in front of the pending records, the thread
+ * retries it after GSM_LOG_RETRY and the waiters get -EIO meanwhile.
+ *
+ * Every GSM_SNAPSHOT_RECORDS records or GSM_SNAPSHOT_INTERVAL,
+ * the whole hash table is written to one of two snapshot slots,
+ * alternately, and the log is truncated. A slot carries a generation
+ * and a checksum, a torn slot is ignored and the other one is used.
+ * A crash before the truncation leaves old records in the log,
+ * replaying them over the new snapshot gives the same table.
+ *
+ * Module load reads the newest valid snapshot and replays the log.
+ */
+
+#include "gsm.h"
+#include <linux/fs.h>
+#include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/crc32.h>
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/jiffies.h>
+#include <linux/kthread.h>
+#include <linux/spinlock.h>
+
+#define GSM_SNAPSHOT_MAGIC	0x67736d73	/* "gsms" */
+#define GSM_SNAPSHOT_RECORDS	4096
+#define GSM_SNAPSHOT_INTERVAL	(60 * HZ)
+#define GSM_LOG_RETRY		(HZ)
+
+static const char *log_fname = "/home/yilun/lego-gsm-log";
+static const char *snapshot_fname[2] = {
+	"/home/yilun/lego-gsm-snapshot.0",
+	"/home/yilun/lego-gsm-snapshot.1",
+};
+
+struct gsm_snapshot_header {
+	u32	magic;
+	u32	nr;		/* nr of raw_vnode_struct following */
+	u64	gen;
+	u32	csum;		/* crc32 of the records */
+};
+
+struct gsm_log_record {
+	struct list_head	list;
+	struct raw_vnode_struct	raw;
+};
+
+static struct file *log;
+
+/* Records not written yet */
+static DEFINE_SPINLOCK(gsm_log_lock);
+static LIST_HEAD(gsm_log_pending);
+static u64 log_appended;
+static u64 log_committed;
+static unsigned long log_failures;
+
+static DECLARE_WAIT_QUEUE_HEAD(gsm_logd_wq);
+static DECLARE_WAIT_QUEUE_HEAD(gsm_commit_wq);
+static struct task_struct *gsm_logd;
+
+static u64 snapshot_gen;
+static unsigned long last_snapshot;
+static unsigned long records_since_snapshot;
+
+/*
+ * Called with the hash table locked, so records are queued
+ * in the order of updates.
+ */
+void log_vnode(struct lego_vnode_struct *mm_vnode, bool delete)
+{
+	struct gsm_log_record *rec;
+
+	if (IS_ERR_OR_NULL(log))
+		return;
+
+	rec = kmalloc(sizeof(*rec), GFP_KERNEL);
+	if (!rec) {
+		pr_warn("Fail to log vnode %d\n", mm_vnode->vid);
+		return;
+	}
+
+	rec->raw.vid = mm_vnode->vid;
+	rec->raw.sid = mm_vnode->storage_node_id;
+	rec->raw.valid = !delete;
+
+	spin_lock(&gsm_log_lock);
+	list_add_tail(&rec->list, &gsm_log_pending);
+	log_appended++;
+	spin_unlock(&gsm_log_lock);
+}
+
+/*
+ * Wait until all records queued so far are on disk.
+ * Callers arriving during an fsync share the next one.
+ * Return -EIO if a write fails first, the records stay queued.
+ */
+int gsm_log_commit(void)
+{
+	unsigned long failures;
+	u64 seq;
+
+	if (IS_ERR_OR_NULL(log))
+		return 0;
+
+	spin_lock(&gsm_log_lock);
+	seq = log_appended;
+	failures = log_failures;
+	spin_unlock(&gsm_log_lock);
+
+	if (READ_ONCE(log_committed) >= seq)
+		return 0;
+
+	wake_up(&gsm_logd_wq);
+	wait_event(gsm_commit_wq, READ_ONCE(log_committed) >= seq ||
+				  READ_ONCE(log_failures) != failures);
+
+	if (READ_ONCE(log_committed) >= seq)
+		return 0;
+	return -EIO;
+}
+
+/* Take over pending records, @seq is the last one */
+void grab_log_records(struct list_head *batch, u64 *seq)
+{
+	spin_lock(&gsm_log_lock);
+	list_splice_init(&gsm_log_pending, batch);
+	*seq = log_appended;
+	spin_unlock(&gsm_log_lock);
+}
+
+static bool log_pending(void)
+{
+	return !list_empty_careful(&gsm_log_pending);
+}
+
+/*
+ * Records queued after @batch was grabbed are behind it,
+ * so putting it back in front keeps the order of updates.
+ */
+static void requeue_log_records(struct list_head *batch)
+{
+	spin_lock(&gsm_log_lock);
+	list_splice(batch, &gsm_log_pending);
+	log_failures++;
+	spin_unlock(&gsm_log_lock);
+
+	wake_up_all(&gsm_commit_wq);
+}
+
+static int write_log_records(struct list_head *batch, u64 seq)
+{
+	struct gsm_log_record *rec, *tmp;
+	struct raw_vnode_struct *buf;
+	size_t nr = 0, i = 0;
+	loff_t size;
+	ssize_t ret;
+	int err = 0;
+
+	list_for_each_entry(rec, batch, list)
+		nr++;
+	if (!nr)
+		goto out;
+
+	size = i_size_read(file_inode(log));
+
+	buf = vmalloc(nr * sizeof(*buf));
+	if (buf) {
+		list_for_each_entry(rec, batch, list)
+			buf[i++] = rec->raw;
+
+		ret = kernel_write(log, (char *)buf, nr * sizeof(*buf), log->f_pos);
+		if (ret != nr * sizeof(*buf))
+			err = ret < 0 ? ret : -EIO;
+		vfree(buf);
+	} else {
+		/* Still keep them in order */
+		list_for_each_entry(rec, batch, list) {
+			ret = kernel_write(log, (char *)&rec->raw,
+					   sizeof(rec->raw), log->f_pos);
+			if (ret != sizeof(rec->raw)) {
+				err = ret < 0 ? ret : -EIO;
+				break;
+			}
+		}
+	}
+
+	if (!err)
+		err = vfs_fsync(log, 1);
+
+	if (unlikely(err)) {
+		pr_warn("Fail to log %zu vnodes: %d\n", nr, err);
+
+		/*
+		 * A partial write would misalign the records appended
+		 * by the retry, cut the log back to the last commit.
+		 */
+		if (vfs_truncate(&log->f_path, size))
+			pr_warn("Fail to cut log back to %lld\n", size);
+		requeue_log_records(batch);
+		return err;
+	}
+
+	list_for_each_entry_safe(rec, tmp, batch, list) {
+		list_del(&rec->list);
+		kfree(rec);
+	}
+	records_since_snapshot += nr;
+
+out:
+	WRITE_ONCE(log_committed, seq);
+	wake_up_all(&gsm_commit_wq);
+	return 0;
+}
+
+static int flush_log(void)
+{
+	LIST_HEAD(batch);
+	u64 seq;
+
+	grab_log_records(&batch, &seq);
+	return write_log_records(&batch, seq);
+}
+
+static int write_snapshot(struct raw_vnode_struct *raw, int nr, u64 gen)
+{
+	struct gsm_snapshot_header hdr;
+	struct file *filp;
+	size_t len = nr * sizeof(*raw);
+	ssize_t ret;
+	int err = 0;
+
+	filp = filp_open(snapshot_fname[gen % 2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+
+	hdr.magic = GSM_SNAPSHOT_MAGIC;
+	hdr.nr = nr;
+	hdr.gen = gen;
+	hdr.csum = crc32_le(~0, (unsigned char *)raw, len);
+
+	ret = kernel_write(filp, (char *)&hdr, sizeof(hdr), 0);
+	if (ret != sizeof(hdr))
+		err = -EIO;
+	if (!err && len) {
+		ret = kernel_write(filp, (char *)raw, len, sizeof(hdr));
+		if (ret != len)
+			err = -EIO;
+	}
+	if (!err)
+		err = vfs_fsync(filp, 0);
+
+	filp_close(filp, NULL);
+	return err;
+}
+
+static int take_snapshot(void)
+{
+	struct raw_vnode_struct *raw;
+	LIST_HEAD(batch);
+	u64 seq;
+	int nr, ret;
+
+	raw = collect_hash_table(&nr, &batch, &seq);
+	if (IS_ERR(raw))
+		return flush_log();
+
+	/* The log must cover the snapshot before it is truncated */
+	ret = write_log_records(&batch, seq);
+	if (ret) {
+		vfree(raw);
+		return ret;
+	}
+
+	ret = write_snapshot(raw, nr, snapshot_gen + 1);
+	vfree(raw);
+	if (ret) {
+		pr_warn("Fail to write snapshot: %d\n", ret);
+		return 0;
+	}
+
+	snapshot_gen++;
+	last_snapshot = jiffies;
+	records_since_snapshot = 0;
+
+	ret = vfs_truncate(&log->f_path, 0);
+	if (!ret)
+		ret = vfs_fsync(log, 0);
+	if (ret)
+		pr_warn("Fail to truncate log: %d\n", ret);
+	return 0;
+}
+
+static bool snapshot_due(void)
+{
+	if (!records_since_snapshot)
+		return false;
+	return records_since_snapshot >= GSM_SNAPSHOT_RECORDS ||
+	       time_after(jiffies, last_snapshot + GSM_SNAPSHOT_INTERVAL);
+}
+
+static int gsm_logd_fn(void *unused)
+{
+	int ret;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible_timeout(gsm_logd_wq,
+				log_pending() || kthread_should_stop(),
+				GSM_SNAPSHOT_INTERVAL);
+
+		if (snapshot_due())
+			ret = take_snapshot();
+		else
+			ret = flush_log();
+
+		/* Records are still queued, back off before retrying */
+		if (ret)
+			schedule_timeout_interruptible(GSM_LOG_RETRY);
+	}
+
+	ret = flush_log();
+	if (!ret && records_since_snapshot)
+		ret = take_snapshot();
+	if (ret)
+		pr_err("Records lost at exit: %d\n", ret);
+	return 0;
+}
+
+/* Return the generation of a valid snapshot slot, 0 if none */
+static u64 load_snapshot_header(int slot, struct gsm_snapshot_header *hdr)
+{
+	struct file *filp;
+	size_t len;
+	ssize_t ret;
+
+	filp = filp_open(snapshot_fname[slot], O_RDONLY, 0);
+	if (IS_ERR(filp))
+		return 0;
+
+	ret = kernel_read(filp, 0, (char *)hdr, sizeof(*hdr));
+	len = i_size_read(file_inode(filp));
+	filp_close(filp, NULL);
+
+	if (ret != sizeof(*hdr) || hdr->magic != GSM_SNAPSHOT_MAGIC ||
+	    hdr->gen % 2 != slot ||
+	    len != sizeof(*hdr) + hdr->nr * sizeof(struct raw_vnode_struct))
+		return 0;
+	return hdr->gen;
+}
+
+static int load_snapshot(void)
+{
+	struct gsm_snapshot_header hdr[2];
+	struct raw_vnode_struct *raw;
+	struct file *filp;
+	u64 gen[2];
+	size_t len;
+	ssize_t ret;
+	int slot, i, j;
+
+	gen[0] = load_snapshot_header(0, &hdr[0]);
+	gen[1] = load_snapshot_header(1, &hdr[1]);
+
+	/* Newest first, fall back to the other one if torn */
+	for (i = 0; i < 2; i++) {
+		slot = (gen[1] > gen[0]) ^ i;
+		if (!gen[slot])
+			continue;
+
+		len = hdr[slot].nr * sizeof(*raw);
+		/* Not NULL even for an empty table */
+		raw = vmalloc(len + 1);
+		if (!raw)
+			return -ENOMEM;
+
+		filp = filp_open(snapshot_fname[slot], O_RDONLY, 0);
+		if (IS_ERR(filp)) {
+			vfree(raw);
+			continue;
+		}
+		ret = kernel_read(filp, sizeof(hdr[slot]), (char *)raw, len);
+		filp_close(filp, NULL);
+
+		if (ret != len ||
+		    crc32_le(~0, (unsigned char *)raw, len) != hdr[slot].csum) {
+			pr_warn("Snapshot %s is corrupted\n", snapshot_fname[slot]);
+			vfree(raw);
+			continue;
+		}
+
+		for (j = 0; j < hdr[slot].nr; j++)
+			replay_lego_vnode(&raw[j]);
+		vfree(raw);
+
+		snapshot_gen = gen[slot];
+		pr_info("Loaded snapshot gen %llu, %u vnodes\n",
+			snapshot_gen, hdr[slot].nr);
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static int replay_log(void)
+{
+	struct raw_vnode_struct raw_vnode;
+	size_t len_log, cur;
+	ssize_t retlen;
+
+	len_log = i_size_read(file_inode(log));
+	for (cur = 0; cur + sizeof(raw_vnode) <= len_log; cur += sizeof(raw_vnode)) {
+		retlen = kernel_read(log, cur, (char *)&raw_vnode, sizeof(raw_vnode));
+		if (unlikely(retlen != sizeof(raw_vnode)))
+			return -EIO;
+		replay_lego_vnode(&raw_vnode);
+	}
+
+	/* A torn record at the tail was never committed */
+	if (cur != len_log)
+		vfs_truncate(&log->f_path, cur);
+
+	pr_info("Replayed %zu log records\n", cur / sizeof(raw_vnode));
+	return 0;
+}
+
+int gsm_log_init(void)
+{
+	log = filp_open(log_fname, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (IS_ERR(log)) {
+		pr_warn("No log file, metadata is not persistent\n");
+		return PTR_ERR(log);
+	}
+
+	load_snapshot();
+	replay_log();
+	last_snapshot = jiffies;
+
+	gsm_logd = kthread_run(gsm_logd_fn, NULL, "lego-gsm-logd");
+	if (IS_ERR(gsm_logd)) {
+		filp_close(log, NULL);
+		log = NULL;
+		return PTR_ERR(gsm_logd);
+	}
+	return 0;
+}
+
+void gsm_log_exit(void)
+{
+	struct gsm_log_record *rec, *tmp;
+
+	if (IS_ERR_OR_NULL(log))
+		return;
+
+	kthread_stop(gsm_logd);
+
+	/* Left behind by a failed final flush */
+	list_for_each_entry_safe(rec, tmp, &gsm_log_pending, list) {
+		list_del(&rec->list);
+		kfree(rec);
+	}
+	filp_close(log, NULL);
+	log = NULL;
+}
@@ -44,12 +44,20 @@ struct gsm2p_ret_struct {
 int ht_insert_lego_vnode(struct lego_vnode_struct *mm_vnode);
 int ht_remove_lego_vnode(struct lego_vnode_struct *mm_vnode);
 struct lego_vnode_struct *ht_find_lego_vnode(int vid);
-int reconstruct_hash_table(struct file *log);
+int replay_lego_vnode(struct raw_vnode_struct *raw_vnode);
+struct raw_vnode_struct *collect_hash_table(int *nr, struct list_head *batch,
+					    u64 *seq);
 void clear_hash_table(void);
 
 /* core.c */
 struct lego_vnode_struct *alloc_lego_vnode(int vid, int sid);
+
+/* log.c */
 void log_vnode(struct lego_vnode_struct *mm_vnode, bool delete);
+int gsm_log_commit(void);
+void grab_log_records(struct list_head *batch, u64 *seq);
+int gsm_log_init(void);
+void gsm_log_exit(void);
 
 /* handlers.c */
 int handle_p2sm_alloc_nodes(int *payload, uintptr_t desc);
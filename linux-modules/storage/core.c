@@ -246,6 +246,7 @@ static void __exit stop_storage_server(void)
 	 * Cleanup things such as allocated memory,
 	 * opened file, created thread.
 	 */
+	storage_handle_exit();
 	printk(KERN_INFO "Bye, storage server!\n");
 }
 
@@ -71,14 +71,14 @@ ssize_t handle_read_request(void *payload, uintptr_t desc)
 	} */ /*enable in future*/
 	*retval = 0;
 
-	filp = local_file_open(&rq);
+	filp = storage_handle_get(m2s_rq->fh, m2s_rq->filename, O_RDONLY);
 	if (IS_ERR(filp)){
 		*retval = PTR_ERR(filp);
 		goto out_reply;
 	}
 
 	*retval = local_file_read(filp, (char __user *)readbuf, rq.len, &rq.offset);
-	local_file_close(filp);
+	fput(filp);
 	//yield_access(metadata_entry, user_entry); //enable in future
 	//pr_info("Content in readbuf is [%s]\n", readbuf);
 
@@ -120,13 +120,13 @@ ssize_t handle_write_request(void *payload, uintptr_t desc)
 	}*/ //enable in future
 	retval = 0;
 
-	filp = local_file_open(&rq);
+	filp = storage_handle_get(m2s_wq->fh, m2s_wq->filename, rq.flags);
 	if (IS_ERR(filp)){
 		retval = PTR_ERR(filp);
 		goto out_reply;
 	}
 	retval = local_file_write(filp, (const char __user *)writebuf, rq.len, &rq.offset);
-	local_file_close(filp);
+	fput(filp);
 	//yield_access(metadata_entry, user_entry); //enable in future
 
 out_reply:
@@ -139,8 +139,8 @@ out_reply:
 int handle_open_request(void *payload, uintptr_t desc)
 {
 	struct p2s_open_struct *m2s_op = payload;
+	struct p2s_open_ret_struct ret;
 	//int metadata_entry, user_entry;
-	int ret;
 	request rq;
 	struct file *filp;
 
@@ -150,28 +150,44 @@ int handle_open_request(void *payload, uintptr_t desc)
 	pr_info("%s(): filename: %s, uid: %d, permission: %u, flags: %o",
 			__func__, m2s_op->filename, m2s_op->uid, m2s_op->permission, m2s_op->flags);
 #endif
-	ret = 0;
+	ret.retval = 0;
+	ret.fh = 0;
 
+	/* Checks the mode and does O_CREAT/O_TRUNC, the handle stays cached */
 	filp = local_file_open(&rq);
 	if (IS_ERR(filp)){
-		ret = PTR_ERR(filp);
+		ret.retval = PTR_ERR(filp);
 		goto out_reply;
 	}
-
 	local_file_close(filp);
 
+	filp = storage_handle_get(0, m2s_op->filename, O_RDONLY);
+	if (!IS_ERR(filp)) {
+		ret.fh = storage_file_handle(filp);
+		fput(filp);
+	}
+
 out_reply:
 	ibapi_reply_message(&ret, sizeof(ret), desc);
-	return ret;
+	return ret.retval;
 }
 
 int handle_stat_request(void *payload, uintptr_t desc)
 {
 	struct p2s_stat_struct *stat_rq = payload;
 	struct p2s_stat_ret_struct retbuf;
+	struct file *filp = NULL;
 	int res;
 
-	res = kernel_fs_stat(stat_rq->filename, &retbuf.statbuf, stat_rq->flag);
+	/* A cached file is its own target, lstat() still walks the path */
+	if (!(stat_rq->flag & AT_SYMLINK_NOFOLLOW))
+		filp = storage_handle_lookup(stat_rq->filename);
+
+	if (filp) {
+		res = vfs_getattr(&filp->f_path, &retbuf.statbuf);
+		fput(filp);
+	} else
+		res = kernel_fs_stat(stat_rq->filename, &retbuf.statbuf, stat_rq->flag);
 	retbuf.retval = res;
 
 	ibapi_reply_message(&retbuf, sizeof(retbuf), desc);
@@ -226,6 +242,7 @@ long handle_unlink_request(void *payload, uintptr_t desc)
 	struct p2s_unlink_struct *unlink = payload;
 	long ret;
 
+	storage_handle_forget(unlink->filename);
 	ret = do_unlink(unlink->filename);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
@@ -248,6 +265,7 @@ long handle_rmdir_request(void *payload, uintptr_t desc)
 	struct p2s_rmdir_struct *rmdir = payload;
 	long ret;
 
+	storage_handle_forget(rmdir->filename);
 	ret = do_rmdir(rmdir->filename);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
@@ -258,19 +276,16 @@ ssize_t handle_lseek_request(void *payload, uintptr_t desc)
 {
 	struct m2s_lseek_struct *lseek = payload;
 	ssize_t ret;
-	const char *pathname = lseek->filename;
-	unsigned int lookup_flags = LOOKUP_FOLLOW;
-	struct path path;
-	struct dentry *dentry;
+	struct file *filp;
 
-	ret = kern_path(pathname, lookup_flags, &path);
-	if (ret)
+	filp = storage_handle_get(0, lseek->filename, O_RDONLY);
+	if (IS_ERR(filp)) {
+		ret = PTR_ERR(filp);
 		goto reply;
-	
-	dentry = path.dentry;
-	ret = i_size_read(dentry->d_inode);
+	}
 
-	path_put(&path);
+	ret = i_size_read(file_inode(filp));
+	fput(filp);
 
 reply:
 	ibapi_reply_message(&ret, sizeof(ret), desc);
@@ -355,6 +370,8 @@ long handle_rename_request(void *payload, uintptr_t desc)
 	struct p2s_rename_struct *__payload = payload;
 	long ret;
 
+	storage_handle_forget(__payload->oldname);
+	storage_handle_forget(__payload->newname);
 	ret = do_rename(__payload->oldname, __payload->newname);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
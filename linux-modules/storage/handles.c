@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Storage file handles
+ *
+ * open() replies with the inode number of the file as its handle,
+ * processor and memory pass it back with every read and write. Open
+ * files are kept in a cache hashed by handle and by path, so a request
+ * carrying a handle skips both the VFS path walk and the filp_open().
+ * Requests without a handle (page cache, loader) still hit the cache
+ * by path.
+ *
+ * A handle is the inode number plus its generation, so a number reused
+ * after unlink gives a different handle. A handle hit needs no path
+ * compare: hard links share the inode, thus the data. Only inode
+ * numbers wider than 32 bits, which do not fit in a handle, are also
+ * checked by path. Unlink, rmdir and rename drop the affected entries.
+ *
+ * Cached files are opened O_RDWR, or O_RDONLY if that is all we may
+ * do. Callers get their own reference and must fput() it.
+ */
+
+#include <linux/fs.h>
+#include <linux/jhash.h>
+#include <linux/mutex.h>
+#include <linux/hashtable.h>
+
+#include "storage.h"
+#include "common.h"
+#include "CONFIG_LEGO_STORAGE.h"
+
+#define STORAGE_HANDLE_HASH_BITS	10
+#define STORAGE_MAX_HANDLES		1024
+
+struct storage_handle {
+	struct hlist_node	fh_node;
+	struct hlist_node	path_node;
+	struct list_head	lru;
+	u64			fh;
+	struct file		*filp;
+	bool			fh_hashed;
+	char			path[MAX_FILENAME_LENGTH];
+};
+
+static DEFINE_HASHTABLE(fh_hash, STORAGE_HANDLE_HASH_BITS);
+static DEFINE_HASHTABLE(path_hash, STORAGE_HANDLE_HASH_BITS);
+static LIST_HEAD(handle_lru);
+static int nr_handles;
+static DEFINE_MUTEX(handle_lock);
+
+static inline u32 path_hashfn(const char *path)
+{
+	return jhash(path, strlen(path), 0);
+}
+
+static inline bool handle_writable(struct storage_handle *h)
+{
+	return h->filp->f_mode & FMODE_WRITE;
+}
+
+static struct file *handle_filp_open(const char *path, int flags)
+{
+#ifndef STORAGE_BYPASS_PAGE_CACHE
+	return filp_open(path, flags | O_LARGEFILE, 0755);
+#else
+	return filp_open(path, flags | O_DIRECT | O_LARGEFILE, 0755);
+#endif
+}
+
+static struct storage_handle *lookup_handle(u64 fh, const char *path)
+{
+	struct storage_handle *h;
+
+	if (fh) {
+		hash_for_each_possible(fh_hash, h, fh_node, fh) {
+			if (h->fh != fh)
+				continue;
+			if (likely(storage_handle_exact(h->filp)) ||
+			    !strcmp(h->path, path))
+				return h;
+		}
+	}
+
+	hash_for_each_possible(path_hash, h, path_node, path_hashfn(path)) {
+		if (!strcmp(h->path, path))
+			return h;
+	}
+	return NULL;
+}
+
+static void free_handle(struct storage_handle *h)
+{
+	if (h->fh_hashed)
+		hash_del(&h->fh_node);
+	hash_del(&h->path_node);
+	list_del(&h->lru);
+	nr_handles--;
+
+	fput(h->filp);
+	kfree(h);
+}
+
+static void insert_handle(struct storage_handle *h)
+{
+	struct storage_handle *p;
+
+	if (nr_handles >= STORAGE_MAX_HANDLES)
+		free_handle(list_last_entry(&handle_lru, struct storage_handle, lru));
+
+	/* Another link to the same inode is found by path only */
+	h->fh_hashed = true;
+	hash_for_each_possible(fh_hash, p, fh_node, h->fh) {
+		if (p->fh == h->fh) {
+			h->fh_hashed = false;
+			break;
+		}
+	}
+
+	if (h->fh_hashed)
+		hash_add(fh_hash, &h->fh_node, h->fh);
+	hash_add(path_hash, &h->path_node, path_hashfn(h->path));
+	list_add(&h->lru, &handle_lru);
+	nr_handles++;
+}
+
+/*
+ * Open a new cached file. Fall back to read-only for readers,
+ * the O_CREAT in @flags is honored.
+ */
+static struct storage_handle *open_handle(const char *path, int flags)
+{
+	struct storage_handle *h;
+	struct file *filp;
+
+	filp = handle_filp_open(path, O_RDWR | (flags & O_CREAT));
+	if (IS_ERR(filp) && (flags & O_ACCMODE) == O_RDONLY)
+		filp = handle_filp_open(path, O_RDONLY);
+	if (IS_ERR(filp))
+		return ERR_CAST(filp);
+
+	h = kmalloc(sizeof(*h), GFP_KERNEL);
+	if (!h) {
+		fput(filp);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	h->filp = filp;
+	h->fh = storage_file_handle(filp);
+	strlcpy(h->path, path, MAX_FILENAME_LENGTH);
+	insert_handle(h);
+	return h;
+}
+
+/**
+ * storage_handle_get - get an open file for a read or write request
+ * @fh: handle from open(), or 0
+ * @path: full pathname of the file
+ * @flags: O_RDONLY, O_WRONLY or O_RDWR, plus an optional O_CREAT
+ *
+ * Return a referenced file, or ERR_PTR on failure.
+ * The caller must fput() it when done.
+ */
+struct file *storage_handle_get(u64 fh, const char *path, int flags)
+{
+	struct storage_handle *h;
+	struct file *filp;
+
+	mutex_lock(&handle_lock);
+	h = lookup_handle(fh, path);
+	if (!h) {
+		h = open_handle(path, flags);
+		if (IS_ERR(h)) {
+			filp = ERR_CAST(h);
+			goto unlock;
+		}
+	} else if ((flags & O_ACCMODE) != O_RDONLY && !handle_writable(h)) {
+		/* Cached by a reader, upgrade it */
+		filp = handle_filp_open(path, O_RDWR);
+		if (IS_ERR(filp))
+			goto unlock;
+		fput(h->filp);
+		h->filp = filp;
+	}
+
+	list_move(&h->lru, &handle_lru);
+	filp = get_file(h->filp);
+
+unlock:
+	mutex_unlock(&handle_lock);
+	return filp;
+}
+
+/**
+ * storage_handle_lookup - get a cached file, never open one
+ * @path: full pathname of the file
+ *
+ * Return a referenced file, or NULL if it is not cached.
+ */
+struct file *storage_handle_lookup(const char *path)
+{
+	struct storage_handle *h;
+	struct file *filp = NULL;
+
+	mutex_lock(&handle_lock);
+	h = lookup_handle(0, path);
+	if (h) {
+		list_move(&h->lru, &handle_lru);
+		filp = get_file(h->filp);
+	}
+	mutex_unlock(&handle_lock);
+	return filp;
+}
+
+/**
+ * storage_handle_forget - drop cached files at or below @path
+ * @path: file or directory being unlinked or renamed
+ */
+void storage_handle_forget(const char *path)
+{
+	struct storage_handle *h, *tmp;
+	size_t len = strlen(path);
+
+	mutex_lock(&handle_lock);
+	list_for_each_entry_safe(h, tmp, &handle_lru, lru) {
+		if (strncmp(h->path, path, len))
+			continue;
+		if (h->path[len] == '\0' || h->path[len] == '/')
+			free_handle(h);
+	}
+	mutex_unlock(&handle_lock);
+}
+
+void storage_handle_exit(void)
+{
+	struct storage_handle *h, *tmp;
+
+	mutex_lock(&handle_lock);
+	list_for_each_entry_safe(h, tmp, &handle_lru, lru)
+		free_handle(h);
+	mutex_unlock(&handle_lock);
+}
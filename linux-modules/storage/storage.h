@@ -83,6 +83,29 @@ long do_getdents(const char *pathname, struct linux_dirent *dirent,
 long do_readlink(const char *pathname, char *buf, int bufsiz);
 long do_rename(char *oldname, char *newname);
 
+/* handles.c */
+struct file *storage_handle_get(u64 fh, const char *path, int flags);
+struct file *storage_handle_lookup(const char *path);
+void storage_handle_forget(const char *path);
+void storage_handle_exit(void);
+
+/*
+ * Handle given out by open(): inode number and generation. The
+ * generation changes when an inode number is reused after unlink.
+ */
+static inline u64 storage_file_handle(struct file *filp)
+{
+	struct inode *inode = file_inode(filp);
+
+	return (u64)inode->i_generation << 32 | (u32)inode->i_ino;
+}
+
+/* The handle names exactly one inode if its number fits in it */
+static inline bool storage_handle_exact(struct file *filp)
+{
+	return file_inode(filp)->i_ino <= U32_MAX;
+}
+
 /* handler.c */
 int handle_open_request(void *, uintptr_t);
 ssize_t handle_write_request(void *, uintptr_t);
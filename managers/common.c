@@ -12,6 +12,7 @@
 #include <lego/string.h>
 #include <lego/fit_ibapi.h>
 #include <lego/comp_memory.h>
+#include <lego/comp_storage.h>
 #include <processor/processor.h>
 
 /*
@@ -117,6 +118,8 @@ void __init manager_init(void)
 	processor_manager_init();
 #elif defined(CONFIG_COMP_MEMORY)
 	memory_component_init();
+#elif defined(CONFIG_COMP_STORAGE)
+	storage_manager_init();
 #endif
 	manager_state = MANAGER_UP;
 
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * stripe_nodes= boot parameter, the storage nodes files are striped
+ * over. Memory uses it to place stripes, processor to send metadata
+ * changes to all of them, so both must be booted with the same list.
+ */
+
+#define pr_fmt(fmt) "stripe: " fmt
+
+#include <lego/init.h>
+#include <lego/kernel.h>
+#include <lego/comp_common.h>
+
+int stripe_nodes[MAX_STRIPE_NODES];
+int nr_stripe_nodes;
+
+/* stripe_nodes=2,3,4 */
+static int __init stripe_nodes_setup(char *str)
+{
+	unsigned long nid;
+
+	while (*str && nr_stripe_nodes < MAX_STRIPE_NODES) {
+		nid = simple_strtoul(str, &str, 0);
+		if (nid >= CONFIG_FIT_NR_NODES) {
+			pr_warn("Invalid storage node %lu, striping disabled\n", nid);
+			nr_stripe_nodes = 0;
+			return -EINVAL;
+		}
+		stripe_nodes[nr_stripe_nodes++] = nid;
+
+		if (*str != ',')
+			break;
+		str++;
+	}
+
+	pr_info("%d storage nodes\n", nr_stripe_nodes);
+	return 0;
+}
+__setup("stripe_nodes=", stripe_nodes_setup);
@@ -16,7 +16,10 @@
 #include <lego/kthread.h>
 #include <lego/profile.h>
 #include <lego/sysinfo.h>
+#include <lego/tick.h>
+#include <lego/rcupdate.h>
 #include <lego/memblock.h>
+#include <lego/parallel.h>
 #include <lego/fit_ibapi.h>
 #include <lego/completion.h>
 #include <lego/comp_storage.h>
@@ -30,6 +33,7 @@
 #include <memory/replica.h>
 #include <memory/thread_pool.h>
 #include <memory/pgcache.h>
+#include <memory/zeropool.h>
 
 #include <monitor/gmm_handler.h>
 
@@ -184,6 +188,11 @@ static void thpool_worker_handler(struct thpool_worker *worker,
 	case P2M_PCACHE_ZEROFILL:
 		handle_p2m_zerofill(msg, buffer);
 		break;
+#ifdef CONFIG_FIT_ONESIDED_READ
+	case P2M_PCACHE_XLATE:
+		handle_p2m_pcache_xlate(msg, buffer);
+		break;
+#endif
 
 /* SYSCALL */
 	case P2M_READ:
@@ -350,16 +359,24 @@ static int thpool_worker_func(void *_worker)
 	 * However, if our software watchdog is enabled, we want to enable
 	 * the interrupt, so whenever watchdog noticed a dead thread, it
 	 * will be able to send interrupt and dump the current stack.
+	 *
+	 * On a nohz_full core, the tick stops by itself while we are the
+	 * only thread, and IPIs still get through. Other cores still
+	 * disable interrupts, even if NO_HZ_FULL is built in.
 	 */
 #ifndef CONFIG_SOFT_WATCHDOG
-	local_irq_disable();
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		local_irq_disable();
 #endif
 
 	preempt_disable();
 	while (1) {
 		/* Check comments on enqueue */
-		while (!nr_queued_thpool_worker(w))
+		while (!nr_queued_thpool_worker(w)) {
+			/* We never schedule, see kernel/rcu/update.c */
+			rcu_qs();
 			cpu_relax();
+		}
 
 		spin_lock(&w->lock);
 		while (!list_empty(&w->work_head)) {
@@ -416,7 +433,7 @@ static int thpool_worker_func(void *_worker)
 	}
 	preempt_enable();
 
-#ifndef CONFIG_SOFT_WATCHDOG
+#if !defined(CONFIG_SOFT_WATCHDOG) && !defined(CONFIG_NO_HZ_FULL)
 	local_irq_enable();
 #endif
 
@@ -426,6 +443,101 @@ static int thpool_worker_func(void *_worker)
 
 unsigned long nr_thpool_reqs;
 
+#ifdef CONFIG_THPOOL_INLINE_HANDLERS
+#define NR_THPOOL_INLINE_HANDLERS	8
+
+struct thpool_inline_handler {
+	u32			opcode;
+	thpool_inline_handler_t	handler;
+};
+
+static struct thpool_inline_handler
+thpool_inline_handlers[NR_THPOOL_INLINE_HANDLERS] __read_mostly;
+static int nr_thpool_inline_handlers __read_mostly;
+unsigned long nr_thpool_inline_reqs;
+
+/*
+ * Register a handler that runs on FIT polling thread directly.
+ * Must be called before FIT starts delivering requests.
+ */
+int __init register_thpool_inline_handler(u32 opcode,
+					  thpool_inline_handler_t handler)
+{
+	struct thpool_inline_handler *h;
+
+	if (WARN_ON(nr_thpool_inline_handlers >= NR_THPOOL_INLINE_HANDLERS))
+		return -ENOSPC;
+
+	h = &thpool_inline_handlers[nr_thpool_inline_handlers++];
+	h->opcode = opcode;
+	h->handler = handler;
+	return 0;
+}
+
+static inline thpool_inline_handler_t find_thpool_inline_handler(u32 opcode)
+{
+	int i;
+
+	for (i = 0; i < nr_thpool_inline_handlers; i++) {
+		if (thpool_inline_handlers[i].opcode == opcode)
+			return thpool_inline_handlers[i].handler;
+	}
+	return NULL;
+}
+
+/*
+ * Return true if @b was handled and replied inline,
+ * otherwise it should be passed to a worker.
+ */
+static bool thpool_handle_inline(struct thpool_buffer *b)
+{
+	struct common_header *hdr = to_common_header(thpool_buffer_rx(b));
+	thpool_inline_handler_t handler;
+
+	handler = find_thpool_inline_handler(hdr->opcode);
+	if (!handler)
+		return false;
+
+	tb_reset_tx_size(b);
+	tb_reset_private_tx(b);
+	if (handler(thpool_buffer_rx(b), b)) {
+		__ClearThpoolBufferNoreply(b);
+		return false;
+	}
+
+	BUG_ON(!b->tx_size);
+	fit_ack_reply_callback(b);
+
+	__ClearThpoolBufferNoreply(b);
+	__ClearThpoolBufferUsed(b);
+	nr_thpool_inline_reqs++;
+	return true;
+}
+
+static int inline_p2m_test(void *msg, struct thpool_buffer *tb)
+{
+	handle_p2m_test(msg, tb);
+	return 0;
+}
+
+static int inline_p2m_test_noreply(void *msg, struct thpool_buffer *tb)
+{
+	__SetThpoolBufferNoreply(tb);
+	handle_p2m_test_noreply(msg, tb);
+	return 0;
+}
+
+static void __init thpool_init_inline_handlers(void)
+{
+	register_thpool_inline_handler(P2M_TEST, inline_p2m_test);
+	register_thpool_inline_handler(P2M_TEST_NOREPLY, inline_p2m_test_noreply);
+	register_thpool_inline_handler(P2M_PCACHE_FLUSH, handle_p2m_flush_one_inline);
+}
+#else
+static inline bool thpool_handle_inline(struct thpool_buffer *b) { return false; }
+static inline void thpool_init_inline_handlers(void) { }
+#endif /* CONFIG_THPOOL_INLINE_HANDLERS */
+
 void thpool_callback(void *fit_ctx, void *fit_imm,
 		     void *rx, int rx_size, int node_id, int fit_offset)
 {
@@ -439,6 +551,10 @@ void thpool_callback(void *fit_ctx, void *fit_imm,
 	b->fit_offset = fit_offset;
 	b->fit_node_id = node_id;
 
+	/* Cheap requests are handled right here */
+	if (thpool_handle_inline(b))
+		return;
+
 	/*
 	 * Select a worker thread and pass the buffer
 	 * to it. The worker should do ACK and REPLY.
@@ -450,6 +566,26 @@ void thpool_callback(void *fit_ctx, void *fit_imm,
 }
 
 /* Create worker and polling threads */
+/*
+ * Clear the thpool buffer array, which is a few hundred MB,
+ * on all CPUs. Must be done before any buffer is handed out.
+ */
+static void __init thpool_buffer_init(void)
+{
+	int i;
+
+	parallel_clear(thpool_buffer_map,
+		       NR_THPOOL_BUFFER * sizeof(struct thpool_buffer),
+		       "thpool-clear");
+
+	for (i = 0; i < NR_THPOOL_BUFFER; i++) {
+		struct thpool_buffer *tb;
+
+		tb = thpool_buffer_map + i;
+		INIT_LIST_HEAD(&tb->next);
+	}
+}
+
 void __init thpool_init(void)
 {
 	int i;
@@ -457,6 +593,7 @@ void __init thpool_init(void)
 	struct thpool_worker *worker;
 
 	TW_HEAD = 0;
+	thpool_init_inline_handlers();
 	for (i = 0; i < NR_THPOOL_WORKERS; i++) {
 		worker = &thpool_worker_map[i];
 
@@ -494,6 +631,8 @@ void __init memory_component_init(void)
 
 	/* Register exec binary handlers */
 	exec_init();
+	zeropool_init();
+	thpool_buffer_init();
 	thpool_init();
 
 	init_memory_flush_thread();
@@ -510,22 +649,16 @@ void __init memory_component_init(void)
 void __init memory_manager_early_init(void)
 {
 	u64 size;
-	int i;
 
 	size = NR_THPOOL_BUFFER * sizeof(struct thpool_buffer);
 
-	thpool_buffer_map = memblock_virt_alloc(size, PAGE_SIZE);
+	/* Cleared by thpool_buffer_init() once all CPUs are up */
+	thpool_buffer_map = memblock_virt_alloc_raw(size, PAGE_SIZE);
 	if (!thpool_buffer_map)
 		panic("Unable to allocate thpool buffer array!");
 
 	TB_HEAD = 0;
-	memset(thpool_buffer_map, 0, size);
-	for (i = 0; i < NR_THPOOL_BUFFER; i++) {
-		struct thpool_buffer *tb;
-
-		tb = thpool_buffer_map + i;
-		INIT_LIST_HEAD(&tb->next);
-	}
+	ibapi_register_dma_region(thpool_buffer_map, size);
 
 	pr_debug("Memory: thpool_buffer [%p - %#Lx] %Lx bytes nr:%d size:%zu\n",
 		thpool_buffer_map, (unsigned long)(thpool_buffer_map) + size, size,
@@ -624,6 +757,9 @@ void print_thpool_stats(void)
 
 		ht_check_worker(i, tw, &hb_cached_data[i]);
 	}
+#ifdef CONFIG_THPOOL_INLINE_HANDLERS
+	pr_info("    nr_thpool_inline_reqs=%lu\n", nr_thpool_inline_reqs);
+#endif
 }
 #else
 static void print_thpool_stats(void) { }
@@ -637,5 +773,6 @@ void watchdog_print(void)
 	pr_info("Freeram: %#lx\n", si.freeram);
 	print_thpool_stats();
 	print_memory_manager_stats();
+	print_zeropool_stats();
 	print_profile_points();
 }
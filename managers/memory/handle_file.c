@@ -31,14 +31,6 @@
 static inline void file_debug(const char *fmt, ...) { }
 #endif
 
-struct p2m_read_reply {
-	/* nb of bytes read, or error */
-	ssize_t		retval;
-
-	/* the content */
-	char		buf[0];
-};
-
 /*
  * OPCODE: P2M_READ
  * Handle a read() syscall request from processor
@@ -65,8 +57,9 @@ void handle_p2m_read(struct p2m_read_write_payload *payload,
 	 * - tb_set_tx_size() will check against THPOOL_TX_SIZE
 	 */
 	retbuf = thpool_buffer_tx(tb);
-	buf = (char *)retbuf + sizeof(retval);
-	tb_set_tx_size(tb, sizeof(retval) + count);
+	buf = retbuf->buf;
+	tb_set_tx_size(tb, sizeof(*retbuf) + count);
+	retbuf->lease_ms = 0;
 
 #ifndef CONFIG_MEM_PAGE_CACHE
 	tsk = find_lego_task_by_pid(hdr->src_nid, payload->tgid);
@@ -75,7 +68,8 @@ void handle_p2m_read(struct p2m_read_write_payload *payload,
 		return;
 	}
 
-	retval = __storage_read(tsk, payload->filename, buf, count, &pos);
+	retval = __storage_read(tsk, payload->filename, payload->fh,
+				buf, count, &pos);
 #else
 #ifndef CONFIG_GSM
 	storage_node = STORAGE_NODE;
@@ -84,6 +78,9 @@ void handle_p2m_read(struct p2m_read_write_payload *payload,
 #endif	/* CONFIG_GSM */
 
 	retval = lego_pgcache_read(NULL, payload->filename, storage_node, buf, count, &pos);
+	if (retval >= 0)
+		retbuf->lease_ms = lego_pgcache_grant_lease(payload->filename,
+						hdr->src_nid, payload->lease_ms);
 #endif /* CONFIG_MEM_PAGE_CACHE */
 
 	/*
@@ -105,6 +102,8 @@ void handle_p2m_write(struct p2m_read_write_payload *payload,
 		      struct common_header *hdr, struct thpool_buffer *tb)
 {
 	struct lego_task_struct *tsk __maybe_unused;
+	struct lego_pgcache_file *file __maybe_unused;
+	struct p2m_write_reply *reply;
 	ssize_t *retval;
 	loff_t offset = payload->offset;
 	void *content = (void *)payload + sizeof(*payload);
@@ -114,8 +113,10 @@ void handle_p2m_write(struct p2m_read_write_payload *payload,
 		payload->pid, payload->tgid, payload->buf, payload->len,
 		payload->filename);
 
-	retval = thpool_buffer_tx(tb);
-	tb_set_tx_size(tb, sizeof(*retval));
+	reply = thpool_buffer_tx(tb);
+	tb_set_tx_size(tb, sizeof(*reply));
+	reply->retry_ms = 0;
+	retval = &reply->retval;
 
 #ifndef CONFIG_MEM_PAGE_CACHE
 	/*
@@ -128,7 +129,7 @@ void handle_p2m_write(struct p2m_read_write_payload *payload,
 		return;
 	}
 
-	*retval = __storage_write(tsk, payload->filename,
+	*retval = __storage_write(tsk, payload->filename, payload->fh,
 				  content, payload->len, &offset);
 #else
 #ifdef CONFIG_GSM
@@ -136,8 +137,16 @@ void handle_p2m_write(struct p2m_read_write_payload *payload,
 #else
 	storage_node = STORAGE_NODE;
 #endif /* CONFIG_GSM */
+	file = find_lego_pgcache_file(payload->filename);
+	reply->retry_ms = lego_pgcache_break_lease(file, hdr->src_nid);
+	if (reply->retry_ms) {
+		*retval = -EAGAIN;
+		return;
+	}
+
 	*retval = lego_pgcache_write(NULL, payload->filename, storage_node, content,
 				     payload->len, &offset);
+	lego_pgcache_unblock_lease(file);
 #endif /* CONFIG_MEM_PAGE_CACHE */
 }
 
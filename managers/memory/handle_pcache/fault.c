@@ -21,6 +21,7 @@
 #include <lego/comp_storage.h>
 #include <memory/vm.h>
 #include <memory/pid.h>
+#include <memory/stat.h>
 #include <memory/thread_pool.h>
 #include <processor/pcache.h>
 
@@ -192,7 +193,7 @@ void handle_p2m_flush_one(struct p2m_flush_msg *msg, struct thpool_buffer *tb)
 	}
 
 	down_read(&p->mm->mmap_sem);
-	ret = get_user_pages(p, msg->user_va, 1, 0, &dst_page, NULL);
+	ret = get_user_pages(p, msg->user_va, 1, FOLL_WRITE, &dst_page, NULL);
 	up_read(&p->mm->mmap_sem);
 	if (likely(ret == 1)) {
 		memcpy((void *)dst_page, msg->pcacheline, PCACHE_LINE_SIZE);
@@ -206,6 +207,46 @@ out:
 	PROFILE_LEAVE(handle_flush);
 }
 
+#ifdef CONFIG_THPOOL_INLINE_HANDLERS
+/*
+ * Inline version of handle_p2m_flush_one(), called by FIT polling thread.
+ * Only the common case is handled here: the page is already mapped writable
+ * and mmap_sem is not contended. Anything else goes to thpool.
+ */
+int handle_p2m_flush_one_inline(void *_msg, struct thpool_buffer *tb)
+{
+	struct p2m_flush_msg *msg = _msg;
+	struct lego_task_struct *p;
+	struct vm_area_struct *vma;
+	struct lego_mm_struct *mm;
+	unsigned long dst_page = 0;
+
+	p = find_lego_task_by_pid(to_common_header(msg)->src_nid, msg->pid);
+	if (unlikely(!p))
+		return -EAGAIN;
+
+	mm = p->mm;
+	if (!down_read_trylock(&mm->mmap_sem))
+		return -EAGAIN;
+
+	vma = find_vma(mm, msg->user_va);
+	if (likely(vma && vma->vm_start <= msg->user_va))
+		dst_page = find_writable_page(vma, msg->user_va);
+	if (unlikely(!dst_page)) {
+		up_read(&mm->mmap_sem);
+		return -EAGAIN;
+	}
+
+	memcpy((void *)dst_page, msg->pcacheline, PCACHE_LINE_SIZE);
+	up_read(&mm->mmap_sem);
+
+	inc_mm_stat(HANDLE_PCACHE_FLUSH);
+	*(int *)thpool_buffer_tx(tb) = 0;
+	tb_set_tx_size(tb, sizeof(int));
+	return 0;
+}
+#endif
+
 /*
  * Processor counterpart: __pcache_do_fill_page().
  * Check how we fill the information.
@@ -230,7 +271,8 @@ static void do_piggyback_flush(void *_msg, unsigned int src_nid,
 	}
 
 	down_read(&flush_task->mm->mmap_sem);
-	ret = get_user_pages(flush_task, flush_msg->user_va, 1, 0, &dst_page, NULL);
+	ret = get_user_pages(flush_task, flush_msg->user_va, 1, FOLL_WRITE,
+			     &dst_page, NULL);
 	up_read(&flush_task->mm->mmap_sem);
 
 	if (likely(ret == 1))
@@ -317,3 +359,63 @@ void handle_p2m_zerofill(struct p2m_zerofill_msg *msg,
 	handle_zerofill_debug("O nid:%u pid:%u tgid:%u flags:%x vaddr:%#Lx",
 		src_nid, msg->pid, tgid, flags, vaddr);
 }
+
+#ifdef CONFIG_FIT_ONESIDED_READ
+/*
+ * Processor counterpart: pcache_xlate_fetch().
+ * Pages that are not established yet are simply skipped,
+ * processor will fallback to P2M_PCACHE_MISS for them.
+ * So are read-only pages, which may be COW pages that can
+ * be replaced by a later write.
+ */
+void handle_p2m_pcache_xlate(struct p2m_pcache_xlate_msg *msg,
+			     struct thpool_buffer *tb)
+{
+	struct p2m_pcache_xlate_reply *reply = thpool_buffer_tx(tb);
+	struct p2m_pcache_xlate_entry *entry;
+	struct vm_area_struct *vma = NULL;
+	struct lego_task_struct *p;
+	struct lego_mm_struct *mm;
+	unsigned long vaddr, page;
+	unsigned int i, nr_pages, src_nid;
+
+	reply->nr_entries = 0;
+	reply->rkey = ibapi_get_local_rkey();
+
+	src_nid = to_common_header(msg)->src_nid;
+	p = find_lego_task_by_pid(src_nid, msg->pid);
+	if (unlikely(!p))
+		goto out;
+
+	mm = p->mm;
+	vaddr = msg->start_vaddr & PAGE_MASK;
+	nr_pages = min_t(unsigned int, msg->nr_pages, PCACHE_XLATE_MAX_PAGES);
+
+	down_read(&mm->mmap_sem);
+	for (i = 0; i < nr_pages; i++, vaddr += PAGE_SIZE) {
+		if (fault_in_kernel_space(vaddr))
+			break;
+
+		if (!vma || vaddr >= vma->vm_end) {
+			vma = find_vma(mm, vaddr);
+			if (!vma)
+				break;
+		}
+		if (vaddr < vma->vm_start)
+			continue;
+
+		page = find_writable_page(vma, vaddr);
+		if (!page)
+			continue;
+
+		entry = &reply->entries[reply->nr_entries++];
+		entry->vaddr = vaddr;
+		entry->dma_addr = ibapi_get_dma_addr((void *)page, PAGE_SIZE);
+	}
+	up_read(&mm->mmap_sem);
+
+out:
+	tb_set_tx_size(tb, offsetof(struct p2m_pcache_xlate_reply,
+				    entries[reply->nr_entries]));
+}
+#endif /* CONFIG_FIT_ONESIDED_READ */
@@ -18,6 +18,8 @@
 #include <memory/pid.h>
 #include <memory/vm.h>
 #include <memory/file_types.h>
+#include <memory/stripe.h>
+#include <memory/pgcache.h>
 
 #ifdef CONFIG_DEBUG_M2S_READ_WRITE
 #define m2s_debug(fmt, ...)					\
@@ -27,7 +29,25 @@
 static inline void m2s_debug(const char *fmt, ...) { }
 #endif
 
-ssize_t __storage_read(struct lego_task_struct *tsk, char *f_name,
+static ssize_t __storage_read_stripe(struct lego_task_struct *tsk, char *f_name,
+				     char __user *buf, size_t count, loff_t *pos)
+{
+	ssize_t retval;
+	void *content;
+
+	content = kmalloc(count, GFP_KERNEL);
+	if (!content)
+		return -ENOMEM;
+
+	retval = stripe_read(f_name, STORAGE_NODE, content, count, *pos);
+	if (retval > 0)
+		lego_copy_to_user(tsk, buf, content, retval);
+
+	kfree(content);
+	return retval;
+}
+
+ssize_t __storage_read(struct lego_task_struct *tsk, char *f_name, u64 fh,
 		       char __user *buf, size_t count, loff_t *pos)
 {
 	u32 len_msg, len_ret, *opcode;
@@ -35,6 +55,9 @@ ssize_t __storage_read(struct lego_task_struct *tsk, char *f_name,
 	ssize_t retval, *retval_ptr;
 	struct m2s_read_write_payload *payload;
 
+	if (file_striped(STORAGE_NODE))
+		return __storage_read_stripe(tsk, f_name, buf, count, pos);
+
 	len_msg = sizeof(*opcode) + sizeof(*payload);
 	msg = kmalloc(len_msg, GFP_KERNEL);
 	if (!msg)
@@ -56,6 +79,7 @@ ssize_t __storage_read(struct lego_task_struct *tsk, char *f_name,
 	payload->flags = O_RDONLY;
 	payload->len = count;
 	payload->offset = *pos;
+	payload->fh = fh;
 	strncpy(payload->filename, f_name, MAX_FILENAME_LENGTH);
 
 	m2s_debug("f_name:[%s] len:%#lx offset:%#Lx",
@@ -88,18 +112,19 @@ ssize_t storage_read(struct lego_task_struct *tsk,
 		     char *buf, size_t count, loff_t *pos)
 {
 	BUG_ON(!file->filename);
-	return __storage_read(tsk, file->filename, buf, count, pos);
+	return __storage_read(tsk, file->filename, 0, buf, count, pos);
 }
 
 /*
  * perform m2s write
  * @tsk: unused
  * @f_name: filename to write to
+ * @fh: storage file handle, 0 if unknown
  * @count: nrbytes of write
  * @pos: offset where nrbytes write start
  * return value: nrbytes no success, -errno on fail
  */
-ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name,
+ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name, u64 fh,
 			const char *buf, size_t count, loff_t *pos)
 {
 	u32 len_msg, *opcode;
@@ -108,6 +133,9 @@ ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name,
 	struct m2s_read_write_payload *payload;
 	int retlen;
 
+	if (file_striped(STORAGE_NODE))
+		return stripe_write(f_name, STORAGE_NODE, buf, count, *pos);
+
 	/* msg = opcode + payload + send_buffer */
 	len_msg = sizeof(*opcode) + sizeof(*payload) + count;
 	msg = kmalloc(len_msg, GFP_KERNEL);
@@ -122,6 +150,7 @@ ssize_t __storage_write(struct lego_task_struct *tsk, char *f_name,
 	payload->flags = O_WRONLY;
 	payload->len = count;
 	payload->offset = *pos;
+	payload->fh = fh;
 	strncpy(payload->filename, f_name, MAX_FILENAME_LENGTH);
 
 	content = msg + sizeof(*opcode) + sizeof(*payload);
@@ -149,8 +178,46 @@ static ssize_t storage_write(struct lego_task_struct *tsk, struct lego_file *fil
 		const char *buf, size_t count, loff_t *pos)
 {
 	BUG_ON(!file->filename);
-	return __storage_write(tsk, file->filename, buf, count, pos);
+	return __storage_write(tsk, file->filename, 0, buf, count, pos);
+}
+
+#ifdef CONFIG_MEM_PAGE_CACHE
+/*
+ * The data is likely in pgcache already, or will be read() later.
+ * Map the pgcache page itself instead of fetching another copy from
+ * storage, or copy it if this mapping may write the page.
+ */
+static int pgcache_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	unsigned long cached, page;
+	int ret;
+
+	ret = lego_pgcache_get_pages(vma->vm_file->filename, STORAGE_NODE,
+				     vmf->pgoff << PAGE_SHIFT, 1, &cached);
+	if (unlikely(ret < 1))
+		return ret < 0 ? ret : -EIO;
+
+	if (pgcache_can_map(vma, vmf->flags)) {
+		vmf->page = cached;
+		return 0;
+	}
+
+	page = __get_free_page(GFP_KERNEL);
+	if (likely(page))
+		copy_page((void *)page, (void *)cached);
+	free_page(cached);
+	if (unlikely(!page))
+		return -ENOMEM;
+
+	vmf->page = page;
+	return 0;
 }
+#else
+static inline int pgcache_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_MEM_PAGE_CACHE */
 
 static int storage_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
@@ -160,6 +227,9 @@ static int storage_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	loff_t pos;
 	unsigned long page;
 
+	if (!pgcache_vma_fault(vma, vmf))
+		return 0;
+
 	page = __get_free_page(GFP_KERNEL);
 	if (unlikely(!page))
 		return VM_FAULT_OOM;
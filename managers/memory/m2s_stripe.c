@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * File striping across storage nodes
+ *
+ * A file is cut into STRIPE_SIZE stripes. Stripe i is placed on
+ * stripe_nodes[(h + i) % nr_stripe_nodes], where h is the index of
+ * the file's home storage node in the list. Each node keeps its
+ * stripes at their original offset in a sparse local file of the
+ * same path, so no offset translation is needed and the file size
+ * is the largest of the local ones.
+ *
+ * Requests are split at stripe boundaries. Up to nr_stripe_nodes
+ * consecutive stripes go to distinct nodes, they are sent out by one
+ * multicast RPC and served by all those nodes in parallel.
+ *
+ * Only the home node has the file after open(). A stripe node that
+ * was never written to has no local file, its stripes read as holes.
+ * -ENOENT from such a node means just that, any other error fails
+ * the request.
+ * Processor sends truncate, unlink and O_TRUNC to storage directly,
+ * PROCESSOR_FILE_STRIPE makes it apply them on all stripe nodes.
+ */
+
+#define pr_fmt(fmt) "stripe: " fmt
+
+#include <lego/slab.h>
+#include <lego/files.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <lego/comp_storage.h>
+
+#include <memory/stripe.h>
+
+#define STRIPE_SIZE		(1UL << CONFIG_MEM_FILE_STRIPE_SHIFT)
+#define STRIPE_MASK		(STRIPE_SIZE - 1)
+
+/* Index of @storage_node in stripe_nodes, -1 if not striped */
+static int stripe_home_index(unsigned int storage_node)
+{
+	int i;
+
+	if (nr_stripe_nodes < 2)
+		return -1;
+
+	for (i = 0; i < nr_stripe_nodes; i++) {
+		if (stripe_nodes[i] == storage_node)
+			return i;
+	}
+	return -1;
+}
+
+bool file_striped(unsigned int storage_node)
+{
+	return stripe_home_index(storage_node) >= 0;
+}
+
+static inline int stripe_node(int home, loff_t pos)
+{
+	return stripe_nodes[(home + (pos >> CONFIG_MEM_FILE_STRIPE_SHIFT)) %
+			    nr_stripe_nodes];
+}
+
+/* Length of the request piece starting at @pos, within one stripe */
+static inline size_t stripe_len(loff_t pos, loff_t end)
+{
+	return min_t(loff_t, end - pos, STRIPE_SIZE - (pos & STRIPE_MASK));
+}
+
+/* Buffers of one batch, one slot per stripe node */
+struct stripe_batch {
+	int			nr;
+	int			nodes[MAX_STRIPE_NODES];
+	loff_t			pos[MAX_STRIPE_NODES];
+	struct fit_sglist	tx[MAX_STRIPE_NODES];
+	struct fit_sglist	rx[MAX_STRIPE_NODES];
+};
+
+/* rx buffers of replies that timed out were taken over by FIT, NULL */
+static void free_stripe_batch(struct stripe_batch *b)
+{
+	int i;
+
+	for (i = 0; i < nr_stripe_nodes; i++) {
+		kfree(b->tx[i].addr);
+		kfree(b->rx[i].addr);
+	}
+	kfree(b);
+}
+
+static struct stripe_batch *
+alloc_stripe_batch(size_t tx_size, size_t rx_size)
+{
+	struct stripe_batch *b;
+	int i;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return NULL;
+
+	for (i = 0; i < nr_stripe_nodes; i++) {
+		b->tx[i].addr = kmalloc(tx_size, GFP_KERNEL);
+		b->rx[i].addr = kmalloc(rx_size, GFP_KERNEL);
+		if (!b->tx[i].addr || !b->rx[i].addr) {
+			free_stripe_batch(b);
+			return NULL;
+		}
+	}
+	return b;
+}
+
+static struct m2s_read_write_payload *
+stripe_prepare_rw(struct stripe_batch *b, u32 op, char *f_name, int flags,
+		  size_t len, loff_t pos, int node)
+{
+	struct m2s_read_write_payload *payload;
+	int i = b->nr++;
+	u32 *opcode;
+
+	opcode = b->tx[i].addr;
+	*opcode = op;
+
+	payload = b->tx[i].addr + sizeof(*opcode);
+	payload->uid = 0;
+	payload->flags = flags;
+	payload->len = len;
+	payload->offset = pos;
+	payload->fh = 0;
+	strlcpy(payload->filename, f_name, sizeof(payload->filename));
+
+	b->tx[i].len = sizeof(*opcode) + sizeof(*payload);
+	b->nodes[i] = node;
+	b->pos[i] = pos;
+	return payload;
+}
+
+static int stripe_send_batch(struct stripe_batch *b, int max_ret_size)
+{
+	int ret;
+
+	ret = ibapi_multicast_send_reply_timeout(b->nr, b->nodes, b->tx, b->rx,
+						 max_ret_size, 0, 0);
+	if (ret < 0)
+		return ret;
+	return ret == b->nr ? 0 : -EIO;
+}
+
+/*
+ * Read [@pos, @pos + @count) of a striped file into kernel @buf.
+ * Holes read as zero. Return the number of bytes until EOF.
+ */
+ssize_t stripe_read(char *f_name, unsigned int storage_node,
+		    void *buf, size_t count, loff_t pos)
+{
+	struct stripe_batch *b;
+	loff_t cur, end, eof;
+	size_t rx_size, len;
+	ssize_t retval, got;
+	int home, i;
+
+	home = stripe_home_index(storage_node);
+	if (WARN_ON(home < 0))
+		return -EINVAL;
+
+	rx_size = sizeof(ssize_t) + STRIPE_SIZE;
+	b = alloc_stripe_batch(sizeof(u32) + sizeof(struct m2s_read_write_payload),
+			       rx_size);
+	if (!b)
+		return -ENOMEM;
+
+	memset(buf, 0, count);
+	cur = eof = pos;
+	end = pos + count;
+	retval = 0;
+
+	while (cur < end) {
+		for (b->nr = 0; b->nr < nr_stripe_nodes && cur < end; cur += len) {
+			len = stripe_len(cur, end);
+			stripe_prepare_rw(b, M2S_READ, f_name, O_RDONLY, len, cur,
+					  stripe_node(home, cur));
+		}
+
+		retval = stripe_send_batch(b, rx_size);
+		if (retval)
+			goto out;
+
+		/* Reply = nr of bytes been read + content */
+		for (i = 0; i < b->nr; i++) {
+			got = *(ssize_t *)b->rx[i].addr;
+			if (got == -ENOENT && b->nodes[i] != storage_node)
+				continue;
+			if (got < 0) {
+				retval = got;
+				goto out;
+			}
+			if (!got)
+				continue;
+
+			memcpy(buf + (b->pos[i] - pos),
+			       b->rx[i].addr + sizeof(ssize_t), got);
+			eof = max_t(loff_t, eof, b->pos[i] + got);
+		}
+	}
+	retval = eof - pos;
+
+out:
+	free_stripe_batch(b);
+	return retval;
+}
+
+/*
+ * Write kernel @buf to [@pos, @pos + @count) of a striped file.
+ * Return @count on success, or the first error.
+ */
+ssize_t stripe_write(char *f_name, unsigned int storage_node,
+		     const void *buf, size_t count, loff_t pos)
+{
+	struct m2s_read_write_payload *payload;
+	struct stripe_batch *b;
+	loff_t cur, end;
+	size_t tx_size, len;
+	ssize_t retval;
+	int home, i;
+
+	home = stripe_home_index(storage_node);
+	if (WARN_ON(home < 0))
+		return -EINVAL;
+
+	tx_size = sizeof(u32) + sizeof(*payload) + STRIPE_SIZE;
+	b = alloc_stripe_batch(tx_size, sizeof(ssize_t));
+	if (!b)
+		return -ENOMEM;
+
+	cur = pos;
+	end = pos + count;
+	retval = 0;
+
+	while (cur < end) {
+		for (b->nr = 0; b->nr < nr_stripe_nodes && cur < end; cur += len) {
+			len = stripe_len(cur, end);
+
+			/* Stripe nodes other than home create the file on demand */
+			payload = stripe_prepare_rw(b, M2S_WRITE, f_name,
+						    O_WRONLY | O_CREAT, len, cur,
+						    stripe_node(home, cur));
+			memcpy((void *)payload + sizeof(*payload),
+			       buf + (cur - pos), len);
+			b->tx[b->nr - 1].len += len;
+		}
+
+		retval = stripe_send_batch(b, sizeof(ssize_t));
+		if (retval)
+			goto out;
+
+		for (i = 0; i < b->nr; i++) {
+			retval = *(ssize_t *)b->rx[i].addr;
+			if (retval < 0)
+				goto out;
+		}
+	}
+	retval = count;
+
+out:
+	free_stripe_batch(b);
+	return retval;
+}
+
+/* Size of a striped file: the largest local file size */
+ssize_t stripe_file_size(char *f_name, unsigned int storage_node)
+{
+	struct m2s_lseek_struct *payload;
+	struct stripe_batch *b;
+	ssize_t retval, size;
+	u32 *opcode;
+	int i;
+
+	b = alloc_stripe_batch(sizeof(*opcode) + sizeof(*payload), sizeof(ssize_t));
+	if (!b)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_stripe_nodes; i++) {
+		opcode = b->tx[i].addr;
+		*opcode = M2S_LSEEK;
+		payload = b->tx[i].addr + sizeof(*opcode);
+		strlcpy(payload->filename, f_name, sizeof(payload->filename));
+
+		b->tx[i].len = sizeof(*opcode) + sizeof(*payload);
+		b->nodes[i] = stripe_nodes[i];
+	}
+	b->nr = nr_stripe_nodes;
+
+	retval = stripe_send_batch(b, sizeof(ssize_t));
+	if (retval)
+		goto out;
+
+	for (i = 0; i < b->nr; i++) {
+		size = *(ssize_t *)b->rx[i].addr;
+		if (size == -ENOENT && b->nodes[i] != storage_node)
+			continue;
+		if (size < 0) {
+			retval = size;
+			goto out;
+		}
+		retval = max(retval, size);
+	}
+
+out:
+	free_stripe_batch(b);
+	return retval;
+}
@@ -7,9 +7,38 @@
  * (at your option) any later version.
  */
 
+#include <lego/mm.h>
 #include <lego/slab.h>
 #include <memory/pgcache.h>
 
+/*
+ * Pages of a cacheline are split, so that each of them can be mapped
+ * into user address spaces with its own refcount, and outlive the
+ * cacheline if it is evicted. See lego_pgcache_get_pages().
+ */
+void *pgcache_alloc_pages(void)
+{
+	unsigned long pages;
+
+	pages = __get_free_pages(GFP_KERNEL | __GFP_ZERO, PGCACHE_PREFETCH_ORDER);
+	if (unlikely(!pages))
+		return NULL;
+
+	split_page(virt_to_page((void *)pages), PGCACHE_PREFETCH_ORDER);
+	return (void *)pages;
+}
+
+void pgcache_free_pages(void *pages)
+{
+	int i;
+
+	if (!pages)
+		return;
+
+	for (i = 0; i < (1 << PGCACHE_PREFETCH_ORDER); i++)
+		free_page((unsigned long)pages + i * PAGE_SIZE);
+}
+
 struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
 		unsigned int storage_node)
 {
@@ -35,8 +64,7 @@ struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
 	/* init pgc lock */
 	spin_lock_init(&pgc->lock);
 
-	pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
-			PGCACHE_PREFETCH_ORDER);
+	pgc->cached_pages = pgcache_alloc_pages();
 
 	pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
 			pgc, pgc->pos, pgc->cached_pages, pgc->filepath);
@@ -46,13 +74,13 @@ struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
 
 void __free_pgcache_locked(struct lego_pgcache_struct *pgc)
 {
-	free_pages((unsigned long)pgc->cached_pages, PGCACHE_PREFETCH_ORDER);
+	pgcache_free_pages(pgc->cached_pages);
 	pgc->cached_pages = NULL;
 	//kfree(pgc);
 }
 
 void __free_pgcache_struct(struct lego_pgcache_struct *pgc)
 {
-	free_pages((unsigned long)pgc->cached_pages, PGCACHE_PREFETCH_ORDER);
+	pgcache_free_pages(pgc->cached_pages);
 	kfree(pgc);
 }
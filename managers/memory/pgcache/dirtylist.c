@@ -10,6 +10,7 @@
 #include <lego/list.h>
 #include <lego/spinlock.h>
 #include <lego/timer.h>
+#include <lego/jiffies.h>
 #include <memory/pgcache.h>
 #include <lego/hashtable.h>
 #include <lego/fit_ibapi.h>
@@ -51,6 +52,9 @@ struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,
 
 	INIT_LIST_HEAD(&file->head);
 	spin_lock_init(&file->dirtylist_lock);
+	file->lease_expires = jiffies;
+	file->lease_blocked = jiffies;
+	file->lease_node = -1;
 
 	return file;
 }
@@ -197,28 +201,92 @@ void make_lego_pgcache_clean(struct lego_pgcache_struct *pgc)
 	return;
 }
 
-int pgcache_flush_file(struct lego_pgcache_file *file)
+/* @pgc is on @file's dirty list, caller holds dirtylist_lock */
+static inline bool on_dirtylist(struct lego_pgcache_struct *pgc)
 {
-	struct lego_pgcache_struct *pos;
+	return pgc && pgc->dirty && !list_empty(&pgc->dirtylist);
+}
 
-	spin_lock(&file->dirtylist_lock);
-	while(!list_empty(&file->head)) {
-		pos = list_entry(file->head.next,
-				struct lego_pgcache_struct, dirtylist);
-		pos->dirty = false;
-		list_del_init(&pos->dirtylist);
-		spin_unlock(&file->dirtylist_lock);
+/*
+ * Find the dirty cacheline after (@next) or before @pgc, if both are
+ * part of one contiguous range of the file.
+ */
+static struct lego_pgcache_struct *
+dirty_neighbour(struct lego_pgcache_file *file,
+		struct lego_pgcache_struct *pgc, bool next)
+{
+	struct lego_pgcache_struct *p;
+
+	if (next) {
+		if (pgc->real_len != CL_SIZE)
+			return NULL;
+		p = find_lego_pgcache_struct(file->filepath, pgc->pos + CL_SIZE);
+	} else {
+		if (pgc->pos < CL_SIZE)
+			return NULL;
+		p = find_lego_pgcache_struct(file->filepath, pgc->pos - CL_SIZE);
+		if (p && p->real_len != CL_SIZE)
+			return NULL;
+	}
+	return on_dirtylist(p) ? p : NULL;
+}
 
-		pgcache_debug("pgc: %p, head: %p, pgc->next: %p, sid: %u",		\
-			pos, &file->head, pos->dirtylist.next, pos->storage_node);
+/*
+ * Take the dirty cacheline at the head of the dirty list, together
+ * with the dirty cachelines adjacent to it, off the list. The dirty
+ * list is not sorted, so walk the pgcache hashtable to find the start
+ * of the range first.
+ * Return the nr of cachelines put into @pgcs, in file order.
+ */
+static int pgcache_grab_dirty_range(struct lego_pgcache_file *file,
+		struct lego_pgcache_struct **pgcs)
+{
+	struct lego_pgcache_struct *pgc, *p;
+	int i, nr = 0;
 
-		flush_one_cacheline_locked(pos);
+	spin_lock(&file->dirtylist_lock);
+	if (list_empty(&file->head))
+		goto out;
 
-		spin_lock(&file->dirtylist_lock);
+	pgc = list_entry(file->head.next, struct lego_pgcache_struct, dirtylist);
+	for (i = 1; i < PGCACHE_FLUSH_BATCH; i++) {
+		p = dirty_neighbour(file, pgc, false);
+		if (!p)
+			break;
+		pgc = p;
 	}
+
+	do {
+		pgc->dirty = false;
+		list_del_init(&pgc->dirtylist);
+		pgcs[nr++] = pgc;
+	} while (nr < PGCACHE_FLUSH_BATCH &&
+		 (pgc = dirty_neighbour(file, pgc, true)));
+out:
 	spin_unlock(&file->dirtylist_lock);
+	return nr;
+}
 
-	return 0;
+/*
+ * Write back all dirty cachelines of @file. Adjacent ones are
+ * coalesced, up to PGCACHE_FLUSH_BATCH per M2S_WRITE.
+ */
+int pgcache_flush_file(struct lego_pgcache_file *file)
+{
+	struct lego_pgcache_struct *pgcs[PGCACHE_FLUSH_BATCH];
+	ssize_t retval;
+	int nr, ret = 0;
+
+	while ((nr = pgcache_grab_dirty_range(file, pgcs)) > 0) {
+		pgcache_debug("pgc: %p, nr: %d, head: %p, sid: %u",		\
+			pgcs[0], nr, &file->head, pgcs[0]->storage_node);
+
+		retval = flush_cachelines(pgcs, nr);
+		if (retval < 0 && !ret)
+			ret = retval;
+	}
+
+	return ret;
 }
 
 struct p2m_fsync_reply {
@@ -11,6 +11,7 @@
 #include <lego/hashtable.h>
 #include <lego/fit_ibapi.h>
 #include <memory/pgcache.h>
+#include <memory/stripe.h>
 
 static long do_m2s_rename(char *oldname, char *newname, __u32 storage_node)
 {
@@ -83,10 +84,27 @@ static void __do_page_cache_rename(char *oldname, char *newname)
 int handle_p2m_rename(struct p2m_rename_struct *payload, struct common_header *hdr,
 		      struct thpool_buffer *tb)
 {
-	long *retval;
+	struct lego_pgcache_file *oldfile, *newfile;
+	struct p2m_write_reply *reply;
+	ssize_t *retval;
+
+	reply = thpool_buffer_tx(tb);
+	tb_set_tx_size(tb, sizeof(*reply));
+	retval = &reply->retval;
+
+	oldfile = find_lego_pgcache_file(payload->oldname);
+	newfile = find_lego_pgcache_file(payload->newname);
+
+	reply->retry_ms = lego_pgcache_break_lease(oldfile, hdr->src_nid);
+	if (reply->retry_ms)
+		goto eagain;
+
+	reply->retry_ms = lego_pgcache_break_lease(newfile, hdr->src_nid);
+	if (reply->retry_ms) {
+		lego_pgcache_unblock_lease(oldfile);
+		goto eagain;
+	}
 
-	retval = thpool_buffer_tx(tb);
-	tb_set_tx_size(tb, sizeof(*retval));
 	*retval = do_m2s_rename(payload->oldname,
 			payload->newname, payload->storage_node);
 	/*
@@ -97,6 +115,12 @@ int handle_p2m_rename(struct p2m_rename_struct *payload, struct common_header *h
 
 	__do_page_cache_rename(payload->oldname, payload->newname);
 out:
+	lego_pgcache_unblock_lease(oldfile);
+	lego_pgcache_unblock_lease(newfile);
+	return *retval;
+
+eagain:
+	*retval = -EAGAIN;
 	return *retval;
 }
 
@@ -113,6 +137,9 @@ ssize_t get_file_size_from_storage(char *filepath, unsigned int storage_node)
 	struct m2s_lseek_struct *payload;
 	u32 len_msg = sizeof(*opcode) + sizeof(*payload);
 
+	if (file_striped(storage_node))
+		return stripe_file_size(filepath, storage_node);
+
 	msg = kmalloc(len_msg, GFP_KERNEL);
 	if (unlikely(!msg))
 		return -ENOMEM;
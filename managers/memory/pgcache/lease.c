@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Read leases on pgcache files
+ *
+ * Processors may cache file data locally for small reads. Instead of
+ * calling back every reader when a file changes, the pgcache hands out
+ * short time-based leases along with P2M_READ replies: until the lease
+ * expires, writes and renames from other processors are turned away
+ * with -EAGAIN and retried by the processor.
+ * A processor counts its lease from before it sent the read, so it
+ * always gives up a lease before we think it expired.
+ *
+ * Writes from the lease holder itself are not delayed, that
+ * processor invalidates its own copy before sending the write.
+ */
+
+#include <lego/kernel.h>
+#include <lego/jiffies.h>
+#include <lego/spinlock.h>
+#include <memory/pgcache.h>
+
+static inline bool lease_active(struct lego_pgcache_file *file)
+{
+	return time_before(jiffies, file->lease_expires);
+}
+
+/**
+ * lego_pgcache_grant_lease - grant a read lease on a file
+ * @f_name: the file, must have been opened in pgcache already
+ * @nid: the reader
+ * @lease_ms: lease length wanted
+ *
+ * Return the lease length granted, 0 if none.
+ */
+unsigned int lego_pgcache_grant_lease(char *f_name, int nid, unsigned int lease_ms)
+{
+	struct lego_pgcache_file *file;
+	unsigned long expires;
+
+	if (!lease_ms)
+		return 0;
+
+	file = find_lego_pgcache_file(f_name);
+	if (unlikely(!file))
+		return 0;
+
+	lease_ms = min_t(unsigned int, lease_ms, PGCACHE_MAX_LEASE_MS);
+	expires = jiffies + msecs_to_jiffies(lease_ms);
+
+	spin_lock(&file->dirtylist_lock);
+
+	/* Do not let the change race with, or be starved by, new leases */
+	if (file->nr_lease_breakers || time_before(jiffies, file->lease_blocked)) {
+		lease_ms = 0;
+		goto unlock;
+	}
+
+	if (lease_active(file) && file->lease_node != nid)
+		file->lease_node = -1;
+	else
+		file->lease_node = nid;
+
+	if (time_after(expires, file->lease_expires))
+		file->lease_expires = expires;
+unlock:
+	spin_unlock(&file->dirtylist_lock);
+
+	return lease_ms;
+}
+
+/**
+ * lego_pgcache_break_lease - check leases held by others before a change
+ * @file: the file about to change, may be NULL
+ * @nid: the processor changing it
+ *
+ * Called from thpool handlers, which must not sleep. If another processor
+ * holds a lease, return the time left in ms: the caller should reply
+ * -EAGAIN and let the processor retry. No new lease is granted meanwhile,
+ * so the writer will not be starved.
+ *
+ * Return 0 if the change can be applied. New leases are held back until
+ * the caller has applied it and called lego_pgcache_unblock_lease().
+ */
+unsigned int lego_pgcache_break_lease(struct lego_pgcache_file *file, int nid)
+{
+	unsigned int wait_ms = 0;
+
+	if (!file)
+		return 0;
+
+	spin_lock(&file->dirtylist_lock);
+	if (lease_active(file) && file->lease_node != nid) {
+		wait_ms = jiffies_to_msecs(file->lease_expires - jiffies) + 1;
+		file->lease_blocked = file->lease_expires +
+				      msecs_to_jiffies(PGCACHE_MAX_LEASE_MS);
+	} else
+		file->nr_lease_breakers++;
+	spin_unlock(&file->dirtylist_lock);
+
+	return wait_ms;
+}
+
+void lego_pgcache_unblock_lease(struct lego_pgcache_file *file)
+{
+	if (!file)
+		return;
+
+	spin_lock(&file->dirtylist_lock);
+	file->nr_lease_breakers--;
+	spin_unlock(&file->dirtylist_lock);
+}
@@ -17,6 +17,7 @@
 #include <lego/comp_storage.h>
 #include <memory/vm.h>
 #include <memory/file_ops.h>
+#include <memory/stripe.h>
 
 #include <memory/pgcache.h>
 
@@ -28,6 +29,18 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	struct m2s_read_write_payload *payload;
 	u32 count = 0;
 
+	/* Not in the hashtable yet, or not resident: nobody else sees it */
+	if (file_striped(pgc->storage_node)) {
+		retval = stripe_read(f_name, pgc->storage_node,
+				     pgc->cached_pages, CL_SIZE, pgc->pos);
+		if (retval >= 0) {
+			spin_lock(&pgc->lock);
+			pgc->real_len = retval;
+			spin_unlock(&pgc->lock);
+		}
+		return retval;
+	}
+
 	len_msg = sizeof(*opcode) + sizeof(*payload);
 	msg = kmalloc(len_msg, GFP_KERNEL);
 	if (!msg)
@@ -53,6 +66,7 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	payload->flags = O_RDONLY;
 	payload->len = count;
 	payload->offset = pgc->pos;
+	payload->fh = 0;		/* storage looks it up by name */
 	strcpy(payload->filename, f_name);
 
 	ibapi_send_reply_imm(pgc->storage_node, msg, len_msg, retbuf, len_ret, false);
@@ -76,14 +90,46 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	return retval;
 }
 
-ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
+static void copy_cachelines(void *to, struct lego_pgcache_struct **pgcs, int nr)
 {
-	u32 len_msg, *opcode;
+	int i;
+
+	for (i = 0; i < nr - 1; i++)
+		memcpy(to + i * CL_SIZE, pgcs[i]->cached_pages, CL_SIZE);
+	memcpy(to + i * CL_SIZE, pgcs[i]->cached_pages, pgcs[i]->real_len);
+}
+
+/*
+ * flush_cachelines: write back @nr adjacent cachelines of one file
+ * with a single M2S_WRITE. All but the last one must be full.
+ */
+ssize_t flush_cachelines(struct lego_pgcache_struct **pgcs, int nr)
+{
+	struct lego_pgcache_struct *pgc = pgcs[0];
+	u32 len, len_msg, *opcode;
 	void *msg, *content;
 	ssize_t retval;
 	struct m2s_read_write_payload *payload;
 
-	len_msg = sizeof(*opcode) + sizeof(*payload) + pgc->real_len;
+	BUG_ON(nr < 1 || nr > PGCACHE_FLUSH_BATCH);
+	len = (nr - 1) * CL_SIZE + pgcs[nr - 1]->real_len;
+
+	if (file_striped(pgc->storage_node)) {
+		if (nr == 1)
+			return stripe_write(pgc->filepath, pgc->storage_node,
+					    pgc->cached_pages, len, pgc->pos);
+
+		content = kmalloc(len, GFP_KERNEL);
+		if (!content)
+			return -ENOMEM;
+		copy_cachelines(content, pgcs, nr);
+		retval = stripe_write(pgc->filepath, pgc->storage_node,
+				      content, len, pgc->pos);
+		kfree(content);
+		return retval;
+	}
+
+	len_msg = sizeof(*opcode) + sizeof(*payload) + len;
 	msg = kmalloc(len_msg, GFP_KERNEL);
 	if (!msg)
 		return -ENOMEM;
@@ -94,14 +140,15 @@ ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
 	payload = msg + sizeof(*opcode);
 	payload->uid = 0;
 	payload->flags = O_WRONLY;
-	payload->len = pgc->real_len;
+	payload->len = len;
 	payload->offset = pgc->pos;
+	payload->fh = 0;
 	strcpy(payload->filename, pgc->filepath);
 
 	content = msg + sizeof(*opcode) + sizeof(*payload);
 
 	/* COPY content of page cache to payload */
-	memcpy(content, pgc->cached_pages, payload->len);
+	copy_cachelines(content, pgcs, nr);
 
 	ibapi_send_reply_imm(pgc->storage_node, msg, len_msg, &retval, sizeof(retval), false);
 
@@ -109,6 +156,11 @@ ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
 	return retval;
 }
 
+ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
+{
+	return flush_cachelines(&pgc, 1);
+}
+
 static unsigned int __nr_cachelines(loff_t pos, size_t count)
 {
 	unsigned int nr_cachelines, cl_size;
@@ -152,8 +204,7 @@ prepare_cacheline(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval)
 
 	/* no-residental HIR pages */
 	if (!pgc->cached_pages) {
-		pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,	\
-			PGCACHE_PREFETCH_ORDER);
+		pgc->cached_pages = pgcache_alloc_pages();
 		*retval = pgcache_load(f_name, pgc);
 	}
 
@@ -188,8 +239,7 @@ prepare_cacheline_fast(struct lego_pgcache_file *file, loff_t pos, ssize_t *retv
 
 	/* no-residental HIR pages */
 	if (!pgc->cached_pages) {
-		pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,	\
-			PGCACHE_PREFETCH_ORDER);
+		pgc->cached_pages = pgcache_alloc_pages();
 		*retval = CL_SIZE;
 	}
 
@@ -245,7 +295,7 @@ ssize_t __read_from_one_cacheline(struct lego_task_struct *tsk,
 
 	/* NOMEM for caching */
 	if (unlikely(!pgc))
-		return __storage_read(tsk, f_name, buf, count, pos);
+		return __storage_read(tsk, f_name, 0, buf, count, pos);
 
 
 	pgcache_debug("pgcache vaddr: %p, content: [%s]", pgc->cached_pages + ckoff,
@@ -286,7 +336,7 @@ ssize_t __read_from_two_cachelines(struct lego_task_struct *tsk,
 
 	/* NOMEM for allocating cachelines */
 	if(unlikely(!ret)) {
-		return __storage_read(tsk, f_name, buf, count, pos);
+		return __storage_read(tsk, f_name, 0, buf, count, pos);
 	}
 
 	BUG_ON(!pgc1 || !pgc2 || !pgc1->cached_pages || !pgc2->cached_pages);
@@ -363,6 +413,62 @@ ssize_t lego_pgcache_read(struct lego_task_struct *tsk, char *f_name,
 	return __read_from_two_cachelines(tsk, file, buf, count, pos);
 }
 
+/*
+ * lego_pgcache_get_pages: get pgcache pages to be mapped by mmap faults
+ * caller: storage_vma_fault, handle_lego_mmap_faults
+ * @f_name: full pathname of targetted file
+ * @storage_node: hosted storage homenode
+ * @pos: page aligned offset within the file
+ * @nr_pages: max nr of pages wanted
+ * @pages: kernel virtual addresses of returned pages
+ * return value: nr of pages returned, or -errno.
+ *
+ * Pages are returned up to the end of the cacheline covering @pos.
+ * Each of them has an extra reference, which is dropped by free_page()
+ * once it is unmapped.
+ */
+int lego_pgcache_get_pages(char *f_name, unsigned int storage_node,
+		loff_t pos, unsigned int nr_pages, unsigned long *pages)
+{
+	struct lego_pgcache_file *file;
+	struct lego_pgcache_struct *pgc;
+	ssize_t retval = 0;
+	unsigned long page;
+	loff_t ckoff;
+	int i;
+
+	file = find_lego_pgcache_file(f_name);
+	if (!file) {
+		file = lego_pgcache_file_open(f_name, storage_node);
+		/* NO memory for allocating file struct and page cache */
+		if (unlikely(IS_ERR(file))) {
+			return -ENOMEM;
+		}
+		ht_insert_lego_pgcache_file(file);
+	}
+
+	pgc = prepare_cacheline(file, pos, &retval);
+	if (unlikely(IS_ERR_OR_NULL(pgc) || !pgc->cached_pages))
+		return -ENOMEM;
+	if (unlikely(retval < 0))
+		return retval;
+
+	ckoff = chunk_offset(pos);
+	nr_pages = min_t(unsigned int, nr_pages, (CL_SIZE - ckoff) >> PAGE_SHIFT);
+
+	spin_lock(&pgc->lock);
+	page = (unsigned long)pgc->cached_pages + ckoff;
+	for (i = 0; i < nr_pages; i++, page += PAGE_SIZE) {
+		get_page(virt_to_page((void *)page));
+		pages[i] = page;
+	}
+	spin_unlock(&pgc->lock);
+
+	update_lirs_structure(pgc);
+
+	return nr_pages;
+}
+
 /* Write operations */
 
 ssize_t __write_to_one_cacheline(struct lego_task_struct *tsk,
@@ -381,7 +487,7 @@ ssize_t __write_to_one_cacheline(struct lego_task_struct *tsk,
 
 	/* NOMEM for caching */
 	if (unlikely(!pgc))
-		return __storage_write(tsk, f_name, buf, count, pos);
+		return __storage_write(tsk, f_name, 0, buf, count, pos);
 
 	spin_lock(&pgc->lock);
 	memcpy(pgc->cached_pages + ckoff, buf, count);
@@ -426,7 +532,7 @@ ssize_t __write_to_two_cachelines(struct lego_task_struct *tsk,
 
 	/* NOMEM for allocating cachelines */
 	if(unlikely(!ret)) {
-		return __storage_write(tsk, f_name, buf, count, pos);
+		return __storage_write(tsk, f_name, 0, buf, count, pos);
 	}
 
 	BUG_ON(!pgc1 || !pgc2 || !pgc1->cached_pages || !pgc2->cached_pages);
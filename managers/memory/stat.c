@@ -29,7 +29,11 @@ static const char *const memory_manager_stat_text[] = {
 	"handle_write",
 
 	/* replication */
-	"nr_batched_log_flush"
+	"nr_batched_log_flush",
+
+	/* anonymous fault */
+	"nr_zeropool_hit",
+	"nr_zeropool_miss",
 };
 
 #ifdef CONFIG_COUNTER_MEMORY_HANDLER
@@ -16,24 +16,62 @@
 #include <lego/comp_storage.h>
 
 #include <memory/vm.h>
+#include <memory/pgcache.h>
 #include <memory/file_ops.h>
 #include <memory/vm-pgtable.h>
+#include <memory/zeropool.h>
 
+/*
+ * Write to a present but write-protected page. Since processors write
+ * back dirty lines straight into the page, this is mostly reached by
+ * flushes (FOLL_WRITE) rather than by a real write fault.
+ *
+ * A page that is still shared with someone else, e.g. a pgcache page
+ * or a fork()-ed mm, is copied before being written. Otherwise the
+ * page is reused as is.
+ *
+ * Writes to a vma without VM_WRITE fail with SIGSEGV. Note that mprotect()
+ * does not change vm_flags in this tree, see mprotect_fixup().
+ *
+ * We enter with pte *locked*, we return with pte *unlocked*.
+ */
 static int do_wp_page(struct vm_area_struct *vma, unsigned long address,
 		      unsigned int flags, pte_t *ptep, pmd_t *pmd, pte_t entry,
 		      spinlock_t *ptl)
 {
-#if 0
-	/*
-	 * TODO:
-	 * We missed the mprotect() syscall.
-	 * So the VMA actually has the READ/WRITE permission, so as the PTE.
-	 */
-	dump_vma(vma);
-	dump_pte(ptep, NULL);
-	WARN_ON(1);
-#endif
+	unsigned long old_page, new_page;
+
+	if (unlikely(!(vma->vm_flags & VM_WRITE))) {
+		spin_unlock(ptl);
+		return VM_FAULT_SIGSEGV;
+	}
+
+	old_page = lego_pte_to_virt(entry);
+	if (page_ref_count(virt_to_page((void *)old_page)) == 1) {
+		pte_set(ptep, pte_mkwrite(pte_mkdirty(entry)));
+		spin_unlock(ptl);
+		return 0;
+	}
 	spin_unlock(ptl);
+
+	new_page = __get_free_page(GFP_KERNEL);
+	if (unlikely(!new_page))
+		return VM_FAULT_OOM;
+	copy_page((void *)new_page, (void *)old_page);
+
+	spin_lock(ptl);
+	if (likely(pte_same(*ptep, entry))) {
+		entry = lego_vfn_pte(((signed long)new_page >> PAGE_SHIFT),
+					vma->vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+		pte_set(ptep, entry);
+
+		/* Drop our reference to the old one */
+		new_page = old_page;
+	}
+	spin_unlock(ptl);
+
+	free_page(new_page);
 	return 0;
 }
 
@@ -66,9 +104,15 @@ static int __do_fault(struct lego_mm_struct *mm, struct vm_area_struct *vma,
 		if (flags & FAULT_FLAG_WRITE)
 			entry = pte_mkwrite(pte_mkdirty(entry));
 		pte_set(page_table, entry);
+		vmf.page = 0;
 	}
 
 	lego_pte_unlock(page_table, ptl);
+
+	/* Raced, the page may be a referenced pgcache page */
+	if (unlikely(vmf.page))
+		free_page(vmf.page);
+
 	if (mapping_flags)
 		*mapping_flags = PCACHE_MAPPING_FILE;
 	return 0;
@@ -93,7 +137,7 @@ static int do_anonymous_page(struct vm_area_struct *vma, unsigned long address,
 	unsigned long vaddr;
 	struct lego_mm_struct *mm = vma->vm_mm;
 
-	vaddr = __get_free_page(GFP_KERNEL | __GFP_ZERO);
+	vaddr = zeropool_get_page();
 	if (!vaddr)
 		return VM_FAULT_OOM;
 
@@ -111,12 +155,16 @@ static int do_anonymous_page(struct vm_area_struct *vma, unsigned long address,
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
 	page_table = lego_pte_offset_lock(mm, pmd, address, &ptl);
-	if (!pte_none(*page_table))
-		goto unlock;
+	if (!pte_none(*page_table)) {
+		/* Raced with another fault, the page is still clean */
+		lego_pte_unlock(page_table, ptl);
+		zeropool_put_page(vaddr);
+		goto out;
+	}
 
 	pte_set(page_table, entry);
-unlock:
 	lego_pte_unlock(page_table, ptl);
+out:
 	if (mapping_flags)
 		*mapping_flags = PCACHE_MAPPING_ANON;
 	return 0;
@@ -321,6 +369,68 @@ static int handle_prefetch_pte_fault(struct vm_area_struct *vma, unsigned long a
 	return do_linear_prefetch_fault(vma, address, flags, pte, pmd, entry, page);	
 }
 
+#ifdef CONFIG_MEM_PAGE_CACHE
+/*
+ * Map pgcache pages directly, a whole cacheline at a time. Each cacheline
+ * is looked up, and loaded from storage if needed, only once.
+ */
+static int handle_pgcache_mmap_faults(struct vm_area_struct *vma,
+				      unsigned long address, u32 nr_pages)
+{
+	struct lego_mm_struct *mm = vma->vm_mm;
+	unsigned long pages[1 << PGCACHE_PREFETCH_ORDER];
+	unsigned long cur_addr = round_down(address, PAGE_SIZE);
+	spinlock_t *ptl;
+	pgoff_t pgoff;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	int i, nr, ret = 0;
+
+	pgoff = ((cur_addr - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+
+	while (nr_pages) {
+		nr = lego_pgcache_get_pages(vma->vm_file->filename, STORAGE_NODE,
+					    pgoff << PAGE_SHIFT, nr_pages, pages);
+		if (unlikely(nr <= 0))
+			return VM_FAULT_SIGBUS;
+
+		for (i = 0; i < nr; i++, cur_addr += PAGE_SIZE) {
+			if (unlikely(ret))
+				goto put;
+
+			pgd = lego_pgd_offset(mm, cur_addr);
+			pud = lego_pud_alloc(mm, pgd, cur_addr);
+			pmd = pud ? lego_pmd_alloc(mm, pud, cur_addr) : NULL;
+			pte = pmd ? lego_pte_alloc(mm, pmd, cur_addr) : NULL;
+			if (unlikely(!pte)) {
+				ret = VM_FAULT_OOM;
+				goto put;
+			}
+
+			pte = lego_pte_offset_lock(mm, pmd, cur_addr, &ptl);
+			if (pte_none(*pte)) {
+				/* Never writable, see pgcache_can_map() */
+				pte_set(pte, lego_vfn_pte(((signed long)pages[i] >> PAGE_SHIFT),
+							  vma->vm_page_prot));
+				pages[i] = 0;
+			}
+			lego_pte_unlock(pte, ptl);
+put:
+			if (pages[i])
+				free_page(pages[i]);
+		}
+
+		if (unlikely(ret))
+			return ret;
+		pgoff += nr;
+		nr_pages -= nr;
+	}
+	return 0;
+}
+#endif /* CONFIG_MEM_PAGE_CACHE */
+
 int handle_lego_mmap_faults(struct vm_area_struct *vma, unsigned long address,
 		unsigned int flags, u32 nr_pages)
 {
@@ -340,6 +450,11 @@ int handle_lego_mmap_faults(struct vm_area_struct *vma, unsigned long address,
 	unsigned long cur_addr = round_down(address, PAGE_SIZE);
 	unsigned long cur_page_addr;
 
+#ifdef CONFIG_MEM_PAGE_CACHE
+	if (pgcache_can_map(vma, flags))
+		return handle_pgcache_mmap_faults(vma, address, nr_pages);
+#endif
+
 	pages = __get_free_pages(GFP_KERNEL, PREFETCH_ORDER);
 	if (unlikely(!pages))
 		return VM_FAULT_OOM;
@@ -35,34 +35,58 @@ int faultin_page(struct vm_area_struct *vma, unsigned long start,
  *	positive VFN number if found
  *	0 if pgtable is not established yet
  */
-unsigned long find_page(struct vm_area_struct *vma, unsigned long address)
+static pte_t *follow_page_pte(struct vm_area_struct *vma, unsigned long address)
 {
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
-	unsigned long page;
 	struct lego_mm_struct *mm = vma->vm_mm;
 
 	pgd = lego_pgd_offset(mm, address);
 	if (pgd_none(*pgd))
-		return 0;
+		return NULL;
 
 	pud = lego_pud_offset(pgd, address);
 	if (pud_none(*pud))
-		return 0;
+		return NULL;
 
 	pmd = lego_pmd_offset(pud, address);
 	if (pmd_none(*pmd))
-		return 0;
+		return NULL;
 
 	pte = lego_pte_offset(pmd, address);
 	if (pte_none(*pte))
+		return NULL;
+	return pte;
+}
+
+unsigned long find_page(struct vm_area_struct *vma, unsigned long address)
+{
+	pte_t *pte;
+
+	pte = follow_page_pte(vma, address);
+	if (!pte)
 		return 0;
 
 	/* extract vfn from pte */
-	page = pte_val(*pte) & PTE_VFN_MASK;
-	return page;
+	return pte_val(*pte) & PTE_VFN_MASK;
+}
+
+/*
+ * Same as find_page(), but only if the page can be written directly.
+ * Write-protected pages may be shared with pgcache or other mm, they
+ * have to go through do_wp_page() first.
+ */
+unsigned long find_writable_page(struct vm_area_struct *vma, unsigned long address)
+{
+	pte_t *pte;
+
+	pte = follow_page_pte(vma, address);
+	if (!pte || !pte_write(*pte))
+		return 0;
+
+	return pte_val(*pte) & PTE_VFN_MASK;
 }
 
 static __always_inline long
@@ -87,16 +111,17 @@ __get_user_pages(struct lego_task_struct *tsk, struct lego_mm_struct *mm,
 				return i ? : -EFAULT;
 		}
 
-retry:
-		page = find_page(vma, start);
+		if (gup_flags & FOLL_WRITE)
+			page = find_writable_page(vma, start);
+		else
+			page = find_page(vma, start);
 		if (!page) {
 			int ret;
 			unsigned long flags = FAULT_FLAG_WRITE;
 
+			/* Return the page as faultin_page() leaves it */
 			ret = faultin_page(vma, start, flags, &page);
-			if (likely(!ret))
-				goto retry;
-			else
+			if (unlikely(ret))
 				return i ? i : ret;
 		}
 
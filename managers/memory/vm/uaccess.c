@@ -83,7 +83,7 @@ unsigned long _lego_copy_to_user(struct lego_task_struct *tsk,
 		unsigned long page;
 
 		down_read(&tsk->mm->mmap_sem);
-		ret = get_user_pages(tsk, first_page, 1, 0, &page, NULL);
+		ret = get_user_pages(tsk, first_page, 1, FOLL_WRITE, &page, NULL);
 		up_read(&tsk->mm->mmap_sem);
 		if (unlikely(ret != 1))
 			return 0;
@@ -104,7 +104,7 @@ unsigned long _lego_copy_to_user(struct lego_task_struct *tsk,
 			return 0;
 
 		down_read(&tsk->mm->mmap_sem);
-		ret = get_user_pages(tsk, first_page, nr_pages, 0, pages, NULL);
+		ret = get_user_pages(tsk, first_page, nr_pages, FOLL_WRITE, pages, NULL);
 		up_read(&tsk->mm->mmap_sem);
 		if (unlikely(ret != nr_pages)) {
 			kfree(pages);
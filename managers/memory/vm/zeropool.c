@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Pool of pre-zeroed pages for anonymous faults
+ *
+ * The first touch of an anonymous page is a pcache miss that ends up in
+ * do_anonymous_page(), which used to clear a fresh page inline, right on
+ * the critical path of the miss. Instead, one low priority kzerod thread
+ * per node keeps a pool of zeroed pages, cleared with non-temporal stores
+ * so that it does not pollute the cache of thpool workers. The fault path
+ * takes pages from the pool of the local node, and only clears inline if
+ * the pool is empty.
+ */
+
+#include <lego/mm.h>
+#include <lego/init.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/cpumask.h>
+#include <lego/nodemask.h>
+#include <lego/spinlock.h>
+
+#include <memory/stat.h>
+#include <memory/zeropool.h>
+
+#define ZEROPOOL_HIGH		CONFIG_MEM_ZERO_POOL_PAGES
+#define ZEROPOOL_LOW		(ZEROPOOL_HIGH / 2)
+
+/* Pages cleared before kzerod gives up the CPU */
+#define ZEROPOOL_BATCH		32
+
+struct zeropool {
+	spinlock_t		lock;
+	struct list_head	pages;
+	unsigned long		nr_pages;
+	struct task_struct	*task;
+	int			nid;
+} ____cacheline_aligned;
+
+static struct zeropool zeropools[MAX_NUMNODES];
+
+static inline struct zeropool *local_zeropool(void)
+{
+	return &zeropools[smp_node_id()];
+}
+
+static inline void zeropool_wakeup(struct zeropool *zp)
+{
+	if (likely(zp->task))
+		wake_up_process(zp->task);
+}
+
+/**
+ * zeropool_get_page - get a zeroed page
+ *
+ * Take a page from the pool of the local node if there is one,
+ * otherwise allocate and clear one inline. Returns the kernel
+ * virtual address of the page, or 0 if out of memory.
+ */
+unsigned long zeropool_get_page(void)
+{
+	struct zeropool *zp = local_zeropool();
+	struct page *page = NULL;
+	unsigned long nr;
+
+	spin_lock(&zp->lock);
+	if (likely(!list_empty(&zp->pages))) {
+		page = list_first_entry(&zp->pages, struct page, lru);
+		list_del(&page->lru);
+		zp->nr_pages--;
+	}
+	nr = zp->nr_pages;
+	spin_unlock(&zp->lock);
+
+	if (nr < ZEROPOOL_LOW)
+		zeropool_wakeup(zp);
+
+	if (likely(page)) {
+		inc_mm_stat(NR_ZEROPOOL_HIT);
+		return (unsigned long)page_to_virt(page);
+	}
+
+	inc_mm_stat(NR_ZEROPOOL_MISS);
+	return __get_free_page(GFP_KERNEL | __GFP_ZERO);
+}
+
+/**
+ * zeropool_put_page - give back a page that is still all zero
+ * @vaddr: page from zeropool_get_page()
+ *
+ * For callers that got a page but did not end up using it.
+ */
+void zeropool_put_page(unsigned long vaddr)
+{
+	struct page *page = virt_to_page((void *)vaddr);
+	struct zeropool *zp = &zeropools[page_to_nid(page)];
+
+	spin_lock(&zp->lock);
+	if (zp->nr_pages < ZEROPOOL_HIGH) {
+		list_add(&page->lru, &zp->pages);
+		zp->nr_pages++;
+		page = NULL;
+	}
+	spin_unlock(&zp->lock);
+
+	if (page)
+		free_page(vaddr);
+}
+
+/*
+ * Clear one batch of pages for @zp.
+ * Returns false if the pool is full or the node is out of memory.
+ */
+static bool zeropool_refill(struct zeropool *zp)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < ZEROPOOL_BATCH; i++) {
+		if (READ_ONCE(zp->nr_pages) >= ZEROPOOL_HIGH)
+			return false;
+
+		page = alloc_pages_node(zp->nid,
+				GFP_KERNEL | __GFP_THISNODE | __GFP_NOWARN, 0);
+		if (!page)
+			return false;
+
+		clear_page_nocache(page_to_virt(page));
+
+		spin_lock(&zp->lock);
+		list_add(&page->lru, &zp->pages);
+		zp->nr_pages++;
+		spin_unlock(&zp->lock);
+	}
+	return true;
+}
+
+static int kzerod(void *_zp)
+{
+	struct zeropool *zp = _zp;
+
+	/* Only run when workers on this node have nothing better to do */
+	set_user_nice(current, MAX_NICE);
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (READ_ONCE(zp->nr_pages) >= ZEROPOOL_LOW)
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		while (zeropool_refill(zp))
+			cond_resched();
+	}
+	BUG();
+	return 0;
+}
+
+void __init zeropool_init(void)
+{
+	struct task_struct *p;
+	struct zeropool *zp;
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		zp = &zeropools[nid];
+		spin_lock_init(&zp->lock);
+		INIT_LIST_HEAD(&zp->pages);
+		zp->nr_pages = 0;
+		zp->nid = nid;
+	}
+
+	for_each_online_node(nid) {
+		zp = &zeropools[nid];
+
+		p = kthread_create_on_node(kzerod, zp, nid, 0, "kzerod/%d", nid);
+		if (IS_ERR(p))
+			panic("Fail to create kzerod/%d", nid);
+
+		if (!cpumask_empty(cpumask_of_node(nid)))
+			set_cpus_allowed_ptr(p, cpumask_of_node(nid));
+		zp->task = p;
+		wake_up_process(p);
+	}
+
+	pr_info("zeropool: %d pages per node, refill below %d\n",
+		ZEROPOOL_HIGH, ZEROPOOL_LOW);
+}
+
+void print_zeropool_stats(void)
+{
+	int nid;
+
+	for_each_online_node(nid)
+		pr_info("zeropool node%d: %lu pages\n",
+			nid, READ_ONCE(zeropools[nid].nr_pages));
+}
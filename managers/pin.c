@@ -9,6 +9,7 @@
 
 #include <lego/smp.h>
 #include <lego/slab.h>
+#include <lego/sched.h>
 #include <lego/kernel.h>
 #include <lego/string.h>
 #include <lego/fit_ibapi.h>
@@ -66,9 +67,32 @@ int pin_current_thread_to_cpu(int cpu)
 	return 0;
 }
 
+/*
+ * Hand out isolcpus= CPUs first, each to one thread only.
+ * Return nr_cpu_ids if none is left.
+ */
+static int get_isolated_cpu(void)
+{
+	static struct cpumask used_isolated_cpus;
+	int cpu;
+
+	spin_lock(&pincpu_lock);
+	for_each_cpu(cpu, &cpu_isolated_map) {
+		if (!cpu_online(cpu))
+			continue;
+		if (cpumask_test_and_set_cpu(cpu, &used_isolated_cpus))
+			continue;
+		break;
+	}
+	spin_unlock(&pincpu_lock);
+
+	return cpu;
+}
+
 /*
  * Pin the current thread an active CPU.
- * The CPU is chosen from cpu_acitve_mask
+ * The CPU is chosen from isolcpus= if any is left,
+ * otherwise it is the current CPU.
  *
  * After this call, the thread will run on that CPU exclusively:
  * - will not be migrated
@@ -78,7 +102,10 @@ int pin_current_thread_to_cpu(int cpu)
  */
 int pin_current_thread(void)
 {
-	int cpu = smp_processor_id();
+	int cpu = get_isolated_cpu();
+
+	if (cpu >= nr_cpu_ids)
+		cpu = smp_processor_id();
 	return pin_current_thread_to_cpu(cpu);
 }
 
@@ -20,6 +20,7 @@
 #include <lego/syscalls.h>
 #include <lego/uaccess.h>
 #include <lego/fit_ibapi.h>
+#include <asm/vdso.h>
 
 #include <processor/fs.h>
 #include <processor/processor.h>
@@ -473,6 +474,9 @@ int do_execve(const char __user *filename,
 	ELF_PLAT_INIT(regs);
 #endif
 
+	/* Tell user where vDSO is. Without it, libc just uses syscalls. */
+	vdso_setup_auxv(new_sp);
+
 	/* core-kernel: change the task iret frame */
 	start_thread(regs, new_ip, new_sp);
 	ret = 0;
@@ -20,6 +20,7 @@
 #include <lego/kernel.h>
 #include <processor/fs.h>
 #include <processor/processor.h>
+#include <processor/file_cache.h>
 
 #ifdef CONFIG_DEBUG_FILE
 #define file_debug(fmt, ...)	\
@@ -34,7 +35,8 @@ static inline void file_debug(const char *fmt, ...) { }
  */
 static int p2s_open(struct file *f)
 {
-	int retval = 0;
+	struct p2s_open_ret_struct ret;
+	int retval, retlen;
 	void *msg;
 	u32 len_msg, *opcode;
 	struct p2s_open_struct *payload;
@@ -56,43 +58,67 @@ static int p2s_open(struct file *f)
 	file_debug("f_name: %s, mode: 0%o, flags: %x",
 		payload->filename, payload->permission, payload->flags);
 
-	ibapi_send_reply_imm(current_storage_home_node(), msg, len_msg,
-			     &retval, sizeof(retval), false);
+	retlen = ibapi_send_reply_imm(current_storage_home_node(), msg, len_msg,
+				      &ret, sizeof(ret), false);
+	if (unlikely(retlen != sizeof(ret))) {
+		retval = -EIO;
+		goto out;
+	}
+
+	/* Later reads and writes pass it along */
+	retval = ret.retval;
+	if (retval >= 0)
+		f->f_handle = ret.fh;
+
+	/* Home node truncated its part, the other stripe nodes too */
+	if (retval >= 0 && (f->f_flags & O_TRUNC)) {
+		long err = p2s_stripe_truncate(f->f_name, 0);
+
+		if (err)
+			retval = err;
+	}
 
 #ifdef CONFIG_DEBUG_FILE
 	if (retval < 0)
 		pr_debug("%s: %s\n", FUNC, ret_to_string(ERR_TO_LEGO_RET((long)retval)));
 #endif
 
+out:
 	kfree(msg);
 	return retval;
 }
 
-/*
- * p2m_read
- * Send request to memory manager
+/**
+ * p2m_read_rpc - send P2M_READ to memory manager
+ * @f: the file
+ * @count: bytes to read
+ * @pos: file position
+ * @lease_ms: read lease wanted, 0 for none
+ *
+ * The reply is RDMA-written into a DMA buffer, which is returned
+ * and must be released by p2m_read_rpc_free().
  */
-static ssize_t p2m_read(struct file *f, char __user *buf, size_t count,
-			loff_t *off)
+struct p2m_read_reply *p2m_read_rpc(struct file *f, size_t count, loff_t pos,
+				    unsigned int lease_ms)
 {
-	ssize_t retval, retlen;
-	ssize_t *retval_ptr;
+	ssize_t retlen;
 	u32 len_retbuf, len_msg;
-	void *retbuf, *msg, *content;
+	struct p2m_read_reply *retbuf;
+	void *msg;
 	struct common_header *hdr;
 	struct p2m_read_write_payload *payload;
 	int mem_node;	/* = pgcache_node if defined or memory homenode */
 
-	len_retbuf = sizeof(ssize_t) + count;
-	retbuf = kmalloc(len_retbuf, GFP_KERNEL);
+	len_retbuf = sizeof(*retbuf) + count;
+	retbuf = ibapi_alloc_dma_buf(len_retbuf);
 	if (!retbuf)
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 
 	len_msg = sizeof(*hdr) + sizeof(*payload);
 	msg = kmalloc(len_msg, GFP_KERNEL);
 	if (!msg) {
-		kfree(retbuf);
-		return -ENOMEM;
+		ibapi_free_dma_buf(retbuf, len_retbuf);
+		return ERR_PTR(-ENOMEM);
 	}
 
 	/* Construct payload */
@@ -103,44 +129,69 @@ static ssize_t p2m_read(struct file *f, char __user *buf, size_t count,
 	payload = msg + sizeof(*hdr);
 	payload->pid = current->pid;
 	payload->tgid = current->tgid;
-	payload->buf = buf;
+	payload->buf = NULL;
 	payload->uid = current_uid();
 	strncpy(payload->filename, f->f_name, MAX_FILENAME_LENGTH);
 	payload->flags = f->f_flags;
 	payload->len = count;
-	payload->offset = *off;
+	payload->offset = pos;
 	payload->storage_node = current_storage_home_node();
+	payload->fh = f->f_handle;
+	payload->lease_ms = lease_ms;
 
 	mem_node = current_pgcache_home_node();
 	retlen = ibapi_send_reply_imm(mem_node, msg, len_msg,
 				      retbuf, len_retbuf, false);
+	kfree(msg);
 
 	if (retlen != len_retbuf) {
 		WARN_ON_ONCE(1);
-		retval = -EIO;
-		goto out;
+		ibapi_free_dma_buf(retbuf, len_retbuf);
+		return ERR_PTR(-EIO);
 	}
 
-	/*
-	 * The first 8 bytes stores the nr of bytes been read
-	 * The left is the real content
-	 */
-	retval_ptr = retbuf;
-	retval = *retval_ptr;
-	content = retbuf + sizeof(ssize_t);
-
 	/* Either remote memory or storage is buggy */
-	BUG_ON(retval > count);
+	BUG_ON(retbuf->retval > (ssize_t)count);
+
+	return retbuf;
+}
+
+void p2m_read_rpc_free(struct p2m_read_reply *reply, size_t count)
+{
+	ibapi_free_dma_buf(reply, sizeof(*reply) + count);
+}
+
+/*
+ * p2m_read
+ * Send request to memory manager
+ */
+static ssize_t p2m_read(struct file *f, char __user *buf, size_t count,
+			loff_t *off)
+{
+	ssize_t retval;
+	struct p2m_read_reply *reply;
+
+	/* Small reads of hot files are served locally */
+	retval = file_cache_read(f, buf, count, off);
+	if (retval != -ENOENT)
+		return retval;
+
+	reply = p2m_read_rpc(f, count, *off, 0);
+	if (IS_ERR(reply))
+		return PTR_ERR(reply);
+
+	/* The content follows the nr of bytes been read */
+	retval = reply->retval;
 
 	file_debug(" app wants to read: %zu, we read: %zu", count, retval);
 
 	/* If success, we copy the content into user's cacheline */
 	if (likely(retval > 0)) {
 #ifdef CONFIG_DEBUG_FILE
-		print_hex_dump_bytes("Read Content: ", DUMP_PREFIX_ADDRESS, content, retval);
+		print_hex_dump_bytes("Read Content: ", DUMP_PREFIX_ADDRESS, reply->buf, retval);
 #endif
 		*off += retval;
-		if (copy_to_user(buf, content, count)) {
+		if (copy_to_user(buf, reply->buf, count)) {
 			retval = -EFAULT;
 			goto out;
 		}
@@ -148,8 +199,7 @@ static ssize_t p2m_read(struct file *f, char __user *buf, size_t count,
 
 out:
 	file_debug("retval: %zu", retval);
-	kfree(msg);
-	kfree(retbuf);
+	p2m_read_rpc_free(reply, count);
 	return retval;
 }
 
@@ -161,6 +211,7 @@ static ssize_t __p2m_write(struct file *f, const char __user *buf,
 	void *msg, *content;
 	struct common_header *hdr;
 	struct p2m_read_write_payload *payload;
+	struct p2m_write_reply reply;
 	int mem_node;
 
 	len_msg = sizeof(*hdr) + sizeof(*payload) + count;
@@ -181,6 +232,7 @@ static ssize_t __p2m_write(struct file *f, const char __user *buf,
 	payload->flags = f->f_flags;
 	payload->len = count;
 	payload->storage_node = current_storage_home_node();
+	payload->fh = f->f_handle;
 
 	payload->offset = (*off);
 	strncpy(payload->filename, f->f_name, MAX_FILENAME_LENGTH);
@@ -194,14 +246,22 @@ static ssize_t __p2m_write(struct file *f, const char __user *buf,
 
 	/* Send to memory home node */
 	mem_node = current_pgcache_home_node();
+retry:
 	retlen = ibapi_send_reply_imm(mem_node, msg, len_msg,
-			&retval, sizeof(retval), false);
-	if (unlikely(retlen != sizeof(retval))) {
+			&reply, sizeof(reply), false);
+	if (unlikely(retlen != sizeof(reply))) {
 		WARN_ON(1);
 		retval = -EIO;
 		goto out;
 	}
 
+	/* Leased to another processor, wait for it to expire */
+	retval = reply.retval;
+	if (retval == -EAGAIN && reply.retry_ms) {
+		msleep(reply.retry_ms);
+		goto retry;
+	}
+
 	if (retval >= 0)
 		*off += retval;
 
@@ -224,8 +284,16 @@ static ssize_t p2m_write(struct file *f, const char __user *buf,
 	size_t remaining = count;
 	const char __user *curr = buf;
 
-	if (likely(count <= MAX_WRITE_SIZE))
-		return __p2m_write(f, buf, count, off);
+	/*
+	 * Drop local copy before and after, so that reads
+	 * racing with this write do not cache old data.
+	 */
+	file_cache_invalidate(f->f_name);
+
+	if (likely(count <= MAX_WRITE_SIZE)) {
+		retval = __p2m_write(f, buf, count, off);
+		goto out;
+	}
 
 	while (remaining) {
 		ssize_t ret;
@@ -242,6 +310,7 @@ static ssize_t p2m_write(struct file *f, const char __user *buf,
 		remaining -= ret;
 	}
 out:
+	file_cache_invalidate(f->f_name);
 	return retval;
 }
 
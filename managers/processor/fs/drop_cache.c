@@ -11,6 +11,7 @@
 #include <lego/comp_common.h>
 #include <lego/fit_ibapi.h>
 #include <processor/processor.h>
+#include <processor/file_cache.h>
 
 /*
  * Send a request to memory node to let it drop the page cache
@@ -22,6 +23,8 @@ static int do_drop_page_cache(void)
 	struct common_header hdr;
 	int mem_node = current_pgcache_home_node();
 
+	file_cache_drop();
+
 	hdr.opcode = P2M_DROP_CACHE;
 	hdr.src_nid = LEGO_LOCAL_NID;
 
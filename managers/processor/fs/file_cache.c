@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Processor-local file data cache for small reads
+ *
+ * Applications tend to re-read the same small config and data files over
+ * and over, each read() being a P2M_READ round trip. Here we keep the
+ * first few pages of recently read files in local memory, and serve
+ * small reads from them.
+ *
+ * Consistency is lease based. Every P2M_READ sent from here asks the
+ * memory pgcache for a read lease, during which the pgcache holds back
+ * writes from other processors. Cached data is only used while the lease
+ * is valid. Our own writes, truncates, renames and unlinks invalidate the
+ * local copy directly. Truncates from other processors go to storage
+ * directly and are not covered, same as the rest of Lego.
+ */
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/rwsem.h>
+#include <lego/jhash.h>
+#include <lego/string.h>
+#include <lego/kernel.h>
+#include <lego/jiffies.h>
+#include <lego/uaccess.h>
+#include <lego/hashtable.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <processor/fs.h>
+#include <processor/file_cache.h>
+
+#define FCACHE_NR_FILES		CONFIG_PROCESSOR_FILE_CACHE_FILES
+#define FCACHE_NR_CHUNKS	CONFIG_PROCESSOR_FILE_CACHE_PAGES
+#define FCACHE_CHUNK_SIZE	PAGE_SIZE
+#define FCACHE_LEASE_MS		CONFIG_PROCESSOR_FILE_CACHE_LEASE_MS
+#define FCACHE_HASH_BITS	6
+
+/* Reads larger than this are not worth caching */
+#define FCACHE_MAX_READ		FCACHE_CHUNK_SIZE
+
+struct fcache_chunk {
+	void		*data;
+	unsigned int	len;	/* less than FCACHE_CHUNK_SIZE at EOF */
+};
+
+struct fcache_file {
+	struct hlist_node	hnode;
+	struct list_head	list;
+	char			name[FILENAME_LEN_DEFAULT];
+	unsigned long		lease_expires;
+	unsigned long		last_used;
+	struct fcache_chunk	chunks[FCACHE_NR_CHUNKS];
+};
+
+static DEFINE_RWSEM(fcache_sem);
+static DEFINE_HASHTABLE(fcache_hash, FCACHE_HASH_BITS);
+static LIST_HEAD(fcache_files);
+static int nr_fcache_files;
+
+/*
+ * Bumped by every invalidation. A fill that raced with
+ * an invalidation may carry stale data and is dropped.
+ */
+static atomic_t fcache_seq = ATOMIC_INIT(0);
+
+static inline u32 fcache_key(const char *f_name)
+{
+	return jhash(f_name, strnlen(f_name, FILENAME_LEN_DEFAULT), 0);
+}
+
+/* Caller holds fcache_sem */
+static struct fcache_file *fcache_lookup(const char *f_name)
+{
+	struct fcache_file *ff;
+
+	hash_for_each_possible(fcache_hash, ff, hnode, fcache_key(f_name)) {
+		if (!strncmp(ff->name, f_name, FILENAME_LEN_DEFAULT))
+			return ff;
+	}
+	return NULL;
+}
+
+static void fcache_clear_chunks(struct fcache_file *ff)
+{
+	int i;
+
+	for (i = 0; i < FCACHE_NR_CHUNKS; i++) {
+		kfree(ff->chunks[i].data);
+		ff->chunks[i].data = NULL;
+		ff->chunks[i].len = 0;
+	}
+}
+
+/* Caller holds fcache_sem for write */
+static void fcache_free_file(struct fcache_file *ff)
+{
+	hash_del(&ff->hnode);
+	list_del(&ff->list);
+	nr_fcache_files--;
+
+	fcache_clear_chunks(ff);
+	kfree(ff);
+}
+
+/* Caller holds fcache_sem for write */
+static struct fcache_file *fcache_alloc_file(const char *f_name)
+{
+	struct fcache_file *ff, *victim = NULL;
+
+	if (nr_fcache_files >= FCACHE_NR_FILES) {
+		list_for_each_entry(ff, &fcache_files, list) {
+			if (!victim || time_before(ff->last_used, victim->last_used))
+				victim = ff;
+		}
+		fcache_free_file(victim);
+	}
+
+	ff = kzalloc(sizeof(*ff), GFP_KERNEL);
+	if (!ff)
+		return NULL;
+
+	strlcpy(ff->name, f_name, FILENAME_LEN_DEFAULT);
+	ff->lease_expires = jiffies;
+	hash_add(fcache_hash, &ff->hnode, fcache_key(f_name));
+	list_add(&ff->list, &fcache_files);
+	nr_fcache_files++;
+	return ff;
+}
+
+/*
+ * Copy [pos, pos + count) out of cached chunks.
+ * Return nr of bytes copied, -ENOENT if any chunk is missing.
+ * Caller holds fcache_sem for read.
+ */
+static ssize_t fcache_copy(struct fcache_chunk *chunks, char __user *buf,
+			   size_t count, loff_t pos)
+{
+	ssize_t copied = 0;
+	unsigned long idx, offset;
+	unsigned int len;
+
+	while (count) {
+		idx = pos / FCACHE_CHUNK_SIZE;
+		offset = pos % FCACHE_CHUNK_SIZE;
+
+		if (!chunks[idx].data)
+			return -ENOENT;
+
+		/* Beyond EOF */
+		if (offset >= chunks[idx].len)
+			break;
+
+		len = min_t(size_t, count, chunks[idx].len - offset);
+		if (copy_to_user(buf, chunks[idx].data + offset, len))
+			return -EFAULT;
+
+		copied += len;
+		buf += len;
+		pos += len;
+		count -= len;
+
+		if (chunks[idx].len < FCACHE_CHUNK_SIZE)
+			break;
+	}
+	return copied;
+}
+
+static ssize_t fcache_read_cached(struct file *f, char __user *buf,
+				  size_t count, loff_t pos)
+{
+	struct fcache_file *ff;
+	ssize_t ret = -ENOENT;
+
+	down_read(&fcache_sem);
+	ff = fcache_lookup(f->f_name);
+	if (ff && time_before(jiffies, ff->lease_expires)) {
+		ret = fcache_copy(ff->chunks, buf, count, pos);
+		if (ret >= 0)
+			WRITE_ONCE(ff->last_used, jiffies);
+	}
+	up_read(&fcache_sem);
+
+	return ret;
+}
+
+/* Fetch one chunk from memory, asking for a lease */
+static int fcache_fetch_chunk(struct file *f, unsigned long idx,
+			      struct fcache_chunk *chunk, unsigned int *lease_ms)
+{
+	struct p2m_read_reply *reply;
+	ssize_t retval;
+
+	chunk->data = kmalloc(FCACHE_CHUNK_SIZE, GFP_KERNEL);
+	if (!chunk->data)
+		return -ENOMEM;
+
+	reply = p2m_read_rpc(f, FCACHE_CHUNK_SIZE, idx * FCACHE_CHUNK_SIZE,
+			     FCACHE_LEASE_MS);
+	if (IS_ERR(reply)) {
+		kfree(chunk->data);
+		chunk->data = NULL;
+		return PTR_ERR(reply);
+	}
+
+	retval = reply->retval;
+	if (retval < 0) {
+		p2m_read_rpc_free(reply, FCACHE_CHUNK_SIZE);
+		kfree(chunk->data);
+		chunk->data = NULL;
+		return retval;
+	}
+
+	memcpy(chunk->data, reply->buf, retval);
+	chunk->len = retval;
+	*lease_ms = min(*lease_ms, reply->lease_ms);
+	p2m_read_rpc_free(reply, FCACHE_CHUNK_SIZE);
+	return 0;
+}
+
+/*
+ * Cache miss: fetch all chunks covering the read, serve the read from
+ * them, and keep them if memory granted a lease.
+ */
+static ssize_t fcache_read_fill(struct file *f, char __user *buf,
+				size_t count, loff_t pos)
+{
+	struct fcache_chunk chunks[FCACHE_NR_CHUNKS];
+	unsigned long idx, first, last, start;
+	unsigned int lease_ms = FCACHE_LEASE_MS;
+	struct fcache_file *ff;
+	ssize_t ret;
+	int seq;
+
+	first = pos / FCACHE_CHUNK_SIZE;
+	last = (pos + count - 1) / FCACHE_CHUNK_SIZE;
+	memset(chunks, 0, sizeof(chunks));
+
+	/* The lease counts from before the requests are sent */
+	seq = atomic_read(&fcache_seq);
+	start = jiffies;
+
+	for (idx = first; idx <= last; idx++) {
+		ret = fcache_fetch_chunk(f, idx, &chunks[idx], &lease_ms);
+		if (ret)
+			goto out;
+
+		/* EOF, no need to go further */
+		if (chunks[idx].len < FCACHE_CHUNK_SIZE)
+			break;
+	}
+
+	ret = fcache_copy(chunks, buf, count, pos);
+	if (ret < 0 || !lease_ms)
+		goto out;
+
+	down_write(&fcache_sem);
+	if (seq != atomic_read(&fcache_seq))
+		goto unlock;
+
+	ff = fcache_lookup(f->f_name);
+	if (!ff) {
+		ff = fcache_alloc_file(f->f_name);
+		if (!ff)
+			goto unlock;
+	}
+
+	/*
+	 * If the old lease ran out before our requests, the file may have
+	 * been changed in between, the rest of old chunks are not valid.
+	 */
+	if (!time_before(start, ff->lease_expires))
+		fcache_clear_chunks(ff);
+
+	for (idx = first; idx <= last; idx++) {
+		if (!chunks[idx].data)
+			break;
+		kfree(ff->chunks[idx].data);
+		ff->chunks[idx] = chunks[idx];
+		chunks[idx].data = NULL;
+	}
+
+	if (time_after(start + msecs_to_jiffies(lease_ms), ff->lease_expires))
+		ff->lease_expires = start + msecs_to_jiffies(lease_ms);
+	ff->last_used = jiffies;
+unlock:
+	up_write(&fcache_sem);
+out:
+	for (idx = first; idx <= last; idx++)
+		kfree(chunks[idx].data);
+	return ret;
+}
+
+/**
+ * file_cache_read - serve a small read locally
+ * @f: the file
+ * @buf: user buffer
+ * @count: bytes to read
+ * @off: file position, updated on success
+ *
+ * Return nr of bytes read, or -ENOENT if this read is not cacheable
+ * and the caller should go to memory as usual.
+ */
+ssize_t file_cache_read(struct file *f, char __user *buf, size_t count,
+			loff_t *off)
+{
+	loff_t pos = *off;
+	ssize_t ret;
+
+	if (!count || count > FCACHE_MAX_READ || pos < 0 ||
+	    pos + count > FCACHE_NR_CHUNKS * FCACHE_CHUNK_SIZE)
+		return -ENOENT;
+
+	ret = fcache_read_cached(f, buf, count, pos);
+	if (ret == -ENOENT)
+		ret = fcache_read_fill(f, buf, count, pos);
+
+	if (ret > 0)
+		*off += ret;
+	return ret;
+}
+
+/**
+ * file_cache_invalidate - drop cached data of a file
+ * @f_name: absolute pathname
+ */
+void file_cache_invalidate(const char *f_name)
+{
+	struct fcache_file *ff;
+
+	down_write(&fcache_sem);
+	atomic_inc(&fcache_seq);
+	ff = fcache_lookup(f_name);
+	if (ff)
+		fcache_free_file(ff);
+	up_write(&fcache_sem);
+}
+
+/* drop_page_cache() drops ours as well */
+void file_cache_drop(void)
+{
+	struct fcache_file *ff, *tmp;
+
+	down_write(&fcache_sem);
+	atomic_inc(&fcache_seq);
+	list_for_each_entry_safe(ff, tmp, &fcache_files, list)
+		fcache_free_file(ff);
+	up_write(&fcache_sem);
+}
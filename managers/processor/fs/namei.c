@@ -14,8 +14,10 @@
 #include <lego/syscalls.h>
 #include <processor/fs.h>
 #include <processor/processor.h>
+#include <processor/file_cache.h>
 #include <lego/comp_common.h>
 #include <lego/fit_ibapi.h>
+#include <lego/timer.h>
 
 /*
  * Check if a pathname is starts from "/".
@@ -195,6 +197,9 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 
 	storage_node = current_storage_home_node();
 	ibapi_send_reply_imm(storage_node, msg, len_msg, &ret, sizeof(ret), false);
+	if (!ret)
+		ret = p2s_stripe_unlink(payload->filename);
+	file_cache_invalidate(payload->filename);
 
 	kfree(msg);
 
@@ -392,6 +397,8 @@ static long do_rename(const char __user *oldname, const char __user *newname)
 
 	ibapi_send_reply_imm(current_storage_home_node(), msg, len_msg,
 				&ret, sizeof(ret), false);
+	file_cache_invalidate(payload->oldname);
+	file_cache_invalidate(payload->newname);
 
 	kfree(msg);
 
@@ -410,6 +417,7 @@ static long do_rename(const char __user *oldname, const char __user *newname)
 	void *msg;
 	struct common_header *hdr;
 	struct p2m_rename_struct *payload;
+	struct p2m_write_reply reply;
 	u32 len_msg = sizeof(*hdr) + sizeof(*payload);
 
 	msg = kmalloc(len_msg, GFP_KERNEL);
@@ -438,8 +446,21 @@ static long do_rename(const char __user *oldname, const char __user *newname)
 		goto out;
 	}
 
-	ibapi_send_reply_imm(current_pgcache_home_node(), msg, len_msg,
-				&ret, sizeof(ret), false);
+retry:
+	ret = ibapi_send_reply_imm(current_pgcache_home_node(), msg, len_msg,
+				&reply, sizeof(reply), false);
+	if (likely(ret == sizeof(reply))) {
+		ret = reply.retval;
+
+		/* Leased to another processor, wait for it to expire */
+		if (ret == -EAGAIN && reply.retry_ms) {
+			msleep(reply.retry_ms);
+			goto retry;
+		}
+	} else
+		ret = -EIO;
+	file_cache_invalidate(payload->oldname);
+	file_cache_invalidate(payload->newname);
 
 	kfree(msg);
 
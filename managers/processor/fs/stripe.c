@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Metadata changes of striped files
+ *
+ * Memory stripes file data over several storage nodes, each of them
+ * keeps a sparse local file of the same path (managers/memory/m2s_stripe.c).
+ * The file size is the largest local size, so truncate and unlink sent
+ * by processor must reach all of them, not only the home node.
+ *
+ * Callers apply the change at the home node first, then call here to
+ * apply it on the other stripe nodes. Those nodes only have the file
+ * once a stripe was written there, so -ENOENT is fine.
+ */
+
+#define pr_fmt(fmt) "stripe: " fmt
+
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <lego/comp_storage.h>
+#include <processor/fs.h>
+#include <processor/processor.h>
+
+/* Files are striped only if their home node is in the list */
+static bool home_striped(int home)
+{
+	int i;
+
+	if (nr_stripe_nodes < 2)
+		return false;
+
+	for (i = 0; i < nr_stripe_nodes; i++) {
+		if (stripe_nodes[i] == home)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Send @msg to all stripe nodes but home.
+ * Return 0 on success, or the first error.
+ */
+static long p2s_stripe_send(void *msg, u32 len_msg)
+{
+	long ret, retval = 0;
+	int i, home, retlen;
+
+	home = current_storage_home_node();
+	if (!home_striped(home))
+		return 0;
+
+	for (i = 0; i < nr_stripe_nodes; i++) {
+		if (stripe_nodes[i] == home)
+			continue;
+
+		retlen = ibapi_send_reply_imm(stripe_nodes[i], msg, len_msg,
+					      &ret, sizeof(ret), false);
+		if (unlikely(retlen != sizeof(ret)))
+			ret = -EIO;
+		if (ret && ret != -ENOENT && !retval)
+			retval = ret;
+	}
+	return retval;
+}
+
+long p2s_stripe_truncate(const char *kname, long length)
+{
+	struct p2s_truncate_struct *payload;
+	u32 *opcode, len_msg;
+	void *msg;
+	long ret;
+
+	len_msg = sizeof(*opcode) + sizeof(*payload);
+	msg = kmalloc(len_msg, GFP_KERNEL);
+	if (unlikely(!msg))
+		return -ENOMEM;
+
+	opcode = msg;
+	*opcode = P2S_TRUNCATE;
+	payload = msg + sizeof(*opcode);
+	strlcpy(payload->filename, kname, MAX_FILENAME_LENGTH);
+	payload->length = length;
+
+	ret = p2s_stripe_send(msg, len_msg);
+	kfree(msg);
+	return ret;
+}
+
+long p2s_stripe_unlink(const char *kname)
+{
+	struct p2s_unlink_struct *payload;
+	u32 *opcode, len_msg;
+	void *msg;
+	long ret;
+
+	len_msg = sizeof(*opcode) + sizeof(*payload);
+	msg = kmalloc(len_msg, GFP_KERNEL);
+	if (unlikely(!msg))
+		return -ENOMEM;
+
+	opcode = msg;
+	*opcode = P2S_UNLINK;
+	payload = msg + sizeof(*opcode);
+	strlcpy(payload->filename, kname, MAX_FILENAME_LENGTH);
+
+	ret = p2s_stripe_send(msg, len_msg);
+	kfree(msg);
+	return ret;
+}
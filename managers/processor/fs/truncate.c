@@ -14,6 +14,7 @@
 #include <lego/syscalls.h>
 #include <processor/fs.h>
 #include <processor/processor.h>
+#include <processor/file_cache.h>
 #include <lego/comp_common.h>
 #include <lego/fit_ibapi.h>
 
@@ -47,6 +48,9 @@ long do_truncate(const char *kname, long length)
 	storage_node = current_storage_home_node();
 	ibapi_send_reply_imm(current_storage_home_node(), msg, len_msg,		\
 			&ret, sizeof(ret), false);
+	if (!ret)
+		ret = p2s_stripe_truncate(kname, length);
+	file_cache_invalidate(kname);
 	
 	kfree(msg);
 	return ret;
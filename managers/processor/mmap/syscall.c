@@ -18,6 +18,7 @@
 #include <lego/mm.h>
 #include <lego/syscalls.h>
 #include <processor/fs.h>
+#include <processor/pcache.h>
 #include <processor/pgtable.h>
 #include <processor/processor.h>
 #include <processor/distvm.h>
@@ -58,6 +59,7 @@ SYSCALL_DEFINE1(brk, unsigned long, brk)
 	payload.pid = current->tgid;
 	payload.brk = brk;
 
+	pcache_xlate_brk_begin(current->mm, brk);
 	ret_len = net_send_reply_timeout(current_memory_home_node(), P2M_BRK,
 			&payload, sizeof(payload), &reply, sizeof(reply),
 			false, DEF_NET_TIMEOUT);
@@ -65,14 +67,18 @@ SYSCALL_DEFINE1(brk, unsigned long, brk)
 	mmap_debug("ret_brk: %#Lx", reply.ret_brk);
 	if (likely(ret_len == sizeof(reply))) {
 		if (WARN_ON(reply.ret_brk == RET_ESRCH 
-			 || reply.ret_brk == RET_EINTR))
+			 || reply.ret_brk == RET_EINTR)) {
+			pcache_xlate_brk_end(current->mm, 0);
 			return -EINTR;
+		}
 
 #ifdef CONFIG_DISTRIBUTED_VMA_PROCESSOR
 		map_mnode_from_reply(current->mm, &reply.map);
 #endif
+		pcache_xlate_brk_end(current->mm, reply.ret_brk);
 		return reply.ret_brk;
 	}
+	pcache_xlate_brk_end(current->mm, 0);
 	return -EIO;
 }
 
@@ -165,9 +171,12 @@ SYSCALL_DEFINE2(munmap, unsigned long, addr, size_t, len)
 	payload.addr = addr;
 	payload.len = len;
 
+	/* Remote pages are freed once memory gets this */
+	pcache_xlate_unmap_begin(current->mm, addr, addr + len);
 	retlen = net_send_reply_timeout(current_memory_home_node(), P2M_MUNMAP,
 			&payload, sizeof(payload), &retbuf, sizeof(retbuf),
 			false, DEF_NET_TIMEOUT);
+	pcache_xlate_unmap_end(current->mm);
 
 	if (unlikely(retlen != sizeof(retbuf))) {
 		retbuf.ret = -EIO;
@@ -231,9 +240,12 @@ SYSCALL_DEFINE5(mremap, unsigned long, old_addr, unsigned long, old_len,
 	payload.flags = flags;
 	payload.new_addr = new_addr;
 
+	/* Shrink or move, the old range may be gone once memory gets this */
+	pcache_xlate_unmap_begin(current->mm, old_addr, old_addr + old_len);
 	retlen = net_send_reply_timeout(current_memory_home_node(), P2M_MREMAP,
 			&payload, sizeof(payload), &reply, sizeof(reply),
 			false, DEF_NET_TIMEOUT);
+	pcache_xlate_unmap_end(current->mm);
 
 	if (unlikely(retlen != sizeof(reply))) {
 		ret = -EIO;
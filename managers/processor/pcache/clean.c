@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Background cleaner for dirty pcache lines
+ *
+ * Evicting a dirty line has to flush it back to memory first, while a
+ * clean line can be dropped right away. The cleaner looks at the eviction
+ * end of each full set's LRU list, write-protects dirty lines, writes them
+ * back in a batch and marks them clean. A following write takes a wp fault,
+ * which waits for the line lock and then upgrades the pte in place.
+ *
+ * The cleaner backs off if:
+ *  - few lines near the eviction end are dirty,
+ *  - lines it cleaned are dirtied again before they are evicted,
+ *  - flush latency goes up, which means the link is busy.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/sched.h>
+#include <lego/timer.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+#define CLEAN_NR_SCAN		(PCACHE_ASSOCIATIVITY / 4)
+#define CLEAN_BATCH		8
+#define CLEAN_MIN_INTERVAL	CONFIG_PCACHE_BACKGROUND_CLEAN_INTERVAL_MSEC
+#define CLEAN_MAX_INTERVAL	(CLEAN_MIN_INTERVAL * 64)
+
+/* Dirty ratio (in percent) near the eviction end */
+#define CLEAN_LOW_RATIO		10
+#define CLEAN_HIGH_RATIO	50
+
+/* Link is considered busy if flush takes this many times of the best */
+#define CLEAN_BUSY_FACTOR	4
+
+struct clean_control {
+	unsigned long	nr_scanned;
+	unsigned long	nr_dirty;
+	unsigned long	nr_cleaned;
+	unsigned long	nr_redirty;
+	unsigned long	flush_ns;
+};
+
+static struct task_struct *clean_thread;
+
+static unsigned int clean_dirty_ratio;
+static unsigned long clean_min_flush_ns = ULONG_MAX;
+
+static void clean_pset(struct pcache_set *pset, struct clean_control *cc)
+{
+	struct pcache_meta *pcms[CLEAN_BATCH];
+	bool dirty[CLEAN_BATCH];
+	struct pcache_meta *pcm;
+	unsigned long start;
+	int i, nr;
+
+	nr = clean_find_lines_lru(pset, pcms, CLEAN_NR_SCAN, CLEAN_BATCH);
+	if (!nr)
+		return;
+	cc->nr_scanned += nr;
+
+	/* Stop writers of the whole batch first */
+	for (i = 0; i < nr; i++) {
+		pcm = pcms[i];
+		dirty[i] = false;
+
+		if (!pcache_dirty(pcm))
+			continue;
+		cc->nr_dirty++;
+
+		/*
+		 * We cleaned it before, but it was dirtied again before
+		 * being evicted. Writing a hot line back is a waste, skip
+		 * it once. Eviction will flush it if it is still dirty.
+		 */
+		if (TestClearPcacheCleaned(pcm)) {
+			cc->nr_redirty++;
+			continue;
+		}
+
+		if (pcache_wrprotect_dirty(pcm))
+			dirty[i] = true;
+	}
+
+	/* Then write them back */
+	for (i = 0; i < nr; i++) {
+		pcm = pcms[i];
+		if (dirty[i]) {
+			start = sched_clock();
+			pcache_writeback_one(pcm);
+			cc->flush_ns += sched_clock() - start;
+
+			SetPcacheCleaned(pcm);
+			cc->nr_cleaned++;
+		}
+		unlock_pcache(pcm);
+		put_pcache(pcm);
+	}
+}
+
+/*
+ * Adjust the interval based on the last run.
+ * Back off exponentially, speed up by half.
+ */
+static unsigned int clean_next_interval(unsigned int interval,
+					struct clean_control *cc)
+{
+	unsigned long ratio, avg_ns;
+	bool backoff = false;
+
+	ratio = cc->nr_scanned ? cc->nr_dirty * 100 / cc->nr_scanned : 0;
+	clean_dirty_ratio = (clean_dirty_ratio * 3 + ratio) / 4;
+
+	if (clean_dirty_ratio < CLEAN_LOW_RATIO)
+		backoff = true;
+
+	if (cc->nr_redirty * 2 > cc->nr_dirty)
+		backoff = true;
+
+	if (cc->nr_cleaned) {
+		avg_ns = cc->flush_ns / cc->nr_cleaned;
+		if (avg_ns < clean_min_flush_ns)
+			clean_min_flush_ns = avg_ns;
+		else if (avg_ns > clean_min_flush_ns * CLEAN_BUSY_FACTOR)
+			backoff = true;
+
+		/* Slowly forget the best, in case it was a lucky one */
+		clean_min_flush_ns += clean_min_flush_ns / 16;
+	}
+
+	if (backoff) {
+		inc_pcache_event(PCACHE_CLEAN_BACKOFF);
+		return min_t(unsigned int, interval * 2, CLEAN_MAX_INTERVAL);
+	}
+
+	if (clean_dirty_ratio > CLEAN_HIGH_RATIO)
+		return max_t(unsigned int, interval / 2, CLEAN_MIN_INTERVAL);
+	return interval;
+}
+
+static int kpcache_cleand(void *unused)
+{
+	unsigned int interval = CLEAN_MIN_INTERVAL;
+	struct clean_control cc;
+	struct pcache_set *pset;
+	int setidx;
+
+	while (1) {
+		memset(&cc, 0, sizeof(cc));
+
+		pcache_for_each_set(pset, setidx) {
+			/* Do not race with normal eviction */
+			if (PsetEvicting(pset))
+				continue;
+
+			/* Only (nearly) full sets will evict soon */
+			if (pset_nr_lru(pset) < PCACHE_ASSOCIATIVITY - CLEAN_NR_SCAN)
+				continue;
+
+			clean_pset(pset, &cc);
+		}
+
+		inc_pcache_event(PCACHE_CLEAN_RUN);
+		add_pcache_event(PCACHE_CLEAN_NR_SCANNED, cc.nr_scanned);
+		add_pcache_event(PCACHE_CLEAN_NR_CLEANED, cc.nr_cleaned);
+		add_pcache_event(PCACHE_CLEAN_NR_REDIRTY, cc.nr_redirty);
+
+		interval = clean_next_interval(interval, &cc);
+		msleep(interval);
+	}
+	return 0;
+}
+
+int __init pcache_clean_init(void)
+{
+	clean_thread = kthread_run(kpcache_cleand, NULL, "kpcache_cleand");
+	if (IS_ERR(clean_thread))
+		return PTR_ERR(clean_thread);
+	return 0;
+}
@@ -160,6 +160,32 @@ int pcache_flush_one(struct pcache_meta *pcm)
 	return 0;
 }
 
+/**
+ * pcache_writeback_one
+ * @pcm: pcache line to write back
+ *
+ * Same as pcache_flush_one(), except that @pcm is not being evicted and
+ * stays mapped. Used by background cleaner, which has write-protected
+ * all PTEs before calling this. @pcm must be locked on entry.
+ */
+int pcache_writeback_one(struct pcache_meta *pcm)
+{
+	int nr_flushed = 0;
+	struct rmap_walk_control rwc = {
+		.arg = &nr_flushed,
+		.rmap_one = __pcache_flush_one,
+	};
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+	PCACHE_BUG_ON_PCM(PcacheWriteback(pcm) || PcacheReclaim(pcm), pcm);
+
+	SetPcacheWriteback(pcm);
+	rmap_walk(pcm, &rwc);
+	ClearPcacheWriteback(pcm);
+
+	return 0;
+}
+
 void __init init_pcache_clflush_buffer(void)
 {
 	clflush_msg_array = kmalloc(sizeof(*clflush_msg_array) * nr_cpus, GFP_KERNEL);
@@ -23,7 +23,8 @@
 	{1UL << PC_reclaim,		"reclaim"	},	\
 	{1UL << PC_writeback,		"writeback"	},	\
 	{1UL << PC_piggyback,		"piggyback"	},	\
-	{1UL << PC_piggyback,		"piggybackC"	}
+	{1UL << PC_piggyback,		"piggybackC"	},	\
+	{1UL << PC_cleaned,		"cleaned"	}
 
 const struct trace_print_flags pcacheflag_names[] = {
 	__def_pcacheflag_names,
@@ -15,6 +15,7 @@
 #include <lego/kernel.h>
 #include <lego/jiffies.h>
 #include <lego/profile.h>
+#include <lego/rcupdate.h>
 #include <processor/pcache.h>
 #include <processor/processor.h>
 
@@ -152,6 +153,62 @@ unlock_lru:
 	return pcm;
 }
 
+#ifdef CONFIG_PCACHE_BACKGROUND_CLEAN
+/*
+ * Callback for background cleaner.
+ * Collect up to @max lines among the last @nr_scan lines of the LRU list,
+ * which are the next ones to be evicted. Only lines mapped by one PTE
+ * are returned, so a wp fault later will reuse it instead of COW.
+ *
+ * The returned pcache lines are Locked, ref inc'ed 1 by us,
+ * and still in the LRU list.
+ */
+int clean_find_lines_lru(struct pcache_set *pset, struct pcache_meta **pcms,
+			 int nr_scan, int max)
+{
+	struct pcache_meta *pcm;
+	int nr = 0;
+
+	if (!spin_trylock(&pset->lru_lock))
+		return 0;
+
+	list_for_each_entry_reverse(pcm, &pset->lru_list, lru) {
+		PCACHE_BUG_ON_PCM(PcacheReclaim(pcm), pcm);
+
+		if (nr >= max || nr_scan-- <= 0)
+			break;
+
+		/* Eviction is more important */
+		if (PsetEvicting(pset))
+			break;
+
+		if (unlikely(lru_get_pcache(pcm)))
+			break;
+
+		if (unlikely(!PcacheValid(pcm)))
+			goto put_pcache;
+
+		if (!trylock_pcache(pcm))
+			goto put_pcache;
+
+		if (PcacheWriteback(pcm) || pcache_mapcount(pcm) != 1)
+			goto unlock_pcache;
+
+		pcms[nr++] = pcm;
+		continue;
+
+unlock_pcache:
+		unlock_pcache(pcm);
+put_pcache:
+		if (lru_put_pcache(pcm, pset))
+			break;
+	}
+	spin_unlock(&pset->lru_lock);
+
+	return nr;
+}
+#endif /* CONFIG_PCACHE_BACKGROUND_CLEAN */
+
 #ifdef CONFIG_PCACHE_EVICT_GENERIC_SWEEP
 /*
  * This function determines how "aggressive" the sweep is.
@@ -329,6 +386,7 @@ void kevict_sweepd_lru(void)
 		 * Well.. just to stop being an asshole to other customers.
 		 * The more we sleep/delay, probably the nicer we are. ;-)
 		 */
+		rcu_qs();
 		mdelay(sysctl_pcache_evict_interval_msec);
 	}
 }
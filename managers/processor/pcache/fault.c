@@ -184,10 +184,13 @@ static DEFINE_PER_CPU(struct p2m_pcache_miss_flush_combine_msg, pb_msg_array);
 /*
  * Callback for common fill code
  * Fill the pcache line from remote memory.
+ *
+ * If @need_xlate is set on return, the line was filled by a normal miss,
+ * and caller could fetch the translations around @address.
  */
 static int
 __pcache_do_fill_page(unsigned long address, unsigned long flags,
-		      struct pcache_meta *pcm, void *unused)
+		      struct pcache_meta *pcm, void *need_xlate)
 {
 	int ret, len, dst_nid;
 	struct pcache_set *pset;
@@ -265,6 +268,16 @@ __pcache_do_fill_page(unsigned long address, unsigned long flags,
 		inc_pcache_event(PCACHE_FAULT_FILL_FROM_MEMORY_PIGGYBACK);
 	} else {
 fallback:
+		/*
+		 * Fast path: one-sided RDMA READ if the remote translation
+		 * is known, memory does not need to know this miss.
+		 */
+		if (!pcache_xlate_fill(current->mm, address, dst_nid, va_cache)) {
+			inc_pcache_event(PCACHE_FAULT_FILL_FROM_MEMORY_ONESIDED);
+			ret = 0;
+			goto out;
+		}
+
 		fill_common_header(&msg, P2M_PCACHE_MISS);
 		msg.has_flush_msg = 0;
 		msg.pid = current->pid;
@@ -277,6 +290,7 @@ fallback:
 					       va_cache, PCACHE_LINE_SIZE, false,
 					       DEF_NET_TIMEOUT);
 		PROFILE_LEAVE(__pcache_fill_remote_net);
+		*(bool *)need_xlate = true;
 	}
 
 	if (unlikely(len < (int)PCACHE_LINE_SIZE)) {
@@ -315,9 +329,17 @@ static inline int
 pcache_do_fill_page(struct mm_struct *mm, unsigned long address,
 		    pte_t *page_table, pte_t orig_pte, pmd_t *pmd, unsigned long flags)
 {
-	return common_do_fill_page(mm, address, page_table, orig_pte, pmd, flags,
-			__pcache_do_fill_page, NULL, RMAP_FILL_PAGE_REMOTE,
+	bool need_xlate = false;
+	int ret;
+
+	ret = common_do_fill_page(mm, address, page_table, orig_pte, pmd, flags,
+			__pcache_do_fill_page, &need_xlate, RMAP_FILL_PAGE_REMOTE,
 			ENABLE_PIGGYBACK);
+
+	/* Do this after pte is unlocked */
+	if (!ret && need_xlate)
+		pcache_xlate_fetch(mm, address, get_memory_node(current, address));
+	return ret;
 }
 
 #ifdef CONFIG_PCACHE_ZEROFILL
@@ -432,7 +454,7 @@ static int pcache_do_wp_page(struct mm_struct *mm, unsigned long address,
 #ifdef CONFIG_PCACHE_EVICTION_WRITE_PROTECT
 	if (unlikely(PcacheReclaim(old_pcm))) {
 		ret = 0;
-		inc_pcache_event(PCACHE_FAULT_CONCUR_EVICTION)
+		inc_pcache_event(PCACHE_FAULT_CONCUR_EVICTION);
 		goto unlock_pte;
 	}
 #endif
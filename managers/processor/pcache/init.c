@@ -14,6 +14,8 @@
 #include <lego/pgfault.h>
 #include <lego/syscalls.h>
 #include <lego/memblock.h>
+#include <lego/parallel.h>
+#include <lego/fit_ibapi.h>
 
 #include <processor/pcache.h>
 #include <processor/processor.h>
@@ -64,13 +66,17 @@ u64 nr_bits_tag;
 /* Offset between neighbouring ways within a set */
 u64 pcache_way_cache_stride __read_mostly;
 
+/* Not worth a thread for less sets than this at post init */
+#define PCACHE_INIT_MIN_SETS	(1UL << 14)
+
 static void __init alloc_pcache_set_map(void)
 {
 	u64 size;
 
 	/* the pset array */
+	/* Cleared by init_pcache_set(), in parallel */
 	size = nr_cachesets * sizeof(struct pcache_set);
-	pcache_set_map = memblock_virt_alloc(size, PAGE_SIZE);
+	pcache_set_map = memblock_virt_alloc_raw(size, PAGE_SIZE);
 	if (!pcache_set_map)
 		panic("Unable to allocate pcache set array!");
 }
@@ -146,64 +152,67 @@ void __init pcache_early_init(void)
 	victim_cache_early_init();
 }
 
-static void __init init_pcache_set_free_list(void)
+static void __init init_pcache_set(struct pcache_set *pset)
 {
-	struct pcache_set *pset;
-	struct pcache_meta *pcm;
-	int setidx, way;
-
-	pcache_for_each_set(pset, setidx) {
-		pcache_for_each_way_set(pcm, pset, way) {
-			list_add_tail(&pcm->free_list, &pset->free_head);
-		}
-	}
-}
+	int j;
 
-/* Init pcache_set array */
-static void __init init_pcache_set_map(void)
-{
-	struct pcache_set *pset;
-	int setidx, j;
+	memset(pset, 0, sizeof(*pset));
 
-	pcache_for_each_set(pset, setidx) {
-		/* Head of free pcache line */
-		INIT_LIST_HEAD(&pset->free_head);
-		spin_lock_init(&pset->free_lock);
+	/* Head of free pcache line */
+	INIT_LIST_HEAD(&pset->free_head);
+	spin_lock_init(&pset->free_lock);
 
-		/* Eviction Algorithm Specific */
+	/* Eviction Algorithm Specific */
 #ifdef CONFIG_PCACHE_EVICT_LRU
-		INIT_LIST_HEAD(&pset->lru_list);
-		spin_lock_init(&pset->lru_lock);
-		atomic_set(&pset->nr_lru, 0);
+	INIT_LIST_HEAD(&pset->lru_list);
+	spin_lock_init(&pset->lru_lock);
+	atomic_set(&pset->nr_lru, 0);
 #endif
 
-		/* Eviction Mechanism Specific */
+	/* Eviction Mechanism Specific */
 #ifdef CONFIG_PCACHE_EVICTION_VICTIM
-		atomic_set(&pset->nr_victims, 0);
+	atomic_set(&pset->nr_victims, 0);
 #elif defined(CONFIG_PCACHE_EVICTION_PERSET_LIST)
-		INIT_LIST_HEAD(&pset->eviction_list);
-		spin_lock_init(&pset->eviction_list_lock);
-		atomic_set(&pset->nr_eviction_entries, 0);
+	INIT_LIST_HEAD(&pset->eviction_list);
+	spin_lock_init(&pset->eviction_list_lock);
+	atomic_set(&pset->nr_eviction_entries, 0);
 #endif
 
-		for (j = 0; j < NR_PSET_STAT_ITEMS; j++)
-			atomic_set(&pset->stat[j], 0);
-	}
+	for (j = 0; j < NR_PSET_STAT_ITEMS; j++)
+		atomic_set(&pset->stat[j], 0);
 }
 
-/* Init pcache_meta array */
-static void __init init_pcache_meta_map(void)
+static void __init init_pcache_meta(struct pcache_meta *pcm)
 {
+	pcm->bits = 0;
+	INIT_LIST_HEAD(&pcm->free_list);
+	INIT_LIST_HEAD(&pcm->rmap);
+	pcache_mapcount_reset(pcm);
+	pcache_ref_count_set(pcm, 0);
+	init_pcache_lru(pcm);
+}
+
+/*
+ * Init pcache_set [start, end), the pcache_meta of all their ways,
+ * and free all ways into their set free list. Sets share nothing,
+ * so this runs on all CPUs, each with a range of sets.
+ */
+static void __init init_pcache_sets(unsigned long start, unsigned long end,
+				    void *unused)
+{
+	struct pcache_set *pset;
 	struct pcache_meta *pcm;
-	int nr;
-
-	pcache_for_each_way(pcm, nr) {
-		pcm->bits = 0;
-		INIT_LIST_HEAD(&pcm->free_list);
-		INIT_LIST_HEAD(&pcm->rmap);
-		pcache_mapcount_reset(pcm);
-		pcache_ref_count_set(pcm, 0);
-		init_pcache_lru(pcm);
+	unsigned long setidx;
+	int way;
+
+	for (setidx = start; setidx < end; setidx++) {
+		pset = pcache_set_map + setidx;
+		init_pcache_set(pset);
+
+		pcache_for_each_way_set(pcm, pset, way) {
+			init_pcache_meta(pcm);
+			list_add_tail(&pcm->free_list, &pset->free_head);
+		}
 	}
 }
 
@@ -213,6 +222,7 @@ static void __init init_pcache_meta_map(void)
  */
 void __init pcache_post_init(void)
 {
+	struct parallel_job job;
 	int ret;
 
 	/*
@@ -236,18 +246,29 @@ void __init pcache_post_init(void)
 	 * Not sure about physical machine.
 	 */
 	pr_info("before: memset: %#llx %#llx\n", virt_start_cacheline, pcache_registered_size);
-	memset((void *)virt_start_cacheline, 0, pcache_registered_size);
+	parallel_clear((void *)virt_start_cacheline, pcache_registered_size, "pcache-clear");
 	pr_info("After: memset: %#llx %#llx\n", virt_start_cacheline, pcache_registered_size);
 
 	pcache_meta_map = (struct pcache_meta *)(virt_start_cacheline + nr_pages_cacheline * PAGE_SIZE);
 
+	/* Pcache lines are RDMA targets of every miss */
+	ibapi_register_dma_region((void *)virt_start_cacheline,
+				  nr_pages_cacheline * PAGE_SIZE);
+
 	/*
 	 * Init our most important data structures
 	 * and free all pcache lines into their set free list
 	 */
-	init_pcache_meta_map();
-	init_pcache_set_map();
-	init_pcache_set_free_list();
+	job.thread_fn	= init_pcache_sets;
+	job.fn_arg	= NULL;
+	job.start	= 0;
+	job.size	= nr_cachesets;
+	job.align	= 1;
+	job.min_chunk	= PCACHE_INIT_MIN_SETS;
+	job.name	= "pcache-init";
+	parallel_do_job(&job);
+
+	init_pcache_rmap_map();
 
 	init_pcache_clflush_buffer();
 
@@ -259,6 +280,11 @@ void __init pcache_post_init(void)
 	if (ret)
 		panic("Pcache: fail to create evict sweep threads!");
 
+	/* Create background clean thread if configured */
+	ret = pcache_clean_init();
+	if (ret)
+		panic("Pcache: fail to create clean thread!");
+
 	pcache_print_info();
 }
 
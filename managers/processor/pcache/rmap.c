@@ -15,6 +15,7 @@
 #include <lego/syscalls.h>
 #include <lego/ratelimit.h>
 #include <lego/memblock.h>
+#include <lego/parallel.h>
 #include <lego/profile_point.h>
 #include <processor/pcache.h>
 #include <processor/processor.h>
@@ -465,10 +466,13 @@ static inline void __pcache_remove_rmap(struct pcache_meta *pcm,
 
 	/*
 	 * There is no PTE map to this pcache anymore
-	 * Clear the Valid bit
+	 * Clear the Valid bit, and Cleaned which only
+	 * makes sense for the data just dropped.
 	 */
-	if (likely(pcache_mapcount_dec_and_test(pcm)))
+	if (likely(pcache_mapcount_dec_and_test(pcm))) {
 		ClearPcacheValid(pcm);
+		ClearPcacheCleaned(pcm);
+	}
 }
 
 struct pcache_remove_rmap_info {
@@ -1227,6 +1231,105 @@ int pcache_wrprotect(struct pcache_meta *pcm)
 	return protected;
 }
 
+static int pcache_dirty_one(struct pcache_meta *pcm,
+			    struct pcache_rmap *rmap, void *arg)
+{
+	bool *dirty = arg;
+	spinlock_t *ptl = NULL;
+	pte_t *pte;
+
+	pte = rmap_get_pte_locked(pcm, rmap, &ptl);
+	if (unlikely(!pte))
+		return PCACHE_RMAP_AGAIN;
+
+	if (pte_present(*pte) && pte_dirty(*pte))
+		*dirty = true;
+	spin_unlock(ptl);
+
+	if (*dirty)
+		return PCACHE_RMAP_SUCCEED;
+	return PCACHE_RMAP_AGAIN;
+}
+
+/*
+ * Return true if any PTE mapped to @pcm is dirty.
+ * @pcm must be locked on entry.
+ */
+bool pcache_dirty(struct pcache_meta *pcm)
+{
+	bool dirty = false;
+	struct rmap_walk_control rwc = {
+		.arg = &dirty,
+		.rmap_one = pcache_dirty_one,
+	};
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+
+	if (!pcache_mapped(pcm))
+		return false;
+
+	rmap_walk(pcm, &rwc);
+	return dirty;
+}
+
+static int pcache_wrprotect_dirty_one(struct pcache_meta *pcm,
+				      struct pcache_rmap *rmap, void *arg)
+{
+	int *cleaned = arg;
+	spinlock_t *ptl = NULL;
+	pte_t *pte;
+	pte_t entry;
+
+	pte = rmap_get_pte_locked(pcm, rmap, &ptl);
+	if (unlikely(!pte))
+		return PCACHE_RMAP_AGAIN;
+
+	if (!pte_present(*pte) || !pte_dirty(*pte))
+		goto out;
+
+	/* Same as pcache_wrprotect_one() */
+	entry = ptep_get_and_clear(0, pte);
+	entry = pte_wrprotect(entry);
+	entry = pte_mkclean(entry);
+	pte_set(pte, entry);
+
+	flush_tlb_mm_range(rmap->owner_mm,
+			   rmap->address,
+			   rmap->address + PAGE_SIZE -1);
+
+	(*cleaned)++;
+
+out:
+	spin_unlock(ptl);
+	return PCACHE_RMAP_AGAIN;
+}
+
+/**
+ * pcache_wrprotect_dirty
+ * @pcm: pcache line to clean
+ *
+ * Write-protect and clear the dirty bit of dirty PTEs mapped to @pcm.
+ * Once this returns, the content can not be changed until a wp fault,
+ * which has to lock @pcm first. Return the number of PTEs cleaned.
+ * @pcm must be locked on entry.
+ */
+int pcache_wrprotect_dirty(struct pcache_meta *pcm)
+{
+	int cleaned = 0;
+	struct rmap_walk_control rwc = {
+		.arg = &cleaned,
+		.rmap_one = pcache_wrprotect_dirty_one,
+	};
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+
+	if (!pcache_mapped(pcm))
+		return 0;
+
+	rmap_walk(pcm, &rwc);
+	return cleaned;
+}
+
 struct pcache_referenced_control {
 	int pte_contention;
 	int referenced;
@@ -1368,10 +1471,14 @@ out:
  *
  * Be careful while using locks inside your rmap walk function.
  * Do not introduce deadlock here.
+ *
+ * TLB shootdowns issued by @rwc->rmap_one are batched, and all of
+ * them have completed by the time we return.
  */
 int rmap_walk(struct pcache_meta *pcm, struct rmap_walk_control *rwc)
 {
 	struct pcache_rmap *rmap, *keeper;
+	struct tlb_flush_batch batch;
 	int ret = PCACHE_RMAP_AGAIN;
 
 	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
@@ -1383,6 +1490,7 @@ int rmap_walk(struct pcache_meta *pcm, struct rmap_walk_control *rwc)
 	if (unlikely(list_empty(&pcm->rmap)))
 		return ret;
 
+	tlb_flush_batch_start(&batch);
 	list_for_each_entry_safe(rmap, keeper, &pcm->rmap, next) {
 		ret = rwc->rmap_one(pcm, rmap, rwc->arg);
 		if (ret != PCACHE_RMAP_AGAIN)
@@ -1391,6 +1499,7 @@ int rmap_walk(struct pcache_meta *pcm, struct rmap_walk_control *rwc)
 		if (rwc->done && rwc->done(pcm))
 			break;
 	}
+	tlb_flush_batch_finish(&batch);
 
 	return ret;
 }
@@ -1406,10 +1515,18 @@ void __init alloc_pcache_rmap_map(void)
 	size = sizeof(struct pcache_rmap);
 	total = size * nr_cachelines;
 
-	rmap_map = memblock_virt_alloc(total, PAGE_SIZE);
+	/* Cleared by init_pcache_rmap_map(), in parallel */
+	rmap_map = memblock_virt_alloc_raw(total, PAGE_SIZE);
 	if (!rmap_map)
 		panic("Unable to allocate rmap map!");
 
 	pr_info("%s(): rmap size: %zu B, total reserved: %zu B, at %p - %p\n",
 		__func__, size, total, rmap_map, rmap_map + total);
 }
+
+/* Called at post init, when all CPUs are up */
+void __init init_pcache_rmap_map(void)
+{
+	parallel_clear(rmap_map, sizeof(struct pcache_rmap) * nr_cachelines,
+		       "pcache-rmap");
+}
@@ -7,12 +7,35 @@
  * (at your option) any later version.
  */
 
+#include <lego/init.h>
 #include <lego/kernel.h>
+#include <lego/string.h>
 #include <lego/fit_ibapi.h>
+#include <lego/jump_label.h>
 #include <processor/pcache.h>
 
 struct pcache_event_stat pcache_event_stats;
 
+#ifdef CONFIG_COUNTER_PCACHE
+DEFINE_STATIC_KEY_TRUE(pcache_stat_key);
+
+/* pcache_stat=on|off, counters are on by default */
+static int __init pcache_stat_setup(char *str)
+{
+	if (!str)
+		return -EINVAL;
+
+	if (!strcmp(str, "off"))
+		static_branch_disable(&pcache_stat_key);
+	else if (!strcmp(str, "on"))
+		static_branch_enable(&pcache_stat_key);
+	else
+		return -EINVAL;
+	return 0;
+}
+__setup("pcache_stat", pcache_stat_setup);
+#endif
+
 static const char *const pcache_event_text[] = {
 	"nr_pgfault",
 	"nr_pgfault_code",
@@ -33,6 +56,8 @@ static const char *const pcache_event_text[] = {
 	"nr_pcache_fill_from_memory",
 	"nr_pcache_fill_from_memory_piggyback",
 	"nr_pcache_fill_from_memory_piggyback_fallback",
+	"nr_pcache_fill_from_memory_onesided",
+	"nr_pcache_xlate_fetch",
 	"nr_pcache_fill_from_victim",			/* victim cache specific */
 
 	"nr_pcache_eviction_triggered",
@@ -68,6 +93,13 @@ static const char *const pcache_event_text[] = {
 	"nr_sweep_nr_pset",
 	"nr_sweep_nr_moved_pcm",
 
+	/* background clean */
+	"nr_clean_run",
+	"nr_clean_nr_scanned",
+	"nr_clean_nr_cleaned",
+	"nr_clean_nr_redirty",
+	"nr_clean_backoff",
+
 	"nr_mremap_pset_same",
 	"nr_mremap_pset_diff",
 
@@ -88,6 +120,11 @@ void print_pcache_events(void)
 
 	BUILD_BUG_ON(NR_PCACHE_EVENT_ITEMS != ARRAY_SIZE(pcache_event_text));
 
+#ifdef CONFIG_COUNTER_PCACHE
+	if (!static_key_enabled_type(&pcache_stat_key))
+		pr_info("pcache_stat=off, counters are not updated\n");
+#endif
+
 	for (i = 0; i < NR_PCACHE_EVENT_ITEMS; i++) {
 		pr_info("%s: %lu\n", pcache_event_text[i],
 			atomic_long_read(&pcache_event_stats.event[i]));
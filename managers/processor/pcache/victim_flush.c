@@ -22,6 +22,7 @@
 #include <lego/pgfault.h>
 #include <lego/jiffies.h>
 #include <lego/kthread.h>
+#include <lego/rcupdate.h>
 #include <lego/memblock.h>
 #include <lego/comp_common.h>
 #include <lego/completion.h>
@@ -191,8 +192,10 @@ static int victim_flush_async(void *unused)
 		panic("Fail to pin victim flush");
 
 	for (;;) {
-		while (!nr_flush_queue_jobs())
+		while (!nr_flush_queue_jobs()) {
+			rcu_qs();
 			cpu_relax();
+		}
 
 		spin_lock(&victim_flush_lock);
 		while (!list_empty(&victim_flush_queue)) {
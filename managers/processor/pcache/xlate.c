@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Remote page translation cache
+ *
+ * Each mm has a small direct-mapped table, which maps user page to
+ * the DMA address of its backing page at memory component. A pcache
+ * miss that hits in this table is filled by one-sided RDMA READ,
+ * memory CPU is not involved at all.
+ *
+ * The table is populated in batch by P2M_PCACHE_XLATE after a normal
+ * miss. Memory only reports writable pages, so the backing page will
+ * not be replaced by COW. All other mapping changes are initiated by
+ * processor (munmap, mremap, brk, fork, exit), and we drop the affected
+ * entries there.
+ *
+ * munmap, mremap and brk free remote pages, so the entries must be gone
+ * BEFORE the request is sent to memory. They are bracketed by
+ * pcache_xlate_unmap_begin() and pcache_xlate_unmap_end():
+ *  - begin drops the entries and waits for in-flight READs,
+ *  - no fetch can insert entries in between,
+ *  - end bumps the generation, so a fetch that was sent before
+ *    the unmap will not insert stale entries either.
+ */
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/atomic.h>
+#include <lego/kernel.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <lego/rpc/opcode.h>
+#include <lego/rpc/struct_p2m.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+#define XLATE_TABLE_SHIFT	10
+#define XLATE_TABLE_SIZE	(1UL << XLATE_TABLE_SHIFT)
+#define XLATE_WINDOW_SIZE	(PCACHE_XLATE_MAX_PAGES * PAGE_SIZE)
+#define XLATE_WINDOW_NONE	(~0UL)
+
+struct pcache_xlate_entry {
+	unsigned long		vaddr;		/* 0 if invalid */
+	u64			dma_addr;
+	u32			rkey;
+	u32			nid;
+};
+
+struct pcache_xlate_table {
+	spinlock_t		lock;
+	unsigned long		gen;
+	unsigned long		last_window;
+	unsigned long		brk;		/* 0 if unknown */
+	int			nr_unmapping;
+	atomic_t		nr_reading;
+	struct pcache_xlate_entry entries[XLATE_TABLE_SIZE];
+};
+
+static inline struct pcache_xlate_entry *
+xlate_entry(struct pcache_xlate_table *t, unsigned long address)
+{
+	return &t->entries[(address >> PAGE_SHIFT) & (XLATE_TABLE_SIZE - 1)];
+}
+
+int pcache_xlate_init(struct mm_struct *mm)
+{
+	struct pcache_xlate_table *t;
+
+	BUILD_BUG_ON(PCACHE_LINE_SIZE != PAGE_SIZE);
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	spin_lock_init(&t->lock);
+	atomic_set(&t->nr_reading, 0);
+	t->last_window = XLATE_WINDOW_NONE;
+	mm->pcache_xlate = t;
+	return 0;
+}
+
+void pcache_xlate_exit(struct mm_struct *mm)
+{
+	kfree(mm->pcache_xlate);
+	mm->pcache_xlate = NULL;
+}
+
+static void __pcache_xlate_invalidate(struct pcache_xlate_table *t,
+				      unsigned long start, unsigned long end)
+{
+	struct pcache_xlate_entry *e;
+	unsigned long addr;
+	int i;
+
+	t->gen++;
+	t->last_window = XLATE_WINDOW_NONE;
+
+	if (((end - start) >> PAGE_SHIFT) < XLATE_TABLE_SIZE) {
+		for (addr = start; addr < end; addr += PAGE_SIZE) {
+			e = xlate_entry(t, addr);
+			if (e->vaddr == addr)
+				e->vaddr = 0;
+		}
+	} else {
+		for (i = 0; i < XLATE_TABLE_SIZE; i++) {
+			e = &t->entries[i];
+			if (e->vaddr >= start && e->vaddr < end)
+				e->vaddr = 0;
+		}
+	}
+}
+
+void pcache_xlate_invalidate(struct mm_struct *mm,
+			     unsigned long start, unsigned long end)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+
+	if (unlikely(!t))
+		return;
+
+	start &= PAGE_MASK;
+	end = PAGE_ALIGN(end);
+
+	spin_lock(&t->lock);
+	__pcache_xlate_invalidate(t, start, end);
+	spin_unlock(&t->lock);
+}
+
+/* Must be called before asking memory to unmap [@start, @end) */
+void pcache_xlate_unmap_begin(struct mm_struct *mm,
+			      unsigned long start, unsigned long end)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+
+	if (unlikely(!t))
+		return;
+
+	start &= PAGE_MASK;
+	end = PAGE_ALIGN(end);
+
+	spin_lock(&t->lock);
+	t->nr_unmapping++;
+	__pcache_xlate_invalidate(t, start, end);
+	spin_unlock(&t->lock);
+
+	/* READs that looked up an entry before we dropped it */
+	while (atomic_read(&t->nr_reading))
+		cpu_relax();
+}
+
+/* Called once memory replied, whether it succeed or not */
+void pcache_xlate_unmap_end(struct mm_struct *mm)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+
+	if (unlikely(!t))
+		return;
+
+	spin_lock(&t->lock);
+	t->gen++;
+	t->last_window = XLATE_WINDOW_NONE;
+	t->nr_unmapping--;
+	spin_unlock(&t->lock);
+}
+
+/*
+ * brk() version of pcache_xlate_unmap_begin(). Processor does not know
+ * the old brk, so we remember the last one here. If it is unknown, drop
+ * everything above the requested brk.
+ */
+void pcache_xlate_brk_begin(struct mm_struct *mm, unsigned long brk)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+	unsigned long end;
+
+	if (unlikely(!t))
+		return;
+
+	spin_lock(&t->lock);
+	end = t->brk ? PAGE_ALIGN(t->brk) : TASK_SIZE;
+	spin_unlock(&t->lock);
+
+	if (PAGE_ALIGN(brk) < end)
+		pcache_xlate_unmap_begin(mm, brk, end);
+	else
+		pcache_xlate_unmap_begin(mm, 0, 0);
+}
+
+/* @brk is the new brk returned by memory, 0 if unknown */
+void pcache_xlate_brk_end(struct mm_struct *mm, unsigned long brk)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+
+	if (unlikely(!t))
+		return;
+
+	spin_lock(&t->lock);
+	t->brk = brk;
+	spin_unlock(&t->lock);
+
+	pcache_xlate_unmap_end(mm);
+}
+
+/*
+ * Try to fill @va_cache with one-sided RDMA READ.
+ * Return 0 on success, otherwise caller should fallback to normal miss.
+ * Either way the READ is done with @va_cache when we return.
+ */
+int pcache_xlate_fill(struct mm_struct *mm, unsigned long address,
+		      int nid, void *va_cache)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+	struct pcache_xlate_entry *e, entry;
+	int ret;
+
+	address &= PAGE_MASK;
+	e = xlate_entry(t, address);
+
+	spin_lock(&t->lock);
+	entry = *e;
+	if (entry.vaddr != address || entry.nid != nid) {
+		spin_unlock(&t->lock);
+		return -ENOENT;
+	}
+	atomic_inc(&t->nr_reading);
+	spin_unlock(&t->lock);
+
+	ret = ibapi_rdma_read(nid, va_cache, entry.dma_addr,
+			      entry.rkey, PCACHE_LINE_SIZE);
+	atomic_dec(&t->nr_reading);
+	return ret;
+}
+
+/*
+ * Fetch translations of the window around @address from @nid.
+ * Called after a normal miss, with pte unlocked.
+ */
+void pcache_xlate_fetch(struct mm_struct *mm, unsigned long address, int nid)
+{
+	struct pcache_xlate_table *t = mm->pcache_xlate;
+	struct p2m_pcache_xlate_reply *reply;
+	struct p2m_pcache_xlate_msg msg;
+	struct pcache_xlate_entry *e;
+	unsigned long window, gen;
+	int i, len;
+
+	window = address & ~(XLATE_WINDOW_SIZE - 1);
+
+	spin_lock(&t->lock);
+	if (t->last_window == window) {
+		spin_unlock(&t->lock);
+		return;
+	}
+	t->last_window = window;
+	gen = t->gen;
+	spin_unlock(&t->lock);
+
+	reply = kmalloc(sizeof(*reply), GFP_KERNEL);
+	if (!reply)
+		return;
+
+	fill_common_header(&msg, P2M_PCACHE_XLATE);
+	msg.pid = current->tgid;
+	msg.nr_pages = PCACHE_XLATE_MAX_PAGES;
+	msg.start_vaddr = window;
+
+	len = ibapi_send_reply_timeout(nid, &msg, sizeof(msg), reply,
+				       sizeof(*reply), false, DEF_NET_TIMEOUT);
+	if (unlikely(len < (int)offsetof(struct p2m_pcache_xlate_reply, entries) ||
+		     reply->nr_entries > PCACHE_XLATE_MAX_PAGES ||
+		     len != offsetof(struct p2m_pcache_xlate_reply,
+				     entries[reply->nr_entries])))
+		goto out;
+
+	spin_lock(&t->lock);
+	if (t->gen == gen && !t->nr_unmapping) {
+		for (i = 0; i < reply->nr_entries; i++) {
+			e = xlate_entry(t, reply->entries[i].vaddr);
+			e->vaddr = reply->entries[i].vaddr;
+			e->dma_addr = reply->entries[i].dma_addr;
+			e->rkey = reply->rkey;
+			e->nid = nid;
+		}
+	}
+	spin_unlock(&t->lock);
+	inc_pcache_event(PCACHE_XLATE_FETCH);
+out:
+	kfree(reply);
+}
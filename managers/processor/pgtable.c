@@ -254,6 +254,8 @@ void release_pgtable(struct task_struct *tsk,
 	pgtable_debug("%s[%d] [%#lx - %#lx]",
 		tsk->comm, tsk->tgid, start, end);
 
+	pcache_xlate_invalidate(mm, start, end);
+
 	/* Free actual pages */
 	unmap_page_range(mm, start, end);
 
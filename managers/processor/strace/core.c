@@ -365,6 +365,9 @@ int __fork_processor_strace(struct task_struct *p)
 	INIT_LIST_HEAD(&si->next);
 	set_task_strace_info(p, si);
 
+	/* Force syscalls of @p into the slow path, where we trace */
+	set_tsk_thread_flag(p, TIF_SYSCALL_TRACE);
+
 	/*
 	 * Our design is:
 	 * Each thread has its strace info. Threads within a group have
@@ -393,6 +396,7 @@ int fork_processor_strace(struct task_struct *p)
 	/* Kernel thread? */
 	if (p->flags & PF_KTHREAD) {
 		clear_task_strace_info(p);
+		clear_tsk_thread_flag(p, TIF_SYSCALL_TRACE);
 		return 0;
 	}
 	return __fork_processor_strace(p);
@@ -11,6 +11,7 @@
 #include <lego/sched.h>
 #include <lego/kthread.h>
 #include <lego/jiffies.h>
+#include <lego/rcupdate.h>
 #include <lego/fit_ibapi.h>
 #include <lego/comp_common.h>
 #include <processor/distvm.h>
@@ -160,7 +161,7 @@ static int zerofill_async_func(void *_unused)
 	while (1) {
 		while (!has_pending_work()) {
 			cpu_relax();
-			continue;
+			rcu_qs();
 		}
 
 		/* Handle one work at a time */
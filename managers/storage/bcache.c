@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Block cache of the storage manager
+ *
+ * Caches STORAGE_BLOCK_SIZE blocks of the device, one page each. This is
+ * the only cache between memory components and the device, there is no
+ * page cache underneath.
+ *
+ * A block has a reference while someone uses it, and BC_LOCKED while its
+ * content is read from or written to the device, or changed by a writer.
+ * Only clean, unlocked and unreferenced blocks are reclaimed. Dirty blocks
+ * are written back by the flusher, periodically or once too many of them
+ * are dirty, by their own queue.
+ *
+ * Reads are asynchronous: bcache_read() submits all missing blocks of a
+ * batch, kicks the device once, and reaps completions of its queue.
+ */
+
+#define pr_fmt(fmt) "storage: " fmt
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/jiffies.h>
+#include <lego/spinlock.h>
+#include <lego/hashtable.h>
+
+#include "internal.h"
+
+#define BCACHE_HASH_BITS	14
+
+static struct block_device *bc_dev;
+
+static DEFINE_SPINLOCK(bc_lock);
+static DEFINE_HASHTABLE(bc_hash, BCACHE_HASH_BITS);
+static LIST_HEAD(bc_lru);
+static LIST_HEAD(bc_dirty);
+static unsigned long bc_nr_blocks;
+static unsigned long bc_max_blocks;
+static unsigned long bc_nr_dirty;
+
+static struct task_struct *bc_flusher;
+
+static inline u64 block_to_sector(u64 blocknr)
+{
+	return blocknr * STORAGE_BLOCK_SECTORS;
+}
+
+static struct bcache_block *__bcache_lookup(u64 blocknr)
+{
+	struct bcache_block *b;
+
+	hash_for_each_possible(bc_hash, b, hnode, blocknr) {
+		if (b->blocknr == blocknr)
+			return b;
+	}
+	return NULL;
+}
+
+static struct bcache_block *bcache_alloc_block(void)
+{
+	struct bcache_block *b;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return NULL;
+
+	b->data = (void *)__get_free_page(GFP_KERNEL);
+	if (!b->data) {
+		kfree(b);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&b->lru);
+	INIT_LIST_HEAD(&b->dirty);
+	return b;
+}
+
+static void bcache_free_block(struct bcache_block *b)
+{
+	free_page((unsigned long)b->data);
+	kfree(b);
+}
+
+/* Find a block to reuse, from the cold end of the LRU */
+static struct bcache_block *__bcache_evict(void)
+{
+	struct bcache_block *b;
+
+	list_for_each_entry_reverse(b, &bc_lru, lru) {
+		if (atomic_read(&b->ref))
+			continue;
+		if (b->flags & (BIT(BC_DIRTY) | BIT(BC_LOCKED)))
+			continue;
+
+		hash_del(&b->hnode);
+		return b;
+	}
+	return NULL;
+}
+
+static inline void bcache_wake_flusher(void)
+{
+	if (bc_flusher)
+		wake_up_process(bc_flusher);
+}
+
+/**
+ * bcache_get - get the cache block of @blocknr
+ *
+ * The block is referenced but not necessarily uptodate, use bcache_read()
+ * to fill it, or lock it and overwrite it. Release it by bcache_put().
+ */
+struct bcache_block *bcache_get(u64 blocknr)
+{
+	struct bcache_block *b, *new = NULL;
+
+again:
+	spin_lock(&bc_lock);
+	b = __bcache_lookup(blocknr);
+	if (b) {
+		atomic_inc(&b->ref);
+		list_move(&b->lru, &bc_lru);
+		spin_unlock(&bc_lock);
+
+		if (new)
+			bcache_free_block(new);
+		return b;
+	}
+
+	if (new) {
+		b = new;
+		bc_nr_blocks++;
+	} else if (bc_nr_blocks < bc_max_blocks) {
+		/* Allocate outside of the lock and look again */
+		spin_unlock(&bc_lock);
+		new = bcache_alloc_block();
+		if (!new)
+			bc_max_blocks = bc_nr_blocks;
+		goto again;
+	} else {
+		b = __bcache_evict();
+		if (!b) {
+			spin_unlock(&bc_lock);
+			bcache_wake_flusher();
+			cond_resched();
+			goto again;
+		}
+		list_del(&b->lru);
+	}
+
+	b->blocknr = blocknr;
+	b->flags = 0;
+	atomic_set(&b->ref, 1);
+	hash_add(bc_hash, &b->hnode, blocknr);
+	list_add(&b->lru, &bc_lru);
+	spin_unlock(&bc_lock);
+	return b;
+}
+
+void bcache_put(struct bcache_block *b)
+{
+	BUG_ON(!atomic_read(&b->ref));
+	atomic_dec(&b->ref);
+}
+
+static inline bool bcache_trylock_block(struct bcache_block *b)
+{
+	return !test_and_set_bit(BC_LOCKED, &b->flags);
+}
+
+/*
+ * Block locks are held across I/O, which is completed by whoever polls
+ * the queue. Never sleep here, the holder may need this CPU to finish.
+ */
+void bcache_lock_block(struct bcache_block *b)
+{
+	while (!bcache_trylock_block(b))
+		cond_resched();
+}
+
+void bcache_unlock_block(struct bcache_block *b)
+{
+	smp_mb__before_atomic();
+	clear_bit(BC_LOCKED, &b->flags);
+}
+
+/* Wait for a block locked by someone else, reaping our own queue meanwhile */
+static void bcache_wait_block(int qid, struct bcache_block *b)
+{
+	while (test_bit(BC_LOCKED, &b->flags)) {
+		if (!blk_poll(bc_dev, qid))
+			cond_resched();
+	}
+	smp_rmb();
+}
+
+static void bcache_end_read(struct blk_request *req)
+{
+	struct bcache_block *b = container_of(req, struct bcache_block, req);
+
+	if (likely(!req->error)) {
+		clear_bit(BC_ERROR, &b->flags);
+		set_bit(BC_UPTODATE, &b->flags);
+	} else {
+		pr_err("read error %d at block %llu\n", req->error, b->blocknr);
+		set_bit(BC_ERROR, &b->flags);
+	}
+	bcache_unlock_block(b);
+}
+
+static void bcache_submit(int qid, struct bcache_block *b, enum blk_op op,
+			  blk_end_io_fn end_io, void *private)
+{
+	int ret;
+
+	b->req.op = op;
+	b->req.sector = block_to_sector(b->blocknr);
+	b->req.buf = b->data;
+	b->req.len = STORAGE_BLOCK_SIZE;
+	b->req.error = 0;
+	b->req.end_io = end_io;
+	b->req.private = private;
+
+	ret = blk_submit_wait(bc_dev, qid, &b->req);
+	if (unlikely(ret)) {
+		b->req.error = ret;
+		end_io(&b->req);
+	}
+}
+
+/**
+ * bcache_read - make a batch of referenced blocks uptodate
+ * @qid: the block queue of the caller
+ *
+ * Blocks already being read by someone else are waited for.
+ * Return 0 if all of them are uptodate, -EIO otherwise.
+ */
+int bcache_read(int qid, struct bcache_block **bbs, int nr)
+{
+	bool submitted = false;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct bcache_block *b = bbs[i];
+
+		if (bcache_uptodate(b) || !bcache_trylock_block(b))
+			continue;
+
+		if (bcache_uptodate(b)) {
+			bcache_unlock_block(b);
+			continue;
+		}
+		bcache_submit(qid, b, BLK_OP_READ, bcache_end_read, NULL);
+		submitted = true;
+	}
+
+	if (submitted)
+		blk_kick(bc_dev, qid);
+
+	for (i = 0; i < nr; i++) {
+		bcache_wait_block(qid, bbs[i]);
+		if (unlikely(!bcache_uptodate(bbs[i])))
+			return -EIO;
+	}
+	return 0;
+}
+
+/* Caller holds the block lock and has changed its content */
+void bcache_mark_dirty(struct bcache_block *b)
+{
+	set_bit(BC_UPTODATE, &b->flags);
+	if (test_and_set_bit(BC_DIRTY, &b->flags))
+		return;
+
+	spin_lock(&bc_lock);
+	list_add_tail(&b->dirty, &bc_dirty);
+	bc_nr_dirty++;
+	spin_unlock(&bc_lock);
+
+	if (bc_nr_dirty > bc_max_blocks / 2)
+		bcache_wake_flusher();
+}
+
+static void __bcache_forget(struct bcache_block *b)
+{
+	if (test_bit(BC_LOCKED, &b->flags))
+		return;
+
+	if (test_and_clear_bit(BC_DIRTY, &b->flags)) {
+		list_del_init(&b->dirty);
+		bc_nr_dirty--;
+	}
+}
+
+/*
+ * Blocks [@blocknr, @blocknr + @nr) were freed, do not write back
+ * whatever is still dirty in them.
+ */
+void bcache_forget(u64 blocknr, u64 nr)
+{
+	struct bcache_block *b, *tmp;
+	u64 i;
+
+	spin_lock(&bc_lock);
+	if (nr <= bc_nr_dirty) {
+		for (i = 0; i < nr; i++) {
+			b = __bcache_lookup(blocknr + i);
+			if (b)
+				__bcache_forget(b);
+		}
+	} else {
+		list_for_each_entry_safe(b, tmp, &bc_dirty, dirty) {
+			if (b->blocknr >= blocknr && b->blocknr < blocknr + nr)
+				__bcache_forget(b);
+		}
+	}
+	spin_unlock(&bc_lock);
+}
+
+/* Writeback of one bcache_sync() */
+struct bcache_sync_control {
+	atomic_t	inflight;
+	int		error;
+};
+
+static void bcache_end_write(struct blk_request *req)
+{
+	struct bcache_block *b = container_of(req, struct bcache_block, req);
+	struct bcache_sync_control *sc = req->private;
+
+	if (unlikely(req->error)) {
+		pr_err("write error %d at block %llu\n", req->error, b->blocknr);
+		set_bit(BC_ERROR, &b->flags);
+		sc->error = req->error;
+	}
+	bcache_unlock_block(b);
+	bcache_put(b);
+	atomic_dec(&sc->inflight);
+}
+
+/**
+ * bcache_sync - write back all dirty blocks and flush the device
+ * @qid: the block queue to use
+ *
+ * Blocks dirtied while this runs may or may not be written.
+ */
+int bcache_sync(int qid)
+{
+	struct bcache_sync_control sc;
+	struct bcache_block *b;
+	LIST_HEAD(list);
+	int ret;
+
+	atomic_set(&sc.inflight, 0);
+	sc.error = 0;
+
+	spin_lock(&bc_lock);
+	list_splice_init(&bc_dirty, &list);
+	spin_unlock(&bc_lock);
+
+	for (;;) {
+		/* bcache_forget() may take blocks off the list meanwhile */
+		spin_lock(&bc_lock);
+		if (list_empty(&list)) {
+			spin_unlock(&bc_lock);
+			break;
+		}
+		b = list_first_entry(&list, struct bcache_block, dirty);
+		list_del_init(&b->dirty);
+		atomic_inc(&b->ref);
+		spin_unlock(&bc_lock);
+
+		bcache_lock_block(b);
+
+		/*
+		 * Clear it with the block locked, writers dirty it again
+		 * only after the write completes and unlocks it.
+		 */
+		if (!test_and_clear_bit(BC_DIRTY, &b->flags)) {
+			bcache_unlock_block(b);
+			bcache_put(b);
+			continue;
+		}
+
+		spin_lock(&bc_lock);
+		bc_nr_dirty--;
+		spin_unlock(&bc_lock);
+
+		atomic_inc(&sc.inflight);
+		bcache_submit(qid, b, BLK_OP_WRITE, bcache_end_write, &sc);
+	}
+
+	blk_kick(bc_dev, qid);
+	while (atomic_read(&sc.inflight)) {
+		if (!blk_poll(bc_dev, qid))
+			cond_resched();
+	}
+
+	ret = blk_rw(bc_dev, qid, BLK_OP_FLUSH, 0, NULL, 0);
+	return sc.error ? sc.error : ret;
+}
+
+/*
+ * Write back every CONFIG_STORAGE_FLUSH_INTERVAL_SEC seconds, or right
+ * away when woken up because the cache is running out of clean blocks.
+ */
+static int bcache_flusher(void *unused)
+{
+	int ret;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_timeout(CONFIG_STORAGE_FLUSH_INTERVAL_SEC * HZ);
+		__set_current_state(TASK_RUNNING);
+
+		if (!READ_ONCE(bc_nr_dirty))
+			continue;
+
+		ret = bcache_sync(STORAGE_FLUSH_QID);
+		if (ret)
+			pr_err("writeback failed: %d\n", ret);
+	}
+	return 0;
+}
+
+void __init bcache_start_flusher(void)
+{
+	struct task_struct *p;
+
+	p = kthread_run(bcache_flusher, NULL, "storage-flusher");
+	if (IS_ERR(p))
+		panic("storage: fail to create flusher");
+	bc_flusher = p;
+}
+
+int __init bcache_init(struct block_device *bdev, unsigned long nr_blocks)
+{
+	bc_dev = bdev;
+	bc_max_blocks = max(nr_blocks, 64UL);
+	pr_info("block cache: up to %lu blocks\n", bc_max_blocks);
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Storage component manager
+ *
+ * Serves the same M2S/P2S requests as the Linux storage module, but on
+ * top of a block device with a file system and a block cache of its own.
+ * Every worker thread is pinned to a CPU, receives requests from FIT and
+ * does the I/O itself on a block queue of its own.
+ */
+
+#define pr_fmt(fmt) "storage: " fmt
+
+#include <lego/init.h>
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/blkdev.h>
+#include <lego/completion.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <lego/comp_storage.h>
+#include <lego/rpc/opcode.h>
+
+#include "internal.h"
+
+static struct storage_worker storage_workers[STORAGE_NR_WORKERS];
+static DEFINE_COMPLETION(storage_worker_completion);
+
+static bool storage_format __initdata;
+
+static int __init storage_format_setup(char *str)
+{
+	storage_format = true;
+	return 0;
+}
+__setup("storage_format", storage_format_setup);
+
+static void handle_bad_request(u32 opcode, uintptr_t desc)
+{
+	int retbuf;
+
+	pr_info("WARNING: Invalid opcode: %u\n", opcode);
+
+	retbuf = -EINVAL;
+	ibapi_reply_message(&retbuf, sizeof(retbuf), desc);
+}
+
+static void storage_dispatch(struct storage_worker *w, void *msg, uintptr_t desc)
+{
+	u32 opcode = *(u32 *)msg;
+	void *payload = msg + sizeof(opcode);
+
+	switch (opcode) {
+	/* Replica messages are handled as a whole */
+	case M2S_REPLICA_FLUSH:
+		handle_replica_flush(w, msg, desc);
+		break;
+	case M2S_REPLICA_VMA:
+		handle_replica_vma(w, msg, desc);
+		break;
+
+	case M2S_READ:
+		handle_read_request(w, payload, desc);
+		break;
+	case M2S_WRITE:
+		handle_write_request(w, payload, desc);
+		break;
+	case P2S_OPEN:
+		handle_open_request(w, payload, desc);
+		break;
+	case P2S_ACCESS:
+		handle_access_request(w, payload, desc);
+		break;
+	case P2S_STAT:
+		handle_stat_request(w, payload, desc);
+		break;
+	case P2S_TRUNCATE:
+		handle_truncate_request(w, payload, desc);
+		break;
+	case P2S_UNLINK:
+		handle_unlink_request(w, payload, desc);
+		break;
+	case P2S_MKDIR:
+		handle_mkdir_request(w, payload, desc);
+		break;
+	case P2S_RMDIR:
+		handle_rmdir_request(w, payload, desc);
+		break;
+	case M2S_LSEEK:
+		handle_lseek_request(w, payload, desc);
+		break;
+	case P2S_STATFS:
+		handle_statfs_request(w, payload, desc);
+		break;
+	case P2S_GETDENTS:
+		handle_getdents_request(w, payload, desc);
+		break;
+	case P2S_READLINK:
+		handle_readlink_request(w, payload, desc);
+		break;
+	case P2S_RENAME:
+		handle_rename_request(w, payload, desc);
+		break;
+	default:
+		handle_bad_request(opcode, desc);
+	}
+}
+
+static int storage_worker_func(void *_worker)
+{
+	struct storage_worker *w = _worker;
+	uintptr_t desc;
+	int retlen, reply;
+
+	pin_current_thread();
+	pr_info("CPU%2d %s worker_id: %d UP\n",
+		smp_processor_id(), current->comm, w->id);
+	complete(&storage_worker_completion);
+
+	for (;;) {
+		retlen = ibapi_receive_message(0, w->rx_buf, STORAGE_MAX_RXBUF_SIZE, &desc);
+		if (unlikely(retlen >= STORAGE_MAX_RXBUF_SIZE)) {
+			WARN(1, "retlen=%d STORAGE_MAX_RXBUF_SIZE=%lu",
+				retlen, STORAGE_MAX_RXBUF_SIZE);
+			reply = -EFAULT;
+			ibapi_reply_message(&reply, sizeof(reply), desc);
+			continue;
+		}
+
+		storage_dispatch(w, w->rx_buf, desc);
+		w->nr_requests++;
+	}
+	return 0;
+}
+
+static void __init storage_workers_init(void)
+{
+	struct storage_worker *w;
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < STORAGE_NR_WORKERS; i++) {
+		w = &storage_workers[i];
+		w->id = i;
+		w->qid = i;
+		w->rx_buf = kmalloc(STORAGE_MAX_RXBUF_SIZE, GFP_KERNEL);
+		w->tx_buf = kmalloc(STORAGE_TXBUF_SIZE, GFP_KERNEL);
+		if (!w->rx_buf || !w->tx_buf)
+			panic("storage: fail to allocate buffers of worker%d", i);
+
+		init_completion(&storage_worker_completion);
+
+		p = kthread_run(storage_worker_func, w, "storage-worker%d", i);
+		if (IS_ERR(p))
+			panic("storage: fail to create storage-worker%d", i);
+
+		wait_for_completion(&storage_worker_completion);
+		w->task = p;
+	}
+}
+
+void __init storage_manager_init(void)
+{
+	struct block_device *bdev;
+	int ret;
+
+	bdev = blk_get_device();
+	if (!bdev)
+		panic("storage: no block device");
+
+	bcache_init(bdev, (unsigned long)CONFIG_STORAGE_CACHE_MB << (20 - STORAGE_BLOCK_SHIFT));
+
+	ret = storage_fs_mount(bdev, storage_format);
+	if (ret)
+		panic("storage: fail to mount %s: %d", bdev->name, ret);
+
+	bcache_start_flusher();
+	storage_workers_init();
+}
@@ -0,0 +1,1668 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * File system of the storage manager, see internal.h for the layout
+ *
+ * All metadata lives in memory: the block bitmap, and an inode for every
+ * file, hashed by its normalized pathname. The on-disk copies are rebuilt
+ * from memory into the block cache whenever they change, never read back
+ * after mount.
+ *
+ * Locking: fs_ns_rwsem protects the namespace. Data operations take it
+ * for read just to find the inode and lock it, namespace operations take
+ * it for write. The inode rwsem protects file size and extents.
+ *
+ * Blocks are only ever read if they have data below EOF. Whatever lies in
+ * a block past EOF is zero-filled in memory when the block is first
+ * written, and truncate zeroes the tail of the new last block.
+ *
+ * Files are sparse: writes and truncates past EOF only extend the size,
+ * the gap becomes a hole. Blocks are allocated for a hole when it is
+ * written to.
+ */
+
+#define pr_fmt(fmt) "storage: " fmt
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/fcntl.h>
+#include <lego/jhash.h>
+#include <lego/sched.h>
+#include <lego/bitmap.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/spinlock.h>
+#include <lego/hashtable.h>
+#include <lego/timekeeping.h>
+
+#include "internal.h"
+
+#define FS_HASH_BITS		12
+
+/* Blocks per bcache_read() */
+#define FS_BATCH		64
+
+/* The bitmap and inode tables are allocated as one chunk each */
+#define FS_MAX_TABLE_SIZE	(PAGE_SIZE << (MAX_ORDER - 1))
+#define FS_MAX_BLOCKS		((u64)FS_MAX_TABLE_SIZE * BITS_PER_BYTE)
+#define FS_MAX_INODES		(FS_MAX_TABLE_SIZE / sizeof(struct storage_inode *))
+
+#define FS_BITS_PER_BLOCK	(STORAGE_BLOCK_SIZE * BITS_PER_BYTE)
+
+static struct block_device *fs_bdev;
+static struct storage_super fs_sb;
+
+static DEFINE_RWSEM(fs_ns_rwsem);
+static DEFINE_HASHTABLE(fs_inode_hash, FS_HASH_BITS);
+static struct storage_inode **fs_inodes;
+static u32 *fs_generations;
+static u64 fs_nr_free_inodes;
+static u32 fs_ino_cursor;
+
+static DEFINE_SPINLOCK(fs_alloc_lock);
+static unsigned long *fs_bitmap;
+static u64 fs_nr_free_blocks;
+static u64 fs_alloc_cursor;
+
+/* Same layout as linux_dirent */
+struct storage_dirent {
+	unsigned long	d_ino;
+	unsigned long	d_off;
+	unsigned short	d_reclen;
+	char		d_name[1];
+};
+
+static inline s64 fs_now(void)
+{
+	return ktime_get_real_seconds();
+}
+
+static inline u64 fs_block_to_sector(u64 blocknr)
+{
+	return blocknr * STORAGE_BLOCK_SECTORS;
+}
+
+static inline bool fs_is_dir(struct storage_inode *inode)
+{
+	return S_ISDIR(inode->d.mode);
+}
+
+/*
+ * Normalize absolute @path into @out: no repeated or trailing slashes,
+ * no "." or ".." components. Return its length or -errno.
+ */
+static int fs_normalize(const char *path, char *out)
+{
+	const char *p = path, *end = path + MAX_FILENAME_LENGTH;
+	int len = 0;
+
+	if (*p != '/')
+		return -ENOENT;
+
+	while (p < end && *p) {
+		const char *c;
+		int n;
+
+		while (p < end && *p == '/')
+			p++;
+		if (p == end || !*p)
+			break;
+
+		c = p;
+		while (p < end && *p && *p != '/')
+			p++;
+		if (p == end)
+			return -ENAMETOOLONG;
+		n = p - c;
+
+		if (n == 1 && c[0] == '.')
+			continue;
+		if (n == 2 && c[0] == '.' && c[1] == '.') {
+			while (len > 0 && out[len - 1] != '/')
+				len--;
+			if (len > 0)
+				len--;
+			continue;
+		}
+
+		if (len + 1 + n >= MAX_FILENAME_LENGTH)
+			return -ENAMETOOLONG;
+		out[len++] = '/';
+		memcpy(out + len, c, n);
+		len += n;
+	}
+
+	if (!len)
+		out[len++] = '/';
+	out[len] = '\0';
+	return len;
+}
+
+static inline const char *fs_basename(const char *path)
+{
+	return strrchr(path, '/') + 1;
+}
+
+static inline u32 fs_path_hash(const char *path)
+{
+	return jhash(path, strlen(path), 0);
+}
+
+static struct storage_inode *fs_lookup_path(const char *path)
+{
+	struct storage_inode *inode;
+
+	hash_for_each_possible(fs_inode_hash, inode, hnode, fs_path_hash(path)) {
+		if (!strcmp(inode->d.path, path))
+			return inode;
+	}
+	return NULL;
+}
+
+/* The directory @path is in, the root is its own parent */
+static struct storage_inode *fs_lookup_parent(const char *path)
+{
+	char name[MAX_FILENAME_LENGTH];
+	char *slash;
+
+	strcpy(name, path);
+	slash = strrchr(name, '/');
+	if (slash == name)
+		slash[1] = '\0';
+	else
+		*slash = '\0';
+	return fs_lookup_path(name);
+}
+
+/*
+ * Find an inode by the file handle from open, or by path if the handle
+ * is unknown or stale. Caller holds fs_ns_rwsem.
+ */
+static struct storage_inode *fs_lookup(u64 fh, const char *path)
+{
+	char name[MAX_FILENAME_LENGTH];
+	struct storage_inode *inode;
+	u32 ino = fh;
+
+	if (fh && ino < fs_sb.nr_inodes) {
+		inode = fs_inodes[ino];
+		if (inode && inode->d.generation == fh >> 32)
+			return inode;
+	}
+
+	if (fs_normalize(path, name) < 0)
+		return NULL;
+	return fs_lookup_path(name);
+}
+
+static inline u64 fs_inode_fh(struct storage_inode *inode)
+{
+	return (u64)inode->d.generation << 32 | inode->ino;
+}
+
+/*
+ * Metadata writeback into the block cache
+ *
+ * A metadata block is rebuilt from memory as a whole. Concurrent updates
+ * of the same block are serialized by the block lock, whoever copies last
+ * has seen all changes made before.
+ */
+
+static void fs_sync_inode_block(u32 ino)
+{
+	struct bcache_block *b;
+	u32 first, n;
+	int i;
+
+	first = rounddown(ino, STORAGE_INODES_PER_BLOCK);
+	b = bcache_get(fs_sb.inode_start + ino / STORAGE_INODES_PER_BLOCK);
+	bcache_lock_block(b);
+
+	memset(b->data, 0, STORAGE_BLOCK_SIZE);
+	for (i = 0; i < STORAGE_INODES_PER_BLOCK; i++) {
+		struct storage_dinode *d = b->data + i * STORAGE_INODE_SIZE;
+
+		n = first + i;
+		if (n >= fs_sb.nr_inodes)
+			break;
+
+		if (fs_inodes[n])
+			memcpy(d, &fs_inodes[n]->d, sizeof(*d));
+		else
+			d->generation = fs_generations[n];
+	}
+
+	bcache_mark_dirty(b);
+	bcache_unlock_block(b);
+	bcache_put(b);
+}
+
+static void fs_sync_inode(struct storage_inode *inode)
+{
+	struct bcache_block *b;
+
+	if (inode->ext != inode->d.extents)
+		memcpy(inode->d.extents, inode->ext, sizeof(inode->d.extents));
+
+	if (inode->d.ind_block && inode->d.nr_extents > STORAGE_NR_EXTENTS) {
+		b = bcache_get(inode->d.ind_block);
+		bcache_lock_block(b);
+		memset(b->data, 0, STORAGE_BLOCK_SIZE);
+		memcpy(b->data, inode->ext + STORAGE_NR_EXTENTS,
+		       (inode->d.nr_extents - STORAGE_NR_EXTENTS) * sizeof(struct storage_extent));
+		bcache_mark_dirty(b);
+		bcache_unlock_block(b);
+		bcache_put(b);
+	}
+
+	fs_sync_inode_block(inode->ino);
+}
+
+static void fs_sync_bitmap(u64 start, u64 nr)
+{
+	struct bcache_block *b;
+	u64 i;
+
+	for (i = start / FS_BITS_PER_BLOCK; i <= (start + nr - 1) / FS_BITS_PER_BLOCK; i++) {
+		b = bcache_get(fs_sb.bitmap_start + i);
+		bcache_lock_block(b);
+		memcpy(b->data, (void *)fs_bitmap + i * STORAGE_BLOCK_SIZE, STORAGE_BLOCK_SIZE);
+		bcache_mark_dirty(b);
+		bcache_unlock_block(b);
+		bcache_put(b);
+	}
+}
+
+/*
+ * Block allocator
+ */
+
+/*
+ * Allocate up to @want contiguous blocks: at @goal if it is free, so the
+ * caller can extend its last extent, next-fit otherwise. Return how many
+ * were allocated at *@start, 0 if the device is full.
+ */
+static u32 fs_alloc_blocks(u64 goal, u32 want, u64 *start)
+{
+	u64 nr = fs_sb.nr_blocks;
+	u64 s, e;
+
+	spin_lock(&fs_alloc_lock);
+	if (!fs_nr_free_blocks) {
+		spin_unlock(&fs_alloc_lock);
+		return 0;
+	}
+
+	if (goal && goal < nr && !test_bit(goal, fs_bitmap))
+		s = goal;
+	else {
+		s = find_next_zero_bit(fs_bitmap, nr, fs_alloc_cursor);
+		if (s >= nr)
+			s = find_next_zero_bit(fs_bitmap, nr, fs_sb.data_start);
+	}
+	e = find_next_bit(fs_bitmap, min(nr, s + want), s);
+
+	bitmap_set(fs_bitmap, s, e - s);
+	fs_nr_free_blocks -= e - s;
+	fs_alloc_cursor = e;
+	spin_unlock(&fs_alloc_lock);
+
+	fs_sync_bitmap(s, e - s);
+	*start = s;
+	return e - s;
+}
+
+static void fs_free_blocks(u64 start, u64 nr)
+{
+	if (!nr)
+		return;
+
+	spin_lock(&fs_alloc_lock);
+	bitmap_clear(fs_bitmap, start, nr);
+	fs_nr_free_blocks += nr;
+	spin_unlock(&fs_alloc_lock);
+
+	bcache_forget(start, nr);
+	fs_sync_bitmap(start, nr);
+}
+
+/*
+ * Extents
+ */
+
+static inline bool fs_is_hole(struct storage_extent *e)
+{
+	return !e->start;
+}
+
+/* Extent holding file block @lbn, @off is set to its first file block */
+static int fs_find_extent(struct storage_inode *inode, u64 lbn, u64 *off)
+{
+	int i;
+
+	*off = 0;
+	for (i = 0; i < inode->d.nr_extents; i++) {
+		if (lbn < *off + inode->ext[i].len)
+			return i;
+		*off += inode->ext[i].len;
+	}
+	BUG();
+}
+
+/* Device block of file block @lbn, 0 if it is in a hole */
+static u64 fs_bmap(struct storage_inode *inode, u64 lbn)
+{
+	struct storage_extent *e;
+	u64 off;
+
+	e = &inode->ext[fs_find_extent(inode, lbn, &off)];
+	if (fs_is_hole(e))
+		return 0;
+	return e->start + lbn - off;
+}
+
+/* Blocks really allocated to @inode */
+static u64 fs_nr_allocated(struct storage_inode *inode)
+{
+	u64 nr = 0;
+	int i;
+
+	for (i = 0; i < inode->d.nr_extents; i++) {
+		if (!fs_is_hole(&inode->ext[i]))
+			nr += inode->ext[i].len;
+	}
+	return nr;
+}
+
+/* Make room for @nr more extents */
+static int fs_reserve_extent(struct storage_inode *inode, int nr)
+{
+	struct storage_extent *ext;
+	u64 blocknr;
+
+	if (inode->d.nr_extents + nr <= STORAGE_NR_EXTENTS)
+		return 0;
+	if (inode->d.nr_extents + nr > STORAGE_MAX_EXTENTS)
+		return -EFBIG;
+
+	if (inode->ext == inode->d.extents) {
+		ext = kcalloc(STORAGE_MAX_EXTENTS, sizeof(*ext), GFP_KERNEL);
+		if (!ext)
+			return -ENOMEM;
+		memcpy(ext, inode->d.extents, sizeof(inode->d.extents));
+		inode->ext = ext;
+	}
+
+	if (!inode->d.ind_block) {
+		if (fs_alloc_blocks(0, 1, &blocknr) != 1)
+			return -ENOSPC;
+		inode->d.ind_block = blocknr;
+	}
+	return 0;
+}
+
+/*
+ * Make @inode have at least @nr_blocks blocks. A file that grows gets
+ * as much again as it has, up to STORAGE_MAX_PREALLOC blocks, so that
+ * appends end up in few large extents.
+ */
+static int fs_grow(struct storage_inode *inode, u64 nr_blocks)
+{
+	struct storage_extent *last;
+	u64 want, goal, start;
+	u32 got;
+	int ret;
+
+	if (nr_blocks <= inode->nr_blocks)
+		return 0;
+	want = nr_blocks - inode->nr_blocks +
+	       min_t(u64, fs_nr_allocated(inode), STORAGE_MAX_PREALLOC);
+
+	while (inode->nr_blocks < nr_blocks) {
+		last = NULL;
+		goal = 0;
+		if (inode->d.nr_extents) {
+			last = &inode->ext[inode->d.nr_extents - 1];
+			if (!fs_is_hole(last))
+				goal = last->start + last->len;
+		}
+
+		want = max(want, nr_blocks - inode->nr_blocks);
+		got = fs_alloc_blocks(goal, min_t(u64, want, U32_MAX), &start);
+		if (!got)
+			return -ENOSPC;
+
+		if (last && start == goal && (u64)last->len + got <= U32_MAX)
+			last->len += got;
+		else {
+			ret = fs_reserve_extent(inode, 1);
+			if (ret) {
+				fs_free_blocks(start, got);
+				return ret;
+			}
+			last = &inode->ext[inode->d.nr_extents++];
+			last->start = start;
+			last->len = got;
+		}
+
+		inode->nr_blocks += got;
+		want -= min_t(u64, want, got);
+	}
+	return 0;
+}
+
+/* Move the extents back into the inode once they fit */
+static void fs_compact_extents(struct storage_inode *inode)
+{
+	if (inode->d.nr_extents <= STORAGE_NR_EXTENTS && inode->d.ind_block) {
+		fs_free_blocks(inode->d.ind_block, 1);
+		inode->d.ind_block = 0;
+	}
+	if (inode->ext != inode->d.extents && inode->d.nr_extents <= STORAGE_NR_EXTENTS) {
+		memcpy(inode->d.extents, inode->ext, sizeof(inode->d.extents));
+		kfree(inode->ext);
+		inode->ext = inode->d.extents;
+	}
+}
+
+/* Free all blocks of @inode past its first @nr_blocks */
+static void fs_shrink(struct storage_inode *inode, u64 nr_blocks)
+{
+	struct storage_extent *e;
+	u64 off = 0, keep;
+	int i;
+
+	for (i = 0; i < inode->d.nr_extents; i++) {
+		e = &inode->ext[i];
+		if (off + e->len <= nr_blocks) {
+			off += e->len;
+			continue;
+		}
+
+		keep = nr_blocks > off ? nr_blocks - off : 0;
+		if (!fs_is_hole(e))
+			fs_free_blocks(e->start + keep, e->len - keep);
+		off += e->len;
+		e->len = keep;
+	}
+
+	while (inode->d.nr_extents && !inode->ext[inode->d.nr_extents - 1].len) {
+		inode->d.nr_extents--;
+		inode->ext[inode->d.nr_extents].start = 0;
+	}
+	inode->nr_blocks = min(inode->nr_blocks, nr_blocks);
+	fs_compact_extents(inode);
+}
+
+/*
+ * Make blocks from EOF up to @nr_blocks a hole. Blocks preallocated past
+ * EOF are freed first, they were never written and must not show up.
+ */
+static int fs_add_hole(struct storage_inode *inode, u64 nr_blocks)
+{
+	struct storage_extent *last;
+	u64 n;
+	int ret;
+
+	fs_shrink(inode, DIV_ROUND_UP(inode->d.size, STORAGE_BLOCK_SIZE));
+
+	while (inode->nr_blocks < nr_blocks) {
+		last = NULL;
+		if (inode->d.nr_extents)
+			last = &inode->ext[inode->d.nr_extents - 1];
+
+		if (!last || !fs_is_hole(last) || last->len == U32_MAX) {
+			ret = fs_reserve_extent(inode, 1);
+			if (ret)
+				return ret;
+			last = &inode->ext[inode->d.nr_extents++];
+			last->start = 0;
+			last->len = 0;
+		}
+
+		n = min_t(u64, nr_blocks - inode->nr_blocks, U32_MAX - last->len);
+		last->len += n;
+		inode->nr_blocks += n;
+	}
+	return 0;
+}
+
+/* Remove extent @i, which must be empty */
+static void fs_delete_extent(struct storage_inode *inode, int i)
+{
+	struct storage_extent *ext = inode->ext;
+
+	memmove(ext + i, ext + i + 1,
+		(inode->d.nr_extents - i - 1) * sizeof(*ext));
+	inode->d.nr_extents--;
+	memset(ext + inode->d.nr_extents, 0, sizeof(*ext));
+	fs_compact_extents(inode);
+}
+
+/*
+ * Allocate blocks for up to @nr blocks of hole extent @i, starting @hoff
+ * blocks into it. The hole is split around them, or they are appended to
+ * the previous extent if they follow it on the device. Return how many
+ * blocks were allocated, or -errno.
+ */
+static long fs_fill_hole(struct storage_inode *inode, int i, u64 hoff, u64 nr)
+{
+	struct storage_extent *e = &inode->ext[i], *prev = NULL;
+	u64 goal = 0, start, rest;
+	int extra, ret;
+	u32 got;
+
+	if (!hoff && i > 0 && !fs_is_hole(&inode->ext[i - 1])) {
+		prev = &inode->ext[i - 1];
+		goal = prev->start + prev->len;
+	}
+
+	got = fs_alloc_blocks(goal, min_t(u64, nr, U32_MAX), &start);
+	if (!got)
+		return -ENOSPC;
+
+	if (prev && start == goal && (u64)prev->len + got <= U32_MAX) {
+		prev->len += got;
+		e->len -= got;
+		if (!e->len)
+			fs_delete_extent(inode, i);
+		return got;
+	}
+
+	/* [hole @hoff] [data @got] [hole @rest], empty holes are dropped */
+	rest = e->len - hoff - got;
+	extra = !!hoff + !!rest;
+	ret = fs_reserve_extent(inode, extra);
+	if (ret) {
+		fs_free_blocks(start, got);
+		return ret;
+	}
+
+	e = &inode->ext[i];
+	memmove(e + 1 + extra, e + 1,
+		(inode->d.nr_extents - i - 1) * sizeof(*e));
+	inode->d.nr_extents += extra;
+
+	if (hoff) {
+		e->start = 0;
+		e->len = hoff;
+		e++;
+	}
+	e->start = start;
+	e->len = got;
+	if (rest) {
+		e++;
+		e->start = 0;
+		e->len = rest;
+	}
+	return got;
+}
+
+static void fs_zero_block(struct storage_inode *inode, u64 lbn)
+{
+	struct bcache_block *b;
+
+	b = bcache_get(fs_bmap(inode, lbn));
+	bcache_lock_block(b);
+	memset(b->data, 0, STORAGE_BLOCK_SIZE);
+	clear_bit(BC_ERROR, &b->flags);
+	bcache_mark_dirty(b);
+	bcache_unlock_block(b);
+	bcache_put(b);
+}
+
+/*
+ * Allocate blocks for the holes in [@pos, @pos + @len), which must be
+ * covered by extents. New blocks that will be partly written are zeroed
+ * in the cache, so that they are not read from the device.
+ */
+static int fs_fill_holes(struct storage_inode *inode, loff_t pos, size_t len)
+{
+	u64 first = pos >> STORAGE_BLOCK_SHIFT;
+	u64 end = DIV_ROUND_UP(pos + len, STORAGE_BLOCK_SIZE);
+	u64 lbn = first, off, n;
+	long got;
+	int i;
+
+	while (lbn < end) {
+		i = fs_find_extent(inode, lbn, &off);
+		n = min(end, off + inode->ext[i].len) - lbn;
+		if (!fs_is_hole(&inode->ext[i])) {
+			lbn += n;
+			continue;
+		}
+
+		got = fs_fill_hole(inode, i, lbn - off, n);
+		if (got < 0)
+			return got;
+
+		if (lbn == first && (pos & (STORAGE_BLOCK_SIZE - 1)))
+			fs_zero_block(inode, first);
+		if (lbn + got == end && ((pos + len) & (STORAGE_BLOCK_SIZE - 1)))
+			fs_zero_block(inode, end - 1);
+		lbn += got;
+	}
+	return 0;
+}
+
+/*
+ * Data
+ */
+
+static ssize_t __fs_read(int qid, struct storage_inode *inode, void *buf,
+			 size_t len, loff_t pos)
+{
+	struct bcache_block *bbs[FS_BATCH], *rbs[FS_BATCH];
+	size_t done = 0;
+	int i, nr, nr_read, ret;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= inode->d.size)
+		return 0;
+	len = min_t(u64, len, inode->d.size - pos);
+
+	while (done < len) {
+		u64 lbn = (pos + done) >> STORAGE_BLOCK_SHIFT;
+		u64 last = (pos + len - 1) >> STORAGE_BLOCK_SHIFT;
+
+		nr = min_t(u64, FS_BATCH, last - lbn + 1);
+		nr_read = 0;
+		for (i = 0; i < nr; i++) {
+			u64 blocknr = fs_bmap(inode, lbn + i);
+
+			bbs[i] = NULL;
+			if (blocknr) {
+				bbs[i] = bcache_get(blocknr);
+				rbs[nr_read++] = bbs[i];
+			}
+		}
+
+		ret = bcache_read(qid, rbs, nr_read);
+		for (i = 0; i < nr; i++) {
+			size_t off = (pos + done) & (STORAGE_BLOCK_SIZE - 1);
+			size_t n = min(STORAGE_BLOCK_SIZE - off, len - done);
+
+			if (!ret) {
+				if (bbs[i])
+					memcpy(buf + done, bbs[i]->data + off, n);
+				else
+					memset(buf + done, 0, n);
+				done += n;
+			}
+			if (bbs[i])
+				bcache_put(bbs[i]);
+		}
+		if (ret)
+			return done ? done : ret;
+	}
+	return done;
+}
+
+/*
+ * Write @len bytes of @buf at @pos, or zeroes if @buf is NULL.
+ * Blocks must be allocated, not in a hole. The caller updates the size.
+ */
+static ssize_t __fs_write(int qid, struct storage_inode *inode, const void *buf,
+			  size_t len, loff_t pos)
+{
+	struct bcache_block *bbs[FS_BATCH], *rbs[FS_BATCH];
+	u64 size = inode->d.size;
+	size_t done = 0, cur;
+	int i, nr, nr_read, ret;
+
+	while (done < len) {
+		u64 lbn = (pos + done) >> STORAGE_BLOCK_SHIFT;
+		u64 last = (pos + len - 1) >> STORAGE_BLOCK_SHIFT;
+		size_t off;
+
+		nr = min_t(u64, FS_BATCH, last - lbn + 1);
+		nr_read = 0;
+		off = (pos + done) & (STORAGE_BLOCK_SIZE - 1);
+		for (i = 0, cur = done; i < nr; i++) {
+			u64 start = (lbn + i) << STORAGE_BLOCK_SHIFT;
+			size_t boff = i ? 0 : off;
+			size_t n = min(STORAGE_BLOCK_SIZE - boff, len - cur);
+
+			bbs[i] = bcache_get(fs_bmap(inode, lbn + i));
+
+			/* Partially written block with data in it */
+			if (n < STORAGE_BLOCK_SIZE && start < size)
+				rbs[nr_read++] = bbs[i];
+			cur += n;
+		}
+
+		ret = bcache_read(qid, rbs, nr_read);
+		if (ret) {
+			for (i = 0; i < nr; i++)
+				bcache_put(bbs[i]);
+			return done ? done : ret;
+		}
+
+		for (i = 0; i < nr; i++) {
+			struct bcache_block *b = bbs[i];
+			u64 start = (lbn + i) << STORAGE_BLOCK_SHIFT;
+			size_t boff = i ? 0 : off;
+			size_t n = min(STORAGE_BLOCK_SIZE - boff, len - done);
+
+			bcache_lock_block(b);
+			if (start >= size && n < STORAGE_BLOCK_SIZE)
+				memset(b->data, 0, STORAGE_BLOCK_SIZE);
+			if (buf)
+				memcpy(b->data + boff, buf + done, n);
+			else
+				memset(b->data + boff, 0, n);
+			clear_bit(BC_ERROR, &b->flags);
+			bcache_mark_dirty(b);
+			bcache_unlock_block(b);
+			bcache_put(b);
+
+			done += n;
+		}
+	}
+	return done;
+}
+
+/* Caller holds the inode for write */
+static ssize_t fs_do_write(int qid, struct storage_inode *inode,
+			   const void *buf, size_t len, loff_t pos)
+{
+	ssize_t ret;
+
+	if (pos < 0)
+		pos = inode->d.size;
+	if (!len)
+		return 0;
+
+	/* Up to the first block written, the gap past EOF is a hole */
+	if (pos > inode->d.size) {
+		ret = fs_add_hole(inode, pos >> STORAGE_BLOCK_SHIFT);
+		if (ret)
+			goto out;
+	}
+
+	ret = fs_grow(inode, DIV_ROUND_UP(pos + len, STORAGE_BLOCK_SIZE));
+	if (ret)
+		goto out;
+	ret = fs_fill_holes(inode, pos, len);
+	if (ret)
+		goto out;
+
+	ret = __fs_write(qid, inode, buf, len, pos);
+	if (ret > 0 && pos + ret > inode->d.size)
+		inode->d.size = pos + ret;
+
+	inode->d.mtime = inode->d.ctime = fs_now();
+out:
+	fs_sync_inode(inode);
+	return ret;
+}
+
+/* Caller holds the inode for write */
+static int fs_do_truncate(int qid, struct storage_inode *inode, loff_t length)
+{
+	u64 size = inode->d.size;
+	ssize_t ret = 0;
+
+	if (length > size) {
+		ret = fs_add_hole(inode, DIV_ROUND_UP(length, STORAGE_BLOCK_SIZE));
+		if (ret)
+			goto out;
+	} else if (length < size) {
+		/* Whatever lies past EOF must be zero, a hole already is */
+		if ((length & (STORAGE_BLOCK_SIZE - 1)) &&
+		    fs_bmap(inode, length >> STORAGE_BLOCK_SHIFT)) {
+			u64 end = min_t(u64, size, round_up(length, STORAGE_BLOCK_SIZE));
+
+			ret = __fs_write(qid, inode, NULL, end - length, length);
+			if (ret < 0)
+				goto out;
+		}
+		fs_shrink(inode, DIV_ROUND_UP(length, STORAGE_BLOCK_SIZE));
+	}
+
+	inode->d.size = length;
+	inode->d.mtime = inode->d.ctime = fs_now();
+	ret = 0;
+out:
+	fs_sync_inode(inode);
+	return ret;
+}
+
+/*
+ * Inodes
+ */
+
+/* Caller holds fs_ns_rwsem for write */
+static struct storage_inode *fs_new_inode(const char *path, umode_t mode,
+					  struct storage_inode *parent)
+{
+	struct storage_inode *inode;
+	u32 ino = 0, gen;
+	u64 i;
+
+	if (!fs_nr_free_inodes)
+		return ERR_PTR(-ENOSPC);
+
+	for (i = 0; i < fs_sb.nr_inodes; i++) {
+		ino = (fs_ino_cursor + i) % fs_sb.nr_inodes;
+		if (!fs_inodes[ino])
+			break;
+	}
+
+	inode = kzalloc(sizeof(*inode), GFP_KERNEL);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+
+	init_rwsem(&inode->rwsem);
+	inode->ino = ino;
+	inode->parent = parent;
+	inode->ext = inode->d.extents;
+
+	/* Handles of a previous file in this slot go stale */
+	gen = fs_generations[ino] + 1;
+	if (!gen)
+		gen = 1;
+	fs_generations[ino] = gen;
+
+	inode->d.generation = gen;
+	inode->d.mode = mode;
+	inode->d.atime = inode->d.mtime = inode->d.ctime = fs_now();
+	strcpy(inode->d.path, path);
+
+	fs_inodes[ino] = inode;
+	hash_add(fs_inode_hash, &inode->hnode, fs_path_hash(path));
+	if (parent)
+		parent->nr_children++;
+	fs_nr_free_inodes--;
+	fs_ino_cursor = ino + 1;
+
+	fs_sync_inode(inode);
+	return inode;
+}
+
+/*
+ * Caller holds fs_ns_rwsem for write, nobody else can find @inode,
+ * but someone may still be using it.
+ */
+static void fs_free_inode(struct storage_inode *inode)
+{
+	down_write(&inode->rwsem);
+	up_write(&inode->rwsem);
+
+	hash_del(&inode->hnode);
+	fs_inodes[inode->ino] = NULL;
+	if (inode->parent)
+		inode->parent->nr_children--;
+	fs_nr_free_inodes++;
+
+	fs_shrink(inode, 0);
+	fs_sync_inode_block(inode->ino);
+	kfree(inode);
+}
+
+/* Caller holds fs_ns_rwsem for write */
+static struct storage_inode *fs_create(const char *path, umode_t mode)
+{
+	struct storage_inode *parent;
+
+	parent = fs_lookup_parent(path);
+	if (!parent)
+		return ERR_PTR(-ENOENT);
+	if (!fs_is_dir(parent))
+		return ERR_PTR(-ENOTDIR);
+	return fs_new_inode(path, mode, parent);
+}
+
+/*
+ * Look up the inode to write, creating it for O_CREAT.
+ * Return it locked for write, fs_ns_rwsem not held.
+ */
+static struct storage_inode *fs_get_inode_write(u64 fh, const char *path, int flags)
+{
+	char name[MAX_FILENAME_LENGTH];
+	struct storage_inode *inode;
+	int ret;
+
+	down_read(&fs_ns_rwsem);
+	inode = fs_lookup(fh, path);
+	if (!inode && (flags & O_CREAT)) {
+		up_read(&fs_ns_rwsem);
+
+		ret = fs_normalize(path, name);
+		if (ret < 0)
+			return ERR_PTR(ret);
+
+		down_write(&fs_ns_rwsem);
+		inode = fs_lookup_path(name);
+		if (!inode) {
+			inode = fs_create(name, S_IFREG | 0644);
+			if (IS_ERR(inode)) {
+				up_write(&fs_ns_rwsem);
+				return inode;
+			}
+		}
+		downgrade_write(&fs_ns_rwsem);
+	}
+
+	if (!inode)
+		inode = ERR_PTR(-ENOENT);
+	else if (fs_is_dir(inode))
+		inode = ERR_PTR(-EISDIR);
+	else
+		down_write(&inode->rwsem);
+
+	up_read(&fs_ns_rwsem);
+	return inode;
+}
+
+/*
+ * Operations
+ */
+
+int fs_open(int qid, const char *path, int flags, umode_t mode, u64 *fh)
+{
+	char name[MAX_FILENAME_LENGTH];
+	struct storage_inode *inode;
+	int ret;
+
+	ret = fs_normalize(path, name);
+	if (ret < 0)
+		return ret;
+
+	if (flags & O_CREAT)
+		down_write(&fs_ns_rwsem);
+	else
+		down_read(&fs_ns_rwsem);
+
+	ret = 0;
+	inode = fs_lookup_path(name);
+	if (inode) {
+		if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+			ret = -EEXIST;
+	} else if (flags & O_CREAT) {
+		inode = fs_create(name, S_IFREG | (mode & S_IALLUGO));
+		if (IS_ERR(inode)) {
+			ret = PTR_ERR(inode);
+			inode = NULL;
+		}
+	} else
+		ret = -ENOENT;
+	if (ret)
+		goto unlock;
+
+	if (fs_is_dir(inode) && (flags & O_ACCMODE) != O_RDONLY) {
+		ret = -EISDIR;
+		goto unlock;
+	}
+	if ((flags & O_DIRECTORY) && !fs_is_dir(inode)) {
+		ret = -ENOTDIR;
+		goto unlock;
+	}
+
+	if ((flags & O_TRUNC) && S_ISREG(inode->d.mode) &&
+	    (flags & O_ACCMODE) != O_RDONLY) {
+		down_write(&inode->rwsem);
+		ret = fs_do_truncate(qid, inode, 0);
+		up_write(&inode->rwsem);
+	}
+	*fh = fs_inode_fh(inode);
+
+unlock:
+	if (flags & O_CREAT)
+		up_write(&fs_ns_rwsem);
+	else
+		up_read(&fs_ns_rwsem);
+	return ret;
+}
+
+/* No atime updates */
+ssize_t fs_read(int qid, u64 fh, const char *path, void *buf,
+		size_t len, loff_t pos)
+{
+	struct storage_inode *inode;
+	ssize_t ret;
+
+	down_read(&fs_ns_rwsem);
+	inode = fs_lookup(fh, path);
+	if (!inode) {
+		up_read(&fs_ns_rwsem);
+		return -ENOENT;
+	}
+	if (fs_is_dir(inode)) {
+		up_read(&fs_ns_rwsem);
+		return -EISDIR;
+	}
+	down_read(&inode->rwsem);
+	up_read(&fs_ns_rwsem);
+
+	ret = __fs_read(qid, inode, buf, len, pos);
+	up_read(&inode->rwsem);
+	return ret;
+}
+
+/* Write at @pos, or append if @pos is negative */
+ssize_t fs_write(int qid, u64 fh, const char *path, int flags,
+		 const void *buf, size_t len, loff_t pos)
+{
+	struct storage_inode *inode;
+	ssize_t ret;
+
+	inode = fs_get_inode_write(fh, path, flags);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	ret = fs_do_write(qid, inode, buf, len, pos);
+	up_write(&inode->rwsem);
+	return ret;
+}
+
+long fs_truncate(int qid, const char *path, loff_t length)
+{
+	struct storage_inode *inode;
+	long ret;
+
+	if (length < 0)
+		return -EINVAL;
+
+	inode = fs_get_inode_write(0, path, 0);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	ret = fs_do_truncate(qid, inode, length);
+	up_write(&inode->rwsem);
+	return ret;
+}
+
+long fs_file_size(const char *path)
+{
+	struct storage_inode *inode;
+	long ret;
+
+	down_read(&fs_ns_rwsem);
+	inode = fs_lookup(0, path);
+	ret = inode ? inode->d.size : -ENOENT;
+	up_read(&fs_ns_rwsem);
+	return ret;
+}
+
+int fs_stat(const char *path, struct kstat *stat)
+{
+	struct storage_inode *inode;
+
+	down_read(&fs_ns_rwsem);
+	inode = fs_lookup(0, path);
+	if (!inode) {
+		up_read(&fs_ns_rwsem);
+		return -ENOENT;
+	}
+
+	memset(stat, 0, sizeof(*stat));
+	down_read(&inode->rwsem);
+	stat->ino = inode->ino + 1;
+	stat->mode = inode->d.mode;
+	stat->nlink = fs_is_dir(inode) ? 2 : 1;
+	stat->size = inode->d.size;
+	stat->atime.tv_sec = inode->d.atime;
+	stat->mtime.tv_sec = inode->d.mtime;
+	stat->ctime.tv_sec = inode->d.ctime;
+	stat->blksize = STORAGE_BLOCK_SIZE;
+	stat->blocks = fs_nr_allocated(inode) * STORAGE_BLOCK_SECTORS;
+	up_read(&inode->rwsem);
+
+	up_read(&fs_ns_rwsem);
+	return 0;
+}
+
+/* Everything is done as root, so only existence matters */
+int fs_access(const char *path, int mode)
+{
+	struct storage_inode *inode;
+
+	down_read(&fs_ns_rwsem);
+	inode = fs_lookup(0, path);
+	up_read(&fs_ns_rwsem);
+	return inode ? 0 : -ENOENT;
+}
+
+long fs_readlink(const char *path)
+{
+	/* No symbolic links */
+	return fs_access(path, 0) ? -ENOENT : -EINVAL;
+}
+
+long fs_unlink(const char *path)
+{
+	struct storage_inode *inode;
+	long ret = 0;
+
+	down_write(&fs_ns_rwsem);
+	inode = fs_lookup(0, path);
+	if (!inode)
+		ret = -ENOENT;
+	else if (fs_is_dir(inode))
+		ret = -EISDIR;
+	else
+		fs_free_inode(inode);
+	up_write(&fs_ns_rwsem);
+	return ret;
+}
+
+long fs_mkdir(const char *path, umode_t mode)
+{
+	char name[MAX_FILENAME_LENGTH];
+	struct storage_inode *inode;
+	long ret;
+
+	ret = fs_normalize(path, name);
+	if (ret < 0)
+		return ret;
+
+	down_write(&fs_ns_rwsem);
+	ret = 0;
+	if (fs_lookup_path(name))
+		ret = -EEXIST;
+	else {
+		inode = fs_create(name, S_IFDIR | (mode & S_IALLUGO));
+		if (IS_ERR(inode))
+			ret = PTR_ERR(inode);
+	}
+	up_write(&fs_ns_rwsem);
+	return ret;
+}
+
+long fs_rmdir(const char *path)
+{
+	struct storage_inode *inode;
+	long ret = 0;
+
+	down_write(&fs_ns_rwsem);
+	inode = fs_lookup(0, path);
+	if (!inode)
+		ret = -ENOENT;
+	else if (!fs_is_dir(inode))
+		ret = -ENOTDIR;
+	else if (!inode->parent)
+		ret = -EBUSY;
+	else if (inode->nr_children)
+		ret = -ENOTEMPTY;
+	else
+		fs_free_inode(inode);
+	up_write(&fs_ns_rwsem);
+	return ret;
+}
+
+static inline bool fs_is_under(struct storage_inode *inode, const char *dir, int len)
+{
+	return !strncmp(inode->d.path, dir, len) && inode->d.path[len] == '/';
+}
+
+/* Replace the first @cut characters of the path of @inode by @prefix */
+static void fs_set_path(struct storage_inode *inode, const char *prefix, int cut)
+{
+	char name[MAX_FILENAME_LENGTH];
+
+	snprintf(name, sizeof(name), "%s%s", prefix, inode->d.path + cut);
+	hash_del(&inode->hnode);
+	strcpy(inode->d.path, name);
+	hash_add(fs_inode_hash, &inode->hnode, fs_path_hash(name));
+	fs_sync_inode_block(inode->ino);
+}
+
+long fs_rename(const char *oldname, const char *newname)
+{
+	char from[MAX_FILENAME_LENGTH], to[MAX_FILENAME_LENGTH];
+	struct storage_inode *src, *dst, *parent, *inode;
+	int fromlen, tolen;
+	long ret;
+	u64 i;
+
+	fromlen = fs_normalize(oldname, from);
+	if (fromlen < 0)
+		return fromlen;
+	tolen = fs_normalize(newname, to);
+	if (tolen < 0)
+		return tolen;
+
+	down_write(&fs_ns_rwsem);
+	ret = 0;
+	src = fs_lookup_path(from);
+	if (!src) {
+		ret = -ENOENT;
+		goto unlock;
+	}
+	if (!src->parent) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+	if (!strcmp(from, to))
+		goto unlock;
+
+	/* A directory can not move under itself */
+	if (fs_is_dir(src) && !strncmp(to, from, fromlen) && to[fromlen] == '/') {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	parent = fs_lookup_parent(to);
+	if (!parent) {
+		ret = -ENOENT;
+		goto unlock;
+	}
+	if (!fs_is_dir(parent)) {
+		ret = -ENOTDIR;
+		goto unlock;
+	}
+
+	dst = fs_lookup_path(to);
+	if (dst) {
+		if (fs_is_dir(src) && !fs_is_dir(dst))
+			ret = -ENOTDIR;
+		else if (!fs_is_dir(src) && fs_is_dir(dst))
+			ret = -EISDIR;
+		else if (dst->nr_children)
+			ret = -ENOTEMPTY;
+		if (ret)
+			goto unlock;
+	}
+
+	/* Everything below a directory moves along, check it still fits */
+	if (fs_is_dir(src) && tolen > fromlen) {
+		for (i = 0; i < fs_sb.nr_inodes; i++) {
+			inode = fs_inodes[i];
+			if (inode && fs_is_under(inode, from, fromlen) &&
+			    strlen(inode->d.path) - fromlen + tolen >= MAX_FILENAME_LENGTH) {
+				ret = -ENAMETOOLONG;
+				goto unlock;
+			}
+		}
+	}
+
+	if (dst)
+		fs_free_inode(dst);
+
+	if (fs_is_dir(src)) {
+		for (i = 0; i < fs_sb.nr_inodes; i++) {
+			inode = fs_inodes[i];
+			if (inode && fs_is_under(inode, from, fromlen))
+				fs_set_path(inode, to, fromlen);
+		}
+	}
+
+	src->parent->nr_children--;
+	src->parent = parent;
+	parent->nr_children++;
+	src->d.ctime = fs_now();
+	fs_set_path(src, to, fromlen);
+
+unlock:
+	up_write(&fs_ns_rwsem);
+	return ret;
+}
+
+long fs_statfs(struct lego_kstatfs *buf)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->f_type = (u32)STORAGE_MAGIC;
+	buf->f_bsize = STORAGE_BLOCK_SIZE;
+	buf->f_blocks = fs_sb.nr_blocks;
+	buf->f_bfree = READ_ONCE(fs_nr_free_blocks);
+	buf->f_bavail = buf->f_bfree;
+	buf->f_files = fs_sb.nr_inodes;
+	buf->f_ffree = READ_ONCE(fs_nr_free_inodes);
+	buf->f_namelen = MAX_FILENAME_LENGTH - 1;
+	buf->f_frsize = STORAGE_BLOCK_SIZE;
+	return 0;
+}
+
+/*
+ * Directory positions: 0 is ".", 1 is "..", 2 + ino is the child @ino.
+ * Return the number of bytes filled, or -EINVAL if @count does not fit
+ * the first entry.
+ */
+long fs_getdents(const char *path, void *dirent, loff_t *pos, unsigned int count)
+{
+	struct storage_inode *dir, *inode;
+	struct storage_dirent *de;
+	unsigned int used = 0;
+	long ret = 0;
+	loff_t p;
+
+	down_read(&fs_ns_rwsem);
+	dir = fs_lookup(0, path);
+	if (!dir) {
+		ret = -ENOENT;
+		goto unlock;
+	}
+	if (!fs_is_dir(dir)) {
+		ret = -ENOTDIR;
+		goto unlock;
+	}
+
+	for (p = max_t(loff_t, *pos, 0); p < 2 + fs_sb.nr_inodes; p++) {
+		const char *name;
+		int namlen, reclen;
+		unsigned char type;
+
+		if (p < 2) {
+			name = p ? ".." : ".";
+			inode = (p && dir->parent) ? dir->parent : dir;
+		} else {
+			inode = fs_inodes[p - 2];
+			if (!inode || inode->parent != dir)
+				continue;
+			name = fs_basename(inode->d.path);
+		}
+		type = fs_is_dir(inode) ? STORAGE_DT_DIR : STORAGE_DT_REG;
+
+		namlen = strlen(name);
+		reclen = ALIGN(offsetof(struct storage_dirent, d_name) + namlen + 2,
+			       sizeof(long));
+		if (used + reclen > count) {
+			if (!used)
+				ret = -EINVAL;
+			break;
+		}
+
+		de = dirent + used;
+		de->d_ino = inode->ino + 1;
+		de->d_off = p + 1;
+		de->d_reclen = reclen;
+		memcpy(de->d_name, name, namlen);
+		de->d_name[namlen] = '\0';
+		*((char *)de + reclen - 1) = type;
+		used += reclen;
+	}
+
+	*pos = p;
+	if (!ret)
+		ret = used;
+unlock:
+	up_read(&fs_ns_rwsem);
+	return ret;
+}
+
+/*
+ * Mount and format
+ */
+
+static void * __init fs_alloc_table(u64 size)
+{
+	if (size > FS_MAX_TABLE_SIZE)
+		return NULL;
+	return (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, get_order(size));
+}
+
+static int __init fs_alloc_tables(void)
+{
+	fs_bitmap = fs_alloc_table(fs_sb.bitmap_blocks * STORAGE_BLOCK_SIZE);
+	fs_inodes = fs_alloc_table(fs_sb.nr_inodes * sizeof(*fs_inodes));
+	fs_generations = fs_alloc_table(fs_sb.nr_inodes * sizeof(*fs_generations));
+	if (!fs_bitmap || !fs_inodes || !fs_generations)
+		return -ENOMEM;
+	return 0;
+}
+
+/* Synchronous I/O on consecutive blocks, in requests the device takes */
+static int __init fs_rw_blocks(enum blk_op op, u64 blocknr, void *buf, u64 nr)
+{
+	u64 chunk = max_t(u64, fs_bdev->max_len / STORAGE_BLOCK_SIZE, 1);
+	u64 n;
+	int ret;
+
+	while (nr) {
+		n = min(nr, chunk);
+		ret = blk_rw(fs_bdev, 0, op, fs_block_to_sector(blocknr), buf,
+			     n * STORAGE_BLOCK_SIZE);
+		if (ret)
+			return ret;
+		blocknr += n;
+		buf += n * STORAGE_BLOCK_SIZE;
+		nr -= n;
+	}
+	return 0;
+}
+
+static int __init fs_format(void)
+{
+	u64 nr_blocks, nr_inodes, inode_blocks, chunk, i;
+	struct storage_inode *root;
+	struct bcache_block *b;
+	void *zero;
+	int ret;
+
+	nr_blocks = fs_bdev->nr_sectors / STORAGE_BLOCK_SECTORS;
+	if (nr_blocks > FS_MAX_BLOCKS) {
+		pr_warn("using the first %llu of %llu blocks\n", FS_MAX_BLOCKS, nr_blocks);
+		nr_blocks = FS_MAX_BLOCKS;
+	}
+
+	nr_inodes = DIV_ROUND_UP(nr_blocks * STORAGE_BLOCK_SIZE, STORAGE_BYTES_PER_INODE);
+	nr_inodes = clamp_t(u64, nr_inodes, STORAGE_MIN_INODES, FS_MAX_INODES);
+	nr_inodes = round_up(nr_inodes, STORAGE_INODES_PER_BLOCK);
+	inode_blocks = nr_inodes / STORAGE_INODES_PER_BLOCK;
+
+	memset(&fs_sb, 0, sizeof(fs_sb));
+	fs_sb.magic = STORAGE_MAGIC;
+	fs_sb.version = STORAGE_VERSION;
+	fs_sb.block_size = STORAGE_BLOCK_SIZE;
+	fs_sb.nr_blocks = nr_blocks;
+	fs_sb.nr_inodes = nr_inodes;
+	fs_sb.inode_start = 1;
+	fs_sb.bitmap_start = fs_sb.inode_start + inode_blocks;
+	fs_sb.bitmap_blocks = DIV_ROUND_UP(nr_blocks, FS_BITS_PER_BLOCK);
+	fs_sb.data_start = fs_sb.bitmap_start + fs_sb.bitmap_blocks;
+	if (fs_sb.data_start >= nr_blocks)
+		return -ENOSPC;
+
+	ret = fs_alloc_tables();
+	if (ret)
+		return ret;
+
+	bitmap_set(fs_bitmap, 0, fs_sb.data_start);
+	fs_nr_free_blocks = nr_blocks - fs_sb.data_start;
+	fs_alloc_cursor = fs_sb.data_start;
+	fs_nr_free_inodes = nr_inodes;
+
+	/* Clear the inode table and write the bitmap directly */
+	chunk = max_t(u64, fs_bdev->max_len / STORAGE_BLOCK_SIZE, 1);
+	zero = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+					get_order(chunk * STORAGE_BLOCK_SIZE));
+	if (!zero)
+		return -ENOMEM;
+	for (i = 0, ret = 0; i < inode_blocks && !ret; i += chunk)
+		ret = fs_rw_blocks(BLK_OP_WRITE, fs_sb.inode_start + i, zero,
+				   min(chunk, inode_blocks - i));
+	free_pages((unsigned long)zero, get_order(chunk * STORAGE_BLOCK_SIZE));
+	if (ret)
+		return ret;
+
+	ret = fs_rw_blocks(BLK_OP_WRITE, fs_sb.bitmap_start, fs_bitmap, fs_sb.bitmap_blocks);
+	if (ret)
+		return ret;
+
+	root = fs_new_inode("/", S_IFDIR | 0755, NULL);
+	if (IS_ERR(root))
+		return PTR_ERR(root);
+	fs_create("/root", S_IFDIR | 0700);
+	fs_create("/tmp", S_IFDIR | 01777);
+
+	b = bcache_get(0);
+	bcache_lock_block(b);
+	memset(b->data, 0, STORAGE_BLOCK_SIZE);
+	memcpy(b->data, &fs_sb, sizeof(fs_sb));
+	bcache_mark_dirty(b);
+	bcache_unlock_block(b);
+	bcache_put(b);
+
+	return bcache_sync(0);
+}
+
+static int __init fs_load_inode(u32 ino, struct storage_dinode *d, void *buf)
+{
+	struct storage_inode *inode;
+	int i, ret;
+
+	if (d->nr_extents > STORAGE_MAX_EXTENTS ||
+	    (d->nr_extents > STORAGE_NR_EXTENTS && !d->ind_block))
+		return -EINVAL;
+
+	inode = kzalloc(sizeof(*inode), GFP_KERNEL);
+	if (!inode)
+		return -ENOMEM;
+
+	init_rwsem(&inode->rwsem);
+	inode->ino = ino;
+	memcpy(&inode->d, d, sizeof(*d));
+	inode->d.path[MAX_FILENAME_LENGTH - 1] = '\0';
+	inode->ext = inode->d.extents;
+
+	if (d->nr_extents > STORAGE_NR_EXTENTS) {
+		inode->ext = kcalloc(STORAGE_MAX_EXTENTS, sizeof(*inode->ext), GFP_KERNEL);
+		if (!inode->ext) {
+			kfree(inode);
+			return -ENOMEM;
+		}
+		memcpy(inode->ext, d->extents, sizeof(d->extents));
+
+		ret = fs_rw_blocks(BLK_OP_READ, d->ind_block, buf, 1);
+		if (ret) {
+			kfree(inode->ext);
+			kfree(inode);
+			return ret;
+		}
+		memcpy(inode->ext + STORAGE_NR_EXTENTS, buf,
+		       (d->nr_extents - STORAGE_NR_EXTENTS) * sizeof(*inode->ext));
+	}
+
+	for (i = 0; i < d->nr_extents; i++)
+		inode->nr_blocks += inode->ext[i].len;
+
+	fs_inodes[ino] = inode;
+	hash_add(fs_inode_hash, &inode->hnode, fs_path_hash(inode->d.path));
+	return 0;
+}
+
+static int __init fs_load(void)
+{
+	struct storage_inode *inode, *root;
+	void *buf, *ind;
+	u64 ino, nr, n, i;
+	int ret;
+
+	if (fs_sb.magic != STORAGE_MAGIC) {
+		pr_err("no file system found, boot with storage_format to create one\n");
+		return -EINVAL;
+	}
+	if (fs_sb.version != STORAGE_VERSION || fs_sb.block_size != STORAGE_BLOCK_SIZE ||
+	    fs_sb.nr_blocks > fs_bdev->nr_sectors / STORAGE_BLOCK_SECTORS ||
+	    fs_sb.data_start >= fs_sb.nr_blocks) {
+		pr_err("bad superblock\n");
+		return -EINVAL;
+	}
+
+	ret = fs_alloc_tables();
+	if (ret)
+		return ret;
+
+	ret = fs_rw_blocks(BLK_OP_READ, fs_sb.bitmap_start, fs_bitmap, fs_sb.bitmap_blocks);
+	if (ret)
+		return ret;
+	fs_nr_free_blocks = fs_sb.nr_blocks - bitmap_weight(fs_bitmap, fs_sb.nr_blocks);
+	fs_alloc_cursor = fs_sb.data_start;
+
+	nr = max_t(u64, fs_bdev->max_len / STORAGE_BLOCK_SIZE, 1);
+	buf = (void *)__get_free_pages(GFP_KERNEL, get_order(nr * STORAGE_BLOCK_SIZE));
+	ind = (void *)__get_free_page(GFP_KERNEL);
+	if (!buf || !ind)
+		return -ENOMEM;
+
+	fs_nr_free_inodes = fs_sb.nr_inodes;
+	for (ino = 0; ino < fs_sb.nr_inodes; ino += n * STORAGE_INODES_PER_BLOCK) {
+		n = min(nr, (fs_sb.nr_inodes - ino) / STORAGE_INODES_PER_BLOCK);
+		ret = fs_rw_blocks(BLK_OP_READ, fs_sb.inode_start + ino / STORAGE_INODES_PER_BLOCK,
+				   buf, n);
+		if (ret)
+			goto out;
+
+		for (i = 0; i < n * STORAGE_INODES_PER_BLOCK; i++) {
+			struct storage_dinode *d = buf + i * STORAGE_INODE_SIZE;
+
+			fs_generations[ino + i] = d->generation;
+			if (!d->mode)
+				continue;
+
+			ret = fs_load_inode(ino + i, d, ind);
+			if (ret) {
+				pr_err("bad inode %llu: %d\n", ino + i, ret);
+				goto out;
+			}
+			fs_nr_free_inodes--;
+		}
+	}
+
+	root = fs_lookup_path("/");
+	if (!root) {
+		pr_err("no root directory\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (ino = 0; ino < fs_sb.nr_inodes; ino++) {
+		inode = fs_inodes[ino];
+		if (!inode || inode == root)
+			continue;
+
+		inode->parent = fs_lookup_parent(inode->d.path);
+		if (!inode->parent) {
+			pr_warn("%s: no parent, moved to /\n", inode->d.path);
+			inode->parent = root;
+		}
+		inode->parent->nr_children++;
+	}
+	ret = 0;
+out:
+	free_pages((unsigned long)buf, get_order(nr * STORAGE_BLOCK_SIZE));
+	free_page((unsigned long)ind);
+	return ret;
+}
+
+int __init storage_fs_mount(struct block_device *bdev, bool format)
+{
+	void *buf;
+	int ret;
+
+	BUILD_BUG_ON(sizeof(struct storage_dinode) > STORAGE_INODE_SIZE);
+
+	fs_bdev = bdev;
+	if (format) {
+		ret = fs_format();
+		if (ret)
+			return ret;
+		pr_info("formatted %s\n", bdev->name);
+	} else {
+		buf = (void *)__get_free_page(GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+		ret = fs_rw_blocks(BLK_OP_READ, 0, buf, 1);
+		memcpy(&fs_sb, buf, sizeof(fs_sb));
+		free_page((unsigned long)buf);
+		if (ret)
+			return ret;
+
+		ret = fs_load();
+		if (ret)
+			return ret;
+	}
+
+	pr_info("%llu blocks, %llu free, %llu inodes, %llu free\n",
+		fs_sb.nr_blocks, fs_nr_free_blocks, fs_sb.nr_inodes, fs_nr_free_inodes);
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * M2S and P2S request handlers
+ *
+ * Requests and replies are the same as with the Linux storage module,
+ * processor and memory components can not tell the difference.
+ */
+
+#define pr_fmt(fmt) "storage: " fmt
+
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <lego/rpc/struct_m2s.h>
+#include <lego/rpc/struct_p2s.h>
+
+#include "internal.h"
+
+static void *get_reply_buf(struct storage_worker *w, size_t size)
+{
+	if (size <= STORAGE_TXBUF_SIZE)
+		return w->tx_buf;
+	return kmalloc(size, GFP_KERNEL);
+}
+
+static void put_reply_buf(struct storage_worker *w, void *buf)
+{
+	if (buf != w->tx_buf)
+		kfree(buf);
+}
+
+void handle_read_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct m2s_read_write_payload *rq = payload;
+	size_t len_retbuf = rq->len + sizeof(ssize_t);
+	ssize_t *retval, ret;
+	void *retbuf;
+
+	if (unlikely(rq->len > STORAGE_MAX_READ_SIZE)) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	retbuf = get_reply_buf(w, len_retbuf);
+	if (unlikely(!retbuf)) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	retval = retbuf;
+	*retval = fs_read(w->qid, rq->fh, rq->filename, retbuf + sizeof(ssize_t),
+			  rq->len, rq->offset);
+
+	ibapi_reply_message(retbuf, len_retbuf, desc);
+	put_reply_buf(w, retbuf);
+	return;
+
+err:
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_write_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct m2s_read_write_payload *wq = payload;
+	ssize_t retval;
+
+	retval = fs_write(w->qid, wq->fh, wq->filename, wq->flags,
+			  payload + sizeof(*wq), wq->len, wq->offset);
+
+	ibapi_reply_message(&retval, sizeof(retval), desc);
+}
+
+void handle_open_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_open_struct *op = payload;
+	struct p2s_open_ret_struct ret;
+
+	ret.fh = 0;
+	ret.retval = fs_open(w->qid, op->filename, op->flags, op->permission, &ret.fh);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+/* No symbolic links, stat and lstat are the same */
+void handle_stat_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_stat_struct *stat_rq = payload;
+	struct p2s_stat_ret_struct retbuf;
+
+	retbuf.retval = fs_stat(stat_rq->filename, &retbuf.statbuf);
+
+	ibapi_reply_message(&retbuf, sizeof(retbuf), desc);
+}
+
+void handle_access_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_access_struct *acc = payload;
+	int ret;
+
+	ret = fs_access(acc->filename, acc->mode);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_truncate_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_truncate_struct *trunc = payload;
+	long ret;
+
+	ret = fs_truncate(w->qid, trunc->filename, trunc->length);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_unlink_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_unlink_struct *unlink = payload;
+	long ret;
+
+	ret = fs_unlink(unlink->filename);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_mkdir_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_mkdir_struct *mkdir = payload;
+	long ret;
+
+	ret = fs_mkdir(mkdir->filename, mkdir->mode);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_rmdir_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_rmdir_struct *rmdir = payload;
+	long ret;
+
+	ret = fs_rmdir(rmdir->filename);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_lseek_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct m2s_lseek_struct *lseek = payload;
+	ssize_t ret;
+
+	ret = fs_file_size(lseek->filename);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_statfs_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_statfs_ret_struct retbuf;
+
+	retbuf.retval = fs_statfs(&retbuf.kstatfs);
+
+	ibapi_reply_message(&retbuf, sizeof(retbuf), desc);
+}
+
+void handle_getdents_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_getdents_struct *gd = payload;
+	struct p2s_getdents_retval_struct *retval_struct;
+	u32 retlen = sizeof(*retval_struct) + gd->count;
+	void *retbuf;
+	long ret;
+
+	retbuf = get_reply_buf(w, retlen);
+	if (unlikely(!retbuf)) {
+		ret = -ENOMEM;
+		ibapi_reply_message(&ret, sizeof(ret), desc);
+		return;
+	}
+
+	retval_struct = retbuf;
+	retval_struct->pos = gd->pos;
+	retval_struct->retval = fs_getdents(gd->filename, retbuf + sizeof(*retval_struct),
+					    &retval_struct->pos, gd->count);
+
+	ibapi_reply_message(retbuf, retlen, desc);
+	put_reply_buf(w, retbuf);
+}
+
+/*
+ * The reply is the return value followed by the link, but there are no
+ * links, it is always an error.
+ */
+void handle_readlink_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_readlink_struct *rl = payload;
+	long ret;
+
+	ret = fs_readlink(rl->filename);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
+
+void handle_rename_request(struct storage_worker *w, void *payload, uintptr_t desc)
+{
+	struct p2s_rename_struct *rn = payload;
+	long ret;
+
+	ret = fs_rename(rn->oldname, rn->newname);
+
+	ibapi_reply_message(&ret, sizeof(ret), desc);
+}
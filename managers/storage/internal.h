@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _MANAGERS_STORAGE_INTERNAL_H_
+#define _MANAGERS_STORAGE_INTERNAL_H_
+
+#include <lego/stat.h>
+#include <lego/list.h>
+#include <lego/rwsem.h>
+#include <lego/types.h>
+#include <lego/atomic.h>
+#include <lego/blkdev.h>
+#include <lego/comp_common.h>
+#include <lego/rpc/struct_common.h>
+#include <processor/statfs.h>
+
+/*
+ * On-disk layout
+ *
+ *   block 0			superblock
+ *   inode_start		inode table, STORAGE_INODES_PER_BLOCK per block
+ *   bitmap_start		block bitmap, one bit per block of the device
+ *   data_start			file data and indirect extent blocks
+ *
+ * The namespace is flat: an inode keeps the full pathname of its file,
+ * directories are inodes with S_IFDIR and no data. File data is kept in
+ * extents, up to STORAGE_NR_EXTENTS in the inode and the rest in one
+ * indirect extent block. Extents are in file order. An extent starting
+ * at block 0, which is the superblock, is a hole and reads as zeroes.
+ *
+ * There is no journal. Metadata goes through the block cache like data
+ * and is written back by the flusher.
+ */
+#define STORAGE_MAGIC			0x524f5453474f454cULL	/* "LEGOSTOR" */
+#define STORAGE_VERSION			1
+
+#define STORAGE_BLOCK_SHIFT		12
+#define STORAGE_BLOCK_SIZE		(1UL << STORAGE_BLOCK_SHIFT)
+#define STORAGE_BLOCK_SECTORS		(STORAGE_BLOCK_SIZE >> SECTOR_SHIFT)
+
+#define STORAGE_INODE_SIZE		512
+#define STORAGE_INODES_PER_BLOCK	(STORAGE_BLOCK_SIZE / STORAGE_INODE_SIZE)
+#define STORAGE_BYTES_PER_INODE		(1UL << 20)
+#define STORAGE_MIN_INODES		64
+#define STORAGE_ROOT_INO		0
+
+#define STORAGE_NR_EXTENTS		12
+#define STORAGE_NR_IND_EXTENTS		(STORAGE_BLOCK_SIZE / sizeof(struct storage_extent))
+#define STORAGE_MAX_EXTENTS		(STORAGE_NR_EXTENTS + STORAGE_NR_IND_EXTENTS)
+
+/* Files grow by doubling their allocation, up to this many blocks at once */
+#define STORAGE_MAX_PREALLOC		32768
+
+#define STORAGE_DT_DIR			4
+#define STORAGE_DT_REG			8
+
+struct storage_super {
+	__u64			magic;
+	__u32			version;
+	__u32			block_size;
+	__u64			nr_blocks;
+	__u64			nr_inodes;
+	__u64			inode_start;
+	__u64			bitmap_start;
+	__u64			bitmap_blocks;
+	__u64			data_start;
+};
+
+struct storage_extent {
+	__u64			start;
+	__u32			len;		/* in blocks */
+	__u32			pad;
+};
+
+struct storage_dinode {
+	__u32			mode;		/* 0 if free */
+	__u32			generation;
+	__u64			size;
+	__s64			atime;
+	__s64			mtime;
+	__s64			ctime;
+	__u32			nr_extents;
+	__u32			pad;
+	__u64			ind_block;	/* indirect extents, 0 if none */
+	struct storage_extent	extents[STORAGE_NR_EXTENTS];
+	char			path[MAX_FILENAME_LENGTH];
+};
+
+struct storage_inode {
+	struct hlist_node	hnode;		/* by path */
+	struct storage_inode	*parent;
+	u32			ino;
+	int			nr_children;
+	u64			nr_blocks;	/* covered by extents, holes too */
+
+	/* Data, size and extents. The namespace lock is held around it */
+	struct rw_semaphore	rwsem;
+
+	/* All extents, the first STORAGE_NR_EXTENTS mirror d.extents */
+	struct storage_extent	*ext;
+	struct storage_dinode	d;
+};
+
+/* One per worker thread, and the block queue it submits to */
+struct storage_worker {
+	int			id;
+	int			qid;
+	struct task_struct	*task;
+	void			*rx_buf;
+	void			*tx_buf;
+	unsigned long		nr_requests;
+};
+
+#define STORAGE_NR_WORKERS	CONFIG_STORAGE_NR_WORKERS
+
+/* The flusher gets a queue of its own */
+#define STORAGE_FLUSH_QID	STORAGE_NR_WORKERS
+
+/*
+ * Block cache
+ */
+enum bcache_block_flags {
+	BC_UPTODATE,
+	BC_DIRTY,
+	BC_LOCKED,		/* I/O or update in progress */
+	BC_ERROR,
+};
+
+struct bcache_block {
+	struct hlist_node	hnode;
+	struct list_head	lru;
+	struct list_head	dirty;
+	u64			blocknr;
+	void			*data;
+	unsigned long		flags;
+	atomic_t		ref;
+	struct blk_request	req;
+};
+
+int bcache_init(struct block_device *bdev, unsigned long nr_blocks);
+struct bcache_block *bcache_get(u64 blocknr);
+void bcache_put(struct bcache_block *b);
+int bcache_read(int qid, struct bcache_block **bbs, int nr);
+void bcache_lock_block(struct bcache_block *b);
+void bcache_unlock_block(struct bcache_block *b);
+void bcache_mark_dirty(struct bcache_block *b);
+void bcache_forget(u64 blocknr, u64 nr);
+int bcache_sync(int qid);
+void bcache_start_flusher(void);
+
+static inline bool bcache_uptodate(struct bcache_block *b)
+{
+	return test_bit(BC_UPTODATE, &b->flags);
+}
+
+/*
+ * File system
+ */
+int storage_fs_mount(struct block_device *bdev, bool format);
+
+int fs_open(int qid, const char *path, int flags, umode_t mode, u64 *fh);
+ssize_t fs_read(int qid, u64 fh, const char *path, void *buf,
+		size_t len, loff_t pos);
+ssize_t fs_write(int qid, u64 fh, const char *path, int flags,
+		 const void *buf, size_t len, loff_t pos);
+long fs_file_size(const char *path);
+int fs_stat(const char *path, struct kstat *stat);
+int fs_access(const char *path, int mode);
+long fs_truncate(int qid, const char *path, loff_t length);
+long fs_unlink(const char *path);
+long fs_mkdir(const char *path, umode_t mode);
+long fs_rmdir(const char *path);
+long fs_rename(const char *oldname, const char *newname);
+long fs_statfs(struct lego_kstatfs *buf);
+long fs_getdents(const char *path, void *dirent, loff_t *pos, unsigned int count);
+long fs_readlink(const char *path);
+
+/*
+ * Handlers
+ */
+void handle_read_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_write_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_open_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_stat_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_access_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_truncate_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_unlink_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_mkdir_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_rmdir_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_lseek_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_statfs_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_getdents_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_readlink_request(struct storage_worker *w, void *payload, uintptr_t desc);
+void handle_rename_request(struct storage_worker *w, void *payload, uintptr_t desc);
+
+void handle_replica_flush(struct storage_worker *w, void *msg, uintptr_t desc);
+void handle_replica_vma(struct storage_worker *w, void *msg, uintptr_t desc);
+
+#define STORAGE_MAX_RXBUF_SIZE	(512 * PAGE_SIZE)
+
+/* Reply buffer of each worker, larger replies are allocated */
+#define STORAGE_TXBUF_SIZE	(512 * PAGE_SIZE)
+
+/* Same limit as the Linux storage module */
+#define STORAGE_MAX_READ_SIZE	(512 * 5 * PAGE_SIZE)
+
+#endif /* _MANAGERS_STORAGE_INTERNAL_H_ */
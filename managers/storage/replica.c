@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Memory replication logs, one replica file and one mmap file per process,
+ * named as the Linux storage module does. Logs are appended, the files
+ * are created on first use.
+ */
+
+#include <lego/kernel.h>
+#include <lego/fcntl.h>
+#include <lego/fit_ibapi.h>
+#include <lego/comp_common.h>
+#include <lego/rpc/struct_m2s.h>
+
+#include "internal.h"
+
+static const char replica_base_name[] = "/root/lego-replica-file-";
+static const char mmap_base_name[] = "/root/lego-mmap-file-";
+
+static int append_log(struct storage_worker *w, const char *base,
+		      unsigned int pid, unsigned int vnode_id,
+		      void *log, size_t count)
+{
+	char name[MAX_FILENAME_LENGTH];
+	ssize_t written;
+
+	snprintf(name, sizeof(name), "%sv%d-p%d", base, vnode_id, pid);
+
+	written = fs_write(w->qid, 0, name, O_WRONLY | O_CREAT, log, count, -1);
+	if (written < 0)
+		return written;
+	if (written != count)
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Handle memory replication flush from Secondary Memory
+ */
+void handle_replica_flush(struct storage_worker *w, void *_msg, uintptr_t desc)
+{
+	struct m2s_replica_flush_msg *msg = _msg;
+	struct replica_log *log_array;
+	int reply;
+
+	log_array = (struct replica_log *)(&msg->log);
+	reply = append_log(w, replica_base_name,
+			   log_array->meta.pid, log_array->meta.vnode_id,
+			   log_array, msg->nr_log * sizeof(*log_array));
+
+	ibapi_reply_message(&reply, sizeof(reply), desc);
+}
+
+/*
+ * Handle VMA replication from Primary Memory
+ */
+void handle_replica_vma(struct storage_worker *w, void *_msg, uintptr_t desc)
+{
+	struct m2s_replica_vma_msg *msg = _msg;
+	struct replica_vma_log *log = &msg->log;
+	int reply;
+
+	reply = append_log(w, mmap_base_name, log->pid, log->vnode_id,
+			   log, sizeof(*log));
+
+	ibapi_reply_message(&reply, sizeof(reply), desc);
+}
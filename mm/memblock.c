@@ -1095,8 +1095,8 @@ phys_addr_t __init memblock_alloc_try_nid(phys_addr_t size, phys_addr_t align, i
  *
  * The memory block is aligned on SMP_CACHE_BYTES if @align == 0.
  *
- * The phys address of allocated boot memory block is converted to virtual and
- * allocated memory is reset to 0.
+ * The phys address of allocated boot memory block is converted to virtual.
+ * The memory is NOT cleared, callers do it if they need to.
  *
  * RETURNS:
  * Virtual address of allocated memory block on success, NULL on failure.
@@ -1142,7 +1142,6 @@ again:
 done:
 	memblock_reserve(alloc, size);
 	ptr = phys_to_virt(alloc);
-	memset(ptr, 0, size);
 
 	return ptr;
 }
@@ -1168,12 +1167,47 @@ void * __init memblock_virt_alloc_try_nid_nopanic(
 				phys_addr_t size, phys_addr_t align,
 				phys_addr_t min_addr, phys_addr_t max_addr,
 				int nid)
+{
+	void *ptr;
+
+	memblock_dbg("%s: %llu bytes align=0x%llx nid=%d from=0x%llx max_addr=0x%llx %pF\n",
+		     __func__, (u64)size, (u64)align, nid, (u64)min_addr,
+		     (u64)max_addr, (void *)_RET_IP_);
+
+	ptr = memblock_virt_alloc_internal(size, align, min_addr,
+					   max_addr, nid);
+	if (ptr)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+/**
+ * memblock_virt_alloc_try_nid_raw - allocate boot memory block without zeroing
+ * @size: size of memory block to be allocated in bytes
+ * @align: alignment of the region and block's size
+ * @min_addr: the lower bound of the memory region from where the allocation
+ *	  is preferred (phys address)
+ * @max_addr: the upper bound of the memory region from where the allocation
+ *	      is preferred (phys address), or %BOOTMEM_ALLOC_ACCESSIBLE to
+ *	      allocate only from memory limited by memblock.current_limit value
+ * @nid: nid of the free area to find, %NUMA_NO_NODE for any node
+ *
+ * Same as memblock_virt_alloc_try_nid_nopanic(), except the memory is not
+ * cleared. Used for large maps that are initialized later, in parallel.
+ *
+ * RETURNS:
+ * Virtual address of allocated memory block on success, NULL on failure.
+ */
+void * __init memblock_virt_alloc_try_nid_raw(
+				phys_addr_t size, phys_addr_t align,
+				phys_addr_t min_addr, phys_addr_t max_addr,
+				int nid)
 {
 	memblock_dbg("%s: %llu bytes align=0x%llx nid=%d from=0x%llx max_addr=0x%llx %pF\n",
 		     __func__, (u64)size, (u64)align, nid, (u64)min_addr,
 		     (u64)max_addr, (void *)_RET_IP_);
 	return memblock_virt_alloc_internal(size, align, min_addr,
-					     max_addr, nid);
+					    max_addr, nid);
 }
 
 /**
@@ -1192,8 +1226,9 @@ void __init __memblock_free_early(phys_addr_t base, phys_addr_t size)
 	memblock_remove_range(&memblock.reserved, base, size);
 }
 
-static void __init __free_pages_memory(unsigned long start, unsigned long end)
+static unsigned long __init __free_pages_memory(unsigned long start, unsigned long end)
 {
+	unsigned long count = 0;
 	int order;
 
 	while (start < end) {
@@ -1203,10 +1238,11 @@ static void __init __free_pages_memory(unsigned long start, unsigned long end)
 			order--;
 
 		/* Free to allocator */
-		__free_pages_bootmem(pfn_to_page(start), start, order);
+		count += __free_pages_bootmem(pfn_to_page(start), start, order);
 
 		start += (1UL << order);
 	}
+	return count;
 }
 
 static unsigned long __init __free_memory_core(phys_addr_t start,
@@ -1218,9 +1254,7 @@ static unsigned long __init __free_memory_core(phys_addr_t start,
 	if (start_pfn > end_pfn)
 		return 0;
 
-	__free_pages_memory(start_pfn, end_pfn);
-
-	return end_pfn - start_pfn;
+	return __free_pages_memory(start_pfn, end_pfn);
 }
 
 /**
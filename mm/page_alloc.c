@@ -20,6 +20,8 @@
 #include <lego/string.h>
 #include <lego/kernel.h>
 #include <lego/vmstat.h>
+#include <lego/jiffies.h>
+#include <lego/parallel.h>
 #include <lego/sysinfo.h>
 #include <lego/nodemask.h>
 #include <lego/memblock.h>
@@ -94,6 +96,69 @@ static void __init_single_pfn(unsigned long pfn, unsigned long zone,
 	return __init_single_page(pfn_to_page(pfn), pfn, zone, nid);
 }
 
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+/*
+ * Only the first 2GB of each node get their struct pages at early boot,
+ * the rest are initialised and freed to buddy in parallel on all CPUs
+ * by page_alloc_init_late(), once SMP is up.
+ */
+static inline void __init reset_deferred_meminit(pg_data_t *pgdat)
+{
+	pgdat->static_init_pgcnt = min_t(unsigned long, 2UL << (30 - PAGE_SHIFT),
+					 pgdat->node_spanned_pages);
+	pgdat->first_deferred_pfn = ULONG_MAX;
+}
+
+/* Returns true if the struct page for the pfn is not initialised yet */
+static inline bool __init early_page_uninitialised(unsigned long pfn)
+{
+	int nid;
+
+	for_each_online_node(nid) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		if (pfn >= pgdat->first_deferred_pfn && pfn < pgdat_end_pfn(pgdat))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Returns false when the remaining initialisation should be deferred until
+ * later in the boot cycle when it can be parallelised.
+ */
+static inline bool __init update_defer_init(pg_data_t *pgdat, unsigned long pfn,
+					    unsigned long zone_end,
+					    unsigned long *nr_initialised)
+{
+	/* Always populate low zones for address-constrained allocations */
+	if (zone_end < pgdat_end_pfn(pgdat))
+		return true;
+
+	(*nr_initialised)++;
+	if ((*nr_initialised > pgdat->static_init_pgcnt) &&
+	    (pfn & (MAX_ORDER_NR_PAGES - 1)) == 0) {
+		pgdat->first_deferred_pfn = pfn;
+		return false;
+	}
+	return true;
+}
+#else
+static inline void reset_deferred_meminit(pg_data_t *pgdat) { }
+
+static inline bool early_page_uninitialised(unsigned long pfn)
+{
+	return false;
+}
+
+static inline bool update_defer_init(pg_data_t *pgdat, unsigned long pfn,
+				     unsigned long zone_end,
+				     unsigned long *nr_initialised)
+{
+	return true;
+}
+#endif
+
 /**
  * get_pfn_range_for_nid - Return the start and end page frames for a node
  * @nid: The nid to return the range for. If MAX_NUMNODES, the min and max PFN are returned.
@@ -273,7 +338,9 @@ static unsigned long calc_memmap_size(unsigned long spanned_pages,
 static void __init zone_init_mem_map(unsigned long size, int nid,
 				     unsigned long zone, unsigned long start_pfn)
 {
+	pg_data_t *pgdat = NODE_DATA(nid);
 	unsigned long end_pfn = start_pfn + size;
+	unsigned long nr_initialised = 0;
 	unsigned long pfn;
 
 	if (highest_memmap_pfn < end_pfn - 1)
@@ -288,6 +355,8 @@ static void __init zone_init_mem_map(unsigned long size, int nid,
 		 */
 		if (!pfn_valid(pfn))
 			continue;
+		if (!update_defer_init(pgdat, pfn, end_pfn, &nr_initialised))
+			break;
 		__init_single_pfn(pfn, zone, nid);
 	}
 }
@@ -434,6 +503,7 @@ void __init free_area_init_node(int nid, unsigned long *zones_size,
 
 	calculate_node_totalpages(pgdat, start_pfn, end_pfn,
 				  zones_size, zholes_size);
+	reset_deferred_meminit(pgdat);
 
 	alloc_node_mem_map(pgdat, &mem_map_size);
 #ifndef CONFIG_SPARSEMEM
@@ -798,6 +868,20 @@ void free_pages(unsigned long addr, unsigned int order)
 #endif
 }
 
+/*
+ * split_page takes a higher-order page, and splits it into n (1<<order)
+ * sub-pages: page[0..n]. Each sub-page must be freed individually.
+ */
+void split_page(struct page *page, unsigned int order)
+{
+	int i;
+
+	VM_BUG_ON_PAGE(page_ref_count(page) == 0, page);
+
+	for (i = 1; i < (1 << order); i++)
+		set_page_refcounted(page + i);
+}
+
 static __always_inline void __clear_page(void *page)
 {
 	/* XXX: Trace this if necessary */
@@ -969,7 +1053,11 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 	return page;
 }
 
-static void __init __free_pages_boot_core(struct page *page, unsigned int order)
+/*
+ * Give pages to buddy without touching zone->managed_pages,
+ * callers do the accounting.
+ */
+static void __init __free_pages_boot_nocount(struct page *page, unsigned int order)
 {
 	unsigned int i, nr_pages = 1 << order;
 	struct page *p = page;
@@ -980,11 +1068,16 @@ static void __init __free_pages_boot_core(struct page *page, unsigned int order)
 		set_page_count(p, 0);
 	}
 
-	page_zone(page)->managed_pages += nr_pages;
 	set_page_refcounted(page);
 	__free_pages_boot(page, order);
 }
 
+static void __init __free_pages_boot_core(struct page *page, unsigned int order)
+{
+	page_zone(page)->managed_pages += 1 << order;
+	__free_pages_boot_nocount(page, order);
+}
+
 /*
  * Initialised pages do not have PageReserved set. This function is
  * called for each range allocated by the bootmem allocator and
@@ -1000,17 +1093,151 @@ void __init reserve_bootmem_region(phys_addr_t start, phys_addr_t end)
 		if (pfn_valid(start_pfn)) {
 			struct page *page = pfn_to_page(start_pfn);
 
+			/* Done by page_alloc_init_late() */
+			if (early_page_uninitialised(start_pfn))
+				continue;
+
 			SetPageReserved(page);
 		}
 	}
 }
 
-/* Called to free memblock into buddy allocator */
-void __init __free_pages_bootmem(struct page *page, unsigned long pfn,
-				unsigned int order)
+/*
+ * Called to free memblock into buddy allocator.
+ * Returns the number of pages actually freed.
+ */
+unsigned long __init __free_pages_bootmem(struct page *page, unsigned long pfn,
+					  unsigned int order)
+{
+	if (early_page_uninitialised(pfn))
+		return 0;
+	__free_pages_boot_core(page, order);
+	return 1UL << order;
+}
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+struct deferred_init_arg {
+	pg_data_t	*pgdat;
+	struct zone	*zone;
+	atomic_long_t	nr_freed;
+};
+
+static unsigned long __init
+deferred_free_range(unsigned long start_pfn, unsigned long end_pfn)
+{
+	unsigned long pfn = start_pfn;
+	int order;
+
+	while (pfn < end_pfn) {
+		order = min(MAX_ORDER - 1UL, __ffs(pfn));
+		while (pfn + (1UL << order) > end_pfn)
+			order--;
+
+		__free_pages_boot_nocount(pfn_to_page(pfn), order);
+		pfn += 1UL << order;
+	}
+	return end_pfn - start_pfn;
+}
+
+/*
+ * Initialise struct pages of [start_pfn, end_pfn), mark the memblock
+ * reserved ones, and free the rest to buddy. The range is aligned to
+ * MAX_ORDER_NR_PAGES, so no buddy block is shared with other threads.
+ * Every page is initialised before any of them is freed, buddy merging
+ * only ever looks at pages that are already free.
+ */
+static void __init deferred_init_range(unsigned long start_pfn,
+				       unsigned long end_pfn, void *_arg)
+{
+	struct deferred_init_arg *arg = _arg;
+	int nid = arg->pgdat->node_id;
+	unsigned long zid = zone_idx(arg->zone);
+	unsigned long pfn, spfn, epfn, nr_freed = 0;
+	phys_addr_t start, end;
+	u64 i;
+
+	for (pfn = start_pfn; pfn < end_pfn; pfn++) {
+		if (!pfn_valid(pfn))
+			continue;
+		__init_single_pfn(pfn, zid, nid);
+	}
+
+	for_each_reserved_mem_region(i, &start, &end) {
+		spfn = max_t(unsigned long, PFN_DOWN(start), start_pfn);
+		epfn = min_t(unsigned long, PFN_UP(end), end_pfn);
+		for (pfn = spfn; pfn < epfn; pfn++) {
+			if (pfn_valid(pfn))
+				SetPageReserved(pfn_to_page(pfn));
+		}
+	}
+
+	for_each_free_mem_range(i, NUMA_NO_NODE, MEMBLOCK_NONE, &start, &end, NULL) {
+		spfn = max_t(unsigned long, PFN_UP(start), start_pfn);
+		epfn = min_t(unsigned long, PFN_DOWN(end), end_pfn);
+		if (spfn < epfn)
+			nr_freed += deferred_free_range(spfn, epfn);
+	}
+
+	atomic_long_add(nr_freed, &arg->nr_freed);
+}
+
+/**
+ * page_alloc_init_late - finish deferred struct page initialisation
+ *
+ * Called once SMP is up. Pages above pgdat->first_deferred_pfn of every node
+ * are initialised and freed to buddy, the work is spread across all CPUs.
+ */
+void __init page_alloc_init_late(void)
 {
-	return __free_pages_boot_core(page, order);
+	struct deferred_init_arg arg;
+	struct parallel_job job;
+	unsigned long start_time, nr_freed;
+	int nid, j;
+
+	for_each_online_node(nid) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+		unsigned long first_pfn = pgdat->first_deferred_pfn;
+		unsigned long end_pfn = pgdat_end_pfn(pgdat);
+
+		if (first_pfn == ULONG_MAX)
+			continue;
+
+		/* Only the last zone of a node is deferred */
+		arg.pgdat = pgdat;
+		arg.zone = NULL;
+		for (j = MAX_NR_ZONES - 1; j >= 0; j--) {
+			struct zone *zone = pgdat->node_zones + j;
+
+			if (zone->spanned_pages && zone_spans_pfn(zone, first_pfn)) {
+				arg.zone = zone;
+				break;
+			}
+		}
+		if (WARN_ON(!arg.zone))
+			continue;
+		atomic_long_set(&arg.nr_freed, 0);
+
+		job.thread_fn	= deferred_init_range;
+		job.fn_arg	= &arg;
+		job.start	= first_pfn;
+		job.size	= end_pfn - first_pfn;
+		job.align	= MAX_ORDER_NR_PAGES;
+		job.min_chunk	= 1UL << (30 - PAGE_SHIFT);
+		job.name	= "pgdatinit";
+
+		start_time = jiffies;
+		parallel_do_job(&job);
+
+		nr_freed = atomic_long_read(&arg.nr_freed);
+		arg.zone->managed_pages += nr_freed;
+		totalram_pages += nr_freed;
+		pgdat->first_deferred_pfn = ULONG_MAX;
+
+		pr_info("node %d initialised, %lu pages in %ums\n", nid,
+			nr_freed, jiffies_to_msecs(jiffies - start_time));
+	}
 }
+#endif
 
 static void zoneref_set_zone(struct zone *zone, struct zoneref *zoneref)
 {
@@ -75,6 +75,28 @@
 #define HIGH_PRIORITY 4
 #define LOW_PRIORITY 0
 #define KEY_PRIORITY 8
+
+/*
+ * Traffic classes, or lanes.
+ *
+ * Each lane owns a disjoint set of the QPs between a node pair and its
+ * own recv_cq, so a large reply sitting in one lane can never delay a
+ * small message in another. The order below is also the polling order:
+ * recv_cq polling thread always drains lower-numbered lanes first.
+ */
+enum fit_lane {
+	FIT_LANE_PCACHE,	/* pcache miss, flush, zerofill */
+	FIT_LANE_SYSCALL,	/* everything else */
+	FIT_LANE_REPLICA,	/* replication traffic */
+	FIT_LANE_BULK,		/* file read/write, checkpoint, large msgs */
+	NR_FIT_LANES
+};
+
+/*
+ * Messages bigger than this are routed to the bulk lane,
+ * unless the opcode itself says otherwise.
+ */
+#define FIT_LANE_BULK_THRESHOLD		(4 * FIT_PAGE_SIZE)
 #define CONGESTION_ALERT 2
 #define CONGESTION_WARNING 1
 #define CONGESTION_FREE 0
@@ -508,6 +530,18 @@ struct lego_context {
 	atomic_t imm_cache_perport_work_tail[IMM_MAX_PORT];
 
 	atomic_t *connection_count;
+
+#ifdef CONFIG_FIT_PRIORITY_LANES
+	/* [node][lane] RR counter, and per-node outstanding bulk requests */
+	atomic_t *lane_request_num;
+	atomic_t *bulk_inflight;
+#endif
+#ifdef CONFIG_FIT_ONESIDED_READ
+	/* per-node, serialize posting to the one-sided READ QP */
+	spinlock_t *onesided_lock;
+	/* per-node, QP moved to error after a timeout, set under above */
+	u8 *onesided_dead;
+#endif
 	
 	//Lock related
 	atomic_t lock_num;
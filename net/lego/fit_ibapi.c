@@ -71,6 +71,9 @@ static inline void unlock_ib(void) { }
 #endif
 
 unsigned long	nr_recvcq_cqes[NUM_POLLING_THREADS];
+#ifdef CONFIG_FIT_PRIORITY_LANES
+unsigned long	nr_lane_cqes[NR_FIT_LANES];
+#endif
 #ifdef CONFIG_COUNTER_FIT_IB
 atomic_long_t	nr_ib_send_reply;
 atomic_long_t	nr_ib_send;
@@ -86,6 +89,10 @@ void dump_ib_stats(void)
 	pr_info("    nr_ib_send:       %15ld\n", COUNTER_nr_ib_send());
 	for (i = 0; i < NUM_POLLING_THREADS; i++)
 		pr_info("      recvcq[0] CQEs: %15lu\n", nr_recvcq_cqes[i]);
+#ifdef CONFIG_FIT_PRIORITY_LANES
+	for (i = 0; i < NR_FIT_LANES; i++)
+		pr_info("      lane[%d] CQEs:  %15lu\n", i, nr_lane_cqes[i]);
+#endif
 	pr_info("    nr_bytes_tx:      %15ld\n", COUNTER_nr_bytes_tx());
 	pr_info("    nr_bytes_rx:      %15ld\n", COUNTER_nr_bytes_rx());
 }
@@ -195,14 +202,56 @@ int ibapi_send(int target_node, void *addr, int size)
 	return ret;
 }
 
+#ifdef CONFIG_FIT_ONESIDED_READ
+DEFINE_PROFILE_POINT(ibapi_rdma_read)
+
+/**
+ * ibapi_rdma_read - one-sided RDMA READ from remote memory
+ * @target_node: remote node id
+ * @local_addr: local kernel buffer
+ * @remote_addr: DMA address at remote, from ibapi_get_dma_addr()
+ * @rkey: remote rkey, from ibapi_get_local_rkey()
+ * @size: number of bytes
+ */
+int ibapi_rdma_read(int target_node, void *local_addr, u64 remote_addr,
+		    u32 rkey, int size)
+{
+	int ret;
+	PROFILE_POINT_TIME(ibapi_rdma_read)
+
+#ifdef CONFIG_COUNTER_FIT_IB
+	atomic_long_add(size, &nr_bytes_rx);
+#endif
+
+	PROFILE_START(ibapi_rdma_read);
+	ret = fit_rdma_read(FIT_ctx, target_node, local_addr, remote_addr,
+			    rkey, size);
+	PROFILE_LEAVE(ibapi_rdma_read);
+	return ret;
+}
+
+u32 ibapi_get_local_rkey(void)
+{
+	return fit_get_local_rkey(FIT_ctx);
+}
+
+u64 ibapi_get_dma_addr(void *addr, int size)
+{
+	return fit_get_dma_addr(FIT_ctx, addr, size);
+}
+#endif
+
 /**
  * ibapi_multicast_send_reply_timeout - issue a RDMA request with several sge request - mainly used for multicast in kernel
  * @ctx: fit context
  * @num_nodes: number of multicast node
  * @target_node: target node array
  * @sglist: message array to be sent to the nodes
- * @output_msg: array of reply message buffer
+ * @output_msg: array of reply message buffer, from kmalloc()
  * @timeout_sec: timeout value in seconds
+ *
+ * On -ETIMEDOUT, reply buffers that may still be written are owned by
+ * FIT and their addr is set to NULL.
  */
 int ibapi_multicast_send_reply_timeout(int num_nodes, int *target_node,
 				struct fit_sglist *sglist, struct fit_sglist *output_msg,
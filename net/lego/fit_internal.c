@@ -25,6 +25,7 @@
 #include <lego/fit_ibapi.h>
 #include <lego/comp_common.h>
 #include <lego/profile.h>
+#include <lego/rcupdate.h>
 #include <rdma/ib_verbs.h>
 
 #include <processor/pcache.h>
@@ -80,6 +81,231 @@ static inline struct send_and_reply_format *dequeue_wq(void)
 	return p;
 }
 
+#ifdef CONFIG_SOCKET_O_IB
+# define FIT_CONNECTION_STRIDE	(NUM_PARALLEL_CONNECTION + 1)
+#else
+# define FIT_CONNECTION_STRIDE	(NUM_PARALLEL_CONNECTION)
+#endif
+
+#ifdef CONFIG_FIT_PRIORITY_LANES
+/*
+ * The NUM_PARALLEL_CONNECTION QPs between a node pair are carved into
+ * contiguous per-lane ranges. The layout only depends on the config,
+ * so QP i at both ends belongs to the same lane, and a message sent
+ * over a lane QP will land on the same lane recv_cq at remote side.
+ */
+static int lane_qp_base[NR_FIT_LANES];
+static int lane_nr_qps[NR_FIT_LANES];
+
+/* Number of lane QPs used by two-sided messages */
+static int lane_nr_rr_qps[NR_FIT_LANES];
+
+#ifdef CONFIG_FIT_ONESIDED_READ
+/* Per node pair QP index reserved for one-sided READ, -1 if none */
+static int onesided_qp = -1;
+#endif
+
+/*
+ * Max number of CQEs polled from each lane recv_cq per polling round.
+ * Bulk lane gets the smallest budget.
+ */
+static const int lane_poll_budget[NR_FIT_LANES] = {
+	[FIT_LANE_PCACHE]	= 16,
+	[FIT_LANE_SYSCALL]	= 8,
+	[FIT_LANE_REPLICA]	= 4,
+	[FIT_LANE_BULK]		= 2,
+};
+#define LANE_POLL_BUDGET_TOTAL	(16 + 8 + 4 + 2)
+
+#define NUM_RECV_CQS		(NUM_POLLING_THREADS * NR_FIT_LANES)
+
+static const char *lane_names[NR_FIT_LANES] = {
+	[FIT_LANE_PCACHE]	= "pcache",
+	[FIT_LANE_SYSCALL]	= "syscall",
+	[FIT_LANE_REPLICA]	= "replica",
+	[FIT_LANE_BULK]		= "bulk",
+};
+
+static void fit_init_lanes(void)
+{
+	int lane, base;
+
+	BUILD_BUG_ON(NUM_PARALLEL_CONNECTION < NR_FIT_LANES);
+
+	/*
+	 * Replica and bulk get one QP each, syscall gets roughly one third
+	 * of the rest, and pcache takes whatever left.
+	 */
+	lane_nr_qps[FIT_LANE_REPLICA] = 1;
+	lane_nr_qps[FIT_LANE_BULK] = 1;
+	lane_nr_qps[FIT_LANE_SYSCALL] = max(1, (NUM_PARALLEL_CONNECTION - 2) / 3);
+	lane_nr_qps[FIT_LANE_PCACHE] = NUM_PARALLEL_CONNECTION - 2 -
+				       lane_nr_qps[FIT_LANE_SYSCALL];
+
+	for (lane = 0, base = 0; lane < NR_FIT_LANES; lane++) {
+		lane_qp_base[lane] = base;
+		base += lane_nr_qps[lane];
+		pr_info("lane %-8s QPs: [%2d, %2d)\n",
+			lane_names[lane], lane_qp_base[lane], base);
+	}
+	memcpy(lane_nr_rr_qps, lane_nr_qps, sizeof(lane_nr_qps));
+
+#ifdef CONFIG_FIT_ONESIDED_READ
+	/*
+	 * Take the last pcache QP out of the RR. Both ends do the same,
+	 * so only one-sided READs will be posted to this QP.
+	 */
+	if (lane_nr_qps[FIT_LANE_PCACHE] > 1) {
+		lane_nr_rr_qps[FIT_LANE_PCACHE]--;
+		onesided_qp = lane_qp_base[FIT_LANE_PCACHE] +
+			      lane_nr_rr_qps[FIT_LANE_PCACHE];
+		pr_info("one-sided READ QP: %d\n", onesided_qp);
+	} else
+		pr_info("one-sided READ disabled: pcache lane has 1 QP\n");
+#endif
+}
+
+static inline int fit_lane_of_connection(int connection_id)
+{
+	int lane, i = connection_id % FIT_CONNECTION_STRIDE;
+
+	for (lane = NR_FIT_LANES - 1; lane > 0; lane--) {
+		if (i >= lane_qp_base[lane])
+			break;
+	}
+	return lane;
+}
+
+static inline int fit_recv_cq_index(int connection_id)
+{
+	return (connection_id % NUM_POLLING_THREADS) * NR_FIT_LANES +
+		fit_lane_of_connection(connection_id);
+}
+
+/*
+ * Classify a message by its opcode. All Lego messages start with
+ * struct common_header. Everything else, including read() and write(),
+ * is classified by the larger of its request and expected reply size.
+ */
+static inline int fit_lane_of_msg(void *msg, int size, int max_ret_size)
+{
+	unsigned int opcode;
+
+	if (unlikely(size < sizeof(struct common_header)))
+		return FIT_LANE_SYSCALL;
+
+	opcode = to_common_header(msg)->opcode;
+	switch (opcode) {
+	case P2M_PCACHE_MISS:
+	case P2M_PCACHE_FLUSH:
+	case P2M_PCACHE_ZEROFILL:
+	case P2M_PCACHE_XLATE:
+		return FIT_LANE_PCACHE;
+	case P2M_PCACHE_REPLICA:
+	case M2S_REPLICA_FLUSH:
+	case M2S_REPLICA_VMA:
+		return FIT_LANE_REPLICA;
+	case P2M_CHECKPOINT:
+		return FIT_LANE_BULK;
+	}
+
+	if (max(size, max_ret_size) > FIT_LANE_BULK_THRESHOLD)
+		return FIT_LANE_BULK;
+	return FIT_LANE_SYSCALL;
+}
+
+/*
+ * Replies follow the lane of their request, except that a large reply
+ * to a latency-critical request is not allowed to clog that lane.
+ */
+static inline int fit_lane_of_reply(int request_lane, int reply_size)
+{
+	if (reply_size > FIT_LANE_BULK_THRESHOLD && request_lane != FIT_LANE_PCACHE)
+		return FIT_LANE_BULK;
+	return request_lane;
+}
+
+/*
+ * Shape bulk traffic: limit the number of outstanding bulk lane requests
+ * to each remote node. Must be paired with fit_lane_exit().
+ *
+ * Memory thpool handlers send with preemption and irqs disabled,
+ * so spin instead of schedule() there.
+ */
+static inline void fit_lane_enter(ppc *ctx, int target_node, int lane)
+{
+	atomic_t *inflight = &ctx->bulk_inflight[target_node];
+
+	if (lane != FIT_LANE_BULK)
+		return;
+
+	while (atomic_inc_return(inflight) > CONFIG_FIT_BULK_MAX_INFLIGHT) {
+		atomic_dec(inflight);
+		while (atomic_read(inflight) >= CONFIG_FIT_BULK_MAX_INFLIGHT) {
+			if (in_atomic() || irqs_disabled()) {
+				cpu_relax();
+				rcu_qs();
+			} else
+				schedule();
+		}
+	}
+}
+
+static inline void fit_lane_exit(ppc *ctx, int target_node, int lane)
+{
+	if (lane == FIT_LANE_BULK)
+		atomic_dec(&ctx->bulk_inflight[target_node]);
+}
+
+static int fit_init_ctx_lanes(ppc *ctx)
+{
+	int i;
+
+	fit_init_lanes();
+
+	ctx->lane_request_num = kmalloc(ctx->num_node * NR_FIT_LANES * sizeof(atomic_t), GFP_KERNEL);
+	ctx->bulk_inflight = kmalloc(ctx->num_node * sizeof(atomic_t), GFP_KERNEL);
+	if (!ctx->lane_request_num || !ctx->bulk_inflight)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->num_node * NR_FIT_LANES; i++)
+		atomic_set(&ctx->lane_request_num[i], -1);
+	for (i = 0; i < ctx->num_node; i++)
+		atomic_set(&ctx->bulk_inflight[i], 0);
+
+#ifdef CONFIG_FIT_ONESIDED_READ
+	ctx->onesided_lock = kmalloc(ctx->num_node * sizeof(spinlock_t), GFP_KERNEL);
+	ctx->onesided_dead = kzalloc(ctx->num_node * sizeof(u8), GFP_KERNEL);
+	if (!ctx->onesided_lock || !ctx->onesided_dead)
+		return -ENOMEM;
+	for (i = 0; i < ctx->num_node; i++)
+		spin_lock_init(&ctx->onesided_lock[i]);
+#endif
+	return 0;
+}
+#else
+#define NUM_RECV_CQS		(NUM_POLLING_THREADS)
+
+static inline int fit_recv_cq_index(int connection_id)
+{
+	return connection_id % NUM_POLLING_THREADS;
+}
+
+static inline int fit_lane_of_msg(void *msg, int size, int max_ret_size)
+{
+	return FIT_LANE_SYSCALL;
+}
+
+static inline int fit_lane_of_reply(int request_lane, int reply_size)
+{
+	return request_lane;
+}
+
+static inline void fit_lane_enter(ppc *ctx, int target_node, int lane) { }
+static inline void fit_lane_exit(ppc *ctx, int target_node, int lane) { }
+static inline int fit_init_ctx_lanes(ppc *ctx) { return 0; }
+#endif /* CONFIG_FIT_PRIORITY_LANES */
+
 /**
  * gets the page table entry for input address
  * @mm: memory struct
@@ -193,8 +419,79 @@ static inline void free_reply_indicator(ppc *ctx, unsigned int idx)
 }
 
 /*
- * @addr: must be a valid kernel virtual address
+ * A reply that timed out may still be written later. The indicator is
+ * then tagged with FIT_ORPHAN_REPLY and points to a fit_orphan_reply,
+ * which owns the reply buffer until the late reply has landed.
+ */
+#define FIT_ORPHAN_REPLY	1UL
+
+struct fit_orphan_reply {
+	void			*buf;
+};
+
+/*
+ * Hand a reply of @len bytes to the waiter of @idx. The indicator is
+ * claimed with xchg(), so a waiter giving up at the same time can tell
+ * whether the reply was already taken, see orphan_reply_indicator().
+ */
+static inline void fit_deliver_reply(ppc *ctx, unsigned int idx, int len)
+{
+	unsigned long ptr;
+	struct fit_orphan_reply *orphan;
+
+	get_reply_ready_ptr(ctx, idx);
+	ptr = (unsigned long)xchg(&ctx->reply_ready_indicators[idx], NULL);
+
+	if (unlikely(ptr & FIT_ORPHAN_REPLY)) {
+		orphan = (struct fit_orphan_reply *)(ptr & ~FIT_ORPHAN_REPLY);
+		kfree(orphan->buf);
+		kfree(orphan);
+		free_reply_indicator(ctx, idx);
+		return;
+	}
+
+	if (WARN_ON_ONCE(!ptr))
+		return;
+	memcpy((void *)ptr, &len, sizeof(int));
+}
+
+/*
+ * The reply to @checker timed out. Returns true if the reply may still
+ * land: @buf is owned by FIT from now on and freed with @idx once the
+ * reply comes. Returns false if the reply was already claimed, @checker
+ * is set then and the caller keeps @buf.
  */
+static bool orphan_reply_indicator(ppc *ctx, unsigned int idx,
+				   int *checker, void *buf)
+{
+	struct fit_orphan_reply *orphan;
+	void *tagged;
+
+	orphan = kmalloc(sizeof(*orphan), GFP_KERNEL);
+	if (unlikely(!orphan)) {
+		/* Nothing to quarantine with, give up @buf and @idx forever */
+		static int late_reply_sink;
+
+		if (cmpxchg(&ctx->reply_ready_indicators[idx], checker,
+			    &late_reply_sink) == checker)
+			return true;
+		goto claimed;
+	}
+
+	orphan->buf = buf;
+	tagged = (void *)((unsigned long)orphan | FIT_ORPHAN_REPLY);
+	if (cmpxchg(&ctx->reply_ready_indicators[idx], checker, tagged) == checker)
+		return true;
+	kfree(orphan);
+
+claimed:
+	/* The poll thread took it, the store is right behind */
+	while (READ_ONCE(*checker) == SEND_REPLY_WAIT)
+		cpu_relax();
+	free_reply_indicator(ctx, idx);
+	return false;
+}
+
 static inline unsigned int alloc_index_and_set_reply_indicator(ppc *ctx, void *addr)
 {
 	int idx;
@@ -384,13 +681,18 @@ struct lego_context *fit_init_ctx(ppc *ctx, int size, int rx_depth, int port,
 	for(i = 0; i < num_total_connections; i++)
 		ctx->atomic_buffer_cur_length[i]=-1;
 
-	ctx->cq = kmalloc(NUM_POLLING_THREADS * sizeof(struct ib_cq *), GFP_KERNEL);
+	if (fit_init_ctx_lanes(ctx)) {
+		pr_err("OOM\n");
+		return NULL;
+	}
+
+	ctx->cq = kmalloc(NUM_RECV_CQS * sizeof(struct ib_cq *), GFP_KERNEL);
 	if (!ctx->cq) {
 		pr_err("OOM\n");
 		return NULL;
 	}
 
-	for(i = 0; i < NUM_POLLING_THREADS; i++) {
+	for(i = 0; i < NUM_RECV_CQS; i++) {
 		/*
 		 * XXX
 		 * why choose rx_depth*4+1 this maginc number? Reason???
@@ -457,7 +759,7 @@ struct lego_context *fit_init_ctx(ppc *ctx, int size, int rx_depth, int port,
 		{
                 struct ib_qp_init_attr init_attr = {
                         .send_cq = ctx->send_cq[i],
-                        .recv_cq = ctx->cq[i % NUM_POLLING_THREADS],
+                        .recv_cq = ctx->cq[fit_recv_cq_index(i)],
                         .cap = {
                                 .max_send_wr = MAX_OUTSTANDING_SEND,
                                 .max_recv_wr = rx_depth,
@@ -569,6 +871,12 @@ fit_ib_reg_mr_addr_phys(ppc *ctx, void *addr, size_t length)
 static inline uintptr_t
 fit_ib_reg_mr_addr(ppc *ctx, void *addr, size_t length)
 {
+#ifdef CONFIG_FIT_MR_CACHE
+	u64 dma;
+
+	if (fit_mr_cache_lookup(ctx, addr, length, &dma))
+		return dma;
+#endif
 	return (uintptr_t)ib_dma_map_single((struct ib_device *)ctx->context,
 					    addr, length, DMA_BIDIRECTIONAL);
 }
@@ -1205,9 +1513,15 @@ int fit_send_message_with_rdma_write_with_imm_request(ppc *ctx, int connection_i
 	return 0;
 }
 
-inline int fit_get_connection_by_atomic_number(ppc *ctx, int target_node, int priority)
+inline int fit_get_connection_by_atomic_number(ppc *ctx, int target_node, int lane)
 {
-#ifdef CONFIG_SOCKET_O_IB
+#ifdef CONFIG_FIT_PRIORITY_LANES
+	unsigned int nr;
+
+	nr = atomic_inc_return(&ctx->lane_request_num[target_node * NR_FIT_LANES + lane]);
+	return FIT_CONNECTION_STRIDE * target_node + lane_qp_base[lane] +
+		nr % lane_nr_rr_qps[lane];
+#elif defined(CONFIG_SOCKET_O_IB)
 	return atomic_inc_return(&ctx->atomic_request_num[target_node]) % (atomic_read(&ctx->num_alive_connection[target_node]))
 			+ (NUM_PARALLEL_CONNECTION +1) * target_node;
 #else
@@ -1229,8 +1543,10 @@ int fit_receive_message_no_reply(ppc *ctx, unsigned int port, void *ret_addr, in
 
 	/*
 	 * Busy polling incoming message
+	 * Callers are handler threads that never schedule while waiting
 	 */
 	while(1) {
+		rcu_qs();
 		spin_lock(&ctx->imm_waitqueue_perport_lock[port]);
 		if (likely(!list_empty(&(ctx->imm_waitqueue_perport[port].list)))) {
 			new_request = list_entry(ctx->imm_waitqueue_perport[port].list.next,
@@ -1301,7 +1617,7 @@ void fit_ack_reply_callback(struct thpool_buffer *b)
 {
 	int last_ack, ack_flag = 0;
 	int reply_size, node_id, offset;
-	int reply_connection_id;
+	int reply_connection_id, lane;
 	void *reply_data;
 	ppc *ctx;
 	struct imm_message_metadata *request_metadata;
@@ -1354,7 +1670,9 @@ void fit_ack_reply_callback(struct thpool_buffer *b)
 	 * Step III
 	 * Reply message
 	 */
-        reply_connection_id = fit_get_connection_by_atomic_number(ctx, node_id, LOW_PRIORITY);
+	lane = fit_lane_of_msg(b->fit_rx, request_metadata->size, 0);
+	lane = fit_lane_of_reply(lane, reply_size);
+	reply_connection_id = fit_get_connection_by_atomic_number(ctx, node_id, lane);
 
 	/* Send it out. It is really a mess. */
 	fit_send_message_with_rdma_write_with_imm_request(ctx, reply_connection_id,
@@ -1380,8 +1698,10 @@ int fit_receive_message(ppc *ctx, unsigned int port, void *ret_addr, int receive
 
 	/*
 	 * Busy polling incoming message
+	 * Callers are handler threads that never schedule while waiting
 	 */
 	while(1) {
+		rcu_qs();
 		spin_lock(&ctx->imm_waitqueue_perport_lock[port]);
 		if (likely(!list_empty(&(ctx->imm_waitqueue_perport[port].list)))) {
 			new_request = list_entry(ctx->imm_waitqueue_perport[port].list.next,
@@ -1462,7 +1782,8 @@ int fit_receive_message(ppc *ctx, unsigned int port, void *ret_addr, int receive
 int fit_reply_message(ppc *ctx, void *addr, int size, uintptr_t descriptor, int userspace_flag, int if_poll_now)
 {
 	struct imm_message_metadata *tmp = (struct imm_message_metadata *)descriptor;
-	int re_connection_id = fit_get_connection_by_atomic_number(ctx, tmp->source_node_id, LOW_PRIORITY);
+	int re_connection_id = fit_get_connection_by_atomic_number(ctx, tmp->source_node_id,
+					fit_lane_of_reply(FIT_LANE_SYSCALL, size));
 
 	fit_debug("re_connection_id: %d, tmp->source_node_id: %d\n",
 		re_connection_id, tmp->source_node_id);
@@ -1481,7 +1802,8 @@ int fit_reply_message_w_extra_bits(ppc *ctx, void *addr, int size, int private_b
 {
 	int imm_data;
 	struct imm_message_metadata *tmp = (struct imm_message_metadata *)descriptor;
-	int re_connection_id = fit_get_connection_by_atomic_number(ctx, tmp->source_node_id, LOW_PRIORITY);
+	int re_connection_id = fit_get_connection_by_atomic_number(ctx, tmp->source_node_id,
+					fit_lane_of_reply(FIT_LANE_SYSCALL, size));
 
 	fit_debug("re_connection_id: %d, tmp->source_node_id: %d\n",
 		re_connection_id, tmp->source_node_id);
@@ -1830,6 +2152,34 @@ void *fit_alloc_memory_for_mr(unsigned int length)
 
 extern unsigned long	nr_recvcq_cqes[NUM_POLLING_THREADS];
 
+#ifdef CONFIG_FIT_PRIORITY_LANES
+extern unsigned long	nr_lane_cqes[NR_FIT_LANES];
+
+#define NR_POLL_WC	LANE_POLL_BUDGET_TOTAL
+
+/*
+ * Poll all lane recv_cqs owned by polling thread @recvcq_id.
+ * Lanes are polled in priority order, each one up to its budget,
+ * thus the returned @wc array has pcache lane CQEs at the front.
+ */
+static inline int fit_poll_recv_cq_lanes(ppc *ctx, int recvcq_id, struct ib_wc *wc)
+{
+	int lane, ne, total = 0;
+
+	for (lane = 0; lane < NR_FIT_LANES; lane++) {
+		ne = ib_poll_cq(ctx->cq[recvcq_id * NR_FIT_LANES + lane],
+				lane_poll_budget[lane], wc + total);
+		if (unlikely(ne < 0))
+			return ne;
+		nr_lane_cqes[lane] += ne;
+		total += ne;
+	}
+	return total;
+}
+#else
+#define NR_POLL_WC	NUM_PARALLEL_CONNECTION
+#endif
+
 /*
  * HACK!!!
  *
@@ -1846,15 +2196,19 @@ static int fit_poll_recv_cq(void *_info)
 	int node_id, port, offset;
 	int reply_indicator_index, length;
 	struct ib_wc *wc;
+#ifndef CONFIG_FIT_PRIORITY_LANES
 	struct ib_cq *target_cq;
+#endif
 	struct thread_pass_struct *info = _info;
 
 	/* Info passedd down by creater */
 	ctx = info->ctx;
+#ifndef CONFIG_FIT_PRIORITY_LANES
 	target_cq = info->target_cq;
+#endif
 	recvcq_id = info->recvcq_id;
 
-	wc = kmalloc(sizeof(*wc) * NUM_PARALLEL_CONNECTION, GFP_KERNEL);
+	wc = kmalloc(sizeof(*wc) * NR_POLL_WC, GFP_KERNEL);
 	BUG_ON(!wc);
 
 	if (pin_current_thread())
@@ -1863,11 +2217,16 @@ static int fit_poll_recv_cq(void *_info)
 	while(1) {
 		/* We keep polling this CQ */
 		do {
+#ifdef CONFIG_FIT_PRIORITY_LANES
+			ne = fit_poll_recv_cq_lanes(ctx, recvcq_id, wc);
+#else
 			ne = ib_poll_cq(target_cq, NUM_PARALLEL_CONNECTION, wc);
+#endif
 			if (unlikely(ne < 0)) {
 				fit_err("poll_cq error: %d", ne);
 				return ne;
 			}
+			rcu_qs();
 		} while (ne < 1);
 
 		/* Update stats */
@@ -1950,8 +2309,6 @@ static int fit_poll_recv_cq(void *_info)
 					 * This is the sender's handling reply part.
 					 * The incoming message is the reply sent by remote.
 					 */
-					void *dst_ptr;
-
 					length = wc[i].byte_len;
 					reply_indicator_index = wc[i].ex.imm_data & IMM_GET_REPLY_INDICATOR_INDEX;
 					if (unlikely(reply_indicator_index <= 0 ||
@@ -1965,8 +2322,7 @@ static int fit_poll_recv_cq(void *_info)
 					 * The thread who did ibapi_send_reply() is busy polling
 					 * this shared memory. This memcpy will release it.
 					 */
-					dst_ptr = get_reply_ready_ptr(ctx, reply_indicator_index);
-					memcpy(dst_ptr, &length, sizeof(int));
+					fit_deliver_reply(ctx, reply_indicator_index, length);
 				} else if (wc[i].ex.imm_data & IMM_ACK || wc[i].byte_len == 0) {
 					struct send_and_reply_format *recv;
 
@@ -1986,7 +2342,6 @@ static int fit_poll_recv_cq(void *_info)
 				} else if (wc[i].ex.imm_data & IMM_REPLY_W_EXTRA_BITS) {
 					/* Handle reply with extra bits */
 					int reply_data, private_bits;
-					void *dst_ptr;
 
 					length = wc[i].byte_len;
 					reply_indicator_index = wc[i].ex.imm_data & IMM_GET_REPLY_INDICATOR_INDEX;
@@ -1997,8 +2352,7 @@ static int fit_poll_recv_cq(void *_info)
 						reply_indicator_index, wc[i].byte_len, private_bits,
 						ctx->reply_ready_indicators[reply_indicator_index]);
 
-					dst_ptr = get_reply_ready_ptr(ctx, reply_indicator_index);
-					memcpy(dst_ptr, &reply_data, sizeof(int));
+					fit_deliver_reply(ctx, reply_indicator_index, reply_data);
 				} else {
 					fit_err("Unknown wc.ex.imm_data: %#lx", wc[i].ex.imm_data);
 					WARN_ON_ONCE(1);
@@ -2135,8 +2489,6 @@ int sock_poll_cq(void *in)
 					}
 					else //handle reply
 					{
-						void *dst_ptr;
-
 						length = wc[i].byte_len;
 						reply_indicator_index = wc[i].ex.imm_data & IMM_GET_REPLY_INDICATOR_INDEX;
 						//printk(KERN_CRIT "%s: case 2 reply_indicator_index-%d len-%d\n", __func__, reply_indicator_index, wc[i].byte_len);
@@ -2144,8 +2496,7 @@ int sock_poll_cq(void *in)
 						fit_debug("case 2 reply_indicator_index-%d len-%d inboxaddr %lx\n",
 							reply_indicator_index, wc[i].byte_len, ctx->reply_ready_indicators[reply_indicator_index]);
 
-						dst_ptr = get_reply_ready_ptr(ctx, reply_indicator_index);
-						memcpy(dst_ptr, &length, sizeof(int));
+						fit_deliver_reply(ctx, reply_indicator_index, length);
 					}
 				}
 
@@ -2188,8 +2539,10 @@ static int waiting_queue_handler(void *_ctx)
 
 	pin_current_thread();
 	while (1) {
-		while (!atomic_read(&nr_wq_jobs))
+		while (!atomic_read(&nr_wq_jobs)) {
+			rcu_qs();
 			cpu_relax();
+		}
 
 		new_request = dequeue_wq();
 
@@ -2307,6 +2660,153 @@ int fit_send_request(ppc *ctx, int connection_id, enum mode s_mode,
 	return 0;
 }
 
+#ifdef CONFIG_FIT_ONESIDED_READ
+/* One outstanding READ, wr_id points to it */
+struct fit_onesided_req {
+	int			done;
+	enum ib_wc_status	status;
+};
+
+/*
+ * Reap READ completions of @conn, ours or anyone else's.
+ * Return 0 or the error of ib_poll_cq().
+ */
+static int fit_onesided_reap(ppc *ctx, int conn)
+{
+	struct fit_onesided_req *req;
+	struct ib_wc wc;
+	int ne;
+
+	while ((ne = ib_poll_cq(ctx->send_cq[conn], 1, &wc)) > 0) {
+		req = (struct fit_onesided_req *)(unsigned long)wc.wr_id;
+		req->status = wc.status;
+		smp_store_release(&req->done, 1);
+	}
+	return ne;
+}
+
+/*
+ * The READ of @req did not complete in time. The HCA may still write
+ * into the buffer, so it must not be reused yet. Move the QP to error
+ * state, which flushes all posted READs, and wait for ours. The QP is
+ * not used for one-sided READs anymore.
+ */
+static void fit_onesided_quiesce(ppc *ctx, int node, int conn,
+				 struct fit_onesided_req *req)
+{
+	struct ib_qp_attr attr = {
+		.qp_state	= IB_QPS_ERR,
+	};
+
+	spin_lock(&ctx->onesided_lock[node]);
+	if (!ctx->onesided_dead[node]) {
+		ctx->onesided_dead[node] = 1;
+		if (ib_modify_qp(ctx->qp[conn], &attr, IB_QP_STATE))
+			fit_err("Fail to move QP to ERR. conn: %d", conn);
+		pr_warn("one-sided READ to node %d disabled\n", node);
+	}
+	spin_unlock(&ctx->onesided_lock[node]);
+
+	while (!smp_load_acquire(&req->done)) {
+		if (fit_onesided_reap(ctx, conn) < 0)
+			WARN_ON_ONCE(1);
+		cpu_relax();
+	}
+}
+
+/*
+ * One-sided RDMA READ @size bytes at @remote_addr of @target_node into
+ * local kernel buffer @addr. Concurrent READs share the QP, the lock
+ * only covers posting. Each waiter reaps any completion and marks the
+ * request it belongs to.
+ *
+ * The READ is never outstanding when we return, even on failures,
+ * so @addr can be reused right away. A timeout disables one-sided
+ * READs to @target_node, see fit_onesided_quiesce().
+ *
+ * Return:
+ * 0 on success, -EOPNOTSUPP if no QP is usable, other negative
+ * values on failures.
+ */
+int fit_rdma_read(ppc *ctx, int target_node, void *addr, u64 remote_addr,
+		  u32 rkey, int size)
+{
+	struct ib_send_wr wr, *bad_wr = NULL;
+	struct fit_onesided_req req;
+	struct ib_sge sge;
+	int connection_id, ret;
+	unsigned long start_ns;
+
+	if (unlikely(onesided_qp < 0 || ctx->onesided_dead[target_node]))
+		return -EOPNOTSUPP;
+
+	connection_id = FIT_CONNECTION_STRIDE * target_node + onesided_qp;
+
+	req.done = 0;
+	req.status = IB_WC_SUCCESS;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr_id = (unsigned long)&req;
+	wr.opcode = IB_WR_RDMA_READ;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	wr.send_flags = IB_SEND_SIGNALED;
+	wr.wr.rdma.remote_addr = remote_addr;
+	wr.wr.rdma.rkey = rkey;
+
+	sge.addr = fit_ib_reg_mr_addr(ctx, addr, size);
+	sge.length = size;
+	sge.lkey = ctx->proc->lkey;
+
+	spin_lock(&ctx->onesided_lock[target_node]);
+	if (unlikely(ctx->onesided_dead[target_node]))
+		ret = -EOPNOTSUPP;
+	else
+		ret = ib_post_send(ctx->qp[connection_id], &wr, &bad_wr);
+	spin_unlock(&ctx->onesided_lock[target_node]);
+	if (unlikely(ret)) {
+		if (ret != -EOPNOTSUPP)
+			fit_err("Fail to post READ. conn: %d err: %d", connection_id, ret);
+		return ret;
+	}
+
+	start_ns = sched_clock();
+	while (!smp_load_acquire(&req.done)) {
+		ret = fit_onesided_reap(ctx, connection_id);
+		if (unlikely(ret < 0)) {
+			fit_err("Fail to poll send_cq. Err: %d", ret);
+			fit_onesided_quiesce(ctx, target_node, connection_id, &req);
+			return ret;
+		}
+
+		if (unlikely(sched_clock() - start_ns > FIT_POLL_CQ_TIMEOUT_NS)) {
+			pr_info_once("Fail to get READ CQE. conn: %d node: %d\n",
+				connection_id, target_node);
+			WARN_ON_ONCE(1);
+			fit_onesided_quiesce(ctx, target_node, connection_id, &req);
+			return -ETIMEDOUT;
+		}
+		cpu_relax();
+	}
+
+	if (unlikely(req.status != IB_WC_SUCCESS)) {
+		fit_err("wc.status: %s", ib_wc_status_msg(req.status));
+		return -EIO;
+	}
+	return 0;
+}
+
+u32 fit_get_local_rkey(ppc *ctx)
+{
+	return ctx->proc->rkey;
+}
+
+u64 fit_get_dma_addr(ppc *ctx, void *addr, int size)
+{
+	return fit_ib_reg_mr_addr(ctx, addr, size);
+}
+#endif /* CONFIG_FIT_ONESIDED_READ */
+
 /*
  * Return:
  * Negative values on failues
@@ -2323,7 +2823,7 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 	uint32_t remote_rkey;
 	struct fit_ibv_mr *remote_mr;
 	struct imm_message_metadata msg_header;
-	int last_ack;
+	int last_ack, lane;
 	int ret;
 
 	BUG_ON(!addr);
@@ -2334,6 +2834,9 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 		return -EINVAL;
 	}
 
+	lane = fit_lane_of_msg(addr, size, 0);
+	fit_lane_enter(ctx, target_node, lane);
+
 	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
 	/* If hits the end of ring, write start from 0 directly */
 	if (ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)
@@ -2357,7 +2860,7 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 
 	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
 
-	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
+	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, lane);
 
 	imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
@@ -2377,6 +2880,7 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 			(uintptr_t)remote_addr, addr, size, tar_offset_start, imm_data,
 			FIT_SEND_MESSAGE_HEADER_AND_IMM, &msg_header, 0);
 
+	fit_lane_exit(ctx, target_node, lane);
 	return ret;
 }
 
@@ -2404,7 +2908,7 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 	struct imm_message_metadata msg_header;
 	int last_ack;
 	unsigned long start_time;
-	int reply_length;
+	int reply_length, lane;
 
 	int local_reply_ready_checker = SEND_REPLY_WAIT;
 
@@ -2419,6 +2923,9 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 		return -EINVAL;
 	}
 
+	lane = fit_lane_of_msg(addr, size, max_ret_size);
+	fit_lane_enter(ctx, target_node, lane);
+
 	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
 	/* If hits the end of ring, write start from 0 directly */
 	if (ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)
@@ -2442,7 +2949,7 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 
 	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
 
-	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
+	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, lane);
 
 	reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker);
 
@@ -2500,10 +3007,12 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 			print_pcache_events();
 			print_profile_points();
 			dump_ib_stats();
+			fit_lane_exit(ctx, target_node, lane);
 			return -ETIMEDOUT;
 		}
 	}
 	free_reply_indicator(ctx, reply_indicator_index);
+	fit_lane_exit(ctx, target_node, lane);
 	reply_length = local_reply_ready_checker;
 
 	if (unlikely(reply_length < 0)) {
@@ -2536,7 +3045,7 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 	struct imm_message_metadata msg_header;
 	int last_ack;
 	unsigned long start_time;
-	int reply_length;
+	int reply_length, lane;
 
 	real_size = size + sizeof(struct imm_message_metadata);
 	if(real_size > IMM_MAX_SIZE) {
@@ -2545,6 +3054,9 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 		return -1;
 	}
 
+	lane = fit_lane_of_msg(addr, size, max_ret_size);
+	fit_lane_enter(ctx, target_node, lane);
+
 	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
 	if(ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)//If hits the end of ring, write start from 0 directly
 		ctx->remote_rdma_ring_mrs_offset[target_node] = real_size;//Record the last point
@@ -2568,7 +3080,7 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 
 	remote_mr = &(ctx->remote_rdma_ring_mrs[target_node]);
 
-	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
+	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, lane);
 
 	reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker);
 
@@ -2622,6 +3134,7 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 		if (unlikely(time_after(jiffies, start_time + timeout_sec * HZ))) {
 			pr_warn("ibapi_send_reply() polling timeout (%u ms), caller: %pS\n",
 				jiffies_to_msecs(jiffies - start_time), caller);
+			fit_lane_exit(ctx, target_node, lane);
 			return -ETIMEDOUT;
 		}
 	}
@@ -2661,6 +3174,8 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
 	*ret_private_bits = local_reply_ready_checker & 0xff;
 #endif
 
+	fit_lane_exit(ctx, target_node, lane);
+
 	if (reply_length < 0)
 	{
 		printk(KERN_CRIT "%s: [significant error] send-reply-imm fail with connection-%d inbox-%d reply-length-%d\n",
@@ -2677,6 +3192,15 @@ int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int targe
  * @target_node: target node array
  * @sglist: message array to be sent to the nodes
  * @output_msg: array of reply message buffer
+ *
+ * All requests are posted before waiting for any reply, so the
+ * remote nodes handle them in parallel. @target_node entries must
+ * be distinct. Return the number of successful replies, the reply
+ * length of each one is stored in @output_msg[i].len.
+ *
+ * @output_msg buffers must come from kmalloc(). On -ETIMEDOUT, those
+ * whose reply is still due are taken over and their addr is set to
+ * NULL, they are freed once the late reply has landed.
  */
 int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 						struct fit_sglist *sglist, struct fit_sglist *output_msg,
@@ -2685,9 +3209,10 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 {
 	int tar_offset_start;
 	int connection_id;
-	int reply_indicator_index;
 	int imm_data;
 	int *local_reply_ready_checker;
+	int *reply_indicator_index;
+	int *lane;
 	int real_size;
 	void *remote_addr;
 	uint32_t remote_rkey;
@@ -2695,38 +3220,46 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 	struct imm_message_metadata *msg_header;
 	int last_ack;
 	unsigned long start_time;
-        int ret = 0;
-
-        int i;
-	//struct ib_device *ibd = (struct ib_device *)ctx->context;
+	int ret = 0;
+	int i;
 
-        if(!sglist || !target_node || !output_msg || !num_nodes)
-        {
+	if (!sglist || !target_node || !output_msg || !num_nodes) {
 		printk(KERN_CRIT "%s: null input target_node %p input list %p output_msg %p\n",
 				__func__, target_node, sglist, output_msg);
-                return -2;
-        }
-
-        local_reply_ready_checker = kmalloc(sizeof(int) * num_nodes, GFP_KERNEL);
-        msg_header = kmalloc(sizeof(struct imm_message_metadata) * num_nodes, GFP_KERNEL);
+		return -EINVAL;
+	}
 
-        for (i = 0; i < num_nodes; i++)
-        {
-                local_reply_ready_checker[i] = SEND_REPLY_WAIT;
-                if (target_node[i] <= 0)
-                {
-                        printk(KERN_CRIT "%s: target %d node %d\n",
+	/* Check all of them before anything is sent out */
+	for (i = 0; i < num_nodes; i++) {
+		if (target_node[i] < 0 || target_node[i] >= ctx->num_node) {
+			printk(KERN_CRIT "%s: target %d node %d\n",
 				__func__, i, target_node[i]);
-                        ret = -2;
-			goto out;
-                }
-                real_size = sglist[i].len + sizeof(struct imm_message_metadata);
-	        if(real_size > IMM_MAX_SIZE)
-		{
-			printk(KERN_CRIT "%s: target %d, message size %d + header is larger than max size %d\n", __func__, i, real_size, IMM_MAX_SIZE);
-			ret = -1;
-			goto out;
+			return -EINVAL;
+		}
+
+		real_size = sglist[i].len + sizeof(struct imm_message_metadata);
+		if (real_size > IMM_MAX_SIZE) {
+			printk(KERN_CRIT "%s: target %d, message size %d + header is larger than max size %d\n",
+				__func__, i, real_size, IMM_MAX_SIZE);
+			return -EINVAL;
 		}
+	}
+
+	local_reply_ready_checker = kmalloc(sizeof(int) * num_nodes, GFP_KERNEL);
+	reply_indicator_index = kmalloc(sizeof(int) * num_nodes, GFP_KERNEL);
+	lane = kmalloc(sizeof(int) * num_nodes, GFP_KERNEL);
+	msg_header = kmalloc(sizeof(struct imm_message_metadata) * num_nodes, GFP_KERNEL);
+	if (!local_reply_ready_checker || !reply_indicator_index || !lane || !msg_header) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < num_nodes; i++) {
+		local_reply_ready_checker[i] = SEND_REPLY_WAIT;
+		real_size = sglist[i].len + sizeof(struct imm_message_metadata);
+
+		lane[i] = fit_lane_of_msg(sglist[i].addr, sglist[i].len, max_ret_size);
+		fit_lane_enter(ctx, target_node[i], lane[i]);
 
 		spin_lock(&ctx->remote_imm_offset_lock[target_node[i]]);
 		if(ctx->remote_rdma_ring_mrs_offset[target_node[i]] + real_size >= RDMA_RING_SIZE)//If hits the end of ring, write start from 0 directly
@@ -2747,16 +3280,16 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 		}
 
 		remote_mr = &(ctx->remote_rdma_ring_mrs[target_node[i]]);
-		connection_id = fit_get_connection_by_atomic_number(ctx, target_node[i], LOW_PRIORITY);
-		reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker[i]);
-                imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
+		connection_id = fit_get_connection_by_atomic_number(ctx, target_node[i], lane[i]);
+		reply_indicator_index[i] = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker[i]);
+		imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
 		if (if_use_ret_phys_addr == 1)
 			msg_header[i].reply_addr = fit_ib_reg_mr_addr_phys(ctx, output_msg[i].addr, max_ret_size);
 		else
 			msg_header[i].reply_addr = fit_ib_reg_mr_addr(ctx, output_msg[i].addr, max_ret_size);
 		msg_header[i].reply_rkey = ctx->proc->rkey;
-		msg_header[i].reply_indicator_index = reply_indicator_index;
+		msg_header[i].reply_indicator_index = reply_indicator_index[i];
 		msg_header[i].source_node_id = ctx->node_id;
 		msg_header[i].size = real_size - sizeof(struct imm_message_metadata);
 		remote_addr = remote_mr->addr;
@@ -2779,37 +3312,49 @@ int fit_multicast_send_reply(ppc *ctx, int num_nodes, int *target_node,
 
 	start_time = jiffies;
 
-	for (i = 0; i < num_nodes; i++)
-	{
-		while(local_reply_ready_checker[i]==SEND_REPLY_WAIT)
-		{
+	for (i = 0; i < num_nodes; i++) {
+		while (local_reply_ready_checker[i] == SEND_REPLY_WAIT) {
 			cpu_relax();
 			if (unlikely(time_after(jiffies, start_time + timeout_sec * HZ))) {
 				pr_warn("%s CPU:%d PID:%d timeout (%u ms), caller: %pS\n",
 						__func__, smp_processor_id(), current->pid,
 						jiffies_to_msecs(jiffies - start_time), caller);
-				return -ETIMEDOUT;
+				goto timeout;
 			}
 		}
-		if(local_reply_ready_checker[i] < 0)
-		{
+		free_reply_indicator(ctx, reply_indicator_index[i]);
+		fit_lane_exit(ctx, target_node[i], lane[i]);
+
+		if (local_reply_ready_checker[i] < 0) {
 			printk(KERN_CRIT "%s: [significant error] send-reply-imm fail with target %d node %d status-%d\n",
 					__func__, i, target_node[i], local_reply_ready_checker[i]);
-		}
-		else
-		{
+		} else
 			ret++;
-		}
 		output_msg[i].len = local_reply_ready_checker[i];
 	}
+	goto out;
 
-	if (1) {
-		panic("If used, patch the usage reply_indicator. "
-		      "Similar to send_reply part.");
+timeout:
+	/*
+	 * Release what is left. A late reply must not hit the checkers, and
+	 * may still write into its buffer: FIT takes the buffer over.
+	 */
+	for (; i < num_nodes; i++) {
+		if (local_reply_ready_checker[i] == SEND_REPLY_WAIT &&
+		    orphan_reply_indicator(ctx, reply_indicator_index[i],
+					   &local_reply_ready_checker[i],
+					   output_msg[i].addr))
+			output_msg[i].addr = NULL;
+		else
+			free_reply_indicator(ctx, reply_indicator_index[i]);
+		fit_lane_exit(ctx, target_node[i], lane[i]);
 	}
+	ret = -ETIMEDOUT;
 
 out:
 	kfree(local_reply_ready_checker);
+	kfree(reply_indicator_index);
+	kfree(lane);
 	kfree(msg_header);
 
 	return ret;
@@ -3007,7 +3552,7 @@ retry:
 	for (i = 0; i < NUM_POLLING_THREADS; i++) {
 		info[i].recvcq_id = i;
 		info[i].ctx = ctx;
-		info[i].target_cq = ctx->cq[i];
+		info[i].target_cq = ctx->cq[i * NUM_RECV_CQS / NUM_POLLING_THREADS];
 		kthread_run(fit_poll_recv_cq, &info[i], "FIT_RecvCQ-%d", i);
 	}
 
@@ -67,6 +67,17 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 					       int size, int userspace_flag);
 int fit_receive_message_no_reply(ppc *ctx, unsigned int port, void *ret_addr, int receive_size, int userspace_flag);
 
+#ifdef CONFIG_FIT_MR_CACHE
+bool fit_mr_cache_lookup(ppc *ctx, void *addr, size_t len, u64 *dma);
+#endif
+
+#ifdef CONFIG_FIT_ONESIDED_READ
+int fit_rdma_read(ppc *ctx, int target_node, void *addr, u64 remote_addr,
+		  u32 rkey, int size);
+u32 fit_get_local_rkey(ppc *ctx);
+u64 fit_get_dma_addr(ppc *ctx, void *addr, int size);
+#endif
+
 int fit_reply_message(ppc *ctx, void *addr, int size, uintptr_t descriptor, int userspace_flag, int if_poll_now);
 int fit_reply_message_w_extra_bits(ppc *ctx, void *addr, int size, int private_bits, uintptr_t descriptor, int userspace_flag, int if_poll_now);
 int fit_receive_message(ppc *ctx, unsigned int port, void *ret_addr, int receive_size, uintptr_t *reply_descriptor, int userspace_flag);
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Registered buffer pool and registration cache
+ *
+ * FIT registers one DMA MR covering all memory (ctx->proc), so registering
+ * a buffer means translating it with ib_dma_map_single() before every post.
+ * Here we remember the DMA address of long-lived physically contiguous
+ * regions: the huge chunks backing the buffer pool below, and regions
+ * registered by others such as pcache lines and thpool buffers. An sge
+ * that falls into a known region is translated by offset.
+ *
+ * The pool hands out power-of-two buffers carved from 2MB chunks.
+ * Large reply destinations allocated from here can be RDMA-written by
+ * remote directly, without kmalloc and mapping on each call.
+ */
+
+#include <lego/mm.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/spinlock.h>
+#include <rdma/ib_verbs.h>
+#include <lego/fit_ibapi.h>
+#include "fit.h"
+#include "fit_internal.h"
+
+#define FIT_MR_CHUNK_ORDER	(21 - PAGE_SHIFT)
+#define FIT_MR_CHUNK_SIZE	(PAGE_SIZE << FIT_MR_CHUNK_ORDER)
+#define FIT_MR_NR_CLASSES	(FIT_MR_CHUNK_ORDER + 1)
+#define FIT_MR_MAX_REGIONS	(CONFIG_FIT_MR_POOL_MAX_CHUNKS + 16)
+
+struct fit_mr_region {
+	unsigned long		start;
+	unsigned long		end;
+	u64			dma;		/* 0 if not mapped yet */
+	bool			pool;		/* chunk of the buffer pool */
+};
+
+/*
+ * Regions are append-only. A new region is fully written
+ * before nr_regions is bumped, so lookup is lockless.
+ */
+static struct fit_mr_region fit_mr_regions[FIT_MR_MAX_REGIONS];
+static int nr_regions;
+static int nr_chunks;
+static DEFINE_SPINLOCK(fit_mr_regions_lock);
+
+/* Per size class free buffers, linked through their first word */
+static void *fit_mr_free_list[FIT_MR_NR_CLASSES];
+static DEFINE_SPINLOCK(fit_mr_pool_lock);
+
+static int __fit_mr_register(void *addr, size_t len, bool pool)
+{
+	struct fit_mr_region *r;
+	int ret = 0;
+
+	spin_lock(&fit_mr_regions_lock);
+	if (nr_regions >= FIT_MR_MAX_REGIONS ||
+	    (pool && nr_chunks >= CONFIG_FIT_MR_POOL_MAX_CHUNKS)) {
+		ret = -ENOSPC;
+		goto unlock;
+	}
+
+	r = &fit_mr_regions[nr_regions];
+	r->start = (unsigned long)addr;
+	r->end = (unsigned long)addr + len;
+	r->dma = 0;
+	r->pool = pool;
+	smp_wmb();
+	nr_regions++;
+	if (pool)
+		nr_chunks++;
+unlock:
+	spin_unlock(&fit_mr_regions_lock);
+	return ret;
+}
+
+/**
+ * ibapi_register_dma_region - cache the DMA address of a region
+ * @addr: kernel virtual address, must be physically contiguous
+ * @len: length in bytes
+ *
+ * The region must live forever. This can be called before FIT is up,
+ * the DMA address is resolved upon first use.
+ */
+int ibapi_register_dma_region(void *addr, size_t len)
+{
+	int ret;
+
+	ret = __fit_mr_register(addr, len, false);
+	if (ret)
+		pr_warn("%s(): fail to register [%p - %p]\n",
+			__func__, addr, addr + len);
+	return ret;
+}
+
+/*
+ * Return true and fill @dma if [@addr, @addr + @len) is inside a
+ * registered region.
+ */
+bool fit_mr_cache_lookup(ppc *ctx, void *addr, size_t len, u64 *dma)
+{
+	unsigned long start = (unsigned long)addr;
+	struct fit_mr_region *r;
+	int i, nr;
+
+	nr = READ_ONCE(nr_regions);
+	smp_rmb();
+
+	for (i = 0; i < nr; i++) {
+		r = &fit_mr_regions[i];
+		if (start < r->start || start + len > r->end)
+			continue;
+
+		/* Benign race, the result is always the same */
+		if (unlikely(!r->dma))
+			r->dma = ib_dma_map_single((struct ib_device *)ctx->context,
+						   (void *)r->start,
+						   r->end - r->start,
+						   DMA_BIDIRECTIONAL);
+		*dma = r->dma + (start - r->start);
+		return true;
+	}
+	return false;
+}
+
+static inline int size_to_class(size_t size)
+{
+	if (size <= PAGE_SIZE)
+		return 0;
+	return order_base_2(DIV_ROUND_UP(size, PAGE_SIZE));
+}
+
+/* Carve a new chunk into buffers of @class */
+static int fit_mr_refill(int class)
+{
+	unsigned long chunk, buf, size;
+
+	if (READ_ONCE(nr_chunks) >= CONFIG_FIT_MR_POOL_MAX_CHUNKS)
+		return -ENOSPC;
+
+	chunk = __get_free_pages(GFP_KERNEL, FIT_MR_CHUNK_ORDER);
+	if (!chunk)
+		return -ENOMEM;
+
+	if (__fit_mr_register((void *)chunk, FIT_MR_CHUNK_SIZE, true)) {
+		free_pages(chunk, FIT_MR_CHUNK_ORDER);
+		return -ENOSPC;
+	}
+
+	size = PAGE_SIZE << class;
+	spin_lock(&fit_mr_pool_lock);
+	for (buf = chunk; buf < chunk + FIT_MR_CHUNK_SIZE; buf += size) {
+		*(void **)buf = fit_mr_free_list[class];
+		fit_mr_free_list[class] = (void *)buf;
+	}
+	spin_unlock(&fit_mr_pool_lock);
+	return 0;
+}
+
+static void *fit_mr_pop(int class)
+{
+	void *buf;
+
+	spin_lock(&fit_mr_pool_lock);
+	buf = fit_mr_free_list[class];
+	if (buf)
+		fit_mr_free_list[class] = *(void **)buf;
+	spin_unlock(&fit_mr_pool_lock);
+	return buf;
+}
+
+/**
+ * ibapi_alloc_dma_buf - allocate a buffer to receive RDMA data
+ * @size: buffer size
+ *
+ * Buffers larger than a chunk, or allocated after the pool has reached
+ * its limit, fall back to kmalloc. Free with ibapi_free_dma_buf().
+ */
+void *ibapi_alloc_dma_buf(size_t size)
+{
+	void *buf;
+	int class;
+
+	if (unlikely(size > FIT_MR_CHUNK_SIZE))
+		return kmalloc(size, GFP_KERNEL);
+
+	class = size_to_class(size);
+
+	buf = fit_mr_pop(class);
+	if (!buf && !fit_mr_refill(class))
+		buf = fit_mr_pop(class);
+
+	if (unlikely(!buf))
+		buf = kmalloc(size, GFP_KERNEL);
+	return buf;
+}
+
+static bool fit_mr_in_pool(void *buf)
+{
+	unsigned long addr = (unsigned long)buf;
+	struct fit_mr_region *r;
+	int i, nr;
+
+	nr = READ_ONCE(nr_regions);
+	smp_rmb();
+
+	for (i = 0; i < nr; i++) {
+		r = &fit_mr_regions[i];
+		if (r->pool && addr >= r->start && addr < r->end)
+			return true;
+	}
+	return false;
+}
+
+void ibapi_free_dma_buf(void *buf, size_t size)
+{
+	int class;
+
+	if (!buf)
+		return;
+
+	if (size > FIT_MR_CHUNK_SIZE || !fit_mr_in_pool(buf)) {
+		kfree(buf);
+		return;
+	}
+
+	class = size_to_class(size);
+
+	spin_lock(&fit_mr_pool_lock);
+	*(void **)buf = fit_mr_free_list[class];
+	fit_mr_free_list[class] = buf;
+	spin_unlock(&fit_mr_pool_lock);
+}
@@ -365,6 +365,16 @@ ip_input(struct pbuf *p, struct netif *inp)
 			return ERR_OK;
 		}
 		iphdr = p->payload;
+#if LWIP_SHARDS > 1
+		/* fragments are reassembled in shard 0, hand TCP to its owner */
+		{
+			struct lwip_shard *owner = lwip_shard_steer(p);
+
+			if (owner != lwip_this_shard()) {
+				return lwip_shard_input(owner, p, inp);
+			}
+		}
+#endif /* LWIP_SHARDS > 1 */
 #else /* IP_REASSEMBLY == 0, no packet fragment reassembly code present */
 		pbuf_free(p);
 		LWIP_DEBUGF(IP_DEBUG | 2, ("IP packet dropped since it was fragmented (0x%"X16_F") (while IP_REASSEMBLY == 0).\n",
@@ -52,13 +52,21 @@
 
 #include "lego/string.h"
 
+#if LWIP_SHARDS == 1
 /* Incremented every coarse grained timer shot (typically every 500 ms). */
 u32_t tcp_ticks;
+#endif /* LWIP_SHARDS == 1 */
 const u8_t tcp_backoff[13] =
     { 1, 2, 3, 4, 5, 6, 7, 7, 7, 7, 7, 7, 7};
  /* Times per slowtmr hits */
 const u8_t tcp_persist_backoff[7] = { 3, 6, 12, 24, 48, 96, 120 };
 
+#if LWIP_SHARDS > 1
+/* The PCB lists and timer state live in struct lwip_shard */
+#define tcp_timer     (lwip_this_shard()->tcp.timer)
+#define tcp_port      (lwip_this_shard()->tcp.port)
+#define tcp_iss       (lwip_this_shard()->tcp.iss)
+#else
 /* The TCP PCB lists. */
 
 /** List of all TCP PCBs bound but not yet (connected || listening) */
@@ -74,6 +82,10 @@ struct tcp_pcb *tcp_tw_pcbs;
 struct tcp_pcb *tcp_tmp_pcb;
 
 static u8_t tcp_timer;
+static u16_t tcp_port = TCP_LOCAL_PORT_RANGE_START;
+static u32_t tcp_iss = 6510;
+#endif /* LWIP_SHARDS > 1 */
+
 static u16_t tcp_new_port(void);
 
 /**
@@ -440,16 +452,13 @@ static u16_t
 tcp_new_port(void)
 {
   struct tcp_pcb *pcb;
-#ifndef TCP_LOCAL_PORT_RANGE_START
-#define TCP_LOCAL_PORT_RANGE_START 4096
-#define TCP_LOCAL_PORT_RANGE_END   0x7fff
-#endif
-  static u16_t port = TCP_LOCAL_PORT_RANGE_START;
+  u16_t port;
   
  again:
-  if (++port > TCP_LOCAL_PORT_RANGE_END) {
-    port = TCP_LOCAL_PORT_RANGE_START;
+  if (++tcp_port > TCP_LOCAL_PORT_RANGE_END) {
+    tcp_port = TCP_LOCAL_PORT_RANGE_START;
   }
+  port = tcp_port;
   
   for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
     if (pcb->local_port == port) {
@@ -469,6 +478,29 @@ tcp_new_port(void)
   return port;
 }
 
+#if LWIP_SHARDS > 1
+/**
+ * Allocate a new local TCP port for a connection to ipaddr:port whose
+ * segments are steered to the current shard.
+ *
+ * @return a new (free) local TCP port number, or 0 if none is left
+ */
+static u16_t
+tcp_new_port_steered(struct ip_addr *ipaddr, u16_t port)
+{
+  u16_t local_port;
+  int i;
+
+  for (i = TCP_LOCAL_PORT_RANGE_START; i <= TCP_LOCAL_PORT_RANGE_END; i++) {
+    local_port = tcp_new_port();
+    if (lwip_flow_shard(ipaddr->addr, port, local_port) == lwip_this_shard()->id) {
+      return local_port;
+    }
+  }
+  return 0;
+}
+#endif /* LWIP_SHARDS > 1 */
+
 /**
  * Connects to another host. The function given as the "connected"
  * argument will be called when the connection has been established.
@@ -498,9 +530,22 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
     return ERR_VAL;
   }
   pcb->remote_port = port;
+#if LWIP_SHARDS > 1
+  if (pcb->local_port == 0) {
+    pcb->local_port = tcp_new_port_steered(ipaddr, port);
+    if (pcb->local_port == 0) {
+      return ERR_USE;
+    }
+  } else if (lwip_flow_shard(ipaddr->addr, port, pcb->local_port) != lwip_this_shard()->id) {
+    /* Replies would be steered to another shard */
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_connect: local port %"U16_F" belongs to another shard\n", pcb->local_port));
+    return ERR_VAL;
+  }
+#else
   if (pcb->local_port == 0) {
     pcb->local_port = tcp_new_port();
   }
+#endif /* LWIP_SHARDS > 1 */
   iss = tcp_next_iss();
   pcb->rcv_nxt = 0;
   pcb->snd_nxt = iss;
@@ -1219,10 +1264,8 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
 u32_t
 tcp_next_iss(void)
 {
-  static u32_t iss = 6510;
-  
-  iss += tcp_ticks;       /* XXX */
-  return iss;
+  tcp_iss += tcp_ticks;       /* XXX */
+  return tcp_iss;
 }
 
 #if TCP_CALCULATE_EFF_SEND_MSS
@@ -59,18 +59,14 @@
 
 /* These variables are global to all functions involved in the input
    processing of TCP segments. They are set by the tcp_input()
-   function. */
-static struct tcp_seg inseg;
-static struct tcp_hdr *tcphdr;
-static struct ip_hdr *iphdr;
-static u32_t seqno, ackno;
-static u8_t flags;
-static u16_t tcplen;
-
-static u8_t recv_flags;
-static struct pbuf *recv_data;
+   function. Each shard decodes its own segments. */
+#if LWIP_SHARDS > 1
+#define tcpin (lwip_this_shard()->tcp.in)
+#else
+static struct tcp_input_state tcpin;
 
 struct tcp_pcb *tcp_input_pcb;
+#endif /* LWIP_SHARDS > 1 */
 
 /* Forward declarations. */
 static err_t tcp_process(struct tcp_pcb *pcb);
@@ -102,15 +98,15 @@ tcp_input(struct pbuf *p, struct netif *inp)
   TCP_STATS_INC(tcp.recv);
   snmp_inc_tcpinsegs();
 
-  iphdr = p->payload;
-  tcphdr = (struct tcp_hdr *)((u8_t *)p->payload + IPH_HL(iphdr) * 4);
+  tcpin.iphdr = p->payload;
+  tcpin.tcphdr = (struct tcp_hdr *)((u8_t *)p->payload + IPH_HL(tcpin.iphdr) * 4);
 
 #if TCP_INPUT_DEBUG
-  tcp_debug_print(tcphdr);
+  tcp_debug_print(tcpin.tcphdr);
 #endif
 
   /* remove header from payload */
-  if (pbuf_header(p, -((s16_t)(IPH_HL(iphdr) * 4))) || (p->tot_len < sizeof(struct tcp_hdr))) {
+  if (pbuf_header(p, -((s16_t)(IPH_HL(tcpin.iphdr) * 4))) || (p->tot_len < sizeof(struct tcp_hdr))) {
     /* drop short packets */
     LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: short packet (%"U16_F" bytes) discarded\n", p->tot_len));
     TCP_STATS_INC(tcp.lenerr);
@@ -121,8 +117,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
   }
 
   /* Don't even process incoming broadcasts/multicasts. */
-  if (ip_addr_isbroadcast(&(iphdr->dest), inp) ||
-      ip_addr_ismulticast(&(iphdr->dest))) {
+  if (ip_addr_isbroadcast(&(tcpin.iphdr->dest), inp) ||
+      ip_addr_ismulticast(&(tcpin.iphdr->dest))) {
     TCP_STATS_INC(tcp.proterr);
     TCP_STATS_INC(tcp.drop);
     snmp_inc_tcpinerrs();
@@ -132,14 +128,14 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
 #if CHECKSUM_CHECK_TCP
   /* Verify TCP checksum. */
-  if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
-      (struct ip_addr *)&(iphdr->dest),
+  if (inet_chksum_pseudo(p, (struct ip_addr *)&(tcpin.iphdr->src),
+      (struct ip_addr *)&(tcpin.iphdr->dest),
       IP_PROTO_TCP, p->tot_len) != 0) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packet discarded due to failing checksum 0x%04"X16_F"\n",
-        inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src), (struct ip_addr *)&(iphdr->dest),
+        inet_chksum_pseudo(p, (struct ip_addr *)&(tcpin.iphdr->src), (struct ip_addr *)&(tcpin.iphdr->dest),
       IP_PROTO_TCP, p->tot_len)));
 #if TCP_DEBUG
-    tcp_debug_print(tcphdr);
+    tcp_debug_print(tcpin.tcphdr);
 #endif /* TCP_DEBUG */
     TCP_STATS_INC(tcp.chkerr);
     TCP_STATS_INC(tcp.drop);
@@ -151,7 +147,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
   /* Move the payload pointer in the pbuf so that it points to the
      TCP data instead of the TCP header. */
-  hdrlen = TCPH_HDRLEN(tcphdr);
+  hdrlen = TCPH_HDRLEN(tcpin.tcphdr);
   if(pbuf_header(p, -(hdrlen * 4))){
     /* drop short packets */
     LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: short packet\n"));
@@ -163,14 +159,14 @@ tcp_input(struct pbuf *p, struct netif *inp)
   }
 
   /* Convert fields in TCP header to host byte order. */
-  tcphdr->src = ntohs(tcphdr->src);
-  tcphdr->dest = ntohs(tcphdr->dest);
-  seqno = tcphdr->seqno = ntohl(tcphdr->seqno);
-  ackno = tcphdr->ackno = ntohl(tcphdr->ackno);
-  tcphdr->wnd = ntohs(tcphdr->wnd);
+  tcpin.tcphdr->src = ntohs(tcpin.tcphdr->src);
+  tcpin.tcphdr->dest = ntohs(tcpin.tcphdr->dest);
+  tcpin.seqno = tcpin.tcphdr->seqno = ntohl(tcpin.tcphdr->seqno);
+  tcpin.ackno = tcpin.tcphdr->ackno = ntohl(tcpin.tcphdr->ackno);
+  tcpin.tcphdr->wnd = ntohs(tcpin.tcphdr->wnd);
 
-  flags = TCPH_FLAGS(tcphdr) & TCP_FLAGS;
-  tcplen = p->tot_len + ((flags & TCP_FIN || flags & TCP_SYN)? 1: 0);
+  tcpin.flags = TCPH_FLAGS(tcpin.tcphdr) & TCP_FLAGS;
+  tcpin.tcplen = p->tot_len + ((tcpin.flags & TCP_FIN || tcpin.flags & TCP_SYN)? 1: 0);
 
   /* Demultiplex an incoming segment. First, we check if it is destined
      for an active connection. */
@@ -181,10 +177,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
     LWIP_ASSERT("tcp_input: active pcb->state != CLOSED", pcb->state != CLOSED);
     LWIP_ASSERT("tcp_input: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
     LWIP_ASSERT("tcp_input: active pcb->state != LISTEN", pcb->state != LISTEN);
-    if (pcb->remote_port == tcphdr->src &&
-       pcb->local_port == tcphdr->dest &&
-       ip_addr_cmp(&(pcb->remote_ip), &(iphdr->src)) &&
-       ip_addr_cmp(&(pcb->local_ip), &(iphdr->dest))) {
+    if (pcb->remote_port == tcpin.tcphdr->src &&
+       pcb->local_port == tcpin.tcphdr->dest &&
+       ip_addr_cmp(&(pcb->remote_ip), &(tcpin.iphdr->src)) &&
+       ip_addr_cmp(&(pcb->local_ip), &(tcpin.iphdr->dest))) {
 
       /* Move this PCB to the front of the list so that subsequent
          lookups will be faster (we exploit locality in TCP segment
@@ -206,10 +202,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
        in the TIME-WAIT state. */
     for(pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
       LWIP_ASSERT("tcp_input: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
-      if (pcb->remote_port == tcphdr->src &&
-         pcb->local_port == tcphdr->dest &&
-         ip_addr_cmp(&(pcb->remote_ip), &(iphdr->src)) &&
-         ip_addr_cmp(&(pcb->local_ip), &(iphdr->dest))) {
+      if (pcb->remote_port == tcpin.tcphdr->src &&
+         pcb->local_port == tcpin.tcphdr->dest &&
+         ip_addr_cmp(&(pcb->remote_ip), &(tcpin.iphdr->src)) &&
+         ip_addr_cmp(&(pcb->local_ip), &(tcpin.iphdr->dest))) {
         /* We don't really care enough to move this PCB to the front
            of the list since we are not very likely to receive that
            many segments for connections in TIME-WAIT. */
@@ -225,8 +221,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
     prev = NULL;
     for(lpcb = tcp_listen_pcbs.listen_pcbs; lpcb != NULL; lpcb = lpcb->next) {
       if ((ip_addr_isany(&(lpcb->local_ip)) ||
-        ip_addr_cmp(&(lpcb->local_ip), &(iphdr->dest))) &&
-        lpcb->local_port == tcphdr->dest) {
+        ip_addr_cmp(&(lpcb->local_ip), &(tcpin.iphdr->dest))) &&
+        lpcb->local_port == tcpin.tcphdr->dest) {
         /* Move this PCB to the front of the list so that subsequent
            lookups will be faster (we exploit locality in TCP segment
            arrivals). */
@@ -249,7 +245,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
 #if TCP_INPUT_DEBUG
   LWIP_DEBUGF(TCP_INPUT_DEBUG, ("+-+-+-+-+-+-+-+-+-+-+-+-+-+- tcp_input: flags "));
-  tcp_debug_print_flags(TCPH_FLAGS(tcphdr));
+  tcp_debug_print_flags(TCPH_FLAGS(tcpin.tcphdr));
   LWIP_DEBUGF(TCP_INPUT_DEBUG, ("-+-+-+-+-+-+-+-+-+-+-+-+-+-+\n"));
 #endif /* TCP_INPUT_DEBUG */
 
@@ -263,14 +259,14 @@ tcp_input(struct pbuf *p, struct netif *inp)
 #endif /* TCP_INPUT_DEBUG */
 
     /* Set up a tcp_seg structure. */
-    inseg.next = NULL;
-    inseg.len = p->tot_len;
-    inseg.dataptr = p->payload;
-    inseg.p = p;
-    inseg.tcphdr = tcphdr;
+    tcpin.inseg.next = NULL;
+    tcpin.inseg.len = p->tot_len;
+    tcpin.inseg.dataptr = p->payload;
+    tcpin.inseg.p = p;
+    tcpin.inseg.tcphdr = tcpin.tcphdr;
 
-    recv_data = NULL;
-    recv_flags = 0;
+    tcpin.recv_data = NULL;
+    tcpin.recv_flags = 0;
 
     /* If there is data which was previously "refused" by upper layer */
     if (pcb->refused_data != NULL) {
@@ -295,7 +291,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
     /* A return value of ERR_ABRT means that tcp_abort() was called
        and that the pcb has been freed. If so, we don't do anything. */
     if (err != ERR_ABRT) {
-      if (recv_flags & TF_RESET) {
+      if (tcpin.recv_flags & TF_RESET) {
         /* TF_RESET means that the connection was reset by the other
            end. We then call the error callback to inform the
            application that the connection is dead before we
@@ -303,7 +299,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
         TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_RST);
         tcp_pcb_remove(&tcp_active_pcbs, pcb);
         memp_free(MEMP_TCP_PCB, pcb);
-      } else if (recv_flags & TF_CLOSED) {
+      } else if (tcpin.recv_flags & TF_CLOSED) {
         /* The connection has been closed and we will deallocate the
            PCB. */
         tcp_pcb_remove(&tcp_active_pcbs, pcb);
@@ -317,24 +313,24 @@ tcp_input(struct pbuf *p, struct netif *inp)
           TCP_EVENT_SENT(pcb, pcb->acked, err);
         }
       
-        if (recv_data != NULL) {
-          if(flags & TCP_PSH) {
-            recv_data->flags |= PBUF_FLAG_PUSH;
+        if (tcpin.recv_data != NULL) {
+          if(tcpin.flags & TCP_PSH) {
+            tcpin.recv_data->flags |= PBUF_FLAG_PUSH;
           }
 
           /* Notify application that data has been received. */
-          TCP_EVENT_RECV(pcb, recv_data, ERR_OK, err);
+          TCP_EVENT_RECV(pcb, tcpin.recv_data, ERR_OK, err);
 
           /* If the upper layer can't receive this data, store it */
           if (err != ERR_OK) {
-            pcb->refused_data = recv_data;
+            pcb->refused_data = tcpin.recv_data;
             LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: keep incoming packet, because pcb is \"full\"\n"));
           }
         }
 
         /* If a FIN segment was received, we call the callback
            function with a NULL buffer to indicate EOF. */
-        if (recv_flags & TF_GOT_FIN) {
+        if (tcpin.recv_flags & TF_GOT_FIN) {
           TCP_EVENT_RECV(pcb, NULL, ERR_OK, err);
         }
 
@@ -347,10 +343,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
 
     /* give up our reference to inseg.p */
-    if (inseg.p != NULL)
+    if (tcpin.inseg.p != NULL)
     {
-      pbuf_free(inseg.p);
-      inseg.p = NULL;
+      pbuf_free(tcpin.inseg.p);
+      tcpin.inseg.p = NULL;
     }
 #if TCP_INPUT_DEBUG
 #if TCP_DEBUG
@@ -363,12 +359,12 @@ tcp_input(struct pbuf *p, struct netif *inp)
     /* If no matching PCB was found, send a TCP RST (reset) to the
        sender. */
     LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_input: no PCB match found, resetting.\n"));
-    if (!(TCPH_FLAGS(tcphdr) & TCP_RST)) {
+    if (!(TCPH_FLAGS(tcpin.tcphdr) & TCP_RST)) {
       TCP_STATS_INC(tcp.proterr);
       TCP_STATS_INC(tcp.drop);
-      tcp_rst(ackno, seqno + tcplen,
-        &(iphdr->dest), &(iphdr->src),
-        tcphdr->dest, tcphdr->src);
+      tcp_rst(tcpin.ackno, tcpin.seqno + tcpin.tcplen,
+        &(tcpin.iphdr->dest), &(tcpin.iphdr->src),
+        tcpin.tcphdr->dest, tcpin.tcphdr->src);
     }
     pbuf_free(p);
   }
@@ -397,15 +393,15 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
-  if (flags & TCP_ACK) {
+  if (tcpin.flags & TCP_ACK) {
     /* For incoming segments with the ACK flag set, respond with a
        RST. */
     LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_listen_input: ACK in LISTEN, sending reset\n"));
-    tcp_rst(ackno + 1, seqno + tcplen,
-      &(iphdr->dest), &(iphdr->src),
-      tcphdr->dest, tcphdr->src);
-  } else if (flags & TCP_SYN) {
-    LWIP_DEBUGF(TCP_DEBUG, ("TCP connection request %"U16_F" -> %"U16_F".\n", tcphdr->src, tcphdr->dest));
+    tcp_rst(tcpin.ackno + 1, tcpin.seqno + tcpin.tcplen,
+      &(tcpin.iphdr->dest), &(tcpin.iphdr->src),
+      tcpin.tcphdr->dest, tcpin.tcphdr->src);
+  } else if (tcpin.flags & TCP_SYN) {
+    LWIP_DEBUGF(TCP_DEBUG, ("TCP connection request %"U16_F" -> %"U16_F".\n", tcpin.tcphdr->src, tcpin.tcphdr->dest));
 #if TCP_LISTEN_BACKLOG
     if (pcb->accepts_pending >= pcb->backlog) {
       return ERR_ABRT;
@@ -424,15 +420,15 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
     pcb->accepts_pending++;
 #endif /* TCP_LISTEN_BACKLOG */
     /* Set up the new PCB. */
-    ip_addr_set(&(npcb->local_ip), &(iphdr->dest));
+    ip_addr_set(&(npcb->local_ip), &(tcpin.iphdr->dest));
     npcb->local_port = pcb->local_port;
-    ip_addr_set(&(npcb->remote_ip), &(iphdr->src));
-    npcb->remote_port = tcphdr->src;
+    ip_addr_set(&(npcb->remote_ip), &(tcpin.iphdr->src));
+    npcb->remote_port = tcpin.tcphdr->src;
     npcb->state = SYN_RCVD;
-    npcb->rcv_nxt = seqno + 1;
-    npcb->snd_wnd = tcphdr->wnd;
+    npcb->rcv_nxt = tcpin.seqno + 1;
+    npcb->snd_wnd = tcpin.tcphdr->wnd;
     npcb->ssthresh = npcb->snd_wnd;
-    npcb->snd_wl1 = seqno - 1;/* initialise to seqno-1 to force window update */
+    npcb->snd_wl1 = tcpin.seqno - 1;/* initialise to seqno-1 to force window update */
     npcb->callback_arg = pcb->callback_arg;
 #if LWIP_CALLBACK_API
     npcb->accept = pcb->accept;
@@ -472,10 +468,10 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 static err_t
 tcp_timewait_input(struct tcp_pcb *pcb)
 {
-  if (TCP_SEQ_GT(seqno + tcplen, pcb->rcv_nxt)) {
-    pcb->rcv_nxt = seqno + tcplen;
+  if (TCP_SEQ_GT(tcpin.seqno + tcpin.tcplen, pcb->rcv_nxt)) {
+    pcb->rcv_nxt = tcpin.seqno + tcpin.tcplen;
   }
-  if (tcplen > 0) {
+  if (tcpin.tcplen > 0) {
     tcp_ack_now(pcb);
   }
   return tcp_output(pcb);
@@ -503,14 +499,14 @@ tcp_process(struct tcp_pcb *pcb)
   err = ERR_OK;
 
   /* Process incoming RST segments. */
-  if (flags & TCP_RST) {
+  if (tcpin.flags & TCP_RST) {
     /* First, determine if the reset is acceptable. */
     if (pcb->state == SYN_SENT) {
-      if (ackno == pcb->snd_nxt) {
+      if (tcpin.ackno == pcb->snd_nxt) {
         acceptable = 1;
       }
     } else {
-      if (TCP_SEQ_BETWEEN(seqno, pcb->rcv_nxt, 
+      if (TCP_SEQ_BETWEEN(tcpin.seqno, pcb->rcv_nxt, 
                           pcb->rcv_nxt+pcb->rcv_wnd)) {
         acceptable = 1;
       }
@@ -519,14 +515,14 @@ tcp_process(struct tcp_pcb *pcb)
     if (acceptable) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_process: Connection RESET\n"));
       LWIP_ASSERT("tcp_input: pcb->state != CLOSED", pcb->state != CLOSED);
-      recv_flags = TF_RESET;
+      tcpin.recv_flags = TF_RESET;
       pcb->flags &= ~TF_ACK_DELAY;
       return ERR_RST;
     } else {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_process: unacceptable reset seqno %"U32_F" rcv_nxt %"U32_F"\n",
-       seqno, pcb->rcv_nxt));
+       tcpin.seqno, pcb->rcv_nxt));
       LWIP_DEBUGF(TCP_DEBUG, ("tcp_process: unacceptable reset seqno %"U32_F" rcv_nxt %"U32_F"\n",
-       seqno, pcb->rcv_nxt));
+       tcpin.seqno, pcb->rcv_nxt));
       return ERR_OK;
     }
   }
@@ -538,16 +534,16 @@ tcp_process(struct tcp_pcb *pcb)
   /* Do different things depending on the TCP state. */
   switch (pcb->state) {
   case SYN_SENT:
-    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("SYN-SENT: ackno %"U32_F" pcb->snd_nxt %"U32_F" unacked %"U32_F"\n", ackno,
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("SYN-SENT: ackno %"U32_F" pcb->snd_nxt %"U32_F" unacked %"U32_F"\n", tcpin.ackno,
      pcb->snd_nxt, ntohl(pcb->unacked->tcphdr->seqno)));
     /* received SYN ACK with expected sequence number? */
-    if ((flags & TCP_ACK) && (flags & TCP_SYN)
-        && ackno == ntohl(pcb->unacked->tcphdr->seqno) + 1) {
+    if ((tcpin.flags & TCP_ACK) && (tcpin.flags & TCP_SYN)
+        && tcpin.ackno == ntohl(pcb->unacked->tcphdr->seqno) + 1) {
       pcb->snd_buf++;
-      pcb->rcv_nxt = seqno + 1;
-      pcb->lastack = ackno;
-      pcb->snd_wnd = tcphdr->wnd;
-      pcb->snd_wl1 = seqno - 1; /* initialise to seqno - 1 to force window update */
+      pcb->rcv_nxt = tcpin.seqno + 1;
+      pcb->lastack = tcpin.ackno;
+      pcb->snd_wnd = tcpin.tcphdr->wnd;
+      pcb->snd_wl1 = tcpin.seqno - 1; /* initialise to seqno - 1 to force window update */
       pcb->state = ESTABLISHED;
 
       /* Parse any options in the SYNACK before using pcb->mss since that
@@ -585,20 +581,20 @@ tcp_process(struct tcp_pcb *pcb)
       tcp_ack_now(pcb);
     }
     /* received ACK? possibly a half-open connection */
-    else if (flags & TCP_ACK) {
+    else if (tcpin.flags & TCP_ACK) {
       /* send a RST to bring the other side in a non-synchronized state. */
-      tcp_rst(ackno, seqno + tcplen, &(iphdr->dest), &(iphdr->src),
-        tcphdr->dest, tcphdr->src);
+      tcp_rst(tcpin.ackno, tcpin.seqno + tcpin.tcplen, &(tcpin.iphdr->dest), &(tcpin.iphdr->src),
+        tcpin.tcphdr->dest, tcpin.tcphdr->src);
     }
     break;
   case SYN_RCVD:
-    if (flags & TCP_ACK &&
-       !(flags & TCP_RST)) {
+    if (tcpin.flags & TCP_ACK &&
+       !(tcpin.flags & TCP_RST)) {
       /* expected ACK number? */
-      if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_nxt)) {
+      if (TCP_SEQ_BETWEEN(tcpin.ackno, pcb->lastack+1, pcb->snd_nxt)) {
         u16_t old_cwnd;
         pcb->state = ESTABLISHED;
-        LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
+        LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", tcpin.inseg.tcphdr->src, tcpin.inseg.tcphdr->dest));
 #if LWIP_CALLBACK_API
         LWIP_ASSERT("pcb->accept != NULL", pcb->accept != NULL);
 #endif
@@ -617,7 +613,7 @@ tcp_process(struct tcp_pcb *pcb)
 
         pcb->cwnd = ((old_cwnd == 1) ? (pcb->mss * 2) : pcb->mss);
 
-        if ((flags & TCP_FIN) && accepted_inseq) {
+        if ((tcpin.flags & TCP_FIN) && accepted_inseq) {
           tcp_ack_now(pcb);
           pcb->state = CLOSE_WAIT;
         }
@@ -625,8 +621,8 @@ tcp_process(struct tcp_pcb *pcb)
       /* incorrect ACK number */
       else {
         /* send RST */
-        tcp_rst(ackno, seqno + tcplen, &(iphdr->dest), &(iphdr->src),
-                tcphdr->dest, tcphdr->src);
+        tcp_rst(tcpin.ackno, tcpin.seqno + tcpin.tcplen, &(tcpin.iphdr->dest), &(tcpin.iphdr->src),
+                tcpin.tcphdr->dest, tcpin.tcphdr->src);
       }
     }
     break;
@@ -634,17 +630,17 @@ tcp_process(struct tcp_pcb *pcb)
     /* FALLTHROUGH */
   case ESTABLISHED:
     accepted_inseq = tcp_receive(pcb);
-    if ((flags & TCP_FIN) && accepted_inseq) { /* passive close */
+    if ((tcpin.flags & TCP_FIN) && accepted_inseq) { /* passive close */
       tcp_ack_now(pcb);
       pcb->state = CLOSE_WAIT;
     }
     break;
   case FIN_WAIT_1:
     tcp_receive(pcb);
-    if (flags & TCP_FIN) {
-      if (flags & TCP_ACK && ackno == pcb->snd_nxt) {
+    if (tcpin.flags & TCP_FIN) {
+      if (tcpin.flags & TCP_ACK && tcpin.ackno == pcb->snd_nxt) {
         LWIP_DEBUGF(TCP_DEBUG,
-          ("TCP connection closed %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
+          ("TCP connection closed %"U16_F" -> %"U16_F".\n", tcpin.inseg.tcphdr->src, tcpin.inseg.tcphdr->dest));
         tcp_ack_now(pcb);
         tcp_pcb_purge(pcb);
         TCP_RMV(&tcp_active_pcbs, pcb);
@@ -654,14 +650,14 @@ tcp_process(struct tcp_pcb *pcb)
         tcp_ack_now(pcb);
         pcb->state = CLOSING;
       }
-    } else if (flags & TCP_ACK && ackno == pcb->snd_nxt) {
+    } else if (tcpin.flags & TCP_ACK && tcpin.ackno == pcb->snd_nxt) {
       pcb->state = FIN_WAIT_2;
     }
     break;
   case FIN_WAIT_2:
     tcp_receive(pcb);
-    if (flags & TCP_FIN) {
-      LWIP_DEBUGF(TCP_DEBUG, ("TCP connection closed %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
+    if (tcpin.flags & TCP_FIN) {
+      LWIP_DEBUGF(TCP_DEBUG, ("TCP connection closed %"U16_F" -> %"U16_F".\n", tcpin.inseg.tcphdr->src, tcpin.inseg.tcphdr->dest));
       tcp_ack_now(pcb);
       tcp_pcb_purge(pcb);
       TCP_RMV(&tcp_active_pcbs, pcb);
@@ -671,8 +667,8 @@ tcp_process(struct tcp_pcb *pcb)
     break;
   case CLOSING:
     tcp_receive(pcb);
-    if (flags & TCP_ACK && ackno == pcb->snd_nxt) {
-      LWIP_DEBUGF(TCP_DEBUG, ("TCP connection closed %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
+    if (tcpin.flags & TCP_ACK && tcpin.ackno == pcb->snd_nxt) {
+      LWIP_DEBUGF(TCP_DEBUG, ("TCP connection closed %"U16_F" -> %"U16_F".\n", tcpin.inseg.tcphdr->src, tcpin.inseg.tcphdr->dest));
       tcp_ack_now(pcb);
       tcp_pcb_purge(pcb);
       TCP_RMV(&tcp_active_pcbs, pcb);
@@ -682,10 +678,10 @@ tcp_process(struct tcp_pcb *pcb)
     break;
   case LAST_ACK:
     tcp_receive(pcb);
-    if (flags & TCP_ACK && ackno == pcb->snd_nxt) {
-      LWIP_DEBUGF(TCP_DEBUG, ("TCP connection closed %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
+    if (tcpin.flags & TCP_ACK && tcpin.ackno == pcb->snd_nxt) {
+      LWIP_DEBUGF(TCP_DEBUG, ("TCP connection closed %"U16_F" -> %"U16_F".\n", tcpin.inseg.tcphdr->src, tcpin.inseg.tcphdr->dest));
       /* bugfix #21699: don't set pcb->state to CLOSED here or we risk leaking segments */
-      recv_flags = TF_CLOSED;
+      tcpin.recv_flags = TF_CLOSED;
     }
     break;
   default:
@@ -722,30 +718,30 @@ tcp_receive(struct tcp_pcb *pcb)
   u16_t new_tot_len;
   u8_t accepted_inseq = 0;
 
-  if (flags & TCP_ACK) {
+  if (tcpin.flags & TCP_ACK) {
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl1;
 
     /* Update window. */
-    if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
-       (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
-      pcb->snd_wl1 = seqno;
-      pcb->snd_wl2 = ackno;
+    if (TCP_SEQ_LT(pcb->snd_wl1, tcpin.seqno) ||
+       (pcb->snd_wl1 == tcpin.seqno && TCP_SEQ_LT(pcb->snd_wl2, tcpin.ackno)) ||
+       (pcb->snd_wl2 == tcpin.ackno && tcpin.tcphdr->wnd > pcb->snd_wnd)) {
+      pcb->snd_wnd = tcpin.tcphdr->wnd;
+      pcb->snd_wl1 = tcpin.seqno;
+      pcb->snd_wl2 = tcpin.ackno;
       if (pcb->snd_wnd > 0 && pcb->persist_backoff > 0) {
           pcb->persist_backoff = 0;
       }
       LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != tcpin.tcphdr->wnd) {
         LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: no window update lastack %"U32_F" snd_max %"U32_F" ackno %"U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
-                               pcb->lastack, pcb->snd_max, ackno, pcb->snd_wl1, seqno, pcb->snd_wl2));
+                               pcb->lastack, pcb->snd_max, tcpin.ackno, pcb->snd_wl1, tcpin.seqno, pcb->snd_wl2));
       }
 #endif /* TCP_WND_DEBUG */
     }
 
-    if (pcb->lastack == ackno) {
+    if (pcb->lastack == tcpin.ackno) {
       pcb->acked = 0;
 
       if (pcb->snd_wl1 + pcb->snd_wnd == right_wnd_edge){
@@ -787,7 +783,7 @@ tcp_receive(struct tcp_pcb *pcb)
         LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: dupack averted %"U32_F" %"U32_F"\n",
                                    pcb->snd_wl1 + pcb->snd_wnd, right_wnd_edge));
       }
-    } else if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_max)){
+    } else if (TCP_SEQ_BETWEEN(tcpin.ackno, pcb->lastack+1, pcb->snd_max)){
       /* We come here when the ACK acknowledges new data. */
       
       /* Reset the "IN Fast Retransmit" flag, since we are no longer
@@ -805,13 +801,13 @@ tcp_receive(struct tcp_pcb *pcb)
       pcb->rto = (pcb->sa >> 3) + pcb->sv;
 
       /* Update the send buffer space. Diff between the two can never exceed 64K? */
-      pcb->acked = (u16_t)(ackno - pcb->lastack);
+      pcb->acked = (u16_t)(tcpin.ackno - pcb->lastack);
 
       pcb->snd_buf += pcb->acked;
 
       /* Reset the fast retransmit variables. */
       pcb->dupacks = 0;
-      pcb->lastack = ackno;
+      pcb->lastack = tcpin.ackno;
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
@@ -830,7 +826,7 @@ tcp_receive(struct tcp_pcb *pcb)
         }
       }
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
-                                    ackno,
+                                    tcpin.ackno,
                                     pcb->unacked != NULL?
                                     ntohl(pcb->unacked->tcphdr->seqno): 0,
                                     pcb->unacked != NULL?
@@ -840,7 +836,7 @@ tcp_receive(struct tcp_pcb *pcb)
          ACK acknowlegdes them. */
       while (pcb->unacked != NULL &&
              TCP_SEQ_LEQ(ntohl(pcb->unacked->tcphdr->seqno) +
-                         TCP_TCPLEN(pcb->unacked), ackno)) {
+                         TCP_TCPLEN(pcb->unacked), tcpin.ackno)) {
         LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: removing %"U32_F":%"U32_F" from pcb->unacked\n",
                                       ntohl(pcb->unacked->tcphdr->seqno),
                                       ntohl(pcb->unacked->tcphdr->seqno) +
@@ -883,7 +879,7 @@ tcp_receive(struct tcp_pcb *pcb)
     while (pcb->unsent != NULL &&
            /*TCP_SEQ_LEQ(ntohl(pcb->unsent->tcphdr->seqno) + TCP_TCPLEN(pcb->unsent), ackno) &&
              TCP_SEQ_LEQ(ackno, pcb->snd_max)*/
-           TCP_SEQ_BETWEEN(ackno, ntohl(pcb->unsent->tcphdr->seqno) + TCP_TCPLEN(pcb->unsent), pcb->snd_max)
+           TCP_SEQ_BETWEEN(tcpin.ackno, ntohl(pcb->unsent->tcphdr->seqno) + TCP_TCPLEN(pcb->unsent), pcb->snd_max)
            ) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: removing %"U32_F":%"U32_F" from pcb->unsent\n",
                                     ntohl(pcb->unsent->tcphdr->seqno), ntohl(pcb->unsent->tcphdr->seqno) +
@@ -908,12 +904,12 @@ tcp_receive(struct tcp_pcb *pcb)
     /* End of ACK for new data processing. */
 
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: pcb->rttest %"U32_F" rtseq %"U32_F" ackno %"U32_F"\n",
-                                pcb->rttest, pcb->rtseq, ackno));
+                                pcb->rttest, pcb->rtseq, tcpin.ackno));
 
     /* RTT estimation calculations. This is done by checking if the
        incoming segment acknowledges the segment we use to take a
        round-trip time measurement. */
-    if (pcb->rttest && TCP_SEQ_LT(pcb->rtseq, ackno)) {
+    if (pcb->rttest && TCP_SEQ_LT(pcb->rtseq, tcpin.ackno)) {
       /* diff between this shouldn't exceed 32K since this are tcp timer ticks
          and a round-trip shouldn't be that long... */
       m = (s16_t)(tcp_ticks - pcb->rttest);
@@ -940,7 +936,7 @@ tcp_receive(struct tcp_pcb *pcb)
 
   /* If the incoming segment contains data, we must process it
      further. */
-  if (tcplen > 0) {
+  if (tcpin.tcplen > 0) {
     /* This code basically does three things:
 
     +) If the incoming segment contains data that is the next
@@ -971,7 +967,7 @@ tcp_receive(struct tcp_pcb *pcb)
        segment is larger than rcv_nxt. */
     /*    if (TCP_SEQ_LT(seqno, pcb->rcv_nxt)){
           if (TCP_SEQ_LT(pcb->rcv_nxt, seqno + tcplen)) {*/
-    if (TCP_SEQ_BETWEEN(pcb->rcv_nxt, seqno + 1, seqno + tcplen - 1)){
+    if (TCP_SEQ_BETWEEN(pcb->rcv_nxt, tcpin.seqno + 1, tcpin.seqno + tcpin.tcplen - 1)){
       /* Trimming the first edge is done by pushing the payload
          pointer in the pbuf downwards. This is somewhat tricky since
          we do not want to discard the full contents of the pbuf up to
@@ -992,13 +988,13 @@ tcp_receive(struct tcp_pcb *pcb)
          adjust the ->data pointer in the seg and the segment
          length.*/
 
-      off = pcb->rcv_nxt - seqno;
-      p = inseg.p;
-      LWIP_ASSERT("inseg.p != NULL", inseg.p);
+      off = pcb->rcv_nxt - tcpin.seqno;
+      p = tcpin.inseg.p;
+      LWIP_ASSERT("inseg.p != NULL", tcpin.inseg.p);
       LWIP_ASSERT("insane offset!", (off < 0x7fff));
-      if (inseg.p->len < off) {
-        LWIP_ASSERT("pbuf too short!", (((s32_t)inseg.p->tot_len) >= off));
-        new_tot_len = (u16_t)(inseg.p->tot_len - off);
+      if (tcpin.inseg.p->len < off) {
+        LWIP_ASSERT("pbuf too short!", (((s32_t)tcpin.inseg.p->tot_len) >= off));
+        new_tot_len = (u16_t)(tcpin.inseg.p->tot_len - off);
         while (p->len < off) {
           off -= p->len;
           /* KJM following line changed (with addition of new_tot_len var)
@@ -1013,23 +1009,23 @@ tcp_receive(struct tcp_pcb *pcb)
           LWIP_ASSERT("pbuf_header failed", 0);
         }
       } else {
-        if(pbuf_header(inseg.p, (s16_t)-off)) {
+        if(pbuf_header(tcpin.inseg.p, (s16_t)-off)) {
           /* Do we need to cope with this failing?  Assert for now */
           LWIP_ASSERT("pbuf_header failed", 0);
         }
       }
       /* KJM following line changed to use p->payload rather than inseg->p->payload
          to fix bug #9076 */
-      inseg.dataptr = p->payload;
-      inseg.len -= (u16_t)(pcb->rcv_nxt - seqno);
-      inseg.tcphdr->seqno = seqno = pcb->rcv_nxt;
+      tcpin.inseg.dataptr = p->payload;
+      tcpin.inseg.len -= (u16_t)(pcb->rcv_nxt - tcpin.seqno);
+      tcpin.inseg.tcphdr->seqno = tcpin.seqno = pcb->rcv_nxt;
     }
     else {
-      if (TCP_SEQ_LT(seqno, pcb->rcv_nxt)){
+      if (TCP_SEQ_LT(tcpin.seqno, pcb->rcv_nxt)){
         /* the whole segment is < rcv_nxt */
         /* must be a duplicate of a packet that has already been correctly handled */
 
-        LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: duplicate seqno %"U32_F"\n", seqno));
+        LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: duplicate seqno %"U32_F"\n", tcpin.seqno));
         tcp_ack_now(pcb);
       }
     }
@@ -1037,24 +1033,24 @@ tcp_receive(struct tcp_pcb *pcb)
     /* The sequence number must be within the window (above rcv_nxt
        and below rcv_nxt + rcv_wnd) in order to be further
        processed. */
-    if (TCP_SEQ_BETWEEN(seqno, pcb->rcv_nxt, 
+    if (TCP_SEQ_BETWEEN(tcpin.seqno, pcb->rcv_nxt, 
                         pcb->rcv_nxt + pcb->rcv_wnd - 1)){
-      if (pcb->rcv_nxt == seqno) {
+      if (pcb->rcv_nxt == tcpin.seqno) {
         accepted_inseq = 1; 
         /* The incoming segment is the next in sequence. We check if
            we have to trim the end of the segment and update rcv_nxt
            and pass the data to the application. */
 #if TCP_QUEUE_OOSEQ
         if (pcb->ooseq != NULL &&
-                TCP_SEQ_LEQ(pcb->ooseq->tcphdr->seqno, seqno + inseg.len)) {
+                TCP_SEQ_LEQ(pcb->ooseq->tcphdr->seqno, tcpin.seqno + tcpin.inseg.len)) {
           if (pcb->ooseq->len > 0) {
             /* We have to trim the second edge of the incoming
                segment. */
-            inseg.len = (u16_t)(pcb->ooseq->tcphdr->seqno - seqno);
-            pbuf_realloc(inseg.p, inseg.len);
+            tcpin.inseg.len = (u16_t)(pcb->ooseq->tcphdr->seqno - tcpin.seqno);
+            pbuf_realloc(tcpin.inseg.p, tcpin.inseg.len);
           } else {
             /* does the ooseq segment contain only flags that are in inseg also? */
-            if ((TCPH_FLAGS(inseg.tcphdr) & (TCP_FIN|TCP_SYN)) ==
+            if ((TCPH_FLAGS(tcpin.inseg.tcphdr) & (TCP_FIN|TCP_SYN)) ==
                 (TCPH_FLAGS(pcb->ooseq->tcphdr) & (TCP_FIN|TCP_SYN))) {
               struct tcp_seg *old_ooseq = pcb->ooseq;
               pcb->ooseq = pcb->ooseq->next;
@@ -1064,26 +1060,26 @@ tcp_receive(struct tcp_pcb *pcb)
         }
 #endif /* TCP_QUEUE_OOSEQ */
 
-        tcplen = TCP_TCPLEN(&inseg);
+        tcpin.tcplen = TCP_TCPLEN(&tcpin.inseg);
 
         /* First received FIN will be ACKed +1, on any successive (duplicate)
          * FINs we are already in CLOSE_WAIT and have already done +1.
          */
         if (pcb->state != CLOSE_WAIT) {
-          pcb->rcv_nxt += tcplen;
+          pcb->rcv_nxt += tcpin.tcplen;
         }
 
         /* Update the receiver's (our) window. */
-        if (pcb->rcv_wnd < tcplen) {
+        if (pcb->rcv_wnd < tcpin.tcplen) {
           pcb->rcv_wnd = 0;
         } else {
-          pcb->rcv_wnd -= tcplen;
+          pcb->rcv_wnd -= tcpin.tcplen;
         }
 
-        if (pcb->rcv_ann_wnd < tcplen) {
+        if (pcb->rcv_ann_wnd < tcpin.tcplen) {
           pcb->rcv_ann_wnd = 0;
         } else {
-          pcb->rcv_ann_wnd -= tcplen;
+          pcb->rcv_ann_wnd -= tcpin.tcplen;
         }
 
         /* If there is data in the segment, we make preparations to
@@ -1095,16 +1091,16 @@ tcp_receive(struct tcp_pcb *pcb)
            If the segment was a FIN, we set the TF_GOT_FIN flag that will
            be used to indicate to the application that the remote side has
            closed its end of the connection. */
-        if (inseg.p->tot_len > 0) {
-          recv_data = inseg.p;
+        if (tcpin.inseg.p->tot_len > 0) {
+          tcpin.recv_data = tcpin.inseg.p;
           /* Since this pbuf now is the responsibility of the
              application, we delete our reference to it so that we won't
              (mistakingly) deallocate it. */
-          inseg.p = NULL;
+          tcpin.inseg.p = NULL;
         }
-        if (TCPH_FLAGS(inseg.tcphdr) & TCP_FIN) {
+        if (TCPH_FLAGS(tcpin.inseg.tcphdr) & TCP_FIN) {
           LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: received FIN.\n"));
-          recv_flags = TF_GOT_FIN;
+          tcpin.recv_flags = TF_GOT_FIN;
         }
 
 #if TCP_QUEUE_OOSEQ
@@ -1114,7 +1110,7 @@ tcp_receive(struct tcp_pcb *pcb)
                pcb->ooseq->tcphdr->seqno == pcb->rcv_nxt) {
 
           cseg = pcb->ooseq;
-          seqno = pcb->ooseq->tcphdr->seqno;
+          tcpin.seqno = pcb->ooseq->tcphdr->seqno;
 
           pcb->rcv_nxt += TCP_TCPLEN(cseg);
           if (pcb->rcv_wnd < TCP_TCPLEN(cseg)) {
@@ -1131,16 +1127,16 @@ tcp_receive(struct tcp_pcb *pcb)
           if (cseg->p->tot_len > 0) {
             /* Chain this pbuf onto the pbuf that we will pass to
                the application. */
-            if (recv_data) {
-              pbuf_cat(recv_data, cseg->p);
+            if (tcpin.recv_data) {
+              pbuf_cat(tcpin.recv_data, cseg->p);
             } else {
-              recv_data = cseg->p;
+              tcpin.recv_data = cseg->p;
             }
             cseg->p = NULL;
           }
           if (TCPH_FLAGS(cseg->tcphdr) & TCP_FIN) {
             LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: dequeued FIN.\n"));
-            recv_flags = TF_GOT_FIN;
+            tcpin.recv_flags = TF_GOT_FIN;
             if (pcb->state == ESTABLISHED) { /* force passive close or we can move to active close */
               pcb->state = CLOSE_WAIT;
             } 
@@ -1162,7 +1158,7 @@ tcp_receive(struct tcp_pcb *pcb)
 #if TCP_QUEUE_OOSEQ
         /* We queue the segment on the ->ooseq queue. */
         if (pcb->ooseq == NULL) {
-          pcb->ooseq = tcp_seg_copy(&inseg);
+          pcb->ooseq = tcp_seg_copy(&tcpin.inseg);
         } else {
           /* If the queue is not empty, we walk through the queue and
              try to find a place where the sequence number of the
@@ -1178,16 +1174,16 @@ tcp_receive(struct tcp_pcb *pcb)
 
           prev = NULL;
           for(next = pcb->ooseq; next != NULL; next = next->next) {
-            if (seqno == next->tcphdr->seqno) {
+            if (tcpin.seqno == next->tcphdr->seqno) {
               /* The sequence number of the incoming segment is the
                  same as the sequence number of the segment on
                  ->ooseq. We check the lengths to see which one to
                  discard. */
-              if (inseg.len > next->len) {
+              if (tcpin.inseg.len > next->len) {
                 /* The incoming segment is larger than the old
                    segment. We replace the old segment with the new
                    one. */
-                cseg = tcp_seg_copy(&inseg);
+                cseg = tcp_seg_copy(&tcpin.inseg);
                 if (cseg != NULL) {
                   cseg->next = next->next;
                   if (prev != NULL) {
@@ -1198,9 +1194,9 @@ tcp_receive(struct tcp_pcb *pcb)
                   tcp_seg_free(next);
                   if (cseg->next != NULL) {
                     next = cseg->next;
-                    if (TCP_SEQ_GT(seqno + cseg->len, next->tcphdr->seqno)) {
+                    if (TCP_SEQ_GT(tcpin.seqno + cseg->len, next->tcphdr->seqno)) {
                       /* We need to trim the incoming segment. */
-                      cseg->len = (u16_t)(next->tcphdr->seqno - seqno);
+                      cseg->len = (u16_t)(next->tcphdr->seqno - tcpin.seqno);
                       pbuf_realloc(cseg->p, cseg->len);
                     }
                   }
@@ -1214,18 +1210,18 @@ tcp_receive(struct tcp_pcb *pcb)
               }
             } else {
               if (prev == NULL) {
-                if (TCP_SEQ_LT(seqno, next->tcphdr->seqno)) {
+                if (TCP_SEQ_LT(tcpin.seqno, next->tcphdr->seqno)) {
                   /* The sequence number of the incoming segment is lower
                      than the sequence number of the first segment on the
                      queue. We put the incoming segment first on the
                      queue. */
 
-                  if (TCP_SEQ_GT(seqno + inseg.len, next->tcphdr->seqno)) {
+                  if (TCP_SEQ_GT(tcpin.seqno + tcpin.inseg.len, next->tcphdr->seqno)) {
                     /* We need to trim the incoming segment. */
-                    inseg.len = (u16_t)(next->tcphdr->seqno - seqno);
-                    pbuf_realloc(inseg.p, inseg.len);
+                    tcpin.inseg.len = (u16_t)(next->tcphdr->seqno - tcpin.seqno);
+                    pbuf_realloc(tcpin.inseg.p, tcpin.inseg.len);
                   }
-                  cseg = tcp_seg_copy(&inseg);
+                  cseg = tcp_seg_copy(&tcpin.inseg);
                   if (cseg != NULL) {
                     cseg->next = next;
                     pcb->ooseq = cseg;
@@ -1235,25 +1231,25 @@ tcp_receive(struct tcp_pcb *pcb)
               } else 
                 /*if (TCP_SEQ_LT(prev->tcphdr->seqno, seqno) &&
                   TCP_SEQ_LT(seqno, next->tcphdr->seqno)) {*/
-                if(TCP_SEQ_BETWEEN(seqno, prev->tcphdr->seqno+1, next->tcphdr->seqno-1)){
+                if(TCP_SEQ_BETWEEN(tcpin.seqno, prev->tcphdr->seqno+1, next->tcphdr->seqno-1)){
                 /* The sequence number of the incoming segment is in
                    between the sequence numbers of the previous and
                    the next segment on ->ooseq. We trim and insert the
                    incoming segment and trim the previous segment, if
                    needed. */
-                if (TCP_SEQ_GT(seqno + inseg.len, next->tcphdr->seqno)) {
+                if (TCP_SEQ_GT(tcpin.seqno + tcpin.inseg.len, next->tcphdr->seqno)) {
                   /* We need to trim the incoming segment. */
-                  inseg.len = (u16_t)(next->tcphdr->seqno - seqno);
-                  pbuf_realloc(inseg.p, inseg.len);
+                  tcpin.inseg.len = (u16_t)(next->tcphdr->seqno - tcpin.seqno);
+                  pbuf_realloc(tcpin.inseg.p, tcpin.inseg.len);
                 }
 
-                cseg = tcp_seg_copy(&inseg);
+                cseg = tcp_seg_copy(&tcpin.inseg);
                 if (cseg != NULL) {
                   cseg->next = next;
                   prev->next = cseg;
-                  if (TCP_SEQ_GT(prev->tcphdr->seqno + prev->len, seqno)) {
+                  if (TCP_SEQ_GT(prev->tcphdr->seqno + prev->len, tcpin.seqno)) {
                     /* We need to trim the prev segment. */
-                    prev->len = (u16_t)(seqno - prev->tcphdr->seqno);
+                    prev->len = (u16_t)(tcpin.seqno - prev->tcphdr->seqno);
                     pbuf_realloc(prev->p, prev->len);
                   }
                 }
@@ -1263,12 +1259,12 @@ tcp_receive(struct tcp_pcb *pcb)
                  ooseq queue, we add the incoming segment to the end
                  of the list. */
               if (next->next == NULL &&
-                  TCP_SEQ_GT(seqno, next->tcphdr->seqno)) {
-                next->next = tcp_seg_copy(&inseg);
+                  TCP_SEQ_GT(tcpin.seqno, next->tcphdr->seqno)) {
+                next->next = tcp_seg_copy(&tcpin.inseg);
                 if (next->next != NULL) {
-                  if (TCP_SEQ_GT(next->tcphdr->seqno + next->len, seqno)) {
+                  if (TCP_SEQ_GT(next->tcphdr->seqno + next->len, tcpin.seqno)) {
                     /* We need to trim the last segment. */
-                    next->len = (u16_t)(seqno - next->tcphdr->seqno);
+                    next->len = (u16_t)(tcpin.seqno - next->tcphdr->seqno);
                     pbuf_realloc(next->p, next->len);
                   }
                 }
@@ -1289,7 +1285,7 @@ tcp_receive(struct tcp_pcb *pcb)
        fall out of the window are ACKed. */
     /*if (TCP_SEQ_GT(pcb->rcv_nxt, seqno) ||
       TCP_SEQ_GEQ(seqno, pcb->rcv_nxt + pcb->rcv_wnd)) {*/
-    if(!TCP_SEQ_BETWEEN(seqno, pcb->rcv_nxt, pcb->rcv_nxt + pcb->rcv_wnd-1)){
+    if(!TCP_SEQ_BETWEEN(tcpin.seqno, pcb->rcv_nxt, pcb->rcv_nxt + pcb->rcv_wnd-1)){
       tcp_ack_now(pcb);
     }
   }
@@ -1312,11 +1308,11 @@ tcp_parseopt(struct tcp_pcb *pcb)
   u8_t *opts, opt;
   u16_t mss;
 
-  opts = (u8_t *)tcphdr + TCP_HLEN;
+  opts = (u8_t *)tcpin.tcphdr + TCP_HLEN;
 
   /* Parse the TCP MSS option, if present. */
-  if(TCPH_HDRLEN(tcphdr) > 0x5) {
-    for(c = 0; c < (TCPH_HDRLEN(tcphdr) - 5) << 2 ;) {
+  if(TCPH_HDRLEN(tcpin.tcphdr) > 0x5) {
+    for(c = 0; c < (TCPH_HDRLEN(tcpin.tcphdr) - 5) << 2 ;) {
       opt = opts[c];
       if (opt == 0x00) {
         /* End of options. */
@@ -34,6 +34,7 @@
 //#include <inc/ns.h>
 #include <lego/mm.h>
 #include <lego/pci.h>
+#include <net/virtio_net.h>
 
 #include "jif.h"
 
@@ -45,6 +46,7 @@
 #include <net/lwip/stats.h>
 
 #include <net/netif/etharp.h>
+#include <net/arch/shard.h>
 
 #define PKTMAP		0x10000000
 
@@ -67,7 +69,127 @@ static void low_level_init(struct netif *netif)
     netif->hwaddr[3] = 0x12;
     netif->hwaddr[4] = 0x34;
     netif->hwaddr[5] = 0x56;
+
+#ifdef CONFIG_VIRTIO_NET
+    if (virtnet_present())
+	virtnet_get_mac(netif->hwaddr);
+#endif
+}
+
+#ifdef CONFIG_VIRTIO_NET
+/*
+ * Frames from all virtio-net RX queues come in through their own poll
+ * threads. ARP is done right here under the ARP lock. IP datagrams are
+ * processed in the lwIP shard owning them, inline if that is the shard
+ * of this queue, otherwise queued to it. We send from shard N on queue
+ * N, so the device tends to bring a flow back to the queue of its shard.
+ */
+
+/*
+ * Lives in the headroom of the RX page. The pbuf points at the frame
+ * in the same page, nothing is copied. The page goes back when lwIP
+ * frees the pbuf.
+ */
+struct jif_rx_buf {
+	struct pbuf_custom	pc;
+	struct lwip_work	work;
+	struct netif		*netif;
+};
+
+static void jif_free_rx_pbuf(struct pbuf *p)
+{
+	virtnet_free_rx_buf(container_of(p, struct jif_rx_buf, pc.pbuf));
+}
+
+static void jif_rx_work_fn(struct lwip_work *work)
+{
+	struct jif_rx_buf *buf = container_of(work, struct jif_rx_buf, work);
+
+	buf->netif->input(&buf->pc.pbuf, buf->netif);
+}
+
+static void jif_virtnet_rx(void *arg, int qid, void *page,
+			   void *data, unsigned int len)
+{
+	struct netif *netif = arg;
+	struct jif *jif = netif->state;
+	struct jif_rx_buf *buf = page;
+	struct eth_hdr *ethhdr;
+	struct lwip_shard *s;
+	struct pbuf *p;
+
+	BUILD_BUG_ON(sizeof(*buf) > VIRTNET_RX_HEADROOM);
+
+	p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &buf->pc, data, len);
+	if (!p) {
+		virtnet_free_rx_buf(page);
+		return;
+	}
+	buf->pc.custom_free_function = jif_free_rx_pbuf;
+	buf->netif = netif;
+
+	ethhdr = p->payload;
+	switch (htons(ethhdr->type)) {
+	case ETHTYPE_IP:
+		lwip_arp_lock();
+		etharp_ip_input(netif, p);
+		lwip_arp_unlock();
+		pbuf_header(p, -(int)sizeof(struct eth_hdr));
+		break;
+	case ETHTYPE_ARP:
+		lwip_arp_lock();
+		etharp_arp_input(netif, jif->ethaddr, p);
+		lwip_arp_unlock();
+		return;
+	default:
+		pbuf_free(p);
+		return;
+	}
+
+	s = lwip_shard_steer(p);
+	if (s->id == qid % lwip_nr_shards) {
+		lwip_shard_lock(s);
+		netif->input(p, netif);
+		lwip_shard_unlock(s);
+	} else {
+		buf->work.fn = jif_rx_work_fn;
+		lwip_shard_queue(s, &buf->work);
+	}
+}
+
+static void jif_virtnet_tx_done(void *token)
+{
+	pbuf_free(token);
+}
+
+/*
+ * Send the pbuf chain as is, one sg entry per pbuf. It is referenced
+ * until the device is done with it.
+ */
+static err_t virtnet_output(struct pbuf *p)
+{
+	struct virtio_sg sg[16];
+	struct pbuf *q;
+	int nr = 0;
+
+	for (q = p; q != NULL; q = q->next) {
+		if (!q->len)
+			continue;
+		if (nr == ARRAY_SIZE(sg))
+			return ERR_BUF;
+		sg[nr].addr = q->payload;
+		sg[nr].len = q->len;
+		nr++;
+	}
+
+	pbuf_ref(p);
+	if (virtnet_xmit(lwip_this_shard()->id, sg, nr, p)) {
+		pbuf_free(p);
+		return ERR_MEM;
+	}
+	return ERR_OK;
 }
+#endif
 
 /*
  * low_level_output():
@@ -88,6 +210,10 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
 	jif = netif->state;
 
 	pr_debug("low_level_output\n");
+#ifdef CONFIG_VIRTIO_NET
+	if (virtnet_present())
+		return virtnet_output(p);
+#endif
 	#if 0
 	char *txbuf = alloc_page();
 	int txsize = 0;
@@ -162,9 +288,14 @@ static struct pbuf *low_level_input(void *va)
 static err_t jif_output(struct netif *netif, struct pbuf *p,
       struct ip_addr *ipaddr)
 {
+	err_t err;
+
 	pr_debug("jif_output\n");
-    /* resolve hardware address, then send (or queue) packet */
-    return etharp_output(netif, p, ipaddr);
+	/* resolve hardware address, then send (or queue) packet */
+	lwip_arp_lock();
+	err = etharp_output(netif, p, ipaddr);
+	lwip_arp_unlock();
+	return err;
 }
 
 /*
@@ -177,35 +308,41 @@ static err_t jif_output(struct netif *netif, struct pbuf *p,
  *
  */
 
-void jif_input(struct netif *netif, void *va)
+/*
+ * Called from outside of any shard, the datagram is processed in the
+ * shard owning it, under its lock. See jif_virtnet_rx().
+ */
+static void jif_input_pbuf(struct netif *netif, struct pbuf *p)
 {
 	struct jif *jif;
 	struct eth_hdr *ethhdr;
-	struct pbuf *p;
+	struct lwip_shard *s;
 
 	jif = netif->state;
-  
-	/* move received packet into a new pbuf */
-	p = low_level_input(va);
 
-	/* no packet could be read, silently ignore this */
-	if (p == NULL) return;
 	/* points to packet payload, which starts with an Ethernet header */
 	ethhdr = p->payload;
 
 	switch (htons(ethhdr->type)) {
 		case ETHTYPE_IP:
 			/* update ARP table */
+			lwip_arp_lock();
 			etharp_ip_input(netif, p);
+			lwip_arp_unlock();
 			/* skip Ethernet header */
 			pbuf_header(p, -(int)sizeof(struct eth_hdr));
 			/* pass to network layer */
+			s = lwip_shard_steer(p);
+			lwip_shard_lock(s);
 			netif->input(p, netif);
+			lwip_shard_unlock(s);
 			break;
 
 		case ETHTYPE_ARP:
 			/* pass p to ARP module  */
+			lwip_arp_lock();
 			etharp_arp_input(netif, jif->ethaddr, p);
+			lwip_arp_unlock();
 			break;
 
 		default:
@@ -213,6 +350,19 @@ void jif_input(struct netif *netif, void *va)
 	}
 }
 
+void jif_input(struct netif *netif, void *va)
+{
+	struct pbuf *p;
+
+	/* move received packet into a new pbuf */
+	p = low_level_input(va);
+
+	/* no packet could be read, silently ignore this */
+	if (p == NULL) return;
+
+	jif_input_pbuf(netif, p);
+}
+
 /*
  * jif_init():
  *
@@ -246,6 +396,13 @@ err_t jif_init(struct netif *netif)
 
 	etharp_init();
 
+#ifdef CONFIG_VIRTIO_NET
+	if (virtnet_present()) {
+		lwip_shards_init();
+		virtnet_set_handlers(jif_virtnet_rx, netif, jif_virtnet_tx_done);
+	}
+#endif
+
 	// qemu user-net is dumb; if the host OS does not send and ARP request
 	// first, the qemu will send packets destined for the host using the mac
 	// addr 00:00:00:00:00; do a arp request for the user-net NAT at 10.0.2.2
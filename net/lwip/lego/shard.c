@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2016-2020 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * lwIP shards, see include/net/arch/shard.h
+ *
+ * Locking order: shard lock, ARP lock, virtio-net queue lock and the
+ * pool lock behind SYS_ARCH_PROTECT. A shard lock is never taken with
+ * another one held, so callbacks running in a shard must not call
+ * lwip_shard_for_each().
+ */
+
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/jiffies.h>
+#include <lego/kthread.h>
+#include <lego/cpumask.h>
+
+#include <net/arch/shard.h>
+#include <net/lwip/ip.h>
+#include <net/lwip/sys.h>
+#include <net/lwip/tcp.h>
+#include <net/lwip/ip_frag.h>
+#include <net/netif/etharp.h>
+
+struct lwip_shard lwip_shards[LWIP_SHARDS] = {
+	[0 ... LWIP_SHARDS - 1] = {
+#if LWIP_SHARDS > 1
+		.tcp.port	= TCP_LOCAL_PORT_RANGE_START,
+		.tcp.iss	= 6510,
+#endif
+		.lock		= __SPIN_LOCK_UNLOCKED(lwip_shards.lock),
+	},
+};
+int lwip_nr_shards = 1;
+
+DEFINE_PER_CPU(struct lwip_shard *, lwip_cur_shard);
+
+static DEFINE_SPINLOCK(lwip_arp_spinlock);
+
+#if SYS_LIGHTWEIGHT_PROT
+/*
+ * memp pools, the heap and pbuf reference counts are shared by all
+ * shards. Nothing of lwIP runs in irq context, a spinlock will do.
+ */
+static DEFINE_SPINLOCK(lwip_prot_lock);
+
+sys_prot_t sys_arch_protect(void)
+{
+	spin_lock(&lwip_prot_lock);
+	return 0;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+	spin_unlock(&lwip_prot_lock);
+}
+#endif
+
+void lwip_shard_lock(struct lwip_shard *s)
+{
+	spin_lock(&s->lock);
+	this_cpu_write(lwip_cur_shard, s);
+}
+
+void lwip_shard_unlock(struct lwip_shard *s)
+{
+	this_cpu_write(lwip_cur_shard, NULL);
+	spin_unlock(&s->lock);
+}
+
+/* The ARP table and its queued packets are shared by all shards */
+void lwip_arp_lock(void)
+{
+	spin_lock(&lwip_arp_spinlock);
+}
+
+void lwip_arp_unlock(void)
+{
+	spin_unlock(&lwip_arp_spinlock);
+}
+
+/**
+ * lwip_shard_steer - find the shard to process an IP datagram
+ * @p: the datagram, payload at the IP header
+ *
+ * TCP goes to the shard owning the flow, everything else, including
+ * fragments, to shard 0.
+ */
+struct lwip_shard *lwip_shard_steer(struct pbuf *p)
+{
+#if LWIP_SHARDS > 1
+	struct ip_hdr *iphdr = p->payload;
+	struct tcp_hdr *tcphdr;
+	u16_t hlen;
+
+	if (lwip_nr_shards == 1 || IPH_PROTO(iphdr) != IP_PROTO_TCP)
+		return &lwip_shards[0];
+	if (IPH_OFFSET(iphdr) & htons(IP_OFFMASK | IP_MF))
+		return &lwip_shards[0];
+
+	hlen = IPH_HL(iphdr) * 4;
+	if (p->len < hlen + TCP_HLEN)
+		return &lwip_shards[0];
+
+	tcphdr = (struct tcp_hdr *)((u8_t *)p->payload + hlen);
+	return &lwip_shards[lwip_flow_shard(iphdr->src.addr,
+					    ntohs(tcphdr->src),
+					    ntohs(tcphdr->dest))];
+#else
+	return &lwip_shards[0];
+#endif
+}
+
+/**
+ * lwip_shard_queue - run @work in shard @s
+ *
+ * @work->fn is called by the shard thread with the shard lock held.
+ * Safe to call from any context that may wake up a task.
+ */
+void lwip_shard_queue(struct lwip_shard *s, struct lwip_work *work)
+{
+	if (llist_add(&work->node, &s->work) && s->task)
+		wake_up_process(s->task);
+}
+
+struct lwip_input_work {
+	struct lwip_work	work;
+	struct pbuf		*p;
+	struct netif		*inp;
+};
+
+static void lwip_input_work_fn(struct lwip_work *work)
+{
+	struct lwip_input_work *w = container_of(work, struct lwip_input_work, work);
+
+	ip_input(w->p, w->inp);
+	kfree(w);
+}
+
+/**
+ * lwip_shard_input - pass an IP datagram to ip_input() in shard @s
+ *
+ * For callers without room of their own for a struct lwip_work, such as
+ * the reassembly code. The datagram is dropped if we are out of memory.
+ */
+err_t lwip_shard_input(struct lwip_shard *s, struct pbuf *p, struct netif *inp)
+{
+	struct lwip_input_work *w;
+
+	w = kmalloc(sizeof(*w), GFP_KERNEL);
+	if (!w) {
+		pbuf_free(p);
+		return ERR_MEM;
+	}
+
+	w->work.fn = lwip_input_work_fn;
+	w->p = p;
+	w->inp = inp;
+	lwip_shard_queue(s, &w->work);
+	return ERR_OK;
+}
+
+/**
+ * lwip_shard_for_each - call @fn in every shard
+ *
+ * Used to set up per-shard state, e.g. a listening PCB in each shard.
+ * Must not be called with a shard lock held.
+ */
+void lwip_shard_for_each(void (*fn)(void *arg), void *arg)
+{
+	int i;
+
+	for (i = 0; i < lwip_nr_shards; i++) {
+		lwip_shard_lock(&lwip_shards[i]);
+		fn(arg);
+		lwip_shard_unlock(&lwip_shards[i]);
+	}
+}
+
+static void lwip_shard_run_work(struct lwip_shard *s)
+{
+	struct lwip_work *work, *tmp;
+	struct llist_node *list;
+
+	list = llist_del_all(&s->work);
+	if (!list)
+		return;
+
+	list = llist_reverse_order(list);
+	llist_for_each_entry_safe(work, tmp, list, node)
+		work->fn(work);
+}
+
+/* Run the timers that are due, return jiffies until the next one */
+static long lwip_shard_run_timers(struct lwip_shard *s)
+{
+	unsigned long next;
+
+	if (time_after_eq(jiffies, s->next_tcp_tmr)) {
+		tcp_tmr();
+		s->next_tcp_tmr = jiffies + msecs_to_jiffies(TCP_TMR_INTERVAL);
+	}
+	next = s->next_tcp_tmr;
+
+	/* ARP and reassembly are done in shard 0 */
+	if (s->id)
+		goto out;
+
+	if (time_after_eq(jiffies, s->next_arp_tmr)) {
+		lwip_arp_lock();
+		etharp_tmr();
+		lwip_arp_unlock();
+		s->next_arp_tmr = jiffies + msecs_to_jiffies(ARP_TMR_INTERVAL);
+	}
+	if (time_before(s->next_arp_tmr, next))
+		next = s->next_arp_tmr;
+
+#if IP_REASSEMBLY
+	if (time_after_eq(jiffies, s->next_ip_tmr)) {
+		ip_reass_tmr();
+		s->next_ip_tmr = jiffies + msecs_to_jiffies(IP_TMR_INTERVAL);
+	}
+	if (time_before(s->next_ip_tmr, next))
+		next = s->next_ip_tmr;
+#endif
+
+out:
+	return time_after(next, jiffies) ? next - jiffies : 0;
+}
+
+static int lwip_shard_thread(void *data)
+{
+	struct lwip_shard *s = data;
+	long timeout;
+
+	while (1) {
+		lwip_shard_lock(s);
+		lwip_shard_run_work(s);
+		timeout = lwip_shard_run_timers(s);
+		lwip_shard_unlock(s);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (llist_empty(&s->work) && timeout)
+			schedule_timeout(timeout);
+		__set_current_state(TASK_RUNNING);
+
+		cond_resched();
+	}
+	return 0;
+}
+
+/*
+ * Use one shard per online cpu, at most LWIP_SHARDS, and start
+ * their threads. Before this, everything runs on shard 0 and is
+ * driven by the caller.
+ */
+int lwip_shards_init(void)
+{
+	struct lwip_shard *s;
+	int i;
+
+	lwip_nr_shards = min_t(int, LWIP_SHARDS, num_online_cpus());
+
+	for (i = 0; i < lwip_nr_shards; i++) {
+		s = &lwip_shards[i];
+		s->id = i;
+		s->cpu = i;
+		s->next_tcp_tmr = s->next_arp_tmr = s->next_ip_tmr = jiffies;
+	}
+
+	for (i = 0; i < lwip_nr_shards; i++) {
+		s = &lwip_shards[i];
+		s->task = kthread_create_on_cpu(lwip_shard_thread, s, s->cpu,
+						"lwip/%u");
+		if (IS_ERR(s->task)) {
+			pr_err("lwip: fail to start shard %d\n", i);
+			s->task = NULL;
+			return -ENOMEM;
+		}
+		wake_up_process(s->task);
+	}
+
+	pr_info("lwip: %d shards\n", lwip_nr_shards);
+	return 0;
+}
@@ -28,6 +28,7 @@
 #include <net/lwip/stats.h>
 #include <net/lwip/netbuf.h>
 #include <net/netif/etharp.h>
+#include <net/arch/shard.h>
 #include "lwip/lego/jif/jif.h"
 
 //#include "ns.h"
@@ -285,6 +286,7 @@ static test_tcp(void)
 	char buf[256];
 	char *buf1 = alloc_page();
 	struct jif_pkt pkt;
+	struct lwip_shard *s;
 
 	for (i = 0; i < 256; i++) {
 		buf[i] = 'a';
@@ -292,6 +294,13 @@ static test_tcp(void)
 
 	ipaddr.addr = inet_addr("128.46.115.144");
 
+	/*
+	 * The PCB belongs to the shard it is connected from, every call
+	 * on it is made in there. jif_input() enters shards on its own,
+	 * so it is called with no shard lock held.
+	 */
+	s = &lwip_shards[0];
+
 	//while(1) {
 #if 0
 		/* Check link state, e.g. via MDIO communication with PHY */
@@ -314,7 +323,9 @@ static test_tcp(void)
 			}
 		}
 #endif
+		lwip_shard_lock(s);
 		tpcb = tcp_new();
+		lwip_shard_unlock(s);
 
 		length = pci_receive_packet(buf1);
 		pkt.jp_data = buf1;
@@ -325,7 +336,9 @@ static test_tcp(void)
 		}
 
 		port = 6666;
+		lwip_shard_lock(s);
 		tcp_connect(tpcb, &ipaddr, port, tcp_connected_cb);
+		lwip_shard_unlock(s);
 		pr_debug("after connect %p\n", tpcb);
 
 	for (i = 0; i < 1; i++) {
@@ -341,7 +354,9 @@ static test_tcp(void)
 
 		//tcp_tmr();
 
+		lwip_shard_lock(s);
 		ret = tcp_write(tpcb, buf, 10, 0);
+		lwip_shard_unlock(s);
 		pr_debug("tcp wrote %d\n", ret);
 
 		length = pci_receive_packet(buf1);
@@ -352,7 +367,9 @@ static test_tcp(void)
 			jif_input(&nif, (void *)(&pkt));
 		}
 
+		lwip_shard_lock(s);
 		ret = tcp_output(tpcb);
+		lwip_shard_unlock(s);
 		pr_debug("tcp output %d\n", ret);
 
 		length = pci_receive_packet(buf1);
@@ -363,10 +380,16 @@ static test_tcp(void)
 			jif_input(&nif, (void *)(&pkt));
 		}
 
+		lwip_shard_lock(s);
 		tcp_sent(tpcb, tcp_sent_cb);
-		/* Cyclic lwIP timers check */
+		/*
+		 * Cyclic lwIP timers check, done by the shard thread
+		 * once it is started.
+		 */
 	//	sys_check_timeouts();
-		tcp_tmr();
+		if (!s->task)
+			tcp_tmr();
+		lwip_shard_unlock(s);
 
 		length = pci_receive_packet(buf1);
 		pkt.jp_data = buf1;
@@ -30,6 +30,7 @@
 #include <lego/time.h>
 #include <lego/timer.h>
 #include <lego/jiffies.h>
+#include <lego/hrtimer.h>
 
 #ifdef CONFIG_DEBUG_EPOLL
 #define epoll_debug(fmt, ...) \
@@ -45,9 +46,6 @@ static inline void epoll_debug(const char *fmt, ...) { }
 /* Epoll private bits inside the event mask */
 #define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET)
 
-/* Maximum msec timeout value storeable in a long int */
-#define EP_MAX_MSTIMEO min(1000ULL * MAX_SCHEDULE_TIMEOUT / HZ, (LONG_MAX - 999ULL) / HZ)
-
 struct epoll_filefd {
 	struct file *file;
 	int fd;
@@ -533,11 +531,12 @@ static int ep_poll(struct lego_eventpoll *ep, struct epoll_event __user *events,
 	unsigned long flags;
 	long slack = 0;
 	wait_queue_t wait;
-	long jtimeout; 
+	ktime_t expires, *to = NULL;
 
-	jtimeout = (timeout < 0 || timeout >= EP_MAX_MSTIMEO) ?  
-		MAX_SCHEDULE_TIMEOUT : (timeout * HZ + 999) / 1000;  
-	if (timeout == 0) {
+	if (timeout > 0) {
+		expires = ktime_add_ms(ktime_get(), timeout);
+		to = &expires;
+	} else if (timeout == 0) {
 		/*
 		 * Avoid the unnecessary trip to the wait queue loop, if the
 		 * caller specified a non blocking operation.
@@ -547,7 +546,7 @@ static int ep_poll(struct lego_eventpoll *ep, struct epoll_event __user *events,
 		goto check_events;
 	}
 
-	epoll_debug("%s timeout %d jiffies %d\n", __func__, timeout, jtimeout);
+	epoll_debug("%s timeout %ld ms\n", __func__, timeout);
 
 fetch_events:
 	spin_lock_irqsave(&ep->lock, flags);
@@ -577,7 +576,8 @@ fetch_events:
 			}
 
 			spin_unlock_irqrestore(&ep->lock, flags);
-			jtimeout = schedule_timeout(jtimeout);
+			if (!schedule_hrtimeout(to, HRTIMER_MODE_ABS))
+				timed_out = 1;
 			spin_lock_irqsave(&ep->lock, flags);
 		}
 		__remove_wait_queue(&ep->wq, &wait);